@@ -11,6 +11,7 @@
 /* Holds configuration for the alsa plugin.
  *  io - ALSA ioplug object.
  *  fd - Wakes users with polled io.
+ *  wake_pending - Set while a wake up byte is queued on fd and not yet read.
  *  stream_playing - Indicates if the stream is playing/capturing.
  *  hw_ptr - Current read or write position.
  *  channels - Number of channels.
@@ -27,6 +28,7 @@
 struct snd_pcm_cras {
 	snd_pcm_ioplug_t io;
 	int fd;
+	int wake_pending;
 	int stream_playing;
 	unsigned int hw_ptr;
 	unsigned int channels;
@@ -87,11 +89,16 @@ static int snd_pcm_cras_poll_revents(snd_pcm_ioplug_t *io,
 				     unsigned int nfds,
 				     unsigned short *revents)
 {
+	struct snd_pcm_cras *pcm_cras = io->private_data;
 	static char buf[1];
 	int rc;
 
 	if (pfds == NULL || nfds != 1 || revents == NULL)
 		return -EINVAL;
+	/* Cleared before the read, so a wake up racing with it either has its
+	 * byte consumed here or leaves one in the socket, it is never skipped
+	 * while the socket is empty. */
+	__sync_lock_release(&pcm_cras->wake_pending);
 	rc = read(pfds[0].fd, buf, 1);
 	if (rc < 0 && errno != EWOULDBLOCK && errno != EAGAIN) {
 		fprintf(stderr, "%s read failed %d\n", __func__, errno);
@@ -112,6 +119,22 @@ static snd_pcm_sframes_t snd_pcm_cras_pointer(snd_pcm_ioplug_t *io)
 	return pcm_cras->hw_ptr;
 }
 
+/* Returns non-zero if the ioplug areas hold interleaved frames, the layout
+ * CRAS uses, so that whole frames can be copied at once. */
+static int areas_are_interleaved(const snd_pcm_channel_area_t *areas,
+				 unsigned int channels,
+				 unsigned int width)
+{
+	unsigned int chan;
+
+	for (chan = 0; chan < channels; chan++)
+		if (areas[chan].addr != areas[0].addr ||
+		    areas[chan].first != chan * width ||
+		    areas[chan].step != channels * width)
+			return 0;
+	return 1;
+}
+
 /* Main callback for processing audio.  This is called by CRAS when more samples
  * are needed (playback) or ready (capture).  Copies bytes between ALSA and CRAS
  * buffers. */
@@ -130,6 +153,8 @@ static int pcm_cras_process_cb(struct cras_client *client,
 	snd_pcm_uframes_t copied_frames;
 	char dummy_byte;
 	size_t chan, frame_bytes, sample_bytes;
+	unsigned int width;
+	int interleaved;
 	int rc;
 	uint8_t *samples;
 	const struct timespec *sample_time;
@@ -140,7 +165,8 @@ static int pcm_cras_process_cb(struct cras_client *client,
 	io = (snd_pcm_ioplug_t *)arg;
 	pcm_cras = (struct snd_pcm_cras *)io->private_data;
 	frame_bytes = pcm_cras->bytes_per_frame;
-	sample_bytes = snd_pcm_format_physical_width(io->format) / 8;
+	width = snd_pcm_format_physical_width(io->format);
+	sample_bytes = width / 8;
 
 	if (io->stream == SND_PCM_STREAM_PLAYBACK) {
 		if (io->state != SND_PCM_STATE_RUNNING) {
@@ -162,17 +188,21 @@ static int pcm_cras_process_cb(struct cras_client *client,
 		pcm_cras->capture_sample_time = *sample_time;
 	}
 
-	/* CRAS always takes interleaved samples. */
-	for (chan = 0; chan < io->channels; chan++) {
-		pcm_cras->areas[chan].addr = samples + chan * sample_bytes;
-		pcm_cras->areas[chan].first = 0;
-		pcm_cras->areas[chan].step =
-			snd_pcm_format_physical_width(io->format) *
-			io->channels;
-	}
-
 	areas = snd_pcm_ioplug_mmap_areas(io);
 
+	/* CRAS always takes interleaved samples, if the application uses the
+	 * same layout the frames are copied in one block instead of sample by
+	 * sample for each channel. */
+	interleaved = areas_are_interleaved(areas, io->channels, width);
+	if (!interleaved) {
+		for (chan = 0; chan < io->channels; chan++) {
+			pcm_cras->areas[chan].addr =
+				samples + chan * sample_bytes;
+			pcm_cras->areas[chan].first = 0;
+			pcm_cras->areas[chan].step = width * io->channels;
+		}
+	}
+
 	copied_frames = 0;
 	while (copied_frames < nframes) {
 		snd_pcm_uframes_t frames = nframes - copied_frames;
@@ -181,30 +211,51 @@ static int pcm_cras_process_cb(struct cras_client *client,
 		if (frames > remain)
 			frames = remain;
 
-		for (chan = 0; chan < io->channels; chan++)
+		if (interleaved) {
+			uint8_t *ring = (uint8_t *)areas[0].addr +
+					pcm_cras->hw_ptr * frame_bytes;
+			uint8_t *shm = samples + copied_frames * frame_bytes;
+
 			if (io->stream == SND_PCM_STREAM_PLAYBACK)
-				snd_pcm_area_copy(&pcm_cras->areas[chan],
-						  copied_frames,
-						  &areas[chan],
-						  pcm_cras->hw_ptr,
-						  frames,
-						  io->format);
+				memcpy(shm, ring, frames * frame_bytes);
 			else
-				snd_pcm_area_copy(&areas[chan],
-						  pcm_cras->hw_ptr,
-						  &pcm_cras->areas[chan],
-						  copied_frames,
-						  frames,
-						  io->format);
+				memcpy(ring, shm, frames * frame_bytes);
+		} else {
+			for (chan = 0; chan < io->channels; chan++)
+				if (io->stream == SND_PCM_STREAM_PLAYBACK)
+					snd_pcm_area_copy(
+						&pcm_cras->areas[chan],
+						copied_frames,
+						&areas[chan],
+						pcm_cras->hw_ptr,
+						frames,
+						io->format);
+				else
+					snd_pcm_area_copy(
+						&areas[chan],
+						pcm_cras->hw_ptr,
+						&pcm_cras->areas[chan],
+						copied_frames,
+						frames,
+						io->format);
+		}
 
 		pcm_cras->hw_ptr += frames;
 		pcm_cras->hw_ptr %= io->buffer_size;
 		copied_frames += frames;
 	}
 
-	rc = write(pcm_cras->fd, &dummy_byte, 1); /* Wake up polling clients. */
-	if (rc < 0 && errno != EWOULDBLOCK && errno != EAGAIN)
-		fprintf(stderr, "%s write failed %d\n", __func__, errno);
+	/* Wake up polling clients, unless the last wake up is still queued. */
+	if (!__sync_lock_test_and_set(&pcm_cras->wake_pending, 1)) {
+		rc = write(pcm_cras->fd, &dummy_byte, 1);
+		if (rc < 0) {
+			/* Nothing was queued, let the next period try. */
+			__sync_lock_release(&pcm_cras->wake_pending);
+			if (errno != EWOULDBLOCK && errno != EAGAIN)
+				fprintf(stderr, "%s write failed %d\n",
+					__func__, errno);
+		}
+	}
 
 	return nframes;
 }
@@ -13,6 +13,9 @@
 #define CRAS_CLIENT_NICENESS_LEVEL -10
 #define CRAS_SOCKET_FILE ".cras_socket"
 #define CRAS_CONFIG_FILE_DIR "/etc/cras"
+#define CRAS_CARD_PROBE_CACHE_DIR "/var/cache/cras"
+/* How long an output device stays open after its last stream is removed. */
+#define CRAS_OUTPUT_STANDBY_MS 3000
 
 /* Gets the path to save UDS socket files. */
 const char *cras_config_get_system_socket_file_dir();
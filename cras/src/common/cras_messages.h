@@ -16,7 +16,7 @@
 
 /* Rev when message format changes. If new messages are added, or message ID
  * values change. */
-#define CRAS_PROTO_VER 1
+#define CRAS_PROTO_VER 2
 #define CRAS_SERV_MAX_MSG_SIZE 256
 #define CRAS_CLIENT_MAX_MSG_SIZE 256
 
@@ -42,6 +42,8 @@ enum CRAS_SERVER_MESSAGE_ID {
 	CRAS_SERVER_RM_ACTIVE_NODE,
 	CRAS_SERVER_ADD_TEST_DEV,
 	CRAS_SERVER_TEST_DEV_COMMAND,
+	CRAS_SERVER_UPDATE_DSP_DEBUG_INFO,
+	CRAS_SERVER_UPDATE_STREAM_LATENCY_INFO,
 };
 
 enum CRAS_CLIENT_MESSAGE_ID {
@@ -49,6 +51,8 @@ enum CRAS_CLIENT_MESSAGE_ID {
 	CRAS_CLIENT_CONNECTED,
 	CRAS_CLIENT_STREAM_CONNECTED,
 	CRAS_CLIENT_AUDIO_DEBUG_INFO_READY,
+	CRAS_CLIENT_DSP_DEBUG_INFO_READY,
+	CRAS_CLIENT_STREAM_LATENCY_INFO_READY,
 };
 
 /* Messages that control the server. These are sent from the client to affect
@@ -306,6 +310,30 @@ static inline void cras_fill_dump_audio_thread(
 	m->header.length = sizeof(*m);
 }
 
+/* Copy the dsp pipeline statistics to the shared server state. */
+struct __attribute__ ((__packed__)) cras_update_dsp_debug_info {
+	struct cras_server_message header;
+};
+
+static inline void cras_fill_update_dsp_debug_info(
+		struct cras_update_dsp_debug_info *m)
+{
+	m->header.id = CRAS_SERVER_UPDATE_DSP_DEBUG_INFO;
+	m->header.length = sizeof(*m);
+}
+
+/* Copy the latency statistics of the streams to the shared server state. */
+struct __attribute__ ((__packed__)) cras_update_stream_latency_info {
+	struct cras_server_message header;
+};
+
+static inline void cras_fill_update_stream_latency_info(
+		struct cras_update_stream_latency_info *m)
+{
+	m->header.id = CRAS_SERVER_UPDATE_STREAM_LATENCY_INFO;
+	m->header.length = sizeof(*m);
+}
+
 /* Add a test device. */
 struct __attribute__ ((__packed__)) cras_add_test_dev {
 	struct cras_server_message header;
@@ -405,6 +433,28 @@ static inline void cras_fill_client_audio_debug_info_ready(
 	m->header.length = sizeof(*m);
 }
 
+/* Sent from server to client when dsp debug information is requested. */
+struct cras_client_dsp_debug_info_ready {
+	struct cras_client_message header;
+};
+static inline void cras_fill_client_dsp_debug_info_ready(
+		struct cras_client_dsp_debug_info_ready *m)
+{
+	m->header.id = CRAS_CLIENT_DSP_DEBUG_INFO_READY;
+	m->header.length = sizeof(*m);
+}
+
+/* Sent from server to client when stream latency statistics are requested. */
+struct cras_client_stream_latency_info_ready {
+	struct cras_client_message header;
+};
+static inline void cras_fill_client_stream_latency_info_ready(
+		struct cras_client_stream_latency_info_ready *m)
+{
+	m->header.id = CRAS_CLIENT_STREAM_LATENCY_INFO_READY;
+	m->header.length = sizeof(*m);
+}
+
 /*
  * Messages specific to passing audio between client and server
  */
@@ -6,6 +6,8 @@
 #include <errno.h>
 #include <sbc/sbc.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
 
 #include "cras_sbc_codec.h"
 
@@ -15,11 +17,13 @@
  *    sbc - The main structure for SBC codec.
  *    codesize - The size of one PCM input block in bytes.
  *    frame_length - The size of one SBC output block in bytes.
+ *    block - Holds a PCM input block split across two input buffers.
  */
 struct cras_sbc_data {
 	sbc_t sbc;
 	unsigned int codesize;
 	unsigned int frame_length;
+	uint8_t *block;
 };
 
 int cras_sbc_decode(struct cras_audio_codec *codec, const void *input,
@@ -54,19 +58,63 @@ int cras_sbc_decode(struct cras_audio_codec *codec, const void *input,
 int cras_sbc_encode(struct cras_audio_codec *codec, const void *input,
 		    size_t input_len, void *output, size_t output_len,
 		    size_t *count) {
+	struct iovec iov;
+
+	iov.iov_base = (void *)input;
+	iov.iov_len = input_len;
+	return cras_sbc_encode_iov(codec, &iov, 1, output, output_len, count);
+}
+
+int cras_sbc_encode_iov(struct cras_audio_codec *codec,
+			const struct iovec *input, unsigned int num_input,
+			void *output, size_t output_len, size_t *count)
+{
 	struct cras_sbc_data *data = (struct cras_sbc_data *)codec->priv_data;
+	const uint8_t *block;
+	size_t total = 0, offset = 0, copied, n;
 	ssize_t written, encoded;
+	unsigned int i, num_blocks, idx = 0;
 	int processed = 0, result = 0;
 
-	/* Proceed encode when input buffer has at least one input block and
-	 * there is still room in output buffer.
-	 */
-	while (input_len - processed >= data->codesize &&
-			output_len >= result) {
+	for (i = 0; i < num_input; i++)
+		total += input[i].iov_len;
+
+	/* Encode as many blocks as there are in the input and fit in the
+	 * output, libsbc encodes one block per call. */
+	num_blocks = MIN(total / data->codesize,
+			 output_len / data->frame_length);
+
+	for (i = 0; i < num_blocks; i++) {
+		while (idx < num_input && offset == input[idx].iov_len) {
+			idx++;
+			offset = 0;
+		}
+
+		if (input[idx].iov_len - offset >= data->codesize) {
+			block = (const uint8_t *)input[idx].iov_base + offset;
+			offset += data->codesize;
+		} else {
+			/* The block spans buffers, gather it. */
+			for (copied = 0; copied < data->codesize; copied += n) {
+				while (offset == input[idx].iov_len) {
+					idx++;
+					offset = 0;
+				}
+				n = MIN(data->codesize - copied,
+					input[idx].iov_len - offset);
+				memcpy(data->block + copied,
+				       (const uint8_t *)input[idx].iov_base +
+						offset,
+				       n);
+				offset += n;
+			}
+			block = data->block;
+		}
+
 		encoded = sbc_encode(&data->sbc,
-				     input + processed,
+				     block,
 				     data->codesize,
-				     output + result,
+				     (uint8_t *)output + result,
 				     output_len - result,
 				     &written);
 		if (encoded == -ENOSPC)
@@ -93,11 +141,10 @@ int cras_sbc_get_frame_length(struct cras_audio_codec *codec)
 	return data->frame_length;
 }
 
-struct cras_audio_codec *cras_sbc_codec_create(uint8_t freq,
-		   uint8_t mode, uint8_t subbands, uint8_t alloc,
-		   uint8_t blocks, uint8_t bitpool) {
+/* Allocates a codec around an sbc_t that is not initialized yet. */
+static struct cras_audio_codec *sbc_codec_alloc()
+{
 	struct cras_audio_codec *codec;
-	struct cras_sbc_data *data;
 
 	codec = (struct cras_audio_codec *)calloc(1, sizeof(*codec));
 	if (!codec)
@@ -105,8 +152,44 @@ struct cras_audio_codec *cras_sbc_codec_create(uint8_t freq,
 
 	codec->priv_data = (struct cras_sbc_data *)calloc(1,
 			sizeof(struct cras_sbc_data));
-	if (!codec->priv_data)
-		goto create_error;
+	if (!codec->priv_data) {
+		free(codec);
+		return NULL;
+	}
+
+	codec->decode = cras_sbc_decode;
+	codec->encode = cras_sbc_encode;
+	return codec;
+}
+
+/* Finishes creating the codec once its sbc_t is configured. Frees the
+ * codec and returns NULL on failure. */
+static struct cras_audio_codec *sbc_codec_setup(struct cras_audio_codec *codec)
+{
+	struct cras_sbc_data *data = (struct cras_sbc_data *)codec->priv_data;
+
+	data->codesize = sbc_get_codesize(&data->sbc);
+	data->frame_length = sbc_get_frame_length(&data->sbc);
+	data->block = (uint8_t *)malloc(data->codesize);
+	if (!data->block) {
+		sbc_finish(&data->sbc);
+		free(data);
+		free(codec);
+		return NULL;
+	}
+
+	return codec;
+}
+
+struct cras_audio_codec *cras_sbc_codec_create(uint8_t freq,
+		   uint8_t mode, uint8_t subbands, uint8_t alloc,
+		   uint8_t blocks, uint8_t bitpool) {
+	struct cras_audio_codec *codec;
+	struct cras_sbc_data *data;
+
+	codec = sbc_codec_alloc();
+	if (!codec)
+		return NULL;
 
 	data = (struct cras_sbc_data *)codec->priv_data;
 	sbc_init(&data->sbc, 0L);
@@ -117,21 +200,30 @@ struct cras_audio_codec *cras_sbc_codec_create(uint8_t freq,
 	data->sbc.allocation = alloc;
 	data->sbc.blocks = blocks;
 	data->sbc.bitpool = bitpool;
-	data->codesize = sbc_get_codesize(&data->sbc);
-	data->frame_length = sbc_get_frame_length(&data->sbc);
+	return sbc_codec_setup(codec);
+}
 
-	codec->decode = cras_sbc_decode;
-	codec->encode = cras_sbc_encode;
-	return codec;
+struct cras_audio_codec *cras_msbc_codec_create()
+{
+	struct cras_audio_codec *codec;
+	struct cras_sbc_data *data;
 
-create_error:
-	free(codec);
-	return NULL;
+	codec = sbc_codec_alloc();
+	if (!codec)
+		return NULL;
+
+	data = (struct cras_sbc_data *)codec->priv_data;
+	sbc_init_msbc(&data->sbc, 0L);
+	data->sbc.endian = SBC_LE;
+	return sbc_codec_setup(codec);
 }
 
 void cras_sbc_codec_destroy(struct cras_audio_codec *codec)
 {
-	sbc_finish(&((struct cras_sbc_data *)codec->priv_data)->sbc);
-	free(codec->priv_data);
+	struct cras_sbc_data *data = (struct cras_sbc_data *)codec->priv_data;
+
+	sbc_finish(&data->sbc);
+	free(data->block);
+	free(data);
 	free(codec);
 }
@@ -7,6 +7,7 @@
 #define COMMON_CRAS_SBC_CODEC_H_
 
 #include <sbc/sbc.h>
+#include <sys/uio.h>
 
 #include "cras_audio_codec.h"
 
@@ -23,12 +24,37 @@ struct cras_audio_codec *cras_sbc_codec_create(uint8_t freq,
 		   uint8_t mode, uint8_t subbands, uint8_t alloc,
 		   uint8_t blocks, uint8_t bitpool);
 
+/* Creates an mSBC codec, the wideband speech codec of HFP. Its settings are
+ * fixed by the spec: 16kHz mono, 8 subbands, 15 blocks, loudness allocation
+ * and bitpool 26. Each 240 bytes of PCM are encoded to a 57 bytes frame.
+ */
+struct cras_audio_codec *cras_msbc_codec_create();
+
 /* Destroys an sbc codec.
  * Args:
  *    codec: the codec to destroy.
  */
 void cras_sbc_codec_destroy(struct cras_audio_codec *codec);
 
+/* Encodes PCM samples split in several buffers, like both parts of a ring
+ * buffer, as if they were one. Encodes as many SBC frames as there are full
+ * input blocks and room in output, with no intermediate copy except for a
+ * block that spans two buffers. The analysis filters are libsbc's, which
+ * picks the SIMD version for the machine.
+ * Args:
+ *    codec: The sbc codec.
+ *    input: The buffers of PCM samples, in order.
+ *    num_input: Number of buffers in input.
+ *    output: The buffer for encoded SBC frames.
+ *    output_len: Size of output in bytes.
+ *    count: Filled with the number of bytes written to output.
+ * Returns:
+ *    The number of PCM bytes encoded, or negative error code.
+ */
+int cras_sbc_encode_iov(struct cras_audio_codec *codec,
+			const struct iovec *input, unsigned int num_input,
+			void *output, size_t output_len, size_t *count);
+
 /* Gets codesize, the input block size of sbc codec in bytes.
  */
 int cras_sbc_get_codesize(struct cras_audio_codec *codec);
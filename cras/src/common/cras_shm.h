@@ -7,6 +7,7 @@
 #define CRAS_SHM_H_
 
 #include <assert.h>
+#include <errno.h>
 #include <stdint.h>
 #include <sys/param.h>
 
@@ -45,6 +46,10 @@ struct __attribute__ ((__packed__)) cras_audio_shm_config {
  *  ts - For capture, the time stamp of the next sample at read_index.  For
  *    playback, this is the time that the next sample written will be played.
  *    This is only valid in audio callbacks.
+ *  volume_seq - Incremented before and after volume_scaler, mute and
+ *    volume_ramp_frames are changed, odd while they are being changed.
+ *  volume_ramp_frames - Number of frames the server takes to go from the
+ *    current volume to a new volume_scaler or mute state.
  *  samples - Audio data - a double buffered area that is used to exchange
  *    audio samples.
  */
@@ -64,6 +69,8 @@ struct __attribute__ ((__packed__)) cras_audio_shm_area {
 	uint32_t num_overruns;
 	uint32_t num_cb_timeouts;
 	struct cras_timespec ts;
+	uint32_t volume_seq;
+	uint32_t volume_ramp_frames;
 	uint8_t samples[];
 };
 
@@ -363,13 +370,42 @@ void cras_shm_buffer_read_current(struct cras_audio_shm *shm, size_t frames)
 	}
 }
 
+/* Marks the start and end of a change to the volume of the stream. Volume
+ * changes are written without locks by the one thread that controls the
+ * stream's volume, the server doesn't use values read while volume_seq is odd
+ * or changed during the read. */
+static inline void cras_shm_volume_write_begin(struct cras_audio_shm *shm)
+{
+	shm->area->volume_seq++;
+	__sync_synchronize();
+}
+
+static inline void cras_shm_volume_write_end(struct cras_audio_shm *shm)
+{
+	__sync_synchronize();
+	shm->area->volume_seq++;
+}
+
+/* Sets the volume the stream ramps to and the number of frames the ramp takes,
+ * zero to change the volume at once. The volume level is a scaling factor
+ * that will be applied to the stream before mixing. */
+static inline void cras_shm_set_volume_ramp(struct cras_audio_shm *shm,
+					    float volume_scaler,
+					    unsigned int ramp_frames)
+{
+	volume_scaler = MAX(volume_scaler, 0.0);
+	cras_shm_volume_write_begin(shm);
+	shm->area->volume_scaler = MIN(volume_scaler, 1.0);
+	shm->area->volume_ramp_frames = ramp_frames;
+	cras_shm_volume_write_end(shm);
+}
+
 /* Sets the volume for the stream.  The volume level is a scaling factor that
  * will be applied to the stream before mixing. */
 static inline
 void cras_shm_set_volume_scaler(struct cras_audio_shm *shm, float volume_scaler)
 {
-	volume_scaler = MAX(volume_scaler, 0.0);
-	shm->area->volume_scaler = MIN(volume_scaler, 1.0);
+	cras_shm_set_volume_ramp(shm, volume_scaler, 0);
 }
 
 /* Returns the volume of the stream(0.0-1.0). */
@@ -378,10 +414,50 @@ static inline float cras_shm_get_volume_scaler(const struct cras_audio_shm *shm)
 	return shm->area->volume_scaler;
 }
 
+/* Mutes or unmutes the stream, ramping over ramp_frames. */
+static inline void cras_shm_set_mute_ramp(struct cras_audio_shm *shm,
+					  size_t mute,
+					  unsigned int ramp_frames)
+{
+	cras_shm_volume_write_begin(shm);
+	shm->area->mute = !!mute;
+	shm->area->volume_ramp_frames = ramp_frames;
+	cras_shm_volume_write_end(shm);
+}
+
 /* Indicates that the stream should be muted/unmuted */
 static inline void cras_shm_set_mute(struct cras_audio_shm *shm, size_t mute)
 {
-	shm->area->mute = !!mute;
+	cras_shm_set_mute_ramp(shm, mute, 0);
+}
+
+/* Gets the volume the stream should be played at, zero if muted, and the
+ * number of frames to ramp to it.
+ * Returns:
+ *    0 on success, -EAGAIN if the volume was being changed.
+ */
+static inline int cras_shm_get_volume_ramp(const struct cras_audio_shm *shm,
+					   float *volume_scaler,
+					   unsigned int *ramp_frames)
+{
+	const volatile struct cras_audio_shm_area *area = shm->area;
+	uint32_t seq;
+	int mute;
+
+	seq = area->volume_seq;
+	if (seq & 1)
+		return -EAGAIN;
+	__sync_synchronize();
+	*volume_scaler = area->volume_scaler;
+	mute = area->mute;
+	*ramp_frames = area->volume_ramp_frames;
+	__sync_synchronize();
+	if (area->volume_seq != seq)
+		return -EAGAIN;
+
+	if (mute)
+		*volume_scaler = 0;
+	return 0;
 }
 
 /* Returns the mute state of the stream.  0 if not muted, non-zero if muted. */
@@ -133,6 +133,11 @@ static inline uint32_t node_index_of(cras_node_id_t id)
 #define CRAS_MAX_ATTACHED_CLIENTS 20
 #define MAX_DEBUG_STREAMS 8
 #define AUDIO_THREAD_EVENT_LOG_SIZE (1024*6)
+#define MAX_DEBUG_DSP_PIPELINES 4
+#define MAX_DEBUG_DSP_MODULES 16
+#define DSP_DEBUG_NAME_SIZE 32
+#define DSP_TIME_HISTOGRAM_BUCKETS 32
+#define LATENCY_HISTOGRAM_BUCKETS 24
 
 /* There are 8 bits of space for events. */
 enum AUDIO_THREAD_LOG_EVENTS {
@@ -166,6 +171,7 @@ enum AUDIO_THREAD_LOG_EVENTS {
 	AUDIO_THREAD_IODEV_CB,
 	AUDIO_THREAD_PB_MSG,
 	AUDIO_THREAD_DRAIN_OUTPUT,
+	AUDIO_THREAD_DEV_STANDBY,
 };
 
 struct __attribute__ ((__packed__)) audio_thread_event {
@@ -195,12 +201,17 @@ struct __attribute__ ((__packed__)) audio_stream_debug_info {
 	int8_t channel_layout[CRAS_CH_MAX];
 };
 
-/* Debug info shared from server to client. */
+/* Debug info shared from server to client.
+ *    output_bt_bitpool - SBC bitpool in use when the output is A2DP, else 0.
+ *    output_bt_queued_bytes - Bytes waiting in the A2DP socket.
+ */
 struct __attribute__ ((__packed__)) audio_debug_info {
 	char output_dev_name[CRAS_NODE_NAME_BUFFER_SIZE];
 	uint32_t output_buffer_size;
 	uint32_t output_used_size;
 	uint32_t output_cb_threshold;
+	uint32_t output_bt_bitpool;
+	uint32_t output_bt_queued_bytes;
 	char input_dev_name[CRAS_NODE_NAME_BUFFER_SIZE];
 	uint32_t input_buffer_size;
 	uint32_t input_used_size;
@@ -210,6 +221,97 @@ struct __attribute__ ((__packed__)) audio_debug_info {
 	struct audio_thread_event_log log;
 };
 
+/* Histogram of times in microseconds.
+ *    count - Number of times recorded.
+ *    total_us - Sum of the times recorded.
+ *    max_us - Longest time recorded.
+ *    buckets - buckets[i] counts the times in [2^i, 2^(i+1)) microseconds.
+ *        Bucket 0 also counts zero, the last bucket counts everything longer.
+ */
+struct __attribute__ ((__packed__)) latency_histogram {
+	uint64_t count;
+	uint64_t total_us;
+	uint32_t max_us;
+	uint32_t buckets[LATENCY_HISTOGRAM_BUCKETS];
+};
+
+/* Latency statistics of a stream, recorded by the audio thread.
+ *    stream_id - The stream the statistics are for.
+ *    direction - Input or output.
+ *    frame_rate - Rate of the stream.
+ *    cb_threshold - Frames requested from or posted to the client at once.
+ *    num_underruns - Output only, number of times the client answered a
+ *        request for samples after the samples queued ahead of it were
+ *        played.
+ *    latency - Output: time from the client writing a sample to it reaching
+ *        the DAC, sampled when samples are requested.  Input: time from the
+ *        ADC to the client, sampled each time the device is read.
+ *    cb_lateness - Output only, how long after the scheduled time the
+ *        stream was asked for samples.
+ *    fetch_to_ready - Output only, time from asking the client for samples
+ *        to its data ready reply.
+ */
+struct __attribute__ ((__packed__)) stream_latency_debug_info {
+	uint64_t stream_id;
+	uint32_t direction;
+	uint32_t frame_rate;
+	uint32_t cb_threshold;
+	uint32_t num_underruns;
+	struct latency_histogram latency;
+	struct latency_histogram cb_lateness;
+	struct latency_histogram fetch_to_ready;
+};
+
+/* Stream latency statistics shared from server to client. */
+struct __attribute__ ((__packed__)) stream_latency_info {
+	uint32_t num_streams;
+	struct stream_latency_debug_info streams[MAX_DEBUG_STREAMS];
+};
+
+/* Run time statistics of one module in a dsp pipeline. Only a sample of the
+ * blocks processed is timed, so the counts here are a subset of the total
+ * blocks of the pipeline.
+ *    title - The title of the plugin in the dsp ini file.
+ *    skipped - 1 if the module is not run, because it does nothing or it is
+ *        fused into the next module.
+ *    sampled_blocks - Number of blocks timed.
+ *    sampled_frames - Number of frames in the timed blocks.
+ *    total_time_ns - Time spent in run() for the timed blocks.
+ *    max_time_ns - Longest time spent in run() for one block.
+ *    histogram - histogram[i] counts the blocks which took [2^i, 2^(i+1))
+ *        nanoseconds. Bucket 0 also counts blocks that took no time.
+ */
+struct __attribute__ ((__packed__)) dsp_module_debug_info {
+	char title[DSP_DEBUG_NAME_SIZE];
+	uint32_t skipped;
+	uint64_t sampled_blocks;
+	uint64_t sampled_frames;
+	uint64_t total_time_ns;
+	uint64_t max_time_ns;
+	uint32_t histogram[DSP_TIME_HISTOGRAM_BUCKETS];
+};
+
+/* Run time statistics of a dsp pipeline. The pipeline totals are measured
+ * in thread cpu time around the whole apply, including the format
+ * conversion. */
+struct __attribute__ ((__packed__)) dsp_pipeline_debug_info {
+	char purpose[DSP_DEBUG_NAME_SIZE];
+	uint32_t sample_rate;
+	uint64_t total_blocks;
+	uint64_t total_frames;
+	uint64_t total_time_ns;
+	uint64_t min_time_ns;
+	uint64_t max_time_ns;
+	uint32_t num_modules;
+	struct dsp_module_debug_info modules[MAX_DEBUG_DSP_MODULES];
+};
+
+/* Dsp debug info shared from server to client. */
+struct __attribute__ ((__packed__)) dsp_debug_info {
+	uint32_t num_pipelines;
+	struct dsp_pipeline_debug_info pipelines[MAX_DEBUG_DSP_PIPELINES];
+};
+
 
 /* The server state that is shared with clients.
  *    state_version - Version of this structure.
@@ -246,8 +348,12 @@ struct __attribute__ ((__packed__)) audio_debug_info {
  *    audio_debug_info - Debug data filled in when a client requests it. This
  *        isn't protected against concurrent updating, only one client should
  *        use it.
+ *    dsp_debug_info - Dsp pipeline statistics filled in when a client
+ *        requests it. Same caveat as audio_debug_info.
+ *    stream_latency_info - Latency statistics of the attached streams filled
+ *        in when a client requests it. Same caveat as audio_debug_info.
  */
-#define CRAS_SERVER_STATE_VERSION 2
+#define CRAS_SERVER_STATE_VERSION 5
 struct __attribute__ ((__packed__)) cras_server_state {
 	uint32_t state_version;
 	uint32_t volume;
@@ -278,6 +384,8 @@ struct __attribute__ ((__packed__)) cras_server_state {
 	uint32_t num_active_streams[CRAS_NUM_DIRECTIONS];
 	struct cras_timespec last_active_stream_time;
 	struct audio_debug_info audio_debug_info;
+	struct dsp_debug_info dsp_debug_info;
+	struct stream_latency_info stream_latency_info;
 };
 
 /* Actions for card add/remove/change. */
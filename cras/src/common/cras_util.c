@@ -3,10 +3,15 @@
  * found in the LICENSE file.
  */
 
+#define _GNU_SOURCE /* For sendmmsg. */
+
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
 #include <pthread.h>
 #include <sched.h>
+#include <stdint.h>
 #include <string.h>
 #include <sys/resource.h>
 #include <sys/socket.h>
@@ -109,6 +114,51 @@ int cras_send_with_fd(int sockfd, void *buf, size_t len, int fd)
 	return sendmsg(sockfd, &msg, 0);
 }
 
+/* Max messages handed to one sendmmsg call. */
+#define SEND_MSGS_BATCH 16
+
+int cras_send_msgs_with_fds(int sockfd, void *const *bufs, const size_t *lens,
+			    const int *fds, unsigned int num)
+{
+	struct mmsghdr msgs[SEND_MSGS_BATCH];
+	struct iovec iovs[SEND_MSGS_BATCH];
+	char control[SEND_MSGS_BATCH][CMSG_SPACE(sizeof(int))];
+	struct cmsghdr *cmsg;
+	unsigned int sent = 0, batch, i;
+	int rc;
+
+	while (sent < num) {
+		batch = num - sent;
+		if (batch > SEND_MSGS_BATCH)
+			batch = SEND_MSGS_BATCH;
+
+		memset(msgs, 0, sizeof(msgs[0]) * batch);
+		for (i = 0; i < batch; i++) {
+			iovs[i].iov_base = bufs[sent + i];
+			iovs[i].iov_len = lens[sent + i];
+			msgs[i].msg_hdr.msg_iov = &iovs[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+			msgs[i].msg_hdr.msg_control = control[i];
+			msgs[i].msg_hdr.msg_controllen = sizeof(control[i]);
+			cmsg = CMSG_FIRSTHDR(&msgs[i].msg_hdr);
+			cmsg->cmsg_level = SOL_SOCKET;
+			cmsg->cmsg_type = SCM_RIGHTS;
+			cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+			memcpy(CMSG_DATA(cmsg), &fds[sent + i], sizeof(int));
+			msgs[i].msg_hdr.msg_controllen = cmsg->cmsg_len;
+		}
+
+		rc = sendmmsg(sockfd, msgs, batch, 0);
+		if (rc < 0)
+			return sent ? (int)sent : -errno;
+		sent += rc;
+		if (rc < batch)
+			break;
+	}
+
+	return sent;
+}
+
 int cras_recv_with_fd(int sockfd, void *buf, size_t len, int *fd)
 {
 	struct msghdr msg = {0};
@@ -140,3 +190,19 @@ int cras_recv_with_fd(int sockfd, void *buf, size_t len, int *fd)
 
 	return rc;
 }
+
+int cras_futex_wait(const void *addr, uint32_t val,
+		    const struct timespec *timeout)
+{
+	int rc;
+
+	rc = syscall(SYS_futex, addr, FUTEX_WAIT, val, timeout, NULL, 0);
+	if (rc == 0 || errno == EAGAIN)
+		return 0;
+	return -errno;
+}
+
+int cras_futex_wake(void *addr)
+{
+	return syscall(SYS_futex, addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
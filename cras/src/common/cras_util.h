@@ -69,10 +69,41 @@ int cras_make_fd_blocking(int fd);
 /* Send data in buf to the socket with an extra file descriptor. */
 int cras_send_with_fd(int sockfd, const void *buf, size_t len, int fd);
 
+/* Sends several messages to the socket with one system call, each with an
+ * extra file descriptor.
+ * Args:
+ *    sockfd - The socket to send to.
+ *    bufs - The messages to send.
+ *    lens - The length of each message.
+ *    fds - The file descriptor to send with each message.
+ *    num - The number of messages.
+ * Returns:
+ *    The number of messages sent, which is less than num if the socket is
+ *    full or fails part way, or a negative error if none could be sent.
+ */
+int cras_send_msgs_with_fds(int sockfd, void *const *bufs, const size_t *lens,
+			    const int *fds, unsigned int num);
+
 /* Receive data in buf from the socket. If we also receive a file
 descriptor, put it in *fd, otherwise set *fd to -1. */
 int cras_recv_with_fd(int sockfd, const void *buf, size_t len, int *fd);
 
+/* Blocks while the 32 bit value at addr equals val, until woken by
+ * cras_futex_wake. Works across processes sharing the memory, which may be
+ * mapped read only by the waiter.
+ * Args:
+ *    addr - The 32 bit value to wait on, 4 byte aligned.
+ *    val - The value that keeps the caller waiting.
+ *    timeout - Longest time to wait, NULL waits forever.
+ * Returns:
+ *    0 if woken or the value already differed, -ETIMEDOUT or -EINTR.
+ */
+int cras_futex_wait(const void *addr, uint32_t val,
+		    const struct timespec *timeout);
+
+/* Wakes everyone waiting on addr in cras_futex_wait. */
+int cras_futex_wake(void *addr);
+
 /* This must be written a million times... */
 static inline void subtract_timespecs(const struct timespec *end,
 				      const struct timespec *beg,
@@ -574,11 +574,24 @@ static void lr42_merge(struct lr42 *lp, struct lr42 *hp, int count,
 
 void crossover2_init(struct crossover2 *xo2, float freq1, float freq2)
 {
-	int i;
-	for (i = 0; i < 3; i++) {
-		float f = (i == 0) ? freq1 : freq2;
-		lr42_set(&xo2->lp[i], BQ_LOWPASS, f);
-		lr42_set(&xo2->hp[i], BQ_HIGHPASS, f);
+	float freqs[2] = {freq1, freq2};
+	crossover2_init_bands(xo2, 3, freqs);
+}
+
+void crossover2_init_bands(struct crossover2 *xo2, int num_bands,
+			   const float *freqs)
+{
+	int i, k, n = 0;
+
+	xo2->num_bands = num_bands;
+
+	/* For the split at freqs[k], the allpass filters of bands 0 to k - 1
+	 * come first, then the filter splitting band k. */
+	for (k = 0; k < num_bands - 1; k++) {
+		for (i = 0; i <= k; i++, n++) {
+			lr42_set(&xo2->lp[n], BQ_LOWPASS, freqs[k]);
+			lr42_set(&xo2->hp[n], BQ_HIGHPASS, freqs[k]);
+		}
 	}
 }
 
@@ -587,12 +600,26 @@ void crossover2_process(struct crossover2 *xo2, int count,
 			float *data1L, float *data1R,
 			float *data2L, float *data2R)
 {
+	float *dataL[3] = {data0L, data1L, data2L};
+	float *dataR[3] = {data0R, data1R, data2R};
+
+	crossover2_process_bands(xo2, count, dataL, dataR);
+}
+
+void crossover2_process_bands(struct crossover2 *xo2, int count,
+			      float **dataL, float **dataR)
+{
+	int i, k, n = 0;
+
 	if (!count)
 		return;
 
-	lr42_split(&xo2->lp[0], &xo2->hp[0], count, data0L, data0R,
-		   data1L, data1R);
-	lr42_merge(&xo2->lp[1], &xo2->hp[1], count, data0L, data0R);
-	lr42_split(&xo2->lp[2], &xo2->hp[2], count, data1L, data1R,
-		   data2L, data2R);
+	for (k = 0; k < xo2->num_bands - 1; k++) {
+		for (i = 0; i < k; i++, n++)
+			lr42_merge(&xo2->lp[n], &xo2->hp[n], count,
+				   dataL[i], dataR[i]);
+		lr42_split(&xo2->lp[n], &xo2->hp[n], count,
+			   dataL[k], dataR[k], dataL[k + 1], dataR[k + 1]);
+		n++;
+	}
 }
@@ -28,7 +28,14 @@ struct lr42 {
 	float z1L, z1R, z2L, z2R;
 };
 
-/* Three bands crossover filter:
+/* The maximum number of bands of a crossover filter. */
+#define CROSSOVER2_MAX_BANDS 5
+
+/* The number of lp/hp pairs needed for the maximum number of bands. */
+#define CROSSOVER2_MAX_FILTERS (CROSSOVER2_MAX_BANDS * \
+				(CROSSOVER2_MAX_BANDS - 1) / 2)
+
+/* Multiple bands crossover filter. For three bands it is:
  *
  * INPUT --+-- lp0 --+-- lp1 --+---> LOW (0)
  *         |         |         |
@@ -42,9 +49,16 @@ struct lr42 {
  *
  * Each lp or hp is an LR4 filter, which consists of two second-order
  * lowpass or highpass butterworth filters.
+ *
+ * With more bands, the highest band so far is split again at each
+ * frequency, and all the lower bands pass through an lp and hp pair at that
+ * frequency whose outputs are summed (an allpass filter like lp1 and hp1
+ * above), so all bands keep the same phase. The filters are stored in the
+ * order they are run.
  */
 struct crossover2 {
-	struct lr42 lp[3], hp[3];
+	int num_bands;
+	struct lr42 lp[CROSSOVER2_MAX_FILTERS], hp[CROSSOVER2_MAX_FILTERS];
 };
 
 /* Initializes a crossover2 filter
@@ -55,6 +69,17 @@ struct crossover2 {
  */
 void crossover2_init(struct crossover2 *xo2, float freq1, float freq2);
 
+/* Initializes a crossover2 filter with any number of bands.
+ * Args:
+ *    xo2 - The crossover2 filter we want to initialize.
+ *    num_bands - The number of bands, from 1 to CROSSOVER2_MAX_BANDS.
+ *    freqs - The normalized frequencies splitting the bands, in increasing
+ *            order. freqs[i] splits band i and band i + 1, so there are
+ *            num_bands - 1 of them.
+ */
+void crossover2_init_bands(struct crossover2 *xo2, int num_bands,
+			   const float *freqs);
+
 /* Splits input samples to three bands.
  * Args:
  *    xo2 - The crossover2 filter to use.
@@ -69,6 +94,17 @@ void crossover2_process(struct crossover2 *xo2, int count,
 			float *data1L, float *data1R,
 			float *data2L, float *data2R);
 
+/* Splits input samples to the bands given to crossover2_init_bands().
+ * Args:
+ *    xo2 - The crossover2 filter to use.
+ *    count - The number of input samples.
+ *    dataL, dataR - dataL[i] and dataR[i] are the place to store the output
+ *                   of band i. dataL[0] and dataR[0] are also the input
+ *                   samples.
+ */
+void crossover2_process_bands(struct crossover2 *xo2, int count,
+			      float **dataL, float **dataR);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
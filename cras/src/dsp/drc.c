@@ -10,6 +10,7 @@
 
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "drc.h"
 #include "drc_math.h"
@@ -25,8 +26,24 @@ static void free_kernel(struct drc *drc);
 
 struct drc *drc_new(float sample_rate)
 {
-	struct drc *drc = (struct drc *)calloc(1, sizeof(struct drc));
+	return drc_new_layout(sample_rate, DRC_NUM_CHANNELS, DRC_NUM_KERNELS);
+}
+
+struct drc *drc_new_layout(float sample_rate, int num_channels,
+			   int num_kernels)
+{
+	struct drc *drc;
+
+	if (num_channels < 1 || num_channels > DRC_MAX_CHANNELS ||
+	    num_kernels < 1 || num_kernels > DRC_MAX_KERNELS)
+		return NULL;
+
+	drc = (struct drc *)calloc(1, sizeof(struct drc));
 	drc->sample_rate = sample_rate;
+	drc->num_channels = num_channels;
+	drc->num_pairs = (num_channels + DRC_NUM_CHANNELS - 1) /
+		DRC_NUM_CHANNELS;
+	drc->num_kernels = num_kernels;
 	set_default_parameters(drc);
 	return drc;
 }
@@ -50,24 +67,25 @@ void drc_free(struct drc *drc)
 /* Allocates temporary buffers used during drc_process(). */
 static void init_data_buffer(struct drc *drc)
 {
-	int i;
+	int i, j;
 	size_t size = sizeof(float) * DRC_PROCESS_MAX_FRAMES;
 
-	for (i = 0; i < DRC_NUM_CHANNELS; i++) {
-		drc->data1[i] = (float *)calloc(1, size);
-		drc->data2[i] = (float *)calloc(1, size);
-	}
+	for (i = 0; i < drc->num_kernels - 1; i++)
+		for (j = 0; j < drc->num_pairs * DRC_NUM_CHANNELS; j++)
+			drc->band_data[i][j] = (float *)calloc(1, size);
+	if (drc->num_channels % DRC_NUM_CHANNELS)
+		drc->silence = (float *)calloc(1, size);
 }
 
 /* Frees temporary buffers */
 static void free_data_buffer(struct drc *drc)
 {
-	int i;
+	int i, j;
 
-	for (i = 0; i < DRC_NUM_CHANNELS; i++) {
-		free(drc->data1[i]);
-		free(drc->data2[i]);
-	}
+	for (i = 0; i < drc->num_kernels - 1; i++)
+		for (j = 0; j < drc->num_pairs * DRC_NUM_CHANNELS; j++)
+			free(drc->band_data[i][j]);
+	free(drc->silence);
 }
 
 void drc_set_param(struct drc *drc, int index, unsigned paramID, float value)
@@ -86,10 +104,13 @@ static float drc_get_param(struct drc *drc, int index, unsigned paramID)
 /* Initializes parameters to default values. */
 static void set_default_parameters(struct drc *drc)
 {
+	static const float default_freqs[DRC_MAX_KERNELS] = {
+		0, 200, 2000, 5000, 10000
+	};
 	float nyquist = drc->sample_rate / 2;
 	int i;
 
-	for (i = 0; i < DRC_NUM_KERNELS; i++) {
+	for (i = 0; i < drc->num_kernels; i++) {
 		float *param = drc->parameters[i];
 		param[PARAM_THRESHOLD] = -24; /* dB */
 		param[PARAM_KNEE] = 30; /* dB */
@@ -108,12 +129,9 @@ static void set_default_parameters(struct drc *drc)
 		 * signal */
 		param[PARAM_POST_GAIN] = 0; /* dB */
 		param[PARAM_ENABLED] = 0;
+		param[PARAM_CROSSOVER_LOWER_FREQ] = default_freqs[i] / nyquist;
 	}
 
-	drc->parameters[0][PARAM_CROSSOVER_LOWER_FREQ] = 0;
-	drc->parameters[1][PARAM_CROSSOVER_LOWER_FREQ] = 200 / nyquist;
-	drc->parameters[2][PARAM_CROSSOVER_LOWER_FREQ] = 2000 / nyquist;
-
 	/* These parameters has only one copy */
 	drc->parameters[0][PARAM_FILTER_STAGE_GAIN] = 4.4f; /* dB */
 	drc->parameters[0][PARAM_FILTER_STAGE_RATIO] = 2;
@@ -177,17 +195,24 @@ static void init_emphasis_eq(struct drc *drc)
 	float stage_gain = drc_get_param(drc, 0, PARAM_FILTER_STAGE_GAIN);
 	float stage_ratio = drc_get_param(drc, 0, PARAM_FILTER_STAGE_RATIO);
 	float anchor_freq = drc_get_param(drc, 0,  PARAM_FILTER_ANCHOR);
+	int p;
 
-	drc->emphasis_eq = eq2_new();
-	drc->deemphasis_eq = eq2_new();
+	for (p = 0; p < drc->num_pairs; p++) {
+		drc->emphasis_eq[p] = eq2_new();
+		drc->deemphasis_eq[p] = eq2_new();
+	}
 
 	for (i = 0; i < 2; i++) {
 		emphasis_stage_pair_biquads(stage_gain, anchor_freq,
 					    anchor_freq / stage_ratio,
 					    &e, &d);
-		for (j = 0; j < 2; j++) {
-			eq2_append_biquad_direct(drc->emphasis_eq, j, &e);
-			eq2_append_biquad_direct(drc->deemphasis_eq, j, &d);
+		for (p = 0; p < drc->num_pairs; p++) {
+			for (j = 0; j < 2; j++) {
+				eq2_append_biquad_direct(drc->emphasis_eq[p],
+							 j, &e);
+				eq2_append_biquad_direct(drc->deemphasis_eq[p],
+							 j, &d);
+			}
 		}
 		anchor_freq /= (stage_ratio * stage_ratio);
 	}
@@ -196,26 +221,61 @@ static void init_emphasis_eq(struct drc *drc)
 /* Frees the emphasis and deemphasis filter */
 static void free_emphasis_eq(struct drc *drc)
 {
-	eq2_free(drc->emphasis_eq);
-	eq2_free(drc->deemphasis_eq);
+	int p;
+
+	for (p = 0; p < drc->num_pairs; p++) {
+		eq2_free(drc->emphasis_eq[p]);
+		eq2_free(drc->deemphasis_eq[p]);
+	}
+}
+
+int drc_prepend_eq2(struct drc *drc, struct eq2 *eq2)
+{
+	struct eq2 *merged;
+	int i, j;
+
+	if (drc->num_channels != 2 || drc->emphasis_disabled)
+		return -1;
+
+	for (j = 0; j < 2; j++)
+		if (eq2_len(eq2, j) + eq2_len(drc->emphasis_eq[0], j) >
+		    MAX_BIQUADS_PER_EQ2)
+			return -1;
+
+	merged = eq2_new();
+	for (j = 0; j < 2; j++) {
+		for (i = 0; i < eq2_len(eq2, j); i++)
+			eq2_append_biquad_direct(merged, j,
+						 eq2_get_bq(eq2, j, i));
+		for (i = 0; i < eq2_len(drc->emphasis_eq[0], j); i++)
+			eq2_append_biquad_direct(
+				merged, j,
+				eq2_get_bq(drc->emphasis_eq[0], j, i));
+	}
+
+	eq2_free(drc->emphasis_eq[0]);
+	drc->emphasis_eq[0] = merged;
+	return 0;
 }
 
 /* Initializes the crossover filter */
 static void init_crossover(struct drc *drc)
 {
-	float freq1 = drc->parameters[1][PARAM_CROSSOVER_LOWER_FREQ];
-	float freq2 = drc->parameters[2][PARAM_CROSSOVER_LOWER_FREQ];
+	float freqs[DRC_MAX_KERNELS - 1];
+	int i;
 
-	crossover2_init(&drc->xo2, freq1, freq2);
+	for (i = 1; i < drc->num_kernels; i++)
+		freqs[i - 1] = drc->parameters[i][PARAM_CROSSOVER_LOWER_FREQ];
+	for (i = 0; i < drc->num_pairs; i++)
+		crossover2_init_bands(&drc->xo2[i], drc->num_kernels, freqs);
 }
 
 /* Initializes the compressor kernels */
 static void init_kernel(struct drc *drc)
 {
-	int i;
+	int i, p;
 
-	for (i = 0; i < DRC_NUM_KERNELS; i++) {
-		dk_init(&drc->kernel[i], drc->sample_rate);
+	for (i = 0; i < drc->num_kernels; i++) {
 
 		float db_threshold = drc_get_param(drc, i, PARAM_THRESHOLD);
 		float db_knee = drc_get_param(drc, i, PARAM_KNEE);
@@ -230,30 +290,36 @@ static void init_kernel(struct drc *drc)
 		float db_post_gain = drc_get_param(drc, i, PARAM_POST_GAIN);
 		int enabled = drc_get_param(drc, i, PARAM_ENABLED);
 
-		dk_set_parameters(&drc->kernel[i],
-				  db_threshold,
-				  db_knee,
-				  ratio,
-				  attack_time,
-				  release_time,
-				  pre_delay_time,
-				  db_post_gain,
-				  releaseZone1,
-				  releaseZone2,
-				  releaseZone3,
-				  releaseZone4
-			);
-
-		dk_set_enabled(&drc->kernel[i], enabled);
+		for (p = 0; p < drc->num_pairs; p++) {
+			struct drc_kernel *dk = &drc->kernel[p][i];
+
+			dk_init(dk, drc->sample_rate);
+			dk_set_parameters(dk,
+					  db_threshold,
+					  db_knee,
+					  ratio,
+					  attack_time,
+					  release_time,
+					  pre_delay_time,
+					  db_post_gain,
+					  releaseZone1,
+					  releaseZone2,
+					  releaseZone3,
+					  releaseZone4
+				);
+
+			dk_set_enabled(dk, enabled);
+		}
 	}
 }
 
 /* Frees the compressor kernels */
 static void free_kernel(struct drc *drc)
 {
-	int i;
-	for (i = 0; i < DRC_NUM_KERNELS; i++)
-		dk_free(&drc->kernel[i]);
+	int i, p;
+	for (p = 0; p < drc->num_pairs; p++)
+		for (i = 0; i < drc->num_kernels; i++)
+			dk_free(&drc->kernel[p][i]);
 }
 
 #if defined(__ARM_NEON__)
@@ -350,32 +416,71 @@ static void sum3(float *data, float *data1, float *data2, int n)
 }
 #endif
 
-void drc_process(struct drc *drc, float **data, int frames)
+static void sum2(float *data, float *data1, int n)
+{
+	int i;
+	for (i = 0; i < n; i++)
+		data[i] += data1[i];
+}
+
+/* Processes the channel pair p, whose data is in dataL and dataR. */
+static void drc_process_pair(struct drc *drc, int p, float *dataL,
+			     float *dataR, int frames)
 {
+	float *bandL[DRC_MAX_KERNELS], *bandR[DRC_MAX_KERNELS];
 	int i;
-	float **data1 = drc->data1;
-	float **data2 = drc->data2;
+
+	bandL[0] = dataL;
+	bandR[0] = dataR;
+	for (i = 1; i < drc->num_kernels; i++) {
+		bandL[i] = drc->band_data[i - 1][p * DRC_NUM_CHANNELS];
+		bandR[i] = drc->band_data[i - 1][p * DRC_NUM_CHANNELS + 1];
+	}
 
 	/* Apply pre-emphasis filter if it is not disabled. */
 	if (!drc->emphasis_disabled)
-		eq2_process(drc->emphasis_eq, data[0], data[1], frames);
+		eq2_process(drc->emphasis_eq[p], dataL, dataR, frames);
 
 	/* Crossover */
-	crossover2_process(&drc->xo2, frames, data[0], data[1],
-			   data1[0], data1[1], data2[0], data2[1]);
+	crossover2_process_bands(&drc->xo2[p], frames, bandL, bandR);
 
 	/* Apply compression to each band of the signal. The processing is
 	 * performed in place.
 	 */
-	dk_process(&drc->kernel[0], data, frames);
-	dk_process(&drc->kernel[1], data1, frames);
-	dk_process(&drc->kernel[2], data2, frames);
+	for (i = 0; i < drc->num_kernels; i++) {
+		float *band[DRC_NUM_CHANNELS] = {bandL[i], bandR[i]};
+		dk_process(&drc->kernel[p][i], band, frames);
+	}
 
-	/* Sum the three bands of signal */
-	for (i = 0; i < DRC_NUM_CHANNELS; i++)
-		sum3(data[i], data1[i], data2[i], frames);
+	/* Sum the bands of signal, two at a time */
+	for (i = 1; i + 1 < drc->num_kernels; i += 2) {
+		sum3(dataL, bandL[i], bandL[i + 1], frames);
+		sum3(dataR, bandR[i], bandR[i + 1], frames);
+	}
+	if (i < drc->num_kernels) {
+		sum2(dataL, bandL[i], frames);
+		sum2(dataR, bandR[i], frames);
+	}
 
 	/* Apply de-emphasis filter if emphasis is not disabled. */
 	if (!drc->emphasis_disabled)
-		eq2_process(drc->deemphasis_eq, data[0], data[1], frames);
+		eq2_process(drc->deemphasis_eq[p], dataL, dataR, frames);
+}
+
+void drc_process(struct drc *drc, float **data, int frames)
+{
+	int p;
+
+	for (p = 0; p < drc->num_pairs; p++) {
+		int c = p * DRC_NUM_CHANNELS;
+		float *dataR;
+
+		if (c + 1 < drc->num_channels) {
+			dataR = data[c + 1];
+		} else {
+			dataR = drc->silence;
+			memset(dataR, 0, sizeof(float) * frames);
+		}
+		drc_process_pair(drc, p, data[c], dataR, frames);
+	}
 }
@@ -24,9 +24,14 @@ extern "C" {
  * the loudest parts of the signal and raises the volume of the softest parts,
  * making the sound richer, fuller, and more controlled.
  *
- * This is a three band stereo DRC. There are three compressor kernels, and each
- * can have its own parameters. If a kernel is disabled, it only delays the
- * signal and does not compress it.
+ * This is a multiple band DRC, three bands by default. There is one compressor
+ * kernel for each band, and each can have its own parameters. If a kernel is
+ * disabled, it only delays the signal and does not compress it.
+ *
+ * The channels are processed in pairs, two channels at a time with SIMD
+ * instructions. Each pair has its own emphasis filters, crossover and kernels,
+ * so the compression gain is shared by the two channels of a pair. With an odd
+ * number of channels, the last channel is paired with silence.
  *
  *                   INPUT
  *                     |
@@ -97,9 +102,16 @@ enum {
 	PARAM_LAST
 };
 
-/* The number of compressor kernels (also the number of bands). */
+/* The default number of compressor kernels (also the number of bands). */
 #define DRC_NUM_KERNELS 3
 
+/* The maximum number of compressor kernels. */
+#define DRC_MAX_KERNELS CROSSOVER2_MAX_BANDS
+
+/* The maximum number of channels, and of channel pairs. */
+#define DRC_MAX_CHANNELS 8
+#define DRC_MAX_PAIRS (DRC_MAX_CHANNELS / DRC_NUM_CHANNELS)
+
 /* The maximum number of frames can be passed to drc_process() call. */
 #define DRC_PROCESS_MAX_FRAMES 2048
 
@@ -110,27 +122,37 @@ struct drc {
 	/* sample rate in Hz */
 	float sample_rate;
 
+	/* The number of channels, and of channel pairs. */
+	int num_channels;
+	int num_pairs;
+
+	/* The number of compressor kernels (also the number of bands). */
+	int num_kernels;
+
 	/* 1 to disable the emphasis and deemphasis, 0 to enable it. */
 	int emphasis_disabled;
 
 	/* parameters holds the tweakable compressor parameters. */
-	float parameters[DRC_NUM_KERNELS][PARAM_LAST];
+	float parameters[DRC_MAX_KERNELS][PARAM_LAST];
+
+	/* The emphasis filter and deemphasis filter of each channel pair */
+	struct eq2 *emphasis_eq[DRC_MAX_PAIRS];
+	struct eq2 *deemphasis_eq[DRC_MAX_PAIRS];
 
-	/* The emphasis filter and deemphasis filter */
-	struct eq2 *emphasis_eq;
-	struct eq2 *deemphasis_eq;
+	/* The crossover filter of each channel pair */
+	struct crossover2 xo2[DRC_MAX_PAIRS];
 
-	/* The crossover filter */
-	struct crossover2 xo2;
+	/* The compressor kernels of each channel pair */
+	struct drc_kernel kernel[DRC_MAX_PAIRS][DRC_MAX_KERNELS];
 
-	/* The compressor kernels */
-	struct drc_kernel kernel[DRC_NUM_KERNELS];
+	/* Temporary buffer used during drc_process(). The signal of band i
+	 * (i > 0) is stored in band_data[i - 1] (the lowest band is stored in
+	 * the original input buffer). */
+	float *band_data[DRC_MAX_KERNELS - 1][DRC_MAX_CHANNELS];
 
-	/* Temporary buffer used during drc_process(). The mid and high band
-	 * signal is stored in these buffers (the low band is stored in the
-	 * original input buffer). */
-	float *data1[DRC_NUM_CHANNELS];
-	float *data2[DRC_NUM_CHANNELS];
+	/* The missing channel of the last pair, if the number of channels
+	 * is odd. */
+	float *silence;
 };
 
 /* DRC needs the parameters to be set before initialization. So drc_new() should
@@ -150,9 +172,20 @@ struct drc {
  *  drc_free();
  */
 
-/* Allocates a DRC. */
+/* Allocates a three band stereo DRC. */
 struct drc *drc_new(float sample_rate);
 
+/* Allocates a DRC.
+ * Args:
+ *    sample_rate - The sample rate of the data, in Hz.
+ *    num_channels - The number of channels, from 1 to DRC_MAX_CHANNELS.
+ *    num_kernels - The number of bands, from 1 to DRC_MAX_KERNELS.
+ * Returns:
+ *    The new DRC, or NULL if the channels or bands are out of range.
+ */
+struct drc *drc_new_layout(float sample_rate, int num_channels,
+			   int num_kernels);
+
 /* Initializes a DRC. */
 void drc_init(struct drc *drc);
 
@@ -162,13 +195,25 @@ void drc_free(struct drc *drc);
 /* Processes input data using a DRC.
  * Args:
  *    drc - The DRC we want to use.
- *    float **data - Pointers to input/output data. The input must be stereo
- *        and one channel is pointed by data[0], another pointed by data[1]. The
- *        output data is stored in the same place.
+ *    float **data - Pointers to input/output data. Channel i is pointed by
+ *        data[i]. The output data is stored in the same place.
  *    frames - The number of frames to process.
  */
 void drc_process(struct drc *drc, float **data, int frames);
 
+/* Folds an EQ2 which runs right before the DRC into the emphasis filter of the
+ * DRC, so both are applied in a single pass over the data. The biquads of the
+ * EQ2 run before the emphasis biquads. This must be called after drc_init()
+ * and before the first drc_process().
+ * Args:
+ *    drc - The DRC we want to use.
+ *    eq2 - The EQ2 to fold in. It is not modified.
+ * Returns:
+ *    0 if success. -1 if the DRC is not stereo, the emphasis is disabled or
+ *    there is no room for the biquads of the EQ2.
+ */
+int drc_prepend_eq2(struct drc *drc, struct eq2 *eq2);
+
 /* Sets a parameter for the DRC.
  * Args:
  *    drc - The DRC we want to use.
@@ -49,6 +49,16 @@ int eq2_append_biquad_direct(struct eq2 *eq2, int channel,
 	return 0;
 }
 
+int eq2_len(struct eq2 *eq2, int channel)
+{
+	return eq2->n[channel];
+}
+
+struct biquad *eq2_get_bq(struct eq2 *eq2, int channel, int index)
+{
+	return &eq2->biquad[index][channel];
+}
+
 static inline void eq2_process_one(struct biquad (*bq)[2],
 				   float *data0, float *data1, int count)
 {
@@ -55,6 +55,21 @@ int eq2_append_biquad(struct eq2 *eq2, int channel,
 int eq2_append_biquad_direct(struct eq2 *eq2, int channel,
 			     const struct biquad *biquad);
 
+/* Returns the number of biquad filters on a channel of an EQ2.
+ * Args:
+ *    eq2 - The EQ2 we want to use.
+ *    channel - 0 or 1. The channel we want to query.
+ */
+int eq2_len(struct eq2 *eq2, int channel);
+
+/* Returns a biquad filter of an EQ2.
+ * Args:
+ *    eq2 - The EQ2 we want to use.
+ *    channel - 0 or 1. The channel of the filter.
+ *    index - The index of the filter, from 0 to eq2_len() - 1.
+ */
+struct biquad *eq2_get_bq(struct eq2 *eq2, int channel, int index);
+
 /* Process a buffer of audio data through the EQ2.
  * Args:
  *    eq2 - The EQ2 we want to use.
@@ -0,0 +1,449 @@
+/* Copyright (c) 2015 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/* Measures how fast a dsp pipeline described by a dsp.ini file runs. The
+ * pipeline is built the same way the server builds it, and fed with
+ * synthetic or file input as fast as possible. */
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <linux/perf_event.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cras_dsp_ini.h"
+#include "cras_dsp_pipeline.h"
+#include "cras_expr.h"
+#include "dsp_util.h"
+
+/* Bump this when a field of the json output changes meaning. */
+#define JSON_VERSION 1
+
+enum {
+	COUNTER_CACHE_REFERENCES,
+	COUNTER_CACHE_MISSES,
+	COUNTER_INSTRUCTIONS,
+	NUM_COUNTERS
+};
+
+static const char *counter_names[NUM_COUNTERS] = {
+	"cache_references",
+	"cache_misses",
+	"instructions",
+};
+
+static const uint64_t counter_configs[NUM_COUNTERS] = {
+	PERF_COUNT_HW_CACHE_REFERENCES,
+	PERF_COUNT_HW_CACHE_MISSES,
+	PERF_COUNT_HW_INSTRUCTIONS,
+};
+
+struct bench_result {
+	uint64_t frames;
+	uint64_t wall_ns;
+	uint64_t cpu_ns;
+	int has_counter[NUM_COUNTERS];
+	uint64_t counter[NUM_COUNTERS];
+};
+
+static double tp_diff(struct timespec *tp2, struct timespec *tp1)
+{
+	return (tp2->tv_sec - tp1->tv_sec)
+		+ (tp2->tv_nsec - tp1->tv_nsec) * 1e-9;
+}
+
+/* Opens a hardware counter for this thread. Returns -1 if the kernel or the
+ * machine doesn't support it, or we are not allowed to use it. */
+static int open_counter(uint64_t config)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.size = sizeof(attr);
+	attr.config = config;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/* Fills buf with a deterministic noise signal at about -6dBFS. */
+static void fill_synthetic(int16_t *buf, size_t samples)
+{
+	uint32_t seed = 1;
+	size_t i;
+
+	for (i = 0; i < samples; i++) {
+		seed = seed * 1103515245 + 12345;
+		buf[i] = (int16_t)(seed >> 16) / 2;
+	}
+}
+
+/* Fills buf by repeating the interleaved S16_LE samples in the file. */
+static int fill_from_file(const char *filename, int16_t *buf, size_t samples)
+{
+	FILE *f;
+	size_t pos = 0;
+	size_t n;
+
+	f = fopen(filename, "rb");
+	if (!f) {
+		fprintf(stderr, "cannot open file %s\n", filename);
+		return -1;
+	}
+
+	while (pos < samples) {
+		n = fread(buf + pos, sizeof(int16_t), samples - pos, f);
+		if (n == 0) {
+			if (pos == 0) {
+				fprintf(stderr, "empty file %s\n", filename);
+				fclose(f);
+				return -1;
+			}
+			rewind(f);
+		}
+		pos += n;
+	}
+
+	fclose(f);
+	return 0;
+}
+
+static int set_variable(struct cras_expr_env *env, char *arg)
+{
+	char *value = strchr(arg, '=');
+
+	if (!value) {
+		fprintf(stderr, "variable should be name=value: %s\n", arg);
+		return -1;
+	}
+	*value++ = '\0';
+	if (!strcmp(value, "0") || !strcmp(value, "1"))
+		cras_expr_env_set_variable_boolean(env, arg, atoi(value));
+	else
+		cras_expr_env_set_variable_string(env, arg, value);
+	return 0;
+}
+
+static void run_pipeline(struct pipeline *pipeline, int16_t *buf,
+			 size_t frames, size_t block, int channels,
+			 struct bench_result *result)
+{
+	struct timespec wall1, wall2, cpu1, cpu2;
+	int fds[NUM_COUNTERS];
+	size_t start, chunk;
+	int i;
+
+	for (i = 0; i < NUM_COUNTERS; i++) {
+		fds[i] = open_counter(counter_configs[i]);
+		if (fds[i] >= 0)
+			ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &wall1);
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu1);
+	for (start = 0; start < frames; start += chunk) {
+		chunk = frames - start < block ? frames - start : block;
+		cras_dsp_pipeline_apply(pipeline,
+					(uint8_t *)(buf + start * channels),
+					chunk);
+	}
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu2);
+	clock_gettime(CLOCK_MONOTONIC, &wall2);
+
+	for (i = 0; i < NUM_COUNTERS; i++) {
+		if (fds[i] < 0)
+			continue;
+		ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+		if (read(fds[i], &result->counter[i], sizeof(uint64_t)) ==
+		    sizeof(uint64_t))
+			result->has_counter[i] = 1;
+		close(fds[i]);
+	}
+
+	result->frames = frames;
+	result->wall_ns = tp_diff(&wall2, &wall1) * 1e9;
+	result->cpu_ns = tp_diff(&cpu2, &cpu1) * 1e9;
+}
+
+static double per_frame(uint64_t ns, uint64_t frames)
+{
+	return frames ? (double)ns / frames : 0;
+}
+
+static void print_text(const struct dsp_pipeline_debug_info *info,
+		       const struct bench_result *result, int channels,
+		       size_t block)
+{
+	double audio_ns = result->frames * 1e9 / info->sample_rate;
+	unsigned int i;
+
+	printf("pipeline: %s, rate %u, channels %d, block %zu\n",
+	       info->purpose, (unsigned int)info->sample_rate, channels,
+	       block);
+	printf("frames: %" PRIu64 "\n", result->frames);
+	printf("wall time: %" PRIu64 "ns (%.2fns/frame)\n", result->wall_ns,
+	       per_frame(result->wall_ns, result->frames));
+	printf("cpu time: %" PRIu64 "ns (%.2fns/frame)\n", result->cpu_ns,
+	       per_frame(result->cpu_ns, result->frames));
+	printf("realtime factor: %.1fx\n",
+	       result->wall_ns ? audio_ns / result->wall_ns : 0);
+	for (i = 0; i < NUM_COUNTERS; i++) {
+		if (result->has_counter[i])
+			printf("%s: %" PRIu64 "\n", counter_names[i],
+			       result->counter[i]);
+		else
+			printf("%s: unavailable\n", counter_names[i]);
+	}
+	printf("modules (sampled):\n");
+	for (i = 0; i < info->num_modules; i++) {
+		const struct dsp_module_debug_info *m = &info->modules[i];
+		if (m->skipped) {
+			printf("  %-20s skipped\n", m->title);
+			continue;
+		}
+		printf("  %-20s %8.2fns/frame, max %" PRIu64 "ns/block\n",
+		       m->title,
+		       per_frame(m->total_time_ns, m->sampled_frames),
+		       m->max_time_ns);
+	}
+}
+
+/* Prints a string as a json string, quoted and escaped. */
+static void print_json_string(const char *str)
+{
+	const unsigned char *p;
+
+	putchar('"');
+	for (p = (const unsigned char *)str; *p; p++) {
+		if (*p == '"' || *p == '\\')
+			printf("\\%c", *p);
+		else if (*p < 0x20)
+			printf("\\u%04x", *p);
+		else
+			putchar(*p);
+	}
+	putchar('"');
+}
+
+/* Prints the result as one json object. Keys are always printed in the
+ * same order, and counters that can't be read are null, so the output can
+ * be compared across runs and releases. */
+static void print_json(const char *ini_filename,
+		       const struct dsp_pipeline_debug_info *info,
+		       const struct bench_result *result, int channels,
+		       size_t block)
+{
+	double audio_ns = result->frames * 1e9 / info->sample_rate;
+	unsigned int i;
+
+	printf("{\n");
+	printf("  \"version\": %d,\n", JSON_VERSION);
+	printf("  \"ini\": ");
+	print_json_string(ini_filename);
+	printf(",\n  \"purpose\": ");
+	print_json_string(info->purpose);
+	printf(",\n");
+	printf("  \"rate\": %u,\n", (unsigned int)info->sample_rate);
+	printf("  \"channels\": %d,\n", channels);
+	printf("  \"block_frames\": %zu,\n", block);
+	printf("  \"frames\": %" PRIu64 ",\n", result->frames);
+	printf("  \"wall_ns\": %" PRIu64 ",\n", result->wall_ns);
+	printf("  \"cpu_ns\": %" PRIu64 ",\n", result->cpu_ns);
+	printf("  \"ns_per_frame\": %.3f,\n",
+	       per_frame(result->wall_ns, result->frames));
+	printf("  \"realtime_factor\": %.3f,\n",
+	       result->wall_ns ? audio_ns / result->wall_ns : 0);
+	for (i = 0; i < NUM_COUNTERS; i++) {
+		if (result->has_counter[i])
+			printf("  \"%s\": %" PRIu64 ",\n", counter_names[i],
+			       result->counter[i]);
+		else
+			printf("  \"%s\": null,\n", counter_names[i]);
+	}
+	printf("  \"modules\": [");
+	for (i = 0; i < info->num_modules; i++) {
+		const struct dsp_module_debug_info *m = &info->modules[i];
+		printf("%s\n    {\"title\": ", i ? "," : "");
+		print_json_string(m->title);
+		printf(", \"skipped\": %s, "
+		       "\"sampled_frames\": %" PRIu64 ", "
+		       "\"ns_per_frame\": %.3f, \"max_block_ns\": %" PRIu64
+		       "}",
+		       m->skipped ? "true" : "false",
+		       m->sampled_frames,
+		       per_frame(m->total_time_ns, m->sampled_frames),
+		       m->max_time_ns);
+	}
+	printf("\n  ]\n");
+	printf("}\n");
+}
+
+static void show_usage()
+{
+	printf("Usage: dsp_bench [options] dsp.ini\n");
+	printf("--purpose <name> - Pipeline to run (default playback).\n");
+	printf("--rate <N> - Sample rate in Hz (default 48000).\n");
+	printf("--channels <N> - Expected channel count of the pipeline.\n");
+	printf("--block_size <N> - Frames per apply call (default 256).\n");
+	printf("--duration_seconds <N> - Seconds of audio to process"
+	       " (default 10).\n");
+	printf("--input <file> - Interleaved S16_LE input, repeated as needed."
+	       " Default is synthetic noise.\n");
+	printf("--var <name>=<value> - Set a variable used by the ini"
+	       " (0 and 1 are booleans).\n");
+	printf("--json - Print the result as json.\n");
+}
+
+static struct option long_options[] = {
+	{"block_size",		required_argument,	0, 'b'},
+	{"channels",		required_argument,	0, 'c'},
+	{"duration_seconds",	required_argument,	0, 'd'},
+	{"help",		no_argument,		0, 'h'},
+	{"input",		required_argument,	0, 'i'},
+	{"json",		no_argument,		0, 'j'},
+	{"purpose",		required_argument,	0, 'p'},
+	{"rate",		required_argument,	0, 'r'},
+	{"var",			required_argument,	0, 'v'},
+	{0, 0, 0, 0}
+};
+
+int main(int argc, char **argv)
+{
+	struct cras_expr_env env = CRAS_EXPR_ENV_INIT;
+	struct dsp_pipeline_debug_info info;
+	struct bench_result result;
+	const char *purpose = "playback";
+	const char *input_file = NULL;
+	const char *ini_filename;
+	struct pipeline *pipeline = NULL;
+	struct ini *ini = NULL;
+	int16_t *buf = NULL;
+	int rate = 48000;
+	int channels = 0;
+	size_t block = 256;
+	float duration_seconds = 10;
+	size_t frames;
+	int json = 0;
+	int c, rc = 1;
+
+	cras_expr_env_install_builtins(&env);
+	cras_expr_env_set_variable_boolean(&env, "disable_eq", 0);
+	cras_expr_env_set_variable_boolean(&env, "disable_drc", 0);
+	cras_expr_env_set_variable_string(&env, "dsp_name", "");
+
+	while ((c = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+		switch (c) {
+		case 'b':
+			block = atoi(optarg);
+			break;
+		case 'c':
+			channels = atoi(optarg);
+			break;
+		case 'd':
+			duration_seconds = atof(optarg);
+			break;
+		case 'i':
+			input_file = optarg;
+			break;
+		case 'j':
+			json = 1;
+			break;
+		case 'p':
+			purpose = optarg;
+			break;
+		case 'r':
+			rate = atoi(optarg);
+			break;
+		case 'v':
+			if (set_variable(&env, optarg))
+				goto exit;
+			break;
+		default:
+			show_usage();
+			goto exit;
+		}
+	}
+
+	if (optind != argc - 1 || rate <= 0 || block == 0) {
+		show_usage();
+		goto exit;
+	}
+	ini_filename = argv[optind];
+
+	dsp_enable_flush_denormal_to_zero();
+
+	ini = cras_dsp_ini_create(ini_filename);
+	if (!ini) {
+		fprintf(stderr, "cannot load ini %s\n", ini_filename);
+		goto exit;
+	}
+
+	pipeline = cras_dsp_pipeline_create(ini, &env, purpose);
+	if (!pipeline) {
+		fprintf(stderr, "no %s pipeline in %s\n", purpose,
+			ini_filename);
+		goto exit;
+	}
+	if (cras_dsp_pipeline_load(pipeline) ||
+	    cras_dsp_pipeline_instantiate(pipeline, rate)) {
+		fprintf(stderr, "cannot instantiate pipeline\n");
+		goto exit;
+	}
+
+	/* The pipeline processes the buffer in place. */
+	if (cras_dsp_pipeline_get_num_input_channels(pipeline) !=
+	    cras_dsp_pipeline_get_num_output_channels(pipeline)) {
+		fprintf(stderr, "input and output channels differ\n");
+		goto exit;
+	}
+	if (channels == 0)
+		channels = cras_dsp_pipeline_get_num_input_channels(pipeline);
+	if (channels != cras_dsp_pipeline_get_num_input_channels(pipeline)) {
+		fprintf(stderr, "pipeline has %d channels, not %d\n",
+			cras_dsp_pipeline_get_num_input_channels(pipeline),
+			channels);
+		goto exit;
+	}
+
+	frames = duration_seconds * rate;
+	buf = (int16_t *)malloc(frames * channels * sizeof(int16_t));
+	if (!buf) {
+		fprintf(stderr, "cannot allocate %zu frames\n", frames);
+		goto exit;
+	}
+	if (input_file) {
+		if (fill_from_file(input_file, buf, frames * channels))
+			goto exit;
+	} else {
+		fill_synthetic(buf, frames * channels);
+	}
+
+	memset(&result, 0, sizeof(result));
+	run_pipeline(pipeline, buf, frames, block, channels, &result);
+	cras_dsp_pipeline_get_debug_info(pipeline, &info);
+
+	if (json)
+		print_json(ini_filename, &info, &result, channels, block);
+	else
+		print_text(&info, &result, channels, block);
+	rc = 0;
+
+exit:
+	free(buf);
+	if (pipeline)
+		cras_dsp_pipeline_free(pipeline);
+	if (ini)
+		cras_dsp_ini_free(ini);
+	cras_expr_env_free(&env);
+	return rc;
+}
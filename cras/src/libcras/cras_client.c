@@ -30,6 +30,8 @@
 #include <poll.h>
 #include <pthread.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
 #include <sys/ipc.h>
 #include <sys/param.h>
 #include <sys/shm.h>
@@ -53,10 +55,14 @@ static const size_t SERVER_CONNECT_TIMEOUT_NS = 500000000;
 static const size_t SERVER_SHUTDOWN_TIMEOUT_US = 500000;
 static const size_t SERVER_FIRST_MESSAGE_TIMEOUT_NS = 500000000;
 
+/* Most streams serviced by one pass of the shared audio thread. */
+#define SHARED_AUDIO_MAX_EVENTS 32
+
 /* Commands sent from the user to the running client. */
 enum {
 	CLIENT_STOP,
 	CLIENT_ADD_STREAM,
+	CLIENT_ADD_STREAMS,
 	CLIENT_REMOVE_STREAM,
 	CLIENT_SET_STREAM_VOLUME_SCALER,
 	CLIENT_SERVER_CONNECT,
@@ -71,6 +77,7 @@ struct command_msg {
 struct set_stream_volume_command_message {
 	struct command_msg header;
 	float volume_scaler;
+	unsigned int ramp_frames;
 };
 
 /* Adds a stream to the client.
@@ -86,6 +93,18 @@ struct add_stream_command_message {
 	uint32_t dev_idx;
 };
 
+/* Adds several streams to the client, connecting them together.
+ *  streams - The streams to add.
+ *  num_streams - The number of entries in streams.
+ *  stream_ids_out - Filled with the stream ids of the new streams.
+ */
+struct add_streams_command_message {
+	struct command_msg header;
+	struct client_stream **streams;
+	unsigned int num_streams;
+	cras_stream_id_t *stream_ids_out;
+};
+
 /* Commands send from a running stream to the client. */
 enum {
 	CLIENT_STREAM_EOF,
@@ -117,6 +136,31 @@ struct cras_stream_params {
 	struct cras_audio_format format;
 };
 
+/* One audio thread servicing every stream of a client.
+ * thread - The thread dispatching the stream callbacks.
+ * epoll_fd - Watches the audio sockets of the connected streams and wake_fds.
+ * wake_fds - Pipe to wake the thread when it is stopped.
+ * lock - Protects the fields below, not held while callbacks run so that a
+ *     callback can remove other streams of the client.
+ * generation - Incremented when a stream is removed, events gathered before
+ *     that may point to a freed stream and are dropped.
+ * reqs, num_reqs - Requests of the dispatch in progress, the stream of a
+ *     request is cleared when the stream is removed.
+ * cb_stream - The stream whose callback is running, NULL if none.
+ * cb_done - Signaled when a callback returns.
+ */
+struct shared_audio_thread {
+	struct thread_state thread;
+	int epoll_fd;
+	int wake_fds[2];
+	pthread_mutex_t lock;
+	unsigned int generation;
+	struct shared_audio_request *reqs;
+	int num_reqs;
+	struct client_stream *cb_stream;
+	pthread_cond_t cb_done;
+};
+
 /* Represents an attached audio stream.
  * id - Unique stream identifier.
  * aud_fd - After server connects audio messages come in here.
@@ -130,6 +174,9 @@ struct cras_stream_params {
  * config - Audio stream configuration.
  * capture_shm - Shared memory used to exchange audio samples with the server.
  * play_shm - Shared memory used to exchange audio samples with the server.
+ * pull_mode - Serviced by the application through "pull", no audio thread.
+ * shared_thread - Serviced by the client's shared audio thread.
+ * pull - Handle given to the application for pull mode streams.
  * prev, next - Form a linked list of streams attached to a client.
  */
 struct client_stream {
@@ -144,6 +191,9 @@ struct client_stream {
 	struct cras_stream_params *config;
 	struct cras_audio_shm capture_shm;
 	struct cras_audio_shm play_shm;
+	int pull_mode;
+	int shared_thread;
+	struct cras_pull_stream pull;
 	struct client_stream *prev, *next;
 };
 
@@ -161,6 +211,12 @@ struct client_stream {
  * streams - Linked list of streams attached to this client.
  * server_state - RO shared memory region holding server state.
  * debug_info_callback - Function to call when debug info is received.
+ * dsp_debug_info_callback - Function to call when dsp debug info is received.
+ * stream_latency_info_callback - Function to call when stream latency
+ *     statistics are received.
+ * thread_options - Options given to cras_client_run_thread_with_options.
+ * shared_audio - Audio thread servicing all streams, used when thread_options
+ *     has CRAS_CLIENT_SHARED_AUDIO_THREAD.
  */
 struct cras_client {
 	int id;
@@ -175,6 +231,10 @@ struct cras_client {
 	struct client_stream *streams;
 	const struct cras_server_state *server_state;
 	void (*debug_info_callback)(struct cras_client *);
+	void (*dsp_debug_info_callback)(struct cras_client *);
+	void (*stream_latency_info_callback)(struct cras_client *);
+	unsigned int thread_options;
+	struct shared_audio_thread shared_audio;
 };
 
 /*
@@ -588,6 +648,264 @@ static int wake_aud_thread(struct client_stream *stream)
 	return 0;
 }
 
+/* A message read by the shared audio thread, waiting to be dispatched.
+ * stream - The stream the message is for.
+ * msg - The message from the server.
+ * deadline - Time stamp of the stream's samples, the oldest is serviced first.
+ */
+struct shared_audio_request {
+	struct client_stream *stream;
+	struct audio_message msg;
+	struct timespec deadline;
+};
+
+static int compare_deadlines(const void *a, const void *b)
+{
+	const struct shared_audio_request *ra =
+		(const struct shared_audio_request *)a;
+	const struct shared_audio_request *rb =
+		(const struct shared_audio_request *)b;
+
+	if (timespec_after(&ra->deadline, &rb->deadline))
+		return 1;
+	if (timespec_after(&rb->deadline, &ra->deadline))
+		return -1;
+	return 0;
+}
+
+/* Stops watching a stream that errored or hit end of file. */
+static void shared_audio_drop_stream(struct shared_audio_thread *shared,
+				     struct client_stream *stream)
+{
+	epoll_ctl(shared->epoll_fd, EPOLL_CTL_DEL, stream->aud_fd, NULL);
+}
+
+/* Reads the messages of the streams returned by epoll and calls their
+ * callbacks, the stream with the oldest samples first. Called with the lock
+ * held, it is released while each callback runs. */
+static void shared_audio_dispatch(struct shared_audio_thread *shared,
+				  const struct epoll_event *events,
+				  int num_events)
+{
+	struct shared_audio_request reqs[SHARED_AUDIO_MAX_EVENTS];
+	struct client_stream *stream;
+	struct cras_audio_shm *shm;
+	int num_reqs = 0;
+	int i, rc;
+	char tmp;
+
+	for (i = 0; i < num_events; i++) {
+		stream = (struct client_stream *)events[i].data.ptr;
+		if (stream == NULL) {
+			rc = read(shared->wake_fds[0], &tmp, 1);
+			continue;
+		}
+
+		rc = read(stream->aud_fd, &reqs[num_reqs].msg,
+			  sizeof(reqs[num_reqs].msg));
+		if (rc != sizeof(reqs[num_reqs].msg)) {
+			syslog(LOG_ERR, "Audio socket of stream %x failed",
+			       stream->id);
+			shared_audio_drop_stream(shared, stream);
+			continue;
+		}
+
+		shm = cras_stream_uses_output_hw(stream->direction)
+				? &stream->play_shm : &stream->capture_shm;
+		reqs[num_reqs].stream = stream;
+		cras_timespec_to_timespec(&reqs[num_reqs].deadline,
+					  &shm->area->ts);
+		num_reqs++;
+	}
+
+	qsort(reqs, num_reqs, sizeof(reqs[0]), compare_deadlines);
+	shared->reqs = reqs;
+	shared->num_reqs = num_reqs;
+
+	for (i = 0; i < num_reqs; i++) {
+		/* Cleared if an earlier callback removed the stream. */
+		stream = reqs[i].stream;
+		if (stream == NULL)
+			continue;
+
+		shared->cb_stream = stream;
+		pthread_mutex_unlock(&shared->lock);
+		switch (reqs[i].msg.id) {
+		case AUDIO_MESSAGE_DATA_READY:
+			rc = handle_capture_data_ready(stream,
+						       reqs[i].msg.frames);
+			break;
+		case AUDIO_MESSAGE_REQUEST_DATA:
+			rc = handle_playback_request(stream,
+						     reqs[i].msg.frames);
+			break;
+		default:
+			syslog(LOG_WARNING, "Unknown aud msg %d\n",
+			       reqs[i].msg.id);
+			rc = 0;
+			break;
+		}
+		pthread_mutex_lock(&shared->lock);
+		shared->cb_stream = NULL;
+		pthread_cond_broadcast(&shared->cb_done);
+
+		if (rc)
+			shared_audio_drop_stream(shared, stream);
+	}
+
+	shared->reqs = NULL;
+	shared->num_reqs = 0;
+}
+
+/* Services the audio messages of all the streams of a client. */
+static void *shared_audio_thread(void *arg)
+{
+	struct shared_audio_thread *shared = (struct shared_audio_thread *)arg;
+	struct epoll_event events[SHARED_AUDIO_MAX_EVENTS];
+	unsigned int generation;
+	int num_events;
+
+	if (cras_set_rt_scheduling(CRAS_CLIENT_RT_THREAD_PRIORITY) ||
+	    cras_set_thread_priority(CRAS_CLIENT_RT_THREAD_PRIORITY))
+		cras_set_nice_level(CRAS_CLIENT_NICENESS_LEVEL);
+
+	syslog(LOG_DEBUG, "shared audio thread started");
+	pthread_mutex_lock(&shared->lock);
+	while (shared->thread.running) {
+		generation = shared->generation;
+		pthread_mutex_unlock(&shared->lock);
+
+		num_events = epoll_wait(shared->epoll_fd, events,
+					SHARED_AUDIO_MAX_EVENTS, -1);
+
+		pthread_mutex_lock(&shared->lock);
+		if (num_events < 0) {
+			if (errno == EINTR)
+				continue;
+			syslog(LOG_ERR, "shared audio thread epoll failed");
+			break;
+		}
+		/* The sockets are level triggered, streams still attached will
+		 * be returned again. */
+		if (generation != shared->generation)
+			continue;
+		shared_audio_dispatch(shared, events, num_events);
+	}
+	pthread_mutex_unlock(&shared->lock);
+
+	return NULL;
+}
+
+/* Starts watching the audio socket of a connected stream. The shared thread
+ * keeps running. */
+static int shared_audio_add_stream(struct shared_audio_thread *shared,
+				   struct client_stream *stream)
+{
+	struct epoll_event ev;
+
+	ev.events = EPOLLIN;
+	ev.data.ptr = stream;
+	if (epoll_ctl(shared->epoll_fd, EPOLL_CTL_ADD, stream->aud_fd, &ev))
+		return -errno;
+	return 0;
+}
+
+/* Stops watching a stream. When this returns the shared thread isn't running
+ * the stream's callback and won't use the stream again, so it can be freed.
+ * Can be called while the callback of another stream runs, but not from the
+ * stream's own callback. */
+static void shared_audio_rm_stream(struct shared_audio_thread *shared,
+				   struct client_stream *stream)
+{
+	int i;
+
+	pthread_mutex_lock(&shared->lock);
+	while (shared->cb_stream == stream)
+		pthread_cond_wait(&shared->cb_done, &shared->lock);
+	for (i = 0; i < shared->num_reqs; i++)
+		if (shared->reqs[i].stream == stream)
+			shared->reqs[i].stream = NULL;
+	epoll_ctl(shared->epoll_fd, EPOLL_CTL_DEL, stream->aud_fd, NULL);
+	shared->generation++;
+	pthread_mutex_unlock(&shared->lock);
+}
+
+static void shared_audio_close(struct shared_audio_thread *shared)
+{
+	if (shared->epoll_fd >= 0)
+		close(shared->epoll_fd);
+	if (shared->wake_fds[0] >= 0) {
+		close(shared->wake_fds[0]);
+		close(shared->wake_fds[1]);
+	}
+	shared->epoll_fd = -1;
+	shared->wake_fds[0] = -1;
+	shared->wake_fds[1] = -1;
+	pthread_cond_destroy(&shared->cb_done);
+	pthread_mutex_destroy(&shared->lock);
+}
+
+static int shared_audio_start(struct shared_audio_thread *shared)
+{
+	struct epoll_event ev;
+	int rc;
+
+	pthread_mutex_init(&shared->lock, NULL);
+	pthread_cond_init(&shared->cb_done, NULL);
+	shared->generation = 0;
+	shared->reqs = NULL;
+	shared->num_reqs = 0;
+	shared->cb_stream = NULL;
+	shared->wake_fds[0] = -1;
+	shared->wake_fds[1] = -1;
+	shared->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (shared->epoll_fd < 0) {
+		rc = -errno;
+		goto error;
+	}
+	if (pipe(shared->wake_fds) < 0) {
+		rc = -errno;
+		shared->wake_fds[0] = -1;
+		goto error;
+	}
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	if (epoll_ctl(shared->epoll_fd, EPOLL_CTL_ADD, shared->wake_fds[0],
+		      &ev)) {
+		rc = -errno;
+		goto error;
+	}
+
+	shared->thread.running = 1;
+	if (pthread_create(&shared->thread.tid, NULL, shared_audio_thread,
+			   shared)) {
+		shared->thread.running = 0;
+		rc = -ENOMEM;
+		goto error;
+	}
+	return 0;
+
+error:
+	syslog(LOG_ERR, "Couldn't start shared audio thread %d", rc);
+	shared_audio_close(shared);
+	return rc;
+}
+
+static void shared_audio_stop(struct shared_audio_thread *shared)
+{
+	char wake = 0;
+	int rc;
+
+	pthread_mutex_lock(&shared->lock);
+	shared->thread.running = 0;
+	pthread_mutex_unlock(&shared->lock);
+	rc = write(shared->wake_fds[1], &wake, 1);
+	if (rc != 1)
+		syslog(LOG_ERR, "Couldn't wake shared audio thread");
+	pthread_join(shared->thread.tid, NULL);
+	shared_audio_close(shared);
+}
+
 /*
  * Client thread.
  */
@@ -663,6 +981,25 @@ static int stream_connected(struct client_stream *stream,
 					   stream->volume_scaler);
 	}
 
+	if (stream->pull_mode) {
+		stream->pull.shm = cras_stream_uses_output_hw(stream->direction)
+				? &stream->play_shm : &stream->capture_shm;
+		/* The application may be polling "connected" already. */
+		__sync_synchronize();
+		stream->pull.connected = 1;
+		return 0;
+	}
+
+	if (stream->shared_thread) {
+		rc = shared_audio_add_stream(&stream->client->shared_audio,
+					     stream);
+		if (rc < 0) {
+			syslog(LOG_ERR, "Couldn't watch audio socket");
+			goto err_ret;
+		}
+		return 0;
+	}
+
 	rc = pipe(stream->wake_fds);
 	if (rc < 0) {
 		syslog(LOG_ERR, "Error piping");
@@ -688,22 +1025,23 @@ err_ret:
 	return rc;
 }
 
-static int send_connect_message(struct cras_client *client,
-				struct client_stream *stream,
-				uint32_t dev_idx)
+/* Creates the socket pair the server notifies the stream of audio events on
+ * and fills the message asking the server to connect the stream. The stream
+ * keeps one end, the other is returned in server_end to be sent with the
+ * message. */
+static int prepare_connect_message(struct client_stream *stream,
+				   uint32_t dev_idx,
+				   struct cras_connect_message *serv_msg,
+				   int *server_end)
 {
-	int rc;
-	struct cras_connect_message serv_msg;
-	int sock[2] = {-1, -1};
+	int sock[2];
 
-	/* Create a socket pair for the server to notify of audio events. */
-	rc = socketpair(AF_UNIX, SOCK_STREAM, 0, sock);
-	if (rc != 0) {
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sock) != 0) {
 		syslog(LOG_ERR, "socketpair fails.");
-		goto fail;
+		return -errno;
 	}
 
-	cras_fill_connect_message(&serv_msg,
+	cras_fill_connect_message(serv_msg,
 				  stream->config->direction,
 				  stream->id,
 				  stream->config->stream_type,
@@ -712,35 +1050,50 @@ static int send_connect_message(struct cras_client *client,
 				  stream->flags,
 				  stream->config->format,
 				  dev_idx);
+
+	stream->aud_fd = sock[0];
+	stream->pull.fd = sock[0];
+	*server_end = sock[1];
+	return 0;
+}
+
+/* Closes the stream's end of the audio socket when its connect message
+ * couldn't be sent. */
+static void cancel_connect_message(struct client_stream *stream)
+{
+	close(stream->aud_fd);
+	stream->aud_fd = -1;
+	stream->pull.fd = -1;
+}
+
+static int send_connect_message(struct cras_client *client,
+				struct client_stream *stream,
+				uint32_t dev_idx)
+{
+	int rc;
+	struct cras_connect_message serv_msg;
+	int server_end;
+
+	rc = prepare_connect_message(stream, dev_idx, &serv_msg, &server_end);
+	if (rc != 0)
+		return rc;
+
 	rc = cras_send_with_fd(client->server_fd, &serv_msg, sizeof(serv_msg),
-			       sock[1]);
+			       server_end);
+	close(server_end);
 	if (rc != sizeof(serv_msg)) {
-		rc = EIO;
 		syslog(LOG_ERR, "add_stream: Send server message failed.");
-		goto fail;
+		cancel_connect_message(stream);
+		return -EIO;
 	}
 
-	stream->aud_fd = sock[0];
-	close(sock[1]);
 	return 0;
-
-fail:
-	if (sock[0] != -1)
-		close(sock[0]);
-	if (sock[1] != -1)
-		close(sock[1]);
-	return rc;
 }
 
-/* Adds a stream to a running client.  Checks to make sure that the client is
- * attached, waits if it isn't.  The stream is prepared on the  main thread and
- * passed here. */
-static int client_thread_add_stream(struct cras_client *client,
-				    struct client_stream *stream,
-				    cras_stream_id_t *stream_id_out,
-				    uint32_t dev_idx)
+/* Gives a stream being added to the client an unused id. */
+static void assign_stream_id(struct cras_client *client,
+			     struct client_stream *stream)
 {
-	int rc;
 	cras_stream_id_t new_id;
 	struct client_stream *out;
 
@@ -752,8 +1105,23 @@ static int client_thread_add_stream(struct cras_client *client,
 	} while (out != NULL);
 
 	stream->id = new_id;
-	*stream_id_out = new_id;
 	stream->client = client;
+	stream->shared_thread = !stream->pull_mode &&
+		(client->thread_options & CRAS_CLIENT_SHARED_AUDIO_THREAD);
+}
+
+/* Adds a stream to a running client.  Checks to make sure that the client is
+ * attached, waits if it isn't.  The stream is prepared on the  main thread and
+ * passed here. */
+static int client_thread_add_stream(struct cras_client *client,
+				    struct client_stream *stream,
+				    cras_stream_id_t *stream_id_out,
+				    uint32_t dev_idx)
+{
+	int rc;
+
+	assign_stream_id(client, stream);
+	*stream_id_out = stream->id;
 
 	/* send a message to the server asking that the stream be started. */
 	rc = send_connect_message(client, stream, dev_idx);
@@ -766,6 +1134,72 @@ static int client_thread_add_stream(struct cras_client *client,
 	return 0;
 }
 
+/* Adds several streams to a running client, their connect messages are sent
+ * to the server with one system call. Either all streams are added or none
+ * are, streams the server was already told about are disconnected again. */
+static int client_thread_add_streams(struct cras_client *client,
+				     struct client_stream **streams,
+				     unsigned int num_streams,
+				     cras_stream_id_t *stream_ids_out)
+{
+	struct cras_connect_message serv_msgs[CRAS_CLIENT_MAX_BATCHED_STREAMS];
+	/* Only the prepared entries are sent, cleared to keep gcc from
+	 * warning that the rest may be used uninitialized. */
+	void *bufs[CRAS_CLIENT_MAX_BATCHED_STREAMS] = { NULL };
+	size_t lens[CRAS_CLIENT_MAX_BATCHED_STREAMS] = { 0 };
+	int server_ends[CRAS_CLIENT_MAX_BATCHED_STREAMS] = { 0 };
+	struct cras_disconnect_stream_message disconnect_msg;
+	unsigned int i, prepared, sent = 0;
+	int rc = 0;
+
+	for (prepared = 0; prepared < num_streams; prepared++) {
+		assign_stream_id(client, streams[prepared]);
+		rc = prepare_connect_message(streams[prepared], NO_DEVICE,
+					     &serv_msgs[prepared],
+					     &server_ends[prepared]);
+		if (rc != 0)
+			break;
+		bufs[prepared] = &serv_msgs[prepared];
+		lens[prepared] = sizeof(serv_msgs[prepared]);
+	}
+
+	if (rc == 0) {
+		rc = cras_send_msgs_with_fds(client->server_fd, bufs, lens,
+					     server_ends, num_streams);
+		sent = rc < 0 ? 0 : rc;
+		rc = 0;
+		if (sent < num_streams) {
+			syslog(LOG_ERR,
+			       "add_streams: Send server messages failed.");
+			rc = -EIO;
+		}
+	}
+
+	for (i = 0; i < prepared; i++)
+		close(server_ends[i]);
+
+	if (rc != 0) {
+		for (i = 0; i < sent; i++) {
+			cras_fill_disconnect_stream_message(&disconnect_msg,
+							    streams[i]->id);
+			if (write(client->server_fd, &disconnect_msg,
+				  sizeof(disconnect_msg)) < 0)
+				syslog(LOG_WARNING,
+				       "error removing stream from server\n");
+		}
+		for (i = 0; i < prepared; i++)
+			cancel_connect_message(streams[i]);
+		return rc;
+	}
+
+	for (i = 0; i < num_streams; i++) {
+		stream_ids_out[i] = streams[i]->id;
+		DL_APPEND(client->streams, streams[i]);
+	}
+
+	return 0;
+}
+
 /* Removes a stream from a running client from within the running client's
  * context. */
 static int client_thread_rm_stream(struct cras_client *client,
@@ -786,6 +1220,8 @@ static int client_thread_rm_stream(struct cras_client *client,
 		syslog(LOG_WARNING, "error removing stream from server\n");
 
 	/* And shut down locally. */
+	if (stream->shared_thread)
+		shared_audio_rm_stream(&client->shared_audio, stream);
 	if (stream->thread.running) {
 		stream->thread.running = 0;
 		wake_aud_thread(stream);
@@ -813,7 +1249,8 @@ static int client_thread_rm_stream(struct cras_client *client,
 /* Sets the volume scaling factor for a playing stream. */
 static int client_thread_set_stream_volume(struct cras_client *client,
 					   cras_stream_id_t stream_id,
-					   float volume_scaler)
+					   float volume_scaler,
+					   unsigned int ramp_frames)
 {
 	struct client_stream *stream;
 
@@ -823,7 +1260,8 @@ static int client_thread_set_stream_volume(struct cras_client *client,
 
 	stream->volume_scaler = volume_scaler;
 	if (stream->play_shm.area != NULL)
-		cras_shm_set_volume_scaler(&stream->play_shm, volume_scaler);
+		cras_shm_set_volume_ramp(&stream->play_shm, volume_scaler,
+					 ramp_frames);
 
 	return 0;
 }
@@ -895,6 +1333,8 @@ static int handle_message_from_server(struct cras_client *client)
 			break;
 		rc = stream_connected(stream, cmsg);
 		if (rc < 0)
+			stream->pull.error = rc;
+		if (rc < 0 && stream->config->err_cb)
 			stream->config->err_cb(stream->client,
 					       stream->id,
 					       rc,
@@ -905,6 +1345,14 @@ static int handle_message_from_server(struct cras_client *client)
 		if (client->debug_info_callback)
 			client->debug_info_callback(client);
 		break;
+	case CRAS_CLIENT_DSP_DEBUG_INFO_READY:
+		if (client->dsp_debug_info_callback)
+			client->dsp_debug_info_callback(client);
+		break;
+	case CRAS_CLIENT_STREAM_LATENCY_INFO_READY:
+		if (client->stream_latency_info_callback)
+			client->stream_latency_info_callback(client);
+		break;
 	default:
 		syslog(LOG_WARNING, "Receive unknown command %d", msg->id);
 		break;
@@ -985,6 +1433,15 @@ static int handle_command_message(struct cras_client *client)
 					      add_msg->dev_idx);
 		break;
 	}
+	case CLIENT_ADD_STREAMS: {
+		struct add_streams_command_message *add_msg =
+			(struct add_streams_command_message *)msg;
+		rc = client_thread_add_streams(client,
+					       add_msg->streams,
+					       add_msg->num_streams,
+					       add_msg->stream_ids_out);
+		break;
+	}
 	case CLIENT_REMOVE_STREAM:
 		rc = client_thread_rm_stream(client, msg->stream_id);
 		break;
@@ -993,7 +1450,8 @@ static int handle_command_message(struct cras_client *client)
 			(struct set_stream_volume_command_message *)msg;
 		rc = client_thread_set_stream_volume(client,
 						     vol_msg->header.stream_id,
-						     vol_msg->volume_scaler);
+						     vol_msg->volume_scaler,
+						     vol_msg->ramp_frames);
 		break;
 	}
 	case CLIENT_SERVER_CONNECT:
@@ -1102,7 +1560,8 @@ static int send_simple_cmd_msg(struct cras_client *client,
 /* Sends the set volume message to the client thread. */
 static int send_stream_volume_command_msg(struct cras_client *client,
 					  cras_stream_id_t stream_id,
-					  float volume_scaler)
+					  float volume_scaler,
+					  unsigned int ramp_frames)
 {
 	struct set_stream_volume_command_message msg;
 
@@ -1110,6 +1569,7 @@ static int send_stream_volume_command_msg(struct cras_client *client,
 	msg.header.stream_id = stream_id;
 	msg.header.msg_id = CLIENT_SET_STREAM_VOLUME_SCALER;
 	msg.volume_scaler = volume_scaler;
+	msg.ramp_frames = ramp_frames;
 
 	return send_command_message(client, &msg.header);
 }
@@ -1142,11 +1602,14 @@ static int write_message_to_server(struct cras_client *client,
 static inline
 unsigned begin_server_state_read(const struct cras_server_state *state)
 {
+	/* Servers that don't wake waiters still finish updates in time. */
+	static const struct timespec wait_ts = {0, 1000000};
 	unsigned count;
 
-	/* Version will be odd when the server is writing. */
+	/* Version will be odd when the server is writing. Sleep until the
+	 * server wakes us at the end of the update. */
 	while ((count = *(volatile unsigned *)&state->update_count) & 1)
-		sched_yield();
+		cras_futex_wait(&state->update_count, count, &wait_ts);
 	__sync_synchronize();
 	return count;
 }
@@ -1193,6 +1656,9 @@ int cras_client_create(struct cras_client **client)
 	}
 	(*client)->command_reply_fds[0] = -1;
 	(*client)->command_reply_fds[1] = -1;
+	(*client)->shared_audio.epoll_fd = -1;
+	(*client)->shared_audio.wake_fds[0] = -1;
+	(*client)->shared_audio.wake_fds[1] = -1;
 
 	openlog("cras_client", LOG_PID, LOG_USER);
 	setlogmask(LOG_MASK(LOG_ERR));
@@ -1320,35 +1786,42 @@ void cras_client_stream_params_destroy(struct cras_stream_params *params)
 	free(params);
 }
 
-static inline int cras_client_send_add_stream_command_message(
-		struct cras_client *client,
-		uint32_t dev_idx,
-		cras_stream_id_t *stream_id_out,
-		struct cras_stream_params *config)
+/* Checks that a stream can be created from config, pull tells if it will be
+ * a pull stream. */
+static int check_stream_params(const struct cras_stream_params *config,
+			       int pull)
 {
-	struct add_stream_command_message cmd_msg;
-	struct client_stream *stream;
-	int rc = 0;
-
-	if (client == NULL || config == NULL || stream_id_out == NULL)
+	if (config == NULL)
 		return -EINVAL;
 
-	if (config->aud_cb == NULL && config->unified_cb == NULL)
-		return -EINVAL;
+	if (pull) {
+		if (config->direction == CRAS_STREAM_UNIFIED)
+			return -EINVAL;
+	} else {
+		if (config->aud_cb == NULL && config->unified_cb == NULL)
+			return -EINVAL;
 
-	if (config->err_cb == NULL)
-		return -EINVAL;
+		if (config->err_cb == NULL)
+			return -EINVAL;
+	}
+	return 0;
+}
+
+/* Allocates a stream to pass to the client thread. */
+static struct client_stream *client_stream_create(
+		const struct cras_stream_params *config,
+		int pull)
+{
+	struct client_stream *stream;
 
 	stream = (struct client_stream *)calloc(1, sizeof(*stream));
-	if (stream == NULL) {
-		rc = -ENOMEM;
-		goto add_failed;
-	}
+	if (stream == NULL)
+		return NULL;
 	stream->config = (struct cras_stream_params *)
 			malloc(sizeof(*(stream->config)));
 	if (stream->config == NULL) {
-		rc = -ENOMEM;
-		goto add_failed;
+		free(stream);
+		return NULL;
 	}
 	memcpy(stream->config, config, sizeof(*config));
 	stream->aud_fd = -1;
@@ -1357,6 +1830,39 @@ static inline int cras_client_send_add_stream_command_message(
 	stream->direction = config->direction;
 	stream->volume_scaler = 1.0;
 	stream->flags = config->flags;
+	stream->pull_mode = pull;
+	stream->pull.fd = -1;
+	return stream;
+}
+
+/* Frees a stream the client thread didn't take. */
+static void client_stream_free(struct client_stream *stream)
+{
+	free(stream->config);
+	free(stream);
+}
+
+static inline int cras_client_send_add_stream_command_message(
+		struct cras_client *client,
+		uint32_t dev_idx,
+		cras_stream_id_t *stream_id_out,
+		struct cras_stream_params *config,
+		struct cras_pull_stream **pull_out)
+{
+	struct add_stream_command_message cmd_msg;
+	struct client_stream *stream;
+	int rc = 0;
+
+	if (client == NULL || stream_id_out == NULL)
+		return -EINVAL;
+
+	rc = check_stream_params(config, pull_out != NULL);
+	if (rc < 0)
+		return rc;
+
+	stream = client_stream_create(config, pull_out != NULL);
+	if (stream == NULL)
+		return -ENOMEM;
 
 	cmd_msg.header.len = sizeof(cmd_msg);
 	cmd_msg.header.msg_id = CLIENT_ADD_STREAM;
@@ -1367,18 +1873,13 @@ static inline int cras_client_send_add_stream_command_message(
 	rc = send_command_message(client, &cmd_msg.header);
 	if (rc < 0) {
 		syslog(LOG_ERR, "adding stream failed in thread %d", rc);
-		goto add_failed;
+		client_stream_free(stream);
+		return rc;
 	}
 
+	if (pull_out)
+		*pull_out = &stream->pull;
 	return 0;
-
-add_failed:
-	if (stream) {
-		if (stream->config)
-			free(stream->config);
-		free(stream);
-	}
-	return rc;
 }
 
 int cras_client_add_stream(struct cras_client *client,
@@ -1389,7 +1890,8 @@ int cras_client_add_stream(struct cras_client *client,
 			client,
 			NO_DEVICE,
 			stream_id_out,
-			config);
+			config,
+			NULL);
 }
 
 int cras_client_add_pinned_stream(struct cras_client *client,
@@ -1401,7 +1903,134 @@ int cras_client_add_pinned_stream(struct cras_client *client,
 			client,
 			dev_idx,
 			stream_id_out,
-			config);
+			config,
+			NULL);
+}
+
+int cras_client_add_pull_stream(struct cras_client *client,
+				cras_stream_id_t *stream_id_out,
+				struct cras_stream_params *config,
+				struct cras_pull_stream **pull_out)
+{
+	if (pull_out == NULL)
+		return -EINVAL;
+
+	return cras_client_send_add_stream_command_message(
+			client,
+			NO_DEVICE,
+			stream_id_out,
+			config,
+			pull_out);
+}
+
+int cras_client_add_streams(struct cras_client *client,
+			    unsigned int num_streams,
+			    struct cras_stream_params **configs,
+			    cras_stream_id_t *stream_ids_out,
+			    struct cras_pull_stream **pulls_out)
+{
+	struct add_streams_command_message cmd_msg;
+	struct client_stream *streams[CRAS_CLIENT_MAX_BATCHED_STREAMS];
+	unsigned int i, created = 0;
+	int rc;
+
+	if (client == NULL || configs == NULL || stream_ids_out == NULL ||
+	    num_streams == 0 || num_streams > CRAS_CLIENT_MAX_BATCHED_STREAMS)
+		return -EINVAL;
+
+	for (i = 0; i < num_streams; i++) {
+		rc = check_stream_params(configs[i], pulls_out != NULL);
+		if (rc < 0)
+			return rc;
+	}
+
+	for (created = 0; created < num_streams; created++) {
+		streams[created] = client_stream_create(configs[created],
+							pulls_out != NULL);
+		if (streams[created] == NULL) {
+			rc = -ENOMEM;
+			goto add_failed;
+		}
+	}
+
+	cmd_msg.header.len = sizeof(cmd_msg);
+	cmd_msg.header.msg_id = CLIENT_ADD_STREAMS;
+	cmd_msg.header.stream_id = 0;
+	cmd_msg.streams = streams;
+	cmd_msg.num_streams = num_streams;
+	cmd_msg.stream_ids_out = stream_ids_out;
+	rc = send_command_message(client, &cmd_msg.header);
+	if (rc < 0) {
+		syslog(LOG_ERR, "adding streams failed in thread %d", rc);
+		goto add_failed;
+	}
+
+	if (pulls_out)
+		for (i = 0; i < num_streams; i++)
+			pulls_out[i] = &streams[i]->pull;
+	return 0;
+
+add_failed:
+	for (i = 0; i < created; i++)
+		client_stream_free(streams[i]);
+	return rc;
+}
+
+int cras_client_pull_stream_handle_fd(struct cras_pull_stream *pull)
+{
+	struct audio_message aud_msg;
+	int frames = 0;
+	int rc;
+
+	if (pull == NULL || pull->fd < 0)
+		return -EINVAL;
+
+	/* Drain everything, only the latest request matters. */
+	while (1) {
+		rc = recv(pull->fd, &aud_msg, sizeof(aud_msg), MSG_DONTWAIT);
+		if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			break;
+		if (rc < 0)
+			return -errno;
+		if (rc != sizeof(aud_msg))
+			return -EPIPE;
+
+		switch (aud_msg.id) {
+		case AUDIO_MESSAGE_REQUEST_DATA:
+			pull->requested = aud_msg.frames;
+			frames = aud_msg.frames;
+			break;
+		case AUDIO_MESSAGE_DATA_READY:
+			frames = aud_msg.frames;
+			break;
+		default:
+			syslog(LOG_WARNING, "Unknown aud msg %d\n", aud_msg.id);
+			break;
+		}
+	}
+
+	return frames;
+}
+
+int cras_client_pull_stream_reply(struct cras_pull_stream *pull,
+				  unsigned int frames)
+{
+	struct audio_message aud_msg;
+	int rc;
+
+	if (pull == NULL || pull->fd < 0)
+		return -EINVAL;
+
+	pull->requested = 0;
+	aud_msg.id = AUDIO_MESSAGE_DATA_READY;
+	aud_msg.frames = frames;
+	aud_msg.error = 0;
+
+	rc = write(pull->fd, &aud_msg, sizeof(aud_msg));
+	if (rc != sizeof(aud_msg))
+		return -EPIPE;
+
+	return 0;
 }
 
 int cras_client_rm_stream(struct cras_client *client,
@@ -1420,7 +2049,20 @@ int cras_client_set_stream_volume(struct cras_client *client,
 	if (client == NULL)
 		return -EINVAL;
 
-	return send_stream_volume_command_msg(client, stream_id, volume_scaler);
+	return send_stream_volume_command_msg(client, stream_id, volume_scaler,
+					      0);
+}
+
+int cras_client_set_stream_volume_ramp(struct cras_client *client,
+				       cras_stream_id_t stream_id,
+				       float volume_scaler,
+				       unsigned int ramp_frames)
+{
+	if (client == NULL)
+		return -EINVAL;
+
+	return send_stream_volume_command_msg(client, stream_id, volume_scaler,
+					      ramp_frames);
 }
 
 int cras_client_set_system_volume(struct cras_client *client, size_t volume)
@@ -1573,6 +2215,63 @@ const struct audio_debug_info *cras_client_get_audio_debug_info(
 	return &client->server_state->audio_debug_info;
 }
 
+const struct dsp_debug_info *cras_client_get_dsp_debug_info(
+		struct cras_client *client)
+{
+	if (!client || !client->server_state)
+		return NULL;
+
+	return &client->server_state->dsp_debug_info;
+}
+
+const struct stream_latency_info *cras_client_get_stream_latency_info(
+		struct cras_client *client)
+{
+	if (!client || !client->server_state)
+		return NULL;
+
+	return &client->server_state->stream_latency_info;
+}
+
+int cras_client_wait_for_server_state_change(struct cras_client *client,
+					     unsigned int *update_count,
+					     const struct timespec *timeout)
+{
+	const struct cras_server_state *state;
+	struct timespec now, deadline = {0, 0}, remaining = {0, 0};
+	unsigned int count;
+	int rc;
+
+	if (!client || !client->server_state || !update_count)
+		return -EINVAL;
+	state = client->server_state;
+
+	if (timeout) {
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		add_timespecs(&deadline, timeout);
+	}
+
+	while (1) {
+		count = *(volatile unsigned *)&state->update_count;
+		if (!(count & 1) && count != *update_count)
+			break;
+
+		if (timeout) {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			if (!timespec_after(&deadline, &now))
+				return -ETIMEDOUT;
+			subtract_timespecs(&deadline, &now, &remaining);
+		}
+		rc = cras_futex_wait(&state->update_count, count,
+				     timeout ? &remaining : NULL);
+		if (rc < 0 && rc != -ETIMEDOUT && rc != -EINTR)
+			return rc;
+	}
+
+	*update_count = count;
+	return 0;
+}
+
 unsigned cras_client_get_num_active_streams(struct cras_client *client,
 					    struct timespec *ts)
 {
@@ -1629,12 +2328,27 @@ read_active_streams_again:
 
 int cras_client_run_thread(struct cras_client *client)
 {
+	return cras_client_run_thread_with_options(client, 0);
+}
+
+int cras_client_run_thread_with_options(struct cras_client *client,
+					unsigned int options)
+{
+	int rc;
+
 	if (client == NULL || client->thread.running)
 		return -EINVAL;
 
 	assert(client->command_reply_fds[0] == -1 &&
 	       client->command_reply_fds[1] == -1);
 
+	client->thread_options = options;
+	if (options & CRAS_CLIENT_SHARED_AUDIO_THREAD) {
+		rc = shared_audio_start(&client->shared_audio);
+		if (rc < 0)
+			return rc;
+	}
+
 	client->thread.running = 1;
 	if (pipe(client->command_reply_fds) < 0)
 		return -EIO;
@@ -1652,6 +2366,11 @@ int cras_client_stop(struct cras_client *client)
 	send_simple_cmd_msg(client, 0, CLIENT_STOP);
 	pthread_join(client->thread.tid, NULL);
 
+	/* All streams are removed, the shared audio thread has nothing left to
+	 * service. */
+	if (client->shared_audio.thread.running)
+		shared_audio_stop(&client->shared_audio);
+
 	/* The other end of the reply pipe is closed by the client thread, just
 	 * clost the read end here. */
 	close(client->command_reply_fds[0]);
@@ -2005,6 +2724,36 @@ int cras_client_update_audio_debug_info(
 	return write_message_to_server(client, &msg.header);
 }
 
+int cras_client_update_dsp_debug_info(
+	struct cras_client *client,
+	void (*debug_info_cb)(struct cras_client *))
+{
+	struct cras_update_dsp_debug_info msg;
+
+	if (client == NULL)
+		return -EINVAL;
+
+	client->dsp_debug_info_callback = debug_info_cb;
+
+	cras_fill_update_dsp_debug_info(&msg);
+	return write_message_to_server(client, &msg.header);
+}
+
+int cras_client_update_stream_latency_info(
+	struct cras_client *client,
+	void (*latency_info_cb)(struct cras_client *))
+{
+	struct cras_update_stream_latency_info msg;
+
+	if (client == NULL)
+		return -EINVAL;
+
+	client->stream_latency_info_callback = latency_info_cb;
+
+	cras_fill_update_stream_latency_info(&msg);
+	return write_message_to_server(client, &msg.header);
+}
+
 int cras_client_set_node_volume(struct cras_client *client,
 				cras_node_id_t node_id,
 				uint8_t volume)
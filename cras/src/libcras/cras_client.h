@@ -14,6 +14,7 @@ extern "C" {
 #include <sys/select.h>
 
 #include "cras_iodev_info.h"
+#include "cras_shm.h"
 #include "cras_types.h"
 #include "cras_util.h"
 
@@ -111,6 +112,27 @@ int cras_client_connected_wait(struct cras_client *client);
  */
 int cras_client_run_thread(struct cras_client *client);
 
+/* Options for cras_client_run_thread_with_options.
+ *    CRAS_CLIENT_SHARED_AUDIO_THREAD - Service the audio of all streams from a
+ *        single real time thread, instead of one thread per stream. Callbacks
+ *        of different streams are then never called concurrently, and streams
+ *        whose samples are due first are serviced first.
+ */
+enum CRAS_CLIENT_THREAD_OPTIONS {
+	CRAS_CLIENT_SHARED_AUDIO_THREAD = 0x01,
+};
+
+/* Begins running a client with the given options.
+ * Args:
+ *    client - the client to start (from cras_client_create).
+ *    options - Bitmask of CRAS_CLIENT_THREAD_OPTIONS.
+ * Returns:
+ *    0 on success, -EINVAL if the client pointer is NULL, or a negative error
+ *    code if the threads can't be started.
+ */
+int cras_client_run_thread_with_options(struct cras_client *client,
+					unsigned int options);
+
 /* Stops running a client.
  * Args:
  *    client - the client to stop (from cras_client_create).
@@ -268,6 +290,28 @@ int cras_client_dump_dsp_info(struct cras_client *client);
 int cras_client_update_audio_debug_info(
 	struct cras_client *client, void (*cb)(struct cras_client *));
 
+/* Asks the server to copy the run time statistics of the dsp pipelines to
+ * the shared server state.
+ * Args:
+ *    client - The client from cras_client_create.
+ *    cb - A function to call when the data is received.
+ * Returns:
+ *    0 on success, -EINVAL if the client isn't valid or isn't running.
+ */
+int cras_client_update_dsp_debug_info(
+	struct cras_client *client, void (*cb)(struct cras_client *));
+
+/* Asks the server to copy the latency statistics of the attached streams to
+ * the shared server state.
+ * Args:
+ *    client - The client from cras_client_create.
+ *    cb - A function to call when the data is received.
+ * Returns:
+ *    0 on success, -EINVAL if the client isn't valid or isn't running.
+ */
+int cras_client_update_stream_latency_info(
+	struct cras_client *client, void (*cb)(struct cras_client *));
+
 /*
  * Stream handling.
  */
@@ -357,6 +401,205 @@ int cras_client_add_pinned_stream(struct cras_client *client,
 				  cras_stream_id_t *stream_id_out,
 				  struct cras_stream_params *config);
 
+/* A stream serviced by the application instead of a libcras audio thread.
+ * Filled in by the client thread when the server connects the stream. Samples
+ * are exchanged with the inline functions below, which only touch the shared
+ * memory unless the server is waiting on a reply.
+ * Members:
+ *    fd - Audio socket of the stream, readable when the server requests or
+ *        delivers samples. Pass to cras_client_pull_stream_handle_fd() when it
+ *        is readable.
+ *    shm - Samples shared with the server, valid once "connected" is set.
+ *    connected - Non-zero once the shared memory is mapped.
+ *    error - Negative error code if the stream failed to connect.
+ *    requested - Frames asked for by a server request that hasn't been
+ *        replied to, 0 if none.
+ */
+struct cras_pull_stream {
+	int fd;
+	struct cras_audio_shm *shm;
+	int connected;
+	int error;
+	unsigned int requested;
+};
+
+/* Creates a stream that doesn't get an audio thread or callbacks. The
+ * application polls "fd" of the returned handle from a thread of its choosing
+ * and moves samples with the cras_client_stream_* functions below.
+ * Args:
+ *    client - The client to add the stream to (from cras_client_create).
+ *    stream_id_out - On success will be filled with the new stream id.
+ *    config - The cras_stream_params struct specifying the parameters for the
+ *        stream. The callbacks are ignored, err_cb is still called if set.
+ *        Only CRAS_STREAM_OUTPUT and capture directions are supported.
+ *    pull_out - On success will be filled with the stream handle, valid until
+ *        the stream is removed with cras_client_rm_stream.
+ * Returns:
+ *    0 on success, negative error code on failure (from errno.h).
+ */
+int cras_client_add_pull_stream(struct cras_client *client,
+				cras_stream_id_t *stream_id_out,
+				struct cras_stream_params *config,
+				struct cras_pull_stream **pull_out);
+
+/* Max number of streams added by one call to cras_client_add_streams. */
+#define CRAS_CLIENT_MAX_BATCHED_STREAMS 32
+
+/* Creates several streams at once, like a capture and playback pair or
+ * streams set up ahead of the time they are needed. Their connect messages are
+ * sent to the server together, which sets them all up in one pass.
+ * Args:
+ *    client - The client to add the streams to (from cras_client_create).
+ *    num_streams - The number of streams to add, at most
+ *        CRAS_CLIENT_MAX_BATCHED_STREAMS.
+ *    configs - The parameters of each stream.
+ *    stream_ids_out - On success filled with the id of each new stream.
+ *    pulls_out - NULL to create streams serviced by callbacks, as
+ *        cras_client_add_stream does. Otherwise the streams are pull streams,
+ *        see cras_client_add_pull_stream, and this array is filled with their
+ *        handles.
+ * Returns:
+ *    0 on success, negative error code on failure (from errno.h), in which
+ *    case none of the streams were added.
+ */
+int cras_client_add_streams(struct cras_client *client,
+			    unsigned int num_streams,
+			    struct cras_stream_params **configs,
+			    cras_stream_id_t *stream_ids_out,
+			    struct cras_pull_stream **pulls_out);
+
+/* Reads the messages the server sent on a pull stream's socket, without
+ * blocking. Call when "fd" is readable.
+ * Args:
+ *    pull - The stream handle from cras_client_add_pull_stream.
+ * Returns:
+ *    The number of frames requested for playback or ready for capture, 0 if
+ *    there was nothing to read, or a negative error if the server hung up.
+ */
+int cras_client_pull_stream_handle_fd(struct cras_pull_stream *pull);
+
+/* Tells the server that frames were written in reply to its request. Called
+ * by cras_client_stream_commit(), not needed otherwise.
+ * Args:
+ *    pull - The stream handle from cras_client_add_pull_stream.
+ *    frames - The number of frames committed.
+ * Returns:
+ *    0 on success, negative error code on failure (from errno.h).
+ */
+int cras_client_pull_stream_reply(struct cras_pull_stream *pull,
+				  unsigned int frames);
+
+/* Returns non-zero once the shared memory of a pull stream can be used. */
+static inline int cras_client_pull_stream_ready(struct cras_pull_stream *pull)
+{
+	int connected = *(volatile int *)&pull->connected;
+
+	/* Pairs with the barrier before "connected" is set. */
+	__sync_synchronize();
+	return connected;
+}
+
+/* Gets the buffer to write playback samples to.
+ * Args:
+ *    pull - A playback stream from cras_client_add_pull_stream.
+ *    frames - Filled with the number of frames that can be written.
+ * Returns:
+ *    Pointer to write samples to, or NULL if the server hasn't consumed the
+ *    previous buffers yet or the stream isn't connected.
+ */
+static inline uint8_t *cras_client_stream_get_write_ptr(
+		struct cras_pull_stream *pull,
+		unsigned int *frames)
+{
+	*frames = 0;
+	if (!cras_client_pull_stream_ready(pull) ||
+	    !cras_shm_is_buffer_available(pull->shm))
+		return NULL;
+	*frames = cras_shm_used_frames(pull->shm);
+	return cras_shm_get_write_buffer_base(pull->shm);
+}
+
+/* Hands frames written to the buffer from cras_client_stream_get_write_ptr to
+ * the server. Only makes a syscall if the server is waiting on a request.
+ * Args:
+ *    pull - A playback stream from cras_client_add_pull_stream.
+ *    frames - The number of frames written.
+ * Returns:
+ *    0 on success, negative error code on failure (from errno.h).
+ */
+static inline int cras_client_stream_commit(struct cras_pull_stream *pull,
+					    unsigned int frames)
+{
+	cras_shm_buffer_written_start(pull->shm, frames);
+	if (pull->requested)
+		return cras_client_pull_stream_reply(pull, frames);
+	return 0;
+}
+
+/* Gets the captured samples.
+ * Args:
+ *    pull - A capture stream from cras_client_add_pull_stream.
+ *    frames - Filled with the number of frames that can be read.
+ * Returns:
+ *    Pointer to read samples from, or NULL if there are none.
+ */
+static inline uint8_t *cras_client_stream_get_read_ptr(
+		struct cras_pull_stream *pull,
+		unsigned int *frames)
+{
+	*frames = 0;
+	if (!cras_client_pull_stream_ready(pull))
+		return NULL;
+	*frames = cras_shm_get_frames_in_curr_buffer(pull->shm);
+	if (*frames == 0)
+		return NULL;
+	return cras_shm_get_curr_read_buffer(pull->shm);
+}
+
+/* Marks frames from cras_client_stream_get_read_ptr as read. */
+static inline void cras_client_stream_consume(struct cras_pull_stream *pull,
+					      unsigned int frames)
+{
+	cras_shm_buffer_read_current(pull->shm, frames);
+}
+
+/* Gets the time the first sample of the buffer is played or was captured. */
+static inline void cras_client_stream_sample_time(
+		struct cras_pull_stream *pull,
+		struct timespec *ts)
+{
+	cras_timespec_to_timespec(ts, &pull->shm->area->ts);
+}
+
+/* Sets the volume of a pull playback stream by writing it to the shared
+ * memory, no system call is made. The server ramps to the new volume over
+ * ramp_frames frames at the stream's rate, zero changes it at once. Only one
+ * thread may change the volume of a stream at a time.
+ * Returns:
+ *    0 on success, -EAGAIN if the stream isn't connected yet.
+ */
+static inline int cras_client_stream_set_volume(struct cras_pull_stream *pull,
+						float volume_scaler,
+						unsigned int ramp_frames)
+{
+	if (!cras_client_pull_stream_ready(pull))
+		return -EAGAIN;
+	cras_shm_set_volume_ramp(pull->shm, volume_scaler, ramp_frames);
+	return 0;
+}
+
+/* Mutes or unmutes a pull playback stream, ramping over ramp_frames the same
+ * way as cras_client_stream_set_volume(). */
+static inline int cras_client_stream_set_mute(struct cras_pull_stream *pull,
+					      int mute,
+					      unsigned int ramp_frames)
+{
+	if (!cras_client_pull_stream_ready(pull))
+		return -EAGAIN;
+	cras_shm_set_mute_ramp(pull->shm, mute, ramp_frames);
+	return 0;
+}
+
 /* Removes a currently playing/capturing stream.
  * Args:
  *    client - Client to remove the stream (returned from cras_client_create).
@@ -378,6 +621,21 @@ int cras_client_set_stream_volume(struct cras_client *client,
 				  cras_stream_id_t stream_id,
 				  float volume_scaler);
 
+/* Sets the volume scaling factor for the given stream, the server ramps from
+ * the current volume to the new one. Pull streams can do the same without
+ * waking the client thread with cras_client_stream_set_volume().
+ * Args:
+ *    client - Client owning the stream.
+ *    stream_id - ID returned from cras_client_add_stream.
+ *    volume_scaler - 0.0-1.0 the new value to scale this stream by.
+ *    ramp_frames - Number of frames, at the stream's rate, the change is
+ *        spread over. Zero changes the volume at once.
+ */
+int cras_client_set_stream_volume_ramp(struct cras_client *client,
+				       cras_stream_id_t stream_id,
+				       float volume_scaler,
+				       unsigned int ramp_frames);
+
 /*
  * System level functions.
  */
@@ -544,6 +802,42 @@ long cras_client_get_system_max_capture_gain(struct cras_client *client);
 const struct audio_debug_info *cras_client_get_audio_debug_info(
 		struct cras_client *client);
 
+/* Gets dsp debug info.
+ * Args:
+ *    client - The client from cras_client_create.
+ * Returns:
+ *    A pointer to the dsp statistics.  This info is only updated when
+ *    requested by calling cras_client_update_dsp_debug_info.
+ */
+const struct dsp_debug_info *cras_client_get_dsp_debug_info(
+		struct cras_client *client);
+
+/* Gets the stream latency statistics.
+ * Args:
+ *    client - The client from cras_client_create.
+ * Returns:
+ *    A pointer to the statistics.  This info is only updated when requested
+ *    by calling cras_client_update_stream_latency_info.
+ */
+const struct stream_latency_info *cras_client_get_stream_latency_info(
+		struct cras_client *client);
+
+/* Waits for the server state to change, e.g. the device or node lists, instead
+ * of polling for it. The server updates the state at most once per pass of its
+ * main loop and wakes the waiters once.
+ * Args:
+ *    client - The client from cras_client_create.
+ *    update_count - The count from the previous call, 0 the first time. Filled
+ *        with the count of the state that was found.
+ *    timeout - Longest time to wait, NULL to wait until the state changes.
+ * Returns:
+ *    0 if the state changed since update_count, -ETIMEDOUT, or -EINVAL if the
+ *    client isn't connected.
+ */
+int cras_client_wait_for_server_state_change(struct cras_client *client,
+					     unsigned int *update_count,
+					     const struct timespec *timeout);
+
 /* Gets the number of streams currently attached to the server.  This is the
  * total number of capture and playback streams.  If the ts argument is
  * not null, then it will be filled with the last time audio was played or
@@ -44,6 +44,7 @@ enum AUDIO_THREAD_COMMAND {
 	AUDIO_THREAD_RM_STREAM,
 	AUDIO_THREAD_STOP,
 	AUDIO_THREAD_DUMP_THREAD_INFO,
+	AUDIO_THREAD_DUMP_STREAM_LATENCY,
 	AUDIO_THREAD_METRICS_LOG,
 };
 
@@ -73,6 +74,11 @@ struct audio_thread_dump_debug_info_msg {
 	struct audio_debug_info *info;
 };
 
+struct audio_thread_dump_stream_latency_msg {
+	struct audio_thread_msg header;
+	struct stream_latency_info *info;
+};
+
 struct audio_thread_metrics_log_msg {
 	struct audio_thread_msg header;
 	enum AUDIO_THREAD_METRICS_TYPE type;
@@ -98,6 +104,7 @@ struct iodev_callback_list {
 
 static void enable_loopback(struct audio_thread *thread);
 static void disable_loopback_if_unused(struct audio_thread *thread);
+static void update_loopback_tap(struct audio_thread *thread);
 
 static void _audio_thread_add_callback(int fd, thread_callback cb,
 				       void *data, int is_write)
@@ -280,6 +287,97 @@ static void update_stream_timeout(struct cras_audio_shm *shm)
 		cras_shm_set_longest_timeout(shm, timeout_msec);
 }
 
+/* Adds a time in microseconds to a latency histogram. */
+static void latency_histogram_add(struct latency_histogram *h,
+				  unsigned int us)
+{
+	unsigned int bucket = 0;
+
+	if (us)
+		bucket = MIN(31 - __builtin_clz(us),
+			     LATENCY_HISTOGRAM_BUCKETS - 1);
+	h->buckets[bucket]++;
+	h->count++;
+	h->total_us += us;
+	if (us > h->max_us)
+		h->max_us = us;
+}
+
+/* Returns the time from beg to end in microseconds, 0 if end isn't after
+ * beg. */
+static unsigned int elapsed_us(const struct timespec *end,
+			       const struct timespec *beg)
+{
+	struct timespec diff;
+	uint64_t us;
+
+	if (!timespec_after(end, beg))
+		return 0;
+	subtract_timespecs(end, beg, &diff);
+	us = (uint64_t)diff.tv_sec * 1000000 + diff.tv_nsec / 1000;
+	return MIN(us, UINT32_MAX);
+}
+
+static inline unsigned int frames_to_us(unsigned int frames,
+					unsigned int rate)
+{
+	return (uint64_t)frames * 1000000 / rate;
+}
+
+/* Records the latency of an output stream that is about to be asked for
+ * samples.
+ * Args:
+ *    rstream - The stream.
+ *    now - The current time.
+ *    next_cb_ts - When the stream was due to be asked.
+ *    queued_us - Time left to play the samples queued in the stream and the
+ *        device, which is also how long the client has to answer.
+ */
+static void log_fetch_latency(struct cras_rstream *rstream,
+			      const struct timespec *now,
+			      const struct timespec *next_cb_ts,
+			      unsigned int queued_us)
+{
+	struct timespec *fetch_ts = &rstream->fetch_ts;
+
+	/* The last request is still unanswered and the device ran out. */
+	if ((fetch_ts->tv_sec || fetch_ts->tv_nsec) &&
+	    elapsed_us(now, fetch_ts) > rstream->fetch_budget_us)
+		rstream->num_underruns++;
+
+	latency_histogram_add(&rstream->latency, queued_us);
+	latency_histogram_add(&rstream->cb_lateness,
+			      elapsed_us(now, next_cb_ts));
+
+	/* No request is sent when the client's buffer is full. */
+	if (cras_shm_is_buffer_available(cras_rstream_output_shm(rstream))) {
+		*fetch_ts = *now;
+		rstream->fetch_budget_us = queued_us;
+	} else {
+		fetch_ts->tv_sec = 0;
+		fetch_ts->tv_nsec = 0;
+	}
+}
+
+/* Records the time the client of an output stream took to answer the last
+ * request for samples. */
+static void log_data_ready(struct cras_rstream *rstream)
+{
+	struct timespec now;
+	unsigned int us;
+
+	if (!rstream->fetch_ts.tv_sec && !rstream->fetch_ts.tv_nsec)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	us = elapsed_us(&now, &rstream->fetch_ts);
+	latency_histogram_add(&rstream->fetch_to_ready, us);
+	if (us > rstream->fetch_budget_us)
+		rstream->num_underruns++;
+	rstream->fetch_ts.tv_sec = 0;
+	rstream->fetch_ts.tv_nsec = 0;
+}
+
 /* Gets the first active device for given direction. */
 static inline
 struct cras_iodev *first_active_device(const struct audio_thread *thread,
@@ -358,14 +456,32 @@ static void fill_odevs_zeros_min_level(struct active_dev *adev)
 	fill_odev_zeros(adev, adev->dev->min_buffer_level);
 }
 
+/* Takes an output device out of standby for a new stream.  The device is
+ * still configured, it only needs the pre buffer a newly opened device gets.
+ */
+static void leave_standby(struct active_dev *adev)
+{
+	struct cras_iodev *dev = adev->dev;
+
+	dev->is_standby = 0;
+	dev->min_cb_level = dev->buffer_size;
+	dev->max_cb_level = 0;
+	audio_thread_event_log_data(atlog, AUDIO_THREAD_DEV_STANDBY,
+				    dev->info.idx, 0, 0);
+	fill_odevs_zeros_min_level(adev);
+}
+
 /* Open the device potentially filling the output with a pre buffer. */
 static int init_device(struct active_dev *adev)
 {
 	int rc;
 	struct cras_iodev *dev = adev->dev;
 
-	if (device_open(dev))
+	if (device_open(dev)) {
+		if (dev->is_standby)
+			leave_standby(adev);
 		return 0;
+	}
 
 	rc = cras_iodev_open(dev);
 	if (rc < 0)
@@ -673,6 +789,78 @@ static void disable_fallback_dev(struct audio_thread *thread,
 	DL_DELETE(thread->active_devs[dir], fallback_dev);
 }
 
+/* Puts an output device that has been drained in standby.  It stays open
+ * until the standby time is over, so a new stream can start playing without
+ * waiting for the device to be opened and configured.
+ * Returns:
+ *    0 if the device is in standby, negative error code if it should be
+ *    closed instead.
+ */
+static int enter_standby(struct audio_thread *thread,
+			 struct active_dev *adev)
+{
+	struct cras_iodev *odev = adev->dev;
+	struct timespec standby_ts;
+	int rc;
+
+	if (!thread->standby_ms)
+		return -EINVAL;
+
+	rc = cras_iodev_standby(odev);
+	if (rc < 0)
+		return rc;
+
+	standby_ts.tv_sec = thread->standby_ms / 1000;
+	standby_ts.tv_nsec = (thread->standby_ms % 1000) * 1000000;
+	clock_gettime(CLOCK_MONOTONIC, &odev->standby_deadline);
+	add_timespecs(&odev->standby_deadline, &standby_ts);
+	adev->wake_ts = odev->standby_deadline;
+
+	audio_thread_event_log_data(atlog, AUDIO_THREAD_DEV_STANDBY,
+				    odev->info.idx, 1, 0);
+	return 0;
+}
+
+/* Opens an output device straight into standby, so the first stream played
+ * after boot doesn't wait for the default output to be configured.  The
+ * format is what most streams use, a stream that asks for another one is
+ * converted as it would be when joining a running device. */
+static void prewarm_output(struct audio_thread *thread,
+			   struct active_dev *adev)
+{
+	struct cras_iodev *dev = adev->dev;
+	struct cras_audio_format fmt;
+	unsigned int i;
+	int rc;
+
+	thread->prewarm_pending = 0;
+
+	if (!thread->standby_ms || !dev->standby_dev || device_open(dev))
+		return;
+
+	fmt.format = SND_PCM_FORMAT_S16_LE;
+	fmt.frame_rate = 48000;
+	fmt.num_channels = 2;
+	for (i = 0; i < CRAS_CH_MAX; i++)
+		fmt.channel_layout[i] = (i < fmt.num_channels) ? i : -1;
+
+	rc = cras_iodev_set_format(dev, &fmt);
+	if (rc)
+		return;
+
+	rc = cras_iodev_open(dev);
+	if (rc < 0) {
+		syslog(LOG_ERR, "Failed to pre-warm %s: %d", dev->info.name, rc);
+		cras_iodev_free_format(dev);
+		return;
+	}
+	dev->min_cb_level = dev->buffer_size;
+	dev->max_cb_level = 0;
+
+	if (enter_standby(thread, adev))
+		cras_iodev_close(dev);
+}
+
 /* Handles messages from main thread to add a new active device. */
 static int thread_add_active_dev(struct audio_thread *thread,
 				 struct cras_iodev *iodev)
@@ -710,6 +898,12 @@ static int thread_add_active_dev(struct audio_thread *thread,
 
 	DL_APPEND(thread->active_devs[iodev->direction], adev);
 
+	if (iodev->direction == CRAS_STREAM_OUTPUT) {
+		update_loopback_tap(thread);
+		if (thread->prewarm_pending)
+			prewarm_output(thread, adev);
+	}
+
 	return 0;
 }
 
@@ -749,6 +943,9 @@ static void thread_rm_active_adev(struct audio_thread *thread,
 	if (thread->active_devs[dir] == NULL)
 		enable_fallback_dev(thread, dir);
 
+	if (dir == CRAS_STREAM_OUTPUT)
+		update_loopback_tap(thread);
+
 	DL_FOREACH(dev_to_rm->dev->streams, dev_stream) {
 		cras_iodev_rm_stream(dev_to_rm->dev, dev_stream->stream);
 		dev_stream_destroy(dev_stream);
@@ -864,8 +1061,9 @@ static int thread_add_stream(struct audio_thread *thread,
 }
 
 /* Reads any pending audio message from the socket. */
-static void flush_old_aud_messages(struct cras_audio_shm *shm, int fd)
+static void flush_old_aud_messages(struct cras_rstream *rstream, int fd)
 {
+	struct cras_audio_shm *shm = cras_rstream_output_shm(rstream);
 	struct audio_message msg;
 	struct pollfd pollfd;
 	int err;
@@ -877,6 +1075,9 @@ static void flush_old_aud_messages(struct cras_audio_shm *shm, int fd)
 		err = poll(&pollfd, 1, 0);
 		if (pollfd.revents & POLLIN) {
 			err = read(fd, &msg, sizeof(msg));
+			if (err == sizeof(msg) &&
+			    msg.id == AUDIO_MESSAGE_DATA_READY)
+				log_data_ready(rstream);
 			cras_shm_set_callback_pending(shm, 0);
 		}
 	} while (err > 0);
@@ -909,10 +1110,10 @@ static int fetch_streams(struct audio_thread *thread,
 			cras_rstream_output_shm(rstream);
 		int fd = cras_rstream_get_audio_fd(rstream);
 		const struct timespec *next_cb_ts;
-		struct timespec now;
+		struct timespec now, wake_ts;
 
 		if (cras_shm_callback_pending(shm) && fd >= 0)
-			flush_old_aud_messages(shm, fd);
+			flush_old_aud_messages(rstream, fd);
 
 		frames_in_buff = cras_shm_get_frames(shm);
 		if (frames_in_buff < 0) {
@@ -927,11 +1128,17 @@ static int fetch_streams(struct audio_thread *thread,
 		/* Check if it's time to get more data from this stream.
 		 * Allowing for waking up half a little early. */
 		clock_gettime(CLOCK_MONOTONIC, &now);
-		add_timespecs(&now, &playback_wake_fuzz_ts);
-		if (!timespec_after(&now, next_cb_ts))
+		wake_ts = now;
+		add_timespecs(&wake_ts, &playback_wake_fuzz_ts);
+		if (!timespec_after(&wake_ts, next_cb_ts))
 			continue;
 
 		dev_stream_set_delay(dev_stream, delay);
+		log_fetch_latency(
+			rstream, &now, next_cb_ts,
+			frames_to_us(delay, odev->ext_format->frame_rate) +
+			frames_to_us(frames_in_buff,
+				     rstream->format.frame_rate));
 
 		rc = fetch_stream(dev_stream, frames_in_buff, delay);
 		if (rc < 0) {
@@ -1116,6 +1323,42 @@ static void append_stream_dump_info(struct audio_debug_info *info,
 	longest_wake.tv_nsec = 0;
 }
 
+/* Copies the latency statistics of the streams attached to the devices in
+ * adev_list, skipping the streams already copied from another device. */
+static void append_stream_latency(struct stream_latency_info *info,
+				  struct active_dev *adev_list)
+{
+	struct active_dev *adev;
+	struct dev_stream *curr;
+	struct cras_rstream *rstream;
+	struct stream_latency_debug_info *si;
+	unsigned int i;
+
+	DL_FOREACH(adev_list, adev) {
+		DL_FOREACH(adev->dev->streams, curr) {
+			rstream = curr->stream;
+			for (i = 0; i < info->num_streams; i++)
+				if (info->streams[i].stream_id ==
+				    rstream->stream_id)
+					break;
+			if (i < info->num_streams)
+				continue;
+			if (info->num_streams == MAX_DEBUG_STREAMS)
+				return;
+
+			si = &info->streams[info->num_streams++];
+			si->stream_id = rstream->stream_id;
+			si->direction = rstream->direction;
+			si->frame_rate = rstream->format.frame_rate;
+			si->cb_threshold = rstream->cb_threshold;
+			si->num_underruns = rstream->num_underruns;
+			si->latency = rstream->latency;
+			si->cb_lateness = rstream->cb_lateness;
+			si->fetch_to_ready = rstream->fetch_to_ready;
+		}
+	}
+}
+
 /* Handle a message sent to the playback thread */
 static int handle_playback_thread_message(struct audio_thread *thread)
 {
@@ -1189,11 +1432,17 @@ static int handle_playback_thread_message(struct audio_thread *thread)
 			info->output_buffer_size = odev->buffer_size;
 			info->output_used_size = 0;
 			info->output_cb_threshold = 0;
+			info->output_bt_bitpool = 0;
+			info->output_bt_queued_bytes = 0;
+			if (odev->fill_debug_info)
+				odev->fill_debug_info(odev, info);
 		} else {
 			info->output_dev_name[0] = '\0';
 			info->output_buffer_size = 0;
 			info->output_used_size = 0;
 			info->output_cb_threshold = 0;
+			info->output_bt_bitpool = 0;
+			info->output_bt_queued_bytes = 0;
 		}
 		if (idev) {
 			strncpy(info->input_dev_name, idev->info.name,
@@ -1225,6 +1474,18 @@ static int handle_playback_thread_message(struct audio_thread *thread)
 		memcpy(&info->log, atlog, sizeof(info->log));
 		break;
 	}
+	case AUDIO_THREAD_DUMP_STREAM_LATENCY: {
+		struct audio_thread_dump_stream_latency_msg *lmsg;
+
+		ret = 0;
+		lmsg = (struct audio_thread_dump_stream_latency_msg *)msg;
+		lmsg->info->num_streams = 0;
+		append_stream_latency(lmsg->info,
+				      thread->active_devs[CRAS_STREAM_OUTPUT]);
+		append_stream_latency(lmsg->info,
+				      thread->active_devs[CRAS_STREAM_INPUT]);
+		break;
+	}
 	default:
 		ret = -EINVAL;
 		break;
@@ -1285,8 +1546,10 @@ static int get_next_dev_wake(struct audio_thread *thread,
 	int ret = 0; /* The total number of devices to wait on. */
 
 	DL_FOREACH(thread->active_devs[CRAS_STREAM_OUTPUT], adev) {
-		/* Only wake up for devices when they finish draining. */
-		if (!device_open(adev->dev) || !adev->dev->is_draining)
+		/* Only wake up for devices when they finish draining, or to
+		 * close them when their standby time is over. */
+		if (!device_open(adev->dev) ||
+		    !(adev->dev->is_draining || adev->dev->is_standby))
 			continue;
 		ret++;
 		audio_thread_event_log_data(atlog,
@@ -1316,9 +1579,10 @@ static int get_next_dev_wake(struct audio_thread *thread,
 
 /* Drain the hardware buffer of odev.
  * Args:
+ *    thread - The thread the device is active on.
  *    odev - the output device to be drainned.
  */
-int drain_output_buffer(struct active_dev *adev)
+int drain_output_buffer(struct audio_thread *thread, struct active_dev *adev)
 {
 	int hw_level;
 	int filled_count;
@@ -1339,9 +1603,11 @@ int drain_output_buffer(struct active_dev *adev)
 				    odev->extra_silent_frames);
 
 	if ((int)odev->extra_silent_frames >= hw_level) {
-		/* Remaining audio has been played out. Close the device. */
-		cras_iodev_close(odev);
+		/* Remaining audio has been played out. Keep the device in
+		 * standby for the next stream, or close it. */
 		odev->is_draining = 0;
+		if (enter_standby(thread, adev))
+			cras_iodev_close(odev);
 		return 0;
 	}
 
@@ -1369,6 +1635,11 @@ static void set_odev_wake_times(struct active_dev *dev_list)
 		if (!device_open(adev->dev))
 			continue;
 
+		if (adev->dev->is_standby) {
+			adev->wake_ts = adev->dev->standby_deadline;
+			continue;
+		}
+
 		hw_level = adev->dev->frames_queued(adev->dev);
 		if (hw_level < 0)
 			return;
@@ -1452,7 +1723,20 @@ static int write_output_samples(struct audio_thread *thread,
 	struct cras_audio_area *area = NULL;
 
 	if (odev->is_draining)
-		return drain_output_buffer(adev);
+		return drain_output_buffer(thread, adev);
+
+	if (odev->is_standby) {
+		struct timespec now;
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (!timespec_after(&odev->standby_deadline, &now)) {
+			audio_thread_event_log_data(atlog,
+						    AUDIO_THREAD_DEV_STANDBY,
+						    odev->info.idx, 0, 0);
+			cras_iodev_close(odev);
+		}
+		return 0;
+	}
 
 	rc = odev->frames_queued(odev);
 	if (rc < 0)
@@ -1476,7 +1760,8 @@ static int write_output_samples(struct audio_thread *thread,
 
 	/* Have to loop writing to the device, will be at most 2 loops, this
 	 * only happens when the circular buffer is at the end and returns us a
-	 * partial area to write to from mmap_begin */
+	 * partial area to write to from mmap_begin. Devices with a mirrored
+	 * buffer, a2dp and hfp, return the whole area at once. */
 	while (total_written < fr_to_req) {
 		frames = fr_to_req - total_written;
 		rc = cras_iodev_get_output_buffer(odev, &area, &frames);
@@ -1575,6 +1860,11 @@ static unsigned int get_stream_limit_set_delay(struct active_dev *adev,
 		shm = cras_rstream_input_shm(rstream);
 		cras_shm_check_write_overrun(shm);
 		dev_stream_set_delay(stream, delay);
+		latency_histogram_add(
+			&rstream->latency,
+			frames_to_us(delay, adev->dev->ext_format->frame_rate) +
+			frames_to_us(cras_shm_frames_written(shm),
+				     rstream->format.frame_rate));
 		write_limit = MIN(write_limit,
 				  dev_stream_capture_avail(stream, &needed));
 		min_needed = MIN(min_needed, needed);
@@ -1917,20 +2207,43 @@ static int audio_thread_metrics_log(struct audio_thread_msg *msg)
 	return 0;
 }
 
+/* Points the loopback tap at the output device the system is playing to, the
+ * first active one not only used by pinned streams. */
+static void update_loopback_tap(struct audio_thread *thread)
+{
+	struct active_dev *adev;
+	struct cras_iodev *odev = NULL;
+
+	if (!thread->loopback_dev)
+		return;
+
+	if (thread->loopback_enabled) {
+		DL_FOREACH(thread->active_devs[CRAS_STREAM_OUTPUT], adev) {
+			if (!adev->for_pinned_streams) {
+				odev = adev->dev;
+				break;
+			}
+		}
+		if (!odev)
+			odev = first_output_dev(thread);
+	}
+	loopback_iodev_set_tap(thread->loopback_dev, odev);
+}
+
 /* Enables loopback device if loopback capture stream is connected. */
 static void enable_loopback(struct audio_thread *thread)
 {
-	thread_add_active_dev(thread,
-			      thread->loopback_devs[CRAS_STREAM_OUTPUT]);
+	thread->loopback_enabled = 1;
+	update_loopback_tap(thread);
 }
 
 /* Disables loopback device when no loopback capture streams. */
 static void disable_loopback_if_unused(struct audio_thread *thread)
 {
-	if (!thread->loopback_devs[CRAS_STREAM_INPUT]->streams)
-		thread_rm_active_dev(thread,
-				     thread->loopback_devs[CRAS_STREAM_OUTPUT],
-				     0);
+	if (thread->loopback_dev->streams)
+		return;
+	thread->loopback_enabled = 0;
+	update_loopback_tap(thread);
 }
 
 /* Exported Interface */
@@ -1977,6 +2290,17 @@ int audio_thread_dump_thread_info(struct audio_thread *thread,
 	return audio_thread_post_message(thread, &msg.header);
 }
 
+int audio_thread_dump_stream_latency(struct audio_thread *thread,
+				     struct stream_latency_info *info)
+{
+	struct audio_thread_dump_stream_latency_msg msg;
+
+	msg.header.id = AUDIO_THREAD_DUMP_STREAM_LATENCY;
+	msg.header.length = sizeof(msg);
+	msg.info = info;
+	return audio_thread_post_message(thread, &msg.header);
+}
+
 /* Process all kinds of queued messages post from audio thread. Called by
  * main thread.
  * Args:
@@ -2041,17 +2365,8 @@ static void config_fallback_dev(struct audio_thread *thread,
 	fallback_dev->is_active = 1;
 }
 
-static void config_loopback_dev(struct audio_thread *thread,
-				struct cras_iodev *loopback_dev)
-{
-	enum CRAS_STREAM_DIRECTION dir = loopback_dev->direction;
-
-	thread->loopback_devs[dir] = loopback_dev;
-}
-
 struct audio_thread *audio_thread_create(struct cras_iodev *fallback_output,
 					 struct cras_iodev *fallback_input,
-					 struct cras_iodev *loopback_output,
 					 struct cras_iodev *loopback_input)
 {
 	int rc;
@@ -2070,8 +2385,7 @@ struct audio_thread *audio_thread_create(struct cras_iodev *fallback_output,
 
 	config_fallback_dev(thread, fallback_output);
 	config_fallback_dev(thread, fallback_input);
-	config_loopback_dev(thread, loopback_output);
-	config_loopback_dev(thread, loopback_input);
+	thread->loopback_dev = loopback_input;
 
 	/* Two way pipes for communication with the device's audio thread. */
 	rc = pipe(thread->to_thread_fds);
@@ -2134,6 +2448,14 @@ int audio_thread_rm_active_dev(struct audio_thread *thread,
 	return audio_thread_post_message(thread, &msg.header);
 }
 
+void audio_thread_set_output_standby(struct audio_thread *thread,
+				     unsigned int standby_ms,
+				     int prewarm)
+{
+	thread->standby_ms = standby_ms;
+	thread->prewarm_pending = prewarm;
+}
+
 int audio_thread_start(struct audio_thread *thread)
 {
 	int rc;
@@ -2162,6 +2484,8 @@ void audio_thread_destroy(struct audio_thread *thread)
 		pthread_join(thread->tid, NULL);
 	}
 
+	thread->loopback_enabled = 0;
+	update_loopback_tap(thread);
 	thread_clear_active_devs(thread, CRAS_STREAM_OUTPUT);
 	thread_clear_active_devs(thread, CRAS_STREAM_INPUT);
 	thread_clear_active_devs(thread, CRAS_STREAM_POST_MIX_PRE_DSP);
@@ -38,7 +38,13 @@ struct active_dev {
  *    active_devs - Lists of active devices attached running for each
  *        CRAS_STREAM_DIRECTION.
  *    fallback_devs - One fallback device per direction (empty_iodev).
- *    loopback_devs - Keep loopback input and output devices (loopback_iodev).
+ *    loopback_dev - The loopback record device (loopback_iodev).
+ *    loopback_enabled - True while the loopback device is fed from a tap on
+ *        the first active output device.
+ *    standby_ms - How long a drained output device is kept open in standby
+ *        before it is closed, 0 to close it right away.
+ *    prewarm_pending - Open the next output device that becomes active in
+ *        standby, without waiting for a stream.
  */
 struct audio_thread {
 	int to_thread_fds[2];
@@ -48,8 +54,10 @@ struct audio_thread {
 	int started;
 	struct active_dev *active_devs[CRAS_NUM_DIRECTIONS];
 	struct active_dev *fallback_devs[CRAS_NUM_DIRECTIONS];
-	struct cras_iodev *loopback_devs[CRAS_NUM_DIRECTIONS];
-
+	struct cras_iodev *loopback_dev;
+	int loopback_enabled;
+	unsigned int standby_ms;
+	int prewarm_pending;
 };
 
 /* Callback function to be handled in main loop in audio thread.
@@ -62,7 +70,6 @@ typedef int (*thread_callback)(void *data);
  * Args:
  *    fallback_output - A device to play to when no output is active.
  *    fallback_input - A device to record from when no input is active.
- *    loopback_output - A device that keeps track of what the system is playing.
  *    loopback_input - A device to record what the system is playing.
  * Returns:
  *    A pointer to the newly create audio thread.  It must be freed by calling
@@ -70,7 +77,6 @@ typedef int (*thread_callback)(void *data);
  */
 struct audio_thread *audio_thread_create(struct cras_iodev *fallback_output,
 					 struct cras_iodev *fallback_input,
-					 struct cras_iodev *loopback_output,
 					 struct cras_iodev *loopback_input);
 
 /* Adds an active device.
@@ -120,6 +126,19 @@ void audio_thread_rm_callback(int fd);
 /* Enables or Disabled the callback associated with fd. */
 void audio_thread_enable_callback(int fd, int enabled);
 
+/* Configures the standby of output devices.  Must be called before
+ * audio_thread_start.
+ * Args:
+ *    thread - The thread to configure.
+ *    standby_ms - How long to keep an output device open and prepared after
+ *        its last stream is removed, 0 to close it once drained.
+ *    prewarm - Non-zero to open the first output device that becomes active
+ *        in standby, so the first stream doesn't wait for it to be opened.
+ */
+void audio_thread_set_output_standby(struct audio_thread *thread,
+				     unsigned int standby_ms,
+				     int prewarm);
+
 /* Starts a thread created with audio_thread_create.
  * Args:
  *    thread - The thread to start.
@@ -160,4 +179,14 @@ int audio_thread_disconnect_stream(struct audio_thread *thread,
 int audio_thread_dump_thread_info(struct audio_thread *thread,
 				  struct audio_debug_info *info);
 
+/* Copies the latency statistics of the attached streams.
+ * Args:
+ *    thread - a pointer to the audio thread.
+ *    info - Filled with the statistics of up to MAX_DEBUG_STREAMS streams.
+ * Returns:
+ *    0 on success, negative error code on failure.
+ */
+int audio_thread_dump_stream_latency(struct audio_thread *thread,
+				     struct stream_latency_info *info);
+
 #endif /* AUDIO_THREAD_H_ */
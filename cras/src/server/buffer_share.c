@@ -9,43 +9,176 @@
 #include "cras_types.h"
 #include "buffer_share.h"
 
-static inline struct id_offset *find_unused(const struct buffer_share *mix)
+/*
+ * Hash from id to slot.  Linear probing, entries are shifted back on removal
+ * so lookups stop at the first empty entry.
+ */
+
+static inline unsigned int id_hash(const struct buffer_share *mix,
+				   unsigned int id)
 {
-	unsigned int i;
+	unsigned int h = id * 0x9e3779b1;
+
+	return (h ^ (h >> 16)) & (mix->map_sz - 1);
+}
 
-	for (i = 0; i < mix->id_sz; i++) {
-		if (!mix->wr_idx[i].used)
-			return &mix->wr_idx[i];
+static inline unsigned int map_find(const struct buffer_share *mix,
+				    unsigned int id)
+{
+	unsigned int i = id_hash(mix, id);
+
+	while (mix->id_map[i]) {
+		if (mix->wr_idx[mix->id_map[i] - 1].id == id)
+			return i;
+		i = (i + 1) & (mix->map_sz - 1);
 	}
+	return i;
+}
 
-	return NULL;
+static void map_insert(struct buffer_share *mix, unsigned int slot)
+{
+	unsigned int i = map_find(mix, mix->wr_idx[slot].id);
+
+	mix->id_map[i] = slot + 1;
 }
 
+static void map_remove(struct buffer_share *mix, unsigned int i)
+{
+	unsigned int mask = mix->map_sz - 1;
+	unsigned int j = i;
+	unsigned int home;
+
+	mix->id_map[i] = 0;
+	for (j = (j + 1) & mask; mix->id_map[j]; j = (j + 1) & mask) {
+		home = id_hash(mix, mix->wr_idx[mix->id_map[j] - 1].id);
+		/* Leave the entry if its home is cyclically in (i, j]. */
+		if (i <= j ? (i < home && home <= j) : (i < home || home <= j))
+			continue;
+		mix->id_map[i] = mix->id_map[j];
+		mix->id_map[j] = 0;
+		i = j;
+	}
+}
 
 static inline struct id_offset *find_id(const struct buffer_share *mix,
 					unsigned int id)
 {
-	unsigned int i;
+	unsigned int slot = mix->id_map[map_find(mix, id)];
+
+	return slot ? &mix->wr_idx[slot - 1] : NULL;
+}
+
+/*
+ * Min-heap of the used slots keyed by offset.  All offsets move together
+ * when the write point advances, so the order only changes on update.
+ */
+
+static inline unsigned int heap_key(const struct buffer_share *mix,
+				    unsigned int heap_idx)
+{
+	return mix->wr_idx[mix->heap[heap_idx]].written - mix->base;
+}
+
+static inline void heap_set(struct buffer_share *mix, unsigned int heap_idx,
+			    unsigned int slot)
+{
+	mix->heap[heap_idx] = slot;
+	mix->wr_idx[slot].heap_idx = heap_idx;
+}
 
-	for (i = 0; i < mix->id_sz; i++) {
-		if (mix->wr_idx[i].used && id == mix->wr_idx[i].id)
-			return &mix->wr_idx[i];
+static void heap_sift_up(struct buffer_share *mix, unsigned int i)
+{
+	unsigned int slot = mix->heap[i];
+	unsigned int key = mix->wr_idx[slot].written - mix->base;
+	unsigned int parent;
+
+	while (i > 0) {
+		parent = (i - 1) / 2;
+		if (heap_key(mix, parent) <= key)
+			break;
+		heap_set(mix, i, mix->heap[parent]);
+		i = parent;
 	}
+	heap_set(mix, i, slot);
+}
 
-	return NULL;
+static void heap_sift_down(struct buffer_share *mix, unsigned int i)
+{
+	unsigned int slot = mix->heap[i];
+	unsigned int key = mix->wr_idx[slot].written - mix->base;
+	unsigned int child;
+
+	while ((child = 2 * i + 1) < mix->num_used) {
+		if (child + 1 < mix->num_used &&
+		    heap_key(mix, child + 1) < heap_key(mix, child))
+			child++;
+		if (key <= heap_key(mix, child))
+			break;
+		heap_set(mix, i, mix->heap[child]);
+		i = child;
+	}
+	heap_set(mix, i, slot);
 }
 
-static void alloc_more_ids(struct buffer_share *mix)
+static void heap_remove(struct buffer_share *mix, unsigned int i)
 {
-	unsigned int new_size = mix->id_sz * 2;
-	unsigned int i;
+	unsigned int last = --mix->num_used;
+	unsigned int key;
+
+	if (i == last)
+		return;
+
+	key = heap_key(mix, i);
+	heap_set(mix, i, mix->heap[last]);
+	if (heap_key(mix, i) < key)
+		heap_sift_up(mix, i);
+	else
+		heap_sift_down(mix, i);
+}
 
-	mix->wr_idx = realloc(mix->wr_idx, sizeof(mix->wr_idx[0]) * new_size);
+static void free_slots_from(struct buffer_share *mix, unsigned int first)
+{
+	unsigned int i;
 
-	for (i = mix->id_sz; i < new_size; i++)
+	for (i = first; i < mix->id_sz; i++) {
 		mix->wr_idx[i].used = 0;
+		mix->wr_idx[i].next_free = i + 1 < mix->id_sz ? i + 2 : 0;
+	}
+	mix->first_free = first + 1;
+}
 
+static int alloc_ids(struct buffer_share *mix, unsigned int new_size)
+{
+	struct id_offset *wr_idx;
+	unsigned int *heap, *id_map;
+	unsigned int map_sz = 1;
+	unsigned int i, old_size = mix->id_sz;
+
+	while (map_sz < new_size * 2)
+		map_sz *= 2;
+
+	wr_idx = realloc(mix->wr_idx, sizeof(*wr_idx) * new_size);
+	if (!wr_idx)
+		return -ENOMEM;
+	mix->wr_idx = wr_idx;
+	heap = realloc(mix->heap, sizeof(*heap) * new_size);
+	if (!heap)
+		return -ENOMEM;
+	mix->heap = heap;
+	id_map = calloc(map_sz, sizeof(*id_map));
+	if (!id_map)
+		return -ENOMEM;
+
+	free(mix->id_map);
+	mix->id_map = id_map;
+	mix->map_sz = map_sz;
 	mix->id_sz = new_size;
+	free_slots_from(mix, old_size);
+
+	for (i = 0; i < old_size; i++)
+		if (mix->wr_idx[i].used)
+			map_insert(mix, i);
+	return 0;
 }
 
 struct buffer_share *buffer_share_create(unsigned int buf_sz)
@@ -53,9 +186,13 @@ struct buffer_share *buffer_share_create(unsigned int buf_sz)
 	struct buffer_share *mix;
 
 	mix = calloc(1, sizeof(*mix));
-	mix->id_sz = INITIAL_ID_SIZE;
-	mix->wr_idx = calloc(mix->id_sz, sizeof(mix->wr_idx[0]));
+	if (!mix)
+		return NULL;
 	mix->buf_sz = buf_sz;
+	if (alloc_ids(mix, INITIAL_ID_SIZE)) {
+		buffer_share_destroy(mix);
+		return NULL;
+	}
 
 	return mix;
 }
@@ -65,39 +202,58 @@ void buffer_share_destroy(struct buffer_share *mix)
 	if (!mix)
 		return;
 	free(mix->wr_idx);
+	free(mix->heap);
+	free(mix->id_map);
 	free(mix);
 }
 
 int buffer_share_add_id(struct buffer_share *mix, unsigned int id, void *data)
 {
 	struct id_offset *o;
+	unsigned int slot;
+	int rc;
 
 	o = find_id(mix, id);
 	if (o)
 		return -EEXIST;
 
-	o = find_unused(mix);
-	if (!o)
-		alloc_more_ids(mix);
+	if (!mix->first_free) {
+		rc = alloc_ids(mix, mix->id_sz * 2);
+		if (rc)
+			return rc;
+	}
 
-	o = find_unused(mix);
+	slot = mix->first_free - 1;
+	o = &mix->wr_idx[slot];
+	mix->first_free = o->next_free;
 	o->used = 1;
 	o->id = id;
-	o->offset = 0;
+	o->written = mix->base;
 	o->data = data;
+	map_insert(mix, slot);
+
+	heap_set(mix, mix->num_used++, slot);
+	heap_sift_up(mix, o->heap_idx);
 
 	return 0;
 }
 
 int buffer_share_rm_id(struct buffer_share *mix, unsigned int id)
 {
+	unsigned int i = map_find(mix, id);
+	unsigned int slot = mix->id_map[i];
 	struct id_offset *o;
 
-	o = find_id(mix, id);
-	if (!o)
+	if (!slot)
 		return -ENOENT;
+	o = &mix->wr_idx[slot - 1];
+
+	map_remove(mix, i);
+	heap_remove(mix, o->heap_idx);
 	o->used = 0;
 	o->data = NULL;
+	o->next_free = mix->first_free;
+	mix->first_free = slot;
 
 	return 0;
 }
@@ -105,36 +261,26 @@ int buffer_share_rm_id(struct buffer_share *mix, unsigned int id)
 int buffer_share_offset_update(struct buffer_share *mix, unsigned int id,
 			       unsigned int delta)
 {
-	unsigned int i;
+	struct id_offset *o = find_id(mix, id);
 
-	for (i = 0; i < mix->id_sz; i++) {
-		if (id != mix->wr_idx[i].id)
-			continue;
+	if (!o)
+		return -ENOENT;
 
-		mix->wr_idx[i].offset += delta;
-		break;
-	}
+	o->written += delta;
+	heap_sift_down(mix, o->heap_idx);
 
 	return 0;
 }
 
 unsigned int buffer_share_get_new_write_point(struct buffer_share *mix)
 {
-	unsigned int min_written = mix->buf_sz + 1;
-	unsigned int i;
+	unsigned int min_written;
 
-	for (i = 0; i < mix->id_sz; i++) {
-		struct id_offset *o = &mix->wr_idx[i];
+	if (!mix->num_used)
+		return 0;
 
-		if (!o->used)
-			continue;
-
-		min_written = MIN(min_written, o->offset);
-	}
-	for (i = 0; i < mix->id_sz; i++) {
-		struct id_offset *o = &mix->wr_idx[i];
-		o->offset -= min_written;
-	}
+	min_written = heap_key(mix, 0);
+	mix->base += min_written;
 
 	if (min_written > mix->buf_sz)
 		return 0;
@@ -142,30 +288,16 @@ unsigned int buffer_share_get_new_write_point(struct buffer_share *mix)
 	return min_written;
 }
 
-static struct id_offset *get_id_offset(const struct buffer_share *mix,
-				       unsigned int id)
-{
-	unsigned int i;
-	struct id_offset *o;
-
-	for (i = 0; i < mix->id_sz; i++) {
-		o = &mix->wr_idx[i];
-		if (o->used && o->id == id)
-			return o;
-	}
-	return NULL;
-}
-
 unsigned int buffer_share_id_offset(const struct buffer_share *mix,
 				    unsigned int id)
 {
-	struct id_offset *o = get_id_offset(mix, id);
-	return o ? o->offset : 0;
+	struct id_offset *o = find_id(mix, id);
+	return o ? o->written - mix->base : 0;
 }
 
 void *buffer_share_get_data(const struct buffer_share *mix,
 			    unsigned int id)
 {
-	struct id_offset *o = get_id_offset(mix, id);
+	struct id_offset *o = find_id(mix, id);
 	return o ? o->data : NULL;
 }
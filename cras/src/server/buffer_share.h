@@ -8,17 +8,46 @@
 
 #define INITIAL_ID_SIZE 3
 
+/* Slot given to each id sharing the buffer.
+ *    used - Non-zero if an id has this slot.
+ *    id - The id using this slot.
+ *    written - Frames written by id, counted from the same origin as the
+ *        base of the buffer_share.  The offset of id is written - base.
+ *    heap_idx - Position of this slot in the offsets heap.
+ *    next_free - Index + 1 of the next unused slot, 0 at the end.
+ *    data - Data pointer given with the id.
+ */
 struct id_offset {
 	unsigned int used;
 	unsigned int id;
-	unsigned int offset;
+	unsigned int written;
+	unsigned int heap_idx;
+	unsigned int next_free;
 	void *data;
 };
 
+/* Members:
+ *    buf_sz - Size of the shared buffer in frames.
+ *    id_sz - Number of slots in wr_idx.
+ *    wr_idx - Slot table, ids keep their slot until removed.
+ *    base - Frames already consumed, the current write point.
+ *    num_used - Number of ids sharing the buffer.
+ *    first_free - Index + 1 of the first unused slot, 0 if all are used.
+ *    heap - Indexes of the used slots, a min-heap on their offsets so the
+ *        smallest is found without looking at every id.
+ *    map_sz - Size of id_map, a power of two at least twice id_sz.
+ *    id_map - Open addressed hash from id to slot index + 1, 0 if empty.
+ */
 struct buffer_share {
 	unsigned int buf_sz;
 	unsigned int id_sz;
 	struct id_offset *wr_idx;
+	unsigned int base;
+	unsigned int num_used;
+	unsigned int first_free;
+	unsigned int *heap;
+	unsigned int map_sz;
+	unsigned int *id_map;
 };
 
 /*
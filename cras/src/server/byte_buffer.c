@@ -0,0 +1,71 @@
+/* Copyright (c) 2015 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* for mremap */
+#endif
+#include <errno.h>
+#include <sys/mman.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "byte_buffer.h"
+
+uint8_t *byte_buffer_map_mirrored(size_t size)
+{
+	uint8_t *area, *mem, *mirror;
+
+	if (size == 0 || size % sysconf(_SC_PAGESIZE))
+		return NULL;
+
+	/* Reserve room for both mappings, so nothing else lands in between. */
+	area = (uint8_t *)mmap(NULL, 2 * size, PROT_NONE,
+			       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (area == MAP_FAILED)
+		goto error;
+
+	mem = (uint8_t *)mmap(area, size, PROT_READ | PROT_WRITE,
+			      MAP_SHARED | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+	if (mem == MAP_FAILED)
+		goto unmap;
+
+	/* An old size of zero makes a second mapping of the same shared
+	 * pages, placed right after the first. */
+	mirror = (uint8_t *)mremap(mem, 0, size, MREMAP_MAYMOVE | MREMAP_FIXED,
+				   area + size);
+	if (mirror == MAP_FAILED)
+		goto unmap;
+
+	return mem;
+
+unmap:
+	munmap(area, 2 * size);
+error:
+	syslog(LOG_ERR, "Failed to map mirrored buffer: %d", errno);
+	return NULL;
+}
+
+struct byte_buffer *byte_buffer_create_mirrored(size_t buffer_size_bytes)
+{
+	struct byte_buffer *buf;
+	size_t page_size = sysconf(_SC_PAGESIZE);
+	size_t ring_size;
+
+	ring_size = (buffer_size_bytes + page_size - 1) / page_size * page_size;
+
+	buf = (struct byte_buffer *)calloc(1, sizeof(*buf));
+	if (!buf)
+		return NULL;
+
+	buf->bytes = byte_buffer_map_mirrored(ring_size);
+	if (!buf->bytes) {
+		free(buf);
+		return NULL;
+	}
+	buf->size = buffer_size_bytes;
+	buf->max_size = ring_size;
+	buf->mirrored = 1;
+	return buf;
+}
@@ -3,16 +3,31 @@
  * found in the LICENSE file.
  */
 
+#ifndef BYTE_BUFFER_H_
+#define BYTE_BUFFER_H_
+
 #include <stdint.h>
 #include <stdlib.h>
+#include <sys/mman.h>
 #include <sys/param.h>
 
+/* A ring of bytes. In a mirrored buffer the ring is mapped twice back to
+ * back, so the readable and the writable parts are always contiguous, even
+ * across the end of the ring.
+ * Members:
+ *    size - Number of bytes the buffer holds.
+ *    max_size - Size of the ring, indexes wrap around it. At least size.
+ *    mirrored - Set when the ring is mapped twice.
+ *    bytes - The ring.
+ */
 struct byte_buffer {
 	unsigned int write_idx;
 	unsigned int read_idx;
 	unsigned int level;
 	unsigned int size;
-	uint8_t bytes[];
+	unsigned int max_size;
+	unsigned int mirrored;
+	uint8_t *bytes;
 };
 
 /* Create a byte buffer to hold buffer_size_bytes worth of data. */
@@ -24,12 +39,27 @@ static inline struct byte_buffer *byte_buffer_create(size_t buffer_size_bytes)
 	if (!buf)
 		return buf;
 	buf->size = buffer_size_bytes;
+	buf->max_size = buffer_size_bytes;
+	buf->bytes = (uint8_t *)(buf + 1);
 	return buf;
 }
 
-/* Destory a byte_buffer created with byte_buffer_create. */
+/* Create a mirrored byte buffer to hold buffer_size_bytes worth of data. The
+ * ring is rounded up to a whole number of pages. Returns NULL if the ring
+ * can't be mapped, callers can fall back to byte_buffer_create. */
+struct byte_buffer *byte_buffer_create_mirrored(size_t buffer_size_bytes);
+
+/* Maps size bytes twice in a row, size must be a multiple of the page size.
+ * Returns the first mapping, or NULL on failure. Free with munmap() of
+ * 2 * size bytes. */
+uint8_t *byte_buffer_map_mirrored(size_t size);
+
+/* Destory a byte_buffer created with byte_buffer_create or
+ * byte_buffer_create_mirrored. */
 static inline void byte_buffer_destroy(struct byte_buffer *buf)
 {
+	if (buf->mirrored)
+		munmap(buf->bytes, 2 * buf->max_size);
 	free(buf);
 }
 
@@ -37,21 +67,20 @@ static inline unsigned int buf_writable_bytes(struct byte_buffer *buf)
 {
 	if (buf->level >= buf->size)
 		return 0;
-	if (buf->write_idx < buf->read_idx)
-		return buf->read_idx - buf->write_idx;
+	if (buf->mirrored)
+		return buf->size - buf->level;
 
-	return buf->size - buf->write_idx;
+	return MIN(buf->size - buf->level, buf->max_size - buf->write_idx);
 }
 
 static inline unsigned int buf_readable_bytes(struct byte_buffer *buf)
 {
 	if (buf->level == 0)
 		return 0;
+	if (buf->mirrored)
+		return buf->level;
 
-	if (buf->read_idx < buf->write_idx)
-		return buf->write_idx - buf->read_idx;
-
-	return buf->size - buf->read_idx;
+	return MIN(buf->level, buf->max_size - buf->read_idx);
 }
 
 static inline unsigned int buf_queued_bytes(struct byte_buffer *buf)
@@ -80,7 +109,7 @@ static inline void buf_increment_read(struct byte_buffer *buf, size_t inc)
 {
 	inc = MIN(inc, buf->level);
 	buf->read_idx += inc;
-	buf->read_idx %= buf->size;
+	buf->read_idx %= buf->max_size;
 	buf->level -= inc;
 }
 
@@ -99,7 +128,7 @@ static inline uint8_t *buf_write_pointer_size(struct byte_buffer *buf,
 static inline void buf_increment_write(struct byte_buffer *buf, size_t inc)
 {
 	buf->write_idx += inc;
-	buf->write_idx %= buf->size;
+	buf->write_idx %= buf->max_size;
 	if (buf->level + inc < buf->size)
 		buf->level += inc;
 	else
@@ -112,3 +141,13 @@ static inline void buf_reset(struct byte_buffer *buf)
 	buf->read_idx = 0;
 	buf->level = 0;
 }
+
+/* Sets how many bytes the buffer holds, at most its max_size, and empties
+ * it. */
+static inline void buf_set_size(struct byte_buffer *buf, size_t size)
+{
+	buf->size = MIN(size, buf->max_size);
+	buf_reset(buf);
+}
+
+#endif /* BYTE_BUFFER_H_ */
@@ -15,6 +15,8 @@
 
 static struct option long_options[] = {
 	{"syslog_mask", required_argument, 0, 'l'},
+	{"standby_ms", required_argument, 0, 's'},
+	{"prewarm_output", no_argument, 0, 'p'},
 	{0, 0, 0, 0}
 };
 
@@ -30,6 +32,8 @@ int main(int argc, char **argv)
 {
 	int c, option_index;
 	int log_mask = LOG_ERR;
+	unsigned int standby_ms = CRAS_OUTPUT_STANDBY_MS;
+	int prewarm = 0;
 
 	set_signals();
 
@@ -48,6 +52,15 @@ int main(int argc, char **argv)
 		case 'l':
 			log_mask = atoi(optarg);
 			break;
+		/* Milliseconds to keep an output device open after its
+		   last stream is removed, 0 closes it right away. */
+		case 's':
+			standby_ms = atoi(optarg);
+			break;
+		/* Open the default output before any stream needs it. */
+		case 'p':
+			prewarm = 1;
+			break;
 
 		}
 	}
@@ -70,6 +83,7 @@ int main(int argc, char **argv)
 	cras_server_init();
 	cras_system_state_init();
 	cras_dsp_init(CRAS_CONFIG_FILE_DIR "/dsp.ini");
+	cras_iodev_list_set_output_standby(standby_ms, prewarm);
 	cras_iodev_list_init();
 
 	/* Start the server. */
@@ -0,0 +1,396 @@
+/* Copyright (c) 2015 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "byte_buffer.h"
+#include "cras_a2dp_encoder.h"
+#include "cras_a2dp_info.h"
+#include "cras_config.h"
+#include "cras_util.h"
+
+/* Number of packets the encoder can get ahead of the socket, must be a power
+ * of two and at most A2DP_MAX_SEND_PACKETS so they go in one send call. */
+#define A2DP_ENCODER_MAX_PACKETS 8
+
+/* Members:
+ *    a2dp - The a2dp info object, used only by the encoder thread.
+ *    format_bytes - Number of bytes per PCM frame.
+ *    link_mtu - The maximum transmit unit.
+ *    pcm - The PCM ring, written by the audio thread.
+ *    pcm_size - Size of the PCM ring in bytes.
+ *    pcm_mirrored - Set when the PCM ring is mapped twice in a row, then
+ *        samples are written and encoded across its end in one piece.
+ *    pcm_write - Bytes ever written to the PCM ring, by the audio thread.
+ *    pcm_read - Bytes ever encoded from the PCM ring, by the encoder thread.
+ *    packets - The packet queue, written by the encoder thread. Keeps the
+ *        sequence number and timestamp of each packet.
+ *    packet_buf - Holds the data of the packets, link_mtu bytes each.
+ *    packet_write - Packets ever queued, by the encoder thread.
+ *    packet_read - Packets ever sent, by the audio thread.
+ *    pending_frames - Frames in the packet being filled by the encoder.
+ *    last_sent - The last packet sent, by the audio thread.
+ *    bitpool_request - The bitpool asked for by the audio thread.
+ *    bitpool - The bitpool of the codec, set by the encoder thread.
+ *    bitpool_failed - The last bitpool the codec couldn't switch to, only
+ *        used by the encoder thread. 0 if none.
+ *    wake - Posted to wake up the encoder thread.
+ *    event_fd - Readable when packets are queued.
+ *    stopping - Set to stop the encoder thread.
+ *    tid - The encoder thread.
+ */
+struct a2dp_encoder {
+	struct a2dp_info *a2dp;
+	size_t format_bytes;
+	size_t link_mtu;
+	uint8_t *pcm;
+	unsigned int pcm_size;
+	unsigned int pcm_mirrored;
+	unsigned int pcm_write;
+	unsigned int pcm_read;
+	struct a2dp_packet packets[A2DP_ENCODER_MAX_PACKETS];
+	uint8_t *packet_buf;
+	unsigned int packet_write;
+	unsigned int packet_read;
+	int pending_frames;
+	struct a2dp_packet last_sent;
+	unsigned int bitpool_request;
+	unsigned int bitpool;
+	unsigned int bitpool_failed;
+	sem_t wake;
+	int event_fd;
+	unsigned int stopping;
+	pthread_t tid;
+};
+
+/* The counters above are free running and only ever written by one thread.
+ * A barrier orders the data accesses before publishing a new value, and after
+ * reading the value of the other side. */
+static inline unsigned int load_acquire(const unsigned int *p)
+{
+	unsigned int v = *(volatile const unsigned int *)p;
+	__sync_synchronize();
+	return v;
+}
+
+static inline void store_release(unsigned int *p, unsigned int v)
+{
+	__sync_synchronize();
+	*(volatile unsigned int *)p = v;
+}
+
+static void notify_packet_ready(struct a2dp_encoder *enc)
+{
+	uint64_t event = 1;
+	int rc;
+
+	rc = write(enc->event_fd, &event, sizeof(event));
+	if (rc < 0)
+		syslog(LOG_ERR, "a2dp encoder notify failed %d", errno);
+}
+
+/* Switches the codec to the requested bitpool. This waits for the current
+ * packet to be taken, as all frames of a packet are the same size. */
+static void apply_bitpool(struct a2dp_encoder *enc)
+{
+	unsigned int bitpool = load_acquire(&enc->bitpool_request);
+	int rc;
+
+	if (bitpool == enc->bitpool) {
+		enc->bitpool_failed = 0;
+		return;
+	}
+	/* Don't try again until a different one is asked for. */
+	if (bitpool == enc->bitpool_failed || a2dp_queued_frames(enc->a2dp))
+		return;
+
+	rc = a2dp_set_bitpool(enc->a2dp, bitpool);
+	if (rc < 0) {
+		syslog(LOG_ERR, "a2dp set bitpool %u failed %d", bitpool, rc);
+		enc->bitpool_failed = bitpool;
+		return;
+	}
+	enc->bitpool_failed = 0;
+	store_release(&enc->bitpool, bitpool);
+}
+
+/* Encodes as many samples as possible, until the PCM ring runs out of full
+ * SBC frames or the packet queue is full. */
+static void encode_queued(struct a2dp_encoder *enc)
+{
+	unsigned int read_pos = enc->pcm_read;
+	unsigned int queued, offset;
+	struct iovec iov[2];
+	struct a2dp_packet *packet;
+	int processed, len;
+
+	while (!load_acquire(&enc->stopping)) {
+		if (enc->packet_write - load_acquire(&enc->packet_read) >=
+		    A2DP_ENCODER_MAX_PACKETS)
+			break;
+
+		apply_bitpool(enc);
+
+		/* Both parts of the ring are encoded in one call. */
+		queued = load_acquire(&enc->pcm_write) - read_pos;
+		offset = read_pos & (enc->pcm_size - 1);
+		iov[0].iov_base = enc->pcm + offset;
+		iov[0].iov_len = enc->pcm_mirrored ?
+				queued : MIN(queued, enc->pcm_size - offset);
+		iov[1].iov_base = enc->pcm;
+		iov[1].iov_len = queued - iov[0].iov_len;
+
+		processed = a2dp_encode_iov(enc->a2dp, iov,
+					    iov[1].iov_len ? 2 : 1,
+					    enc->format_bytes, enc->link_mtu);
+		if (processed < 0 && processed != -ENOSPC)
+			break;
+		if (processed > 0) {
+			read_pos += processed;
+			store_release(&enc->pcm_read, read_pos);
+		}
+
+		packet = &enc->packets[enc->packet_write &
+				       (A2DP_ENCODER_MAX_PACKETS - 1)];
+		len = a2dp_take_packet(enc->a2dp, enc->link_mtu, packet,
+				       enc->link_mtu);
+		enc->pending_frames = a2dp_queued_frames(enc->a2dp);
+		if (len > 0) {
+			store_release(&enc->packet_write,
+				      enc->packet_write + 1);
+			notify_packet_ready(enc);
+		}
+
+		if (processed <= 0 && len <= 0)
+			break;
+	}
+}
+
+static void *encoder_thread(void *arg)
+{
+	struct a2dp_encoder *enc = (struct a2dp_encoder *)arg;
+
+	/* Run right below the audio thread, the packets it sends are
+	 * produced here. */
+	cras_set_thread_priority(CRAS_SERVER_RT_THREAD_PRIORITY - 1);
+
+	while (1) {
+		if (sem_wait(&enc->wake) < 0) {
+			if (errno == EINTR)
+				continue;
+			syslog(LOG_ERR, "a2dp encoder wait failed %d", errno);
+			break;
+		}
+		if (load_acquire(&enc->stopping))
+			break;
+		encode_queued(enc);
+	}
+
+	return NULL;
+}
+
+static void free_pcm(struct a2dp_encoder *enc)
+{
+	if (enc->pcm_mirrored)
+		munmap(enc->pcm, 2 * enc->pcm_size);
+	else
+		free(enc->pcm);
+}
+
+struct a2dp_encoder *a2dp_encoder_create(struct a2dp_info *a2dp,
+					 size_t pcm_buf_size,
+					 size_t format_bytes,
+					 size_t link_mtu)
+{
+	struct a2dp_encoder *enc;
+	unsigned int i;
+	int rc;
+
+	if (pcm_buf_size == 0 || (pcm_buf_size & (pcm_buf_size - 1)))
+		return NULL;
+
+	enc = (struct a2dp_encoder *)calloc(1, sizeof(*enc));
+	if (!enc)
+		return NULL;
+
+	enc->pcm_size = pcm_buf_size;
+	enc->pcm = byte_buffer_map_mirrored(pcm_buf_size);
+	if (enc->pcm)
+		enc->pcm_mirrored = 1;
+	else
+		enc->pcm = (uint8_t *)calloc(1, pcm_buf_size);
+	if (!enc->pcm)
+		goto free_enc;
+
+	enc->packet_buf = (uint8_t *)malloc(A2DP_ENCODER_MAX_PACKETS *
+					    link_mtu);
+	if (!enc->packet_buf)
+		goto free_pcm;
+	for (i = 0; i < A2DP_ENCODER_MAX_PACKETS; i++)
+		enc->packets[i].data = enc->packet_buf + i * link_mtu;
+
+	enc->a2dp = a2dp;
+	enc->format_bytes = format_bytes;
+	enc->link_mtu = link_mtu;
+	enc->bitpool = a2dp->bitpool;
+	enc->bitpool_request = a2dp->bitpool;
+
+	enc->event_fd = eventfd(0, EFD_NONBLOCK);
+	if (enc->event_fd < 0) {
+		syslog(LOG_ERR, "a2dp encoder eventfd failed %d", errno);
+		goto free_packets;
+	}
+
+	sem_init(&enc->wake, 0, 0);
+	rc = pthread_create(&enc->tid, NULL, encoder_thread, enc);
+	if (rc) {
+		syslog(LOG_ERR, "a2dp encoder thread failed %d", rc);
+		goto close_fd;
+	}
+
+	return enc;
+
+close_fd:
+	sem_destroy(&enc->wake);
+	close(enc->event_fd);
+free_packets:
+	free(enc->packet_buf);
+free_pcm:
+	free_pcm(enc);
+free_enc:
+	free(enc);
+	return NULL;
+}
+
+void a2dp_encoder_destroy(struct a2dp_encoder *enc)
+{
+	store_release(&enc->stopping, 1);
+	sem_post(&enc->wake);
+	pthread_join(enc->tid, NULL);
+
+	sem_destroy(&enc->wake);
+	close(enc->event_fd);
+	free(enc->packet_buf);
+	free_pcm(enc);
+	free(enc);
+}
+
+int a2dp_encoder_fd(const struct a2dp_encoder *enc)
+{
+	return enc->event_fd;
+}
+
+uint8_t *a2dp_encoder_pcm_write_pointer(struct a2dp_encoder *enc,
+					unsigned int *writable)
+{
+	unsigned int write_pos = enc->pcm_write;
+	unsigned int offset = write_pos & (enc->pcm_size - 1);
+	unsigned int avail;
+
+	avail = enc->pcm_size - (write_pos - load_acquire(&enc->pcm_read));
+	*writable = enc->pcm_mirrored ?
+			avail : MIN(avail, enc->pcm_size - offset);
+	return enc->pcm + offset;
+}
+
+int a2dp_encoder_pcm_commit(struct a2dp_encoder *enc, unsigned int bytes)
+{
+	unsigned int writable;
+
+	a2dp_encoder_pcm_write_pointer(enc, &writable);
+	if (bytes > writable)
+		return -EINVAL;
+
+	store_release(&enc->pcm_write, enc->pcm_write + bytes);
+	sem_post(&enc->wake);
+	return 0;
+}
+
+unsigned int a2dp_encoder_pcm_queued_bytes(const struct a2dp_encoder *enc)
+{
+	unsigned int read_pos = load_acquire(&enc->pcm_read);
+
+	return load_acquire(&enc->pcm_write) - read_pos;
+}
+
+int a2dp_encoder_queued_frames(const struct a2dp_encoder *enc)
+{
+	unsigned int i;
+	unsigned int write_pos = load_acquire(&enc->packet_write);
+	int frames = *(volatile const int *)&enc->pending_frames;
+
+	for (i = load_acquire(&enc->packet_read); i != write_pos; i++)
+		frames += enc->packets[i & (A2DP_ENCODER_MAX_PACKETS - 1)]
+				.frames;
+	return frames;
+}
+
+int a2dp_encoder_send(struct a2dp_encoder *enc, int stream_fd)
+{
+	struct a2dp_packet *packets[A2DP_ENCODER_MAX_PACKETS];
+	unsigned int next = enc->packet_read;
+	unsigned int num_packets = 0;
+	uint64_t events;
+	int written = 0;
+	int i, rc;
+
+	/* Clear the notification first, packets queued from now on either
+	 * get sent below or notify again. */
+	rc = read(enc->event_fd, &events, sizeof(events));
+	if (rc < 0 && errno != EAGAIN)
+		syslog(LOG_ERR, "a2dp encoder read event failed %d", errno);
+
+	while (next + num_packets != load_acquire(&enc->packet_write)) {
+		packets[num_packets] = &enc->packets[
+			(next + num_packets) & (A2DP_ENCODER_MAX_PACKETS - 1)];
+		num_packets++;
+	}
+	if (num_packets == 0)
+		return 0;
+
+	rc = a2dp_send_packets(stream_fd, packets, num_packets);
+	if (rc < 0)
+		return rc;
+	if (rc == 0)
+		return -EAGAIN;
+
+	for (i = 0; i < rc; i++)
+		written += packets[i]->len;
+	enc->last_sent = *packets[rc - 1];
+	store_release(&enc->packet_read, next + rc);
+	/* Slots are free, the encoder may be waiting for one. */
+	sem_post(&enc->wake);
+
+	if ((unsigned int)rc < num_packets)
+		return -EAGAIN;
+	return written;
+}
+
+void a2dp_encoder_last_sent(const struct a2dp_encoder *enc,
+			    uint16_t *seq_num, uint32_t *timestamp)
+{
+	*seq_num = enc->last_sent.seq_num;
+	*timestamp = enc->last_sent.timestamp;
+}
+
+void a2dp_encoder_set_bitpool(struct a2dp_encoder *enc, unsigned int bitpool)
+{
+	store_release(&enc->bitpool_request, bitpool);
+	sem_post(&enc->wake);
+}
+
+unsigned int a2dp_encoder_bitpool(const struct a2dp_encoder *enc)
+{
+	return load_acquire(&enc->bitpool);
+}
@@ -0,0 +1,99 @@
+/* Copyright (c) 2015 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef CRAS_A2DP_ENCODER_H_
+#define CRAS_A2DP_ENCODER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct a2dp_info;
+
+/* Runs the SBC encoding of an a2dp iodev on a dedicated thread, so the cost
+ * of encoding isn't paid on the audio thread.
+ *
+ * The audio thread writes PCM samples to a lock-free ring. The encoder
+ * thread turns them into RTP packets, which are queued for the audio thread
+ * to send when the socket is writable. There is exactly one writer and one
+ * reader on each queue, so neither side takes a lock.
+ */
+struct a2dp_encoder;
+
+/* Creates an encoder and starts its thread. While the encoder exists, a2dp
+ * must not be used by any other thread.
+ * Args:
+ *    a2dp - The a2dp info object holding the codec.
+ *    pcm_buf_size - Size of the PCM ring in bytes, must be a power of two.
+ *    format_bytes - Number of bytes per PCM frame.
+ *    link_mtu - The maximum transmit unit.
+ * Returns:
+ *    The encoder, or NULL on failure.
+ */
+struct a2dp_encoder *a2dp_encoder_create(struct a2dp_info *a2dp,
+					 size_t pcm_buf_size,
+					 size_t format_bytes,
+					 size_t link_mtu);
+
+/* Stops the encoder thread and frees the encoder. Samples and packets still
+ * queued are dropped. */
+void a2dp_encoder_destroy(struct a2dp_encoder *enc);
+
+/* Returns an fd that becomes readable when there are packets to send. It is
+ * cleared by a2dp_encoder_send(). */
+int a2dp_encoder_fd(const struct a2dp_encoder *enc);
+
+/* Gets the contiguous writable part of the PCM ring. Audio thread only.
+ * Args:
+ *    enc - The encoder.
+ *    writable - Filled with the number of bytes that can be written.
+ * Returns:
+ *    Where to write the next samples.
+ */
+uint8_t *a2dp_encoder_pcm_write_pointer(struct a2dp_encoder *enc,
+					unsigned int *writable);
+
+/* Queues bytes written at a2dp_encoder_pcm_write_pointer() for encoding and
+ * wakes the encoder thread. Audio thread only.
+ * Returns:
+ *    0 on success, -EINVAL if more bytes than writable are committed.
+ */
+int a2dp_encoder_pcm_commit(struct a2dp_encoder *enc, unsigned int bytes);
+
+/* Returns the number of PCM bytes waiting to be encoded. */
+unsigned int a2dp_encoder_pcm_queued_bytes(const struct a2dp_encoder *enc);
+
+/* Returns the number of PCM frames that have been encoded but not sent yet,
+ * including the packet being filled by the encoder thread. */
+int a2dp_encoder_queued_frames(const struct a2dp_encoder *enc);
+
+/* Sends the queued packets to the socket in one system call. Audio thread
+ * only.
+ * Args:
+ *    enc - The encoder.
+ *    stream_fd - The socket to send packets to.
+ * Returns:
+ *    The number of bytes sent when every queued packet has been sent,
+ *    -EAGAIN if the socket is full with packets left in the queue, or
+ *    other negative error code on failure.
+ */
+int a2dp_encoder_send(struct a2dp_encoder *enc, int stream_fd);
+
+/* Gets the rtp sequence number and timestamp of the last packet sent.
+ * Audio thread only. */
+void a2dp_encoder_last_sent(const struct a2dp_encoder *enc,
+			    uint16_t *seq_num, uint32_t *timestamp);
+
+/* Asks the encoder thread to switch the codec to a different bitpool. It is
+ * applied at the start of the next packet. Audio thread only.
+ * Args:
+ *    enc - The encoder.
+ *    bitpool - The new bitpool, within the range of the SBC configuration.
+ */
+void a2dp_encoder_set_bitpool(struct a2dp_encoder *enc, unsigned int bitpool);
+
+/* Returns the bitpool the codec is currently encoding with. */
+unsigned int a2dp_encoder_bitpool(const struct a2dp_encoder *enc);
+
+#endif /* CRAS_A2DP_ENCODER_H_ */
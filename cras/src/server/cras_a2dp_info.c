@@ -3,8 +3,15 @@
  * found in the LICENSE file.
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* for sendmmsg */
+#endif
+#include <errno.h>
 #include <netinet/in.h>
 #include <sbc/sbc.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
 #include <syslog.h>
 
 #include "cras_a2dp_info.h"
@@ -12,10 +19,11 @@
 #include "cras_types.h"
 #include "rtp.h"
 
-int init_a2dp(struct a2dp_info *a2dp, a2dp_sbc_t *sbc)
+/* Creates the SBC codec for the given configuration and bitpool. */
+static struct cras_audio_codec *create_codec(const a2dp_sbc_t *sbc,
+					     uint8_t bitpool)
 {
-	uint8_t frequency = 0, mode = 0, subbands = 0, allocation, blocks = 0,
-		bitpool;
+	uint8_t frequency = 0, mode = 0, subbands = 0, allocation, blocks = 0;
 
 	if (sbc->frequency & SBC_SAMPLING_FREQ_48000)
 		frequency = SBC_FREQ_48000;
@@ -64,13 +72,26 @@ int init_a2dp(struct a2dp_info *a2dp, a2dp_sbc_t *sbc)
 		break;
 	}
 
-	bitpool = sbc->max_bitpool;
+	return cras_sbc_codec_create(frequency, mode, subbands, allocation,
+				     blocks, bitpool);
+}
 
-	a2dp->codec = cras_sbc_codec_create(frequency, mode, subbands,
-					    allocation, blocks, bitpool);
+int init_a2dp(struct a2dp_info *a2dp, a2dp_sbc_t *sbc)
+{
+	a2dp->sbc = *sbc;
+	a2dp->bitpool = sbc->max_bitpool;
+	a2dp->codec = create_codec(sbc, a2dp->bitpool);
 	if (!a2dp->codec)
 		return -1;
 
+	a2dp->a2dp_buf = (uint8_t *)calloc(1, A2DP_BUF_SIZE_BYTES);
+	if (!a2dp->a2dp_buf) {
+		cras_sbc_codec_destroy(a2dp->codec);
+		a2dp->codec = NULL;
+		return -1;
+	}
+	a2dp->a2dp_buf_size = A2DP_BUF_SIZE_BYTES;
+
 	/* SBC info */
 	a2dp->codesize = cras_sbc_get_codesize(a2dp->codec);
 	a2dp->frame_length = cras_sbc_get_frame_length(a2dp->codec);
@@ -84,9 +105,48 @@ int init_a2dp(struct a2dp_info *a2dp, a2dp_sbc_t *sbc)
 	return 0;
 }
 
+int a2dp_set_bitpool(struct a2dp_info *a2dp, int bitpool)
+{
+	struct cras_audio_codec *codec;
+
+	if (bitpool == a2dp->bitpool)
+		return 0;
+	if (bitpool < a2dp->sbc.min_bitpool || bitpool > a2dp->sbc.max_bitpool)
+		return -EINVAL;
+	if (a2dp->frame_count)
+		return -EBUSY;
+
+	codec = create_codec(&a2dp->sbc, bitpool);
+	if (!codec)
+		return -ENOMEM;
+	cras_sbc_codec_destroy(a2dp->codec);
+	a2dp->codec = codec;
+	a2dp->bitpool = bitpool;
+	a2dp->codesize = cras_sbc_get_codesize(codec);
+	a2dp->frame_length = cras_sbc_get_frame_length(codec);
+	return 0;
+}
+
 void destroy_a2dp(struct a2dp_info *a2dp)
 {
 	cras_sbc_codec_destroy(a2dp->codec);
+	free(a2dp->a2dp_buf);
+	a2dp->a2dp_buf = NULL;
+}
+
+int a2dp_set_link_mtu(struct a2dp_info *a2dp, size_t link_mtu)
+{
+	uint8_t *buf;
+
+	if (link_mtu <= a2dp->a2dp_buf_size)
+		return 0;
+
+	buf = (uint8_t *)realloc(a2dp->a2dp_buf, link_mtu);
+	if (!buf)
+		return -ENOMEM;
+	a2dp->a2dp_buf = buf;
+	a2dp->a2dp_buf_size = link_mtu;
+	return 0;
 }
 
 int a2dp_codesize(struct a2dp_info *a2dp)
@@ -113,9 +173,9 @@ void a2dp_drain(struct a2dp_info *a2dp)
 	a2dp->frame_count = 0;
 }
 
-static int avdtp_write(int stream_fd, struct a2dp_info *a2dp)
+/* Fills the rtp header of the packet currently in a2dp_buf. */
+static void fill_rtp_header(struct a2dp_info *a2dp)
 {
-	int err;
 	struct rtp_header *header;
 	struct rtp_payload *payload;
 
@@ -129,33 +189,50 @@ static int avdtp_write(int stream_fd, struct a2dp_info *a2dp)
 	header->sequence_number = htons(a2dp->seq_num);
 	header->timestamp = htonl(a2dp->nsamples);
 	header->ssrc = htonl(1);
+}
 
-	err = send(stream_fd, a2dp->a2dp_buf, a2dp->a2dp_buf_used,
-		   MSG_DONTWAIT);
-	if (err < 0)
-		return -errno;
-
-	/* Reset some data */
-	a2dp->a2dp_buf_used = sizeof(*header) + sizeof(*payload);
+/* Starts a new packet after the current one has been taken. */
+static void next_packet(struct a2dp_info *a2dp)
+{
+	a2dp->a2dp_buf_used = sizeof(struct rtp_header)
+			+ sizeof(struct rtp_payload);
 	a2dp->frame_count = 0;
 	a2dp->samples = 0;
 	a2dp->seq_num++;
+}
 
-	return err;
+/* Returns true when the packet can't hold another SBC frame. */
+static int packet_full(const struct a2dp_info *a2dp, size_t link_mtu)
+{
+	if (link_mtu > a2dp->a2dp_buf_size)
+		link_mtu = a2dp->a2dp_buf_size;
+	return a2dp->a2dp_buf_used + a2dp->frame_length >
+	       link_mtu - sizeof(struct rtp_header) -
+			sizeof(struct rtp_payload);
 }
 
 int a2dp_encode(struct a2dp_info *a2dp, const void *pcm_buf, int pcm_buf_size,
 		int format_bytes, size_t link_mtu)
+{
+	struct iovec iov;
+
+	iov.iov_base = (void *)pcm_buf;
+	iov.iov_len = pcm_buf_size;
+	return a2dp_encode_iov(a2dp, &iov, 1, format_bytes, link_mtu);
+}
+
+int a2dp_encode_iov(struct a2dp_info *a2dp, const struct iovec *pcm,
+		    unsigned int num_pcm, int format_bytes, size_t link_mtu)
 {
 	int processed;
 	size_t out_encoded;
 
-	if (link_mtu > A2DP_BUF_SIZE_BYTES)
-		link_mtu = A2DP_BUF_SIZE_BYTES;
+	if (link_mtu > a2dp->a2dp_buf_size)
+		link_mtu = a2dp->a2dp_buf_size;
 	if (link_mtu == a2dp->a2dp_buf_used)
 		return 0;
 
-	processed = a2dp->codec->encode(a2dp->codec, pcm_buf, pcm_buf_size,
+	processed = cras_sbc_encode_iov(a2dp->codec, pcm, num_pcm,
 					a2dp->a2dp_buf + a2dp->a2dp_buf_used,
 					link_mtu - a2dp->a2dp_buf_used,
 					&out_encoded);
@@ -174,12 +251,53 @@ int a2dp_encode(struct a2dp_info *a2dp, const void *pcm_buf, int pcm_buf_size,
 	return processed;
 }
 
-int a2dp_write(struct a2dp_info *a2dp, int stream_fd, size_t link_mtu)
+int a2dp_take_packet(struct a2dp_info *a2dp, size_t link_mtu,
+		     struct a2dp_packet *packet, size_t buf_size)
 {
-	/* Do avdtp write when the max number of SBC frames is reached. */
-	if (a2dp->a2dp_buf_used + a2dp->frame_length >
-	    link_mtu - sizeof(struct rtp_header) - sizeof(struct rtp_payload))
-		return avdtp_write(stream_fd, a2dp);
+	size_t len;
 
-	return 0;
+	if (!packet_full(a2dp, link_mtu))
+		return 0;
+
+	len = a2dp->a2dp_buf_used;
+	if (len > buf_size)
+		return -ENOSPC;
+
+	fill_rtp_header(a2dp);
+	memcpy(packet->data, a2dp->a2dp_buf, len);
+	packet->len = len;
+	packet->frames = a2dp->samples;
+	packet->seq_num = a2dp->seq_num;
+	packet->timestamp = a2dp->nsamples;
+	next_packet(a2dp);
+
+	return len;
+}
+
+int a2dp_send_packets(int stream_fd, struct a2dp_packet *const *packets,
+		      unsigned int num_packets)
+{
+	struct mmsghdr msgs[A2DP_MAX_SEND_PACKETS];
+	struct iovec iovs[A2DP_MAX_SEND_PACKETS];
+	unsigned int i;
+	int rc;
+
+	if (num_packets > A2DP_MAX_SEND_PACKETS)
+		num_packets = A2DP_MAX_SEND_PACKETS;
+	if (num_packets == 0)
+		return 0;
+
+	memset(msgs, 0, sizeof(msgs[0]) * num_packets);
+	for (i = 0; i < num_packets; i++) {
+		iovs[i].iov_base = packets[i]->data;
+		iovs[i].iov_len = packets[i]->len;
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	rc = sendmmsg(stream_fd, msgs, num_packets, MSG_DONTWAIT);
+	if (rc < 0)
+		return -errno;
+
+	return rc;
 }
@@ -6,14 +6,23 @@
 #ifndef CRAS_A2DP_INFO_H_
 #define CRAS_A2DP_INFO_H_
 
+#include <sys/uio.h>
+
 #include "a2dp-codecs.h"
 
+/* Initial size of the a2dp buffer, see a2dp_set_link_mtu(). */
 #define A2DP_BUF_SIZE_BYTES 1024
 
+/* Maximum number of packets sent by one a2dp_send_packets() call. */
+#define A2DP_MAX_SEND_PACKETS 16
+
 /* Represents the codec and encoded state of a2dp iodev.
  * Members:
  *    codec - The codec used to encode PCM buffer to a2dp buffer.
+ *    sbc - The negotiated SBC configuration, kept to rebuild the codec.
+ *    bitpool - The bitpool the codec currently encodes with.
  *    a2dp_buf - The buffer to hold encoded frames.
+ *    a2dp_buf_size - Size of a2dp_buf in bytes.
  *    codesize - Size of a SBC frame in bytes.
  *    frame_length - Size of an encoded SBC frame in bytes.
  *    frame_count - Queued SBC frame count currently in a2dp buffer.
@@ -24,7 +33,10 @@
  */
 struct a2dp_info {
 	struct cras_audio_codec *codec;
-	uint8_t a2dp_buf[A2DP_BUF_SIZE_BYTES];
+	a2dp_sbc_t sbc;
+	int bitpool;
+	uint8_t *a2dp_buf;
+	size_t a2dp_buf_size;
 	int codesize;
 	int frame_length;
 	int frame_count;
@@ -34,16 +46,47 @@ struct a2dp_info {
 	size_t a2dp_buf_used;
 };
 
+/* An encoded packet ready to be sent.
+ * Members:
+ *    data - The buffer holding the rtp packet.
+ *    len - Size of the rtp packet in bytes.
+ *    frames - Number of PCM frames encoded in the packet.
+ *    seq_num - Sequence number in rtp header.
+ *    timestamp - Timestamp in rtp header.
+ */
+struct a2dp_packet {
+	uint8_t *data;
+	int len;
+	int frames;
+	uint16_t seq_num;
+	uint32_t timestamp;
+};
+
 /*
  * Set up codec for given sbc capability.
  */
 int init_a2dp(struct a2dp_info *a2dp, a2dp_sbc_t *sbc);
 
+/*
+ * Re-initializes the codec of an a2dp_info with a different bitpool, within
+ * the min and max bitpool of its SBC configuration. The rtp state is kept so
+ * the stream goes on seamlessly. This can only be done between packets.
+ * Returns 0 on success, -EBUSY if a packet is being filled, -EINVAL if
+ * bitpool is out of range or -ENOMEM if the codec can't be created.
+ */
+int a2dp_set_bitpool(struct a2dp_info *a2dp, int bitpool);
+
 /*
  * Destroys an a2dp_info.
  */
 void destroy_a2dp(struct a2dp_info *a2dp);
 
+/*
+ * Grows the a2dp buffer so packets can be as large as the link allows.
+ * Returns 0 on success, -ENOMEM if the buffer can't be grown.
+ */
+int a2dp_set_link_mtu(struct a2dp_info *a2dp, size_t link_mtu);
+
 /*
  * Gets the codesize of the SBC codec.
  */
@@ -78,12 +121,42 @@ int a2dp_encode(struct a2dp_info *a2dp, const void *pcm_buf, int pcm_buf_size,
 		int format_bytes, size_t link_mtu);
 
 /*
- * Writes samples using a2dp, returns numbewr of bytes written.
+ * Like a2dp_encode(), for samples split in several buffers such as both
+ * parts of a ring buffer. They are encoded as one in a single call.
  * Args:
  *    a2dp: The a2dp info object.
- *    stream_fd: The file descriptor to send stream to.
+ *    pcm: The buffers of pcm samples, in order.
+ *    num_pcm: Number of buffers in pcm.
+ *    format_bytes: Number of bytes per sample.
  *    link_mtu: The maximum transmit unit.
  */
-int a2dp_write(struct a2dp_info *a2dp, int stream_fd, size_t link_mtu);
+int a2dp_encode_iov(struct a2dp_info *a2dp, const struct iovec *pcm,
+		    unsigned int num_pcm, int format_bytes, size_t link_mtu);
+
+/*
+ * Moves the pending packet out of a2dp_info once the max number of SBC frames
+ * is reached. The rtp header is filled in, and the next packet is started.
+ * Returns the packet size in bytes, 0 if the packet isn't full yet or
+ * negative error code.
+ * Args:
+ *    a2dp: The a2dp info object.
+ *    link_mtu: The maximum transmit unit.
+ *    packet: The packet to fill, data must point to buf_size bytes.
+ *    buf_size: Size of packet->data in bytes.
+ */
+int a2dp_take_packet(struct a2dp_info *a2dp, size_t link_mtu,
+		     struct a2dp_packet *packet, size_t buf_size);
+
+/*
+ * Sends packets in order with one system call. Returns the number of packets
+ * sent, which is less than num_packets when the socket is full, or negative
+ * error code. -EAGAIN is returned if no packet could be sent.
+ * Args:
+ *    stream_fd: The file descriptor to send stream to.
+ *    packets: The packets to send.
+ *    num_packets: Number of packets, at most A2DP_MAX_SEND_PACKETS.
+ */
+int a2dp_send_packets(int stream_fd, struct a2dp_packet *const *packets,
+		      unsigned int num_packets);
 
 #endif /* CRAS_A2DP_INFO_H_ */
@@ -13,7 +13,7 @@
 
 #include "audio_thread.h"
 #include "audio_thread_log.h"
-#include "byte_buffer.h"
+#include "cras_a2dp_encoder.h"
 #include "cras_a2dp_info.h"
 #include "cras_a2dp_iodev.h"
 #include "cras_audio_area.h"
@@ -25,6 +25,19 @@
 
 #define PCM_BUF_MAX_SIZE_FRAMES (4096*4)
 #define PCM_BUF_MAX_SIZE_BYTES (PCM_BUF_MAX_SIZE_FRAMES * 4)
+#define PRE_FILL_PACKETS 2
+
+/* The bitpool is lowered by a large step when the link can't keep up, and
+ * raised back by a small one once it has been clear for a while. The SBC
+ * configuration usually allows a min bitpool too low to be listenable, it
+ * isn't lowered past BITPOOL_FLOOR. */
+#define BITPOOL_LOWER_STEP 8
+#define BITPOOL_RAISE_STEP 4
+#define BITPOOL_FLOOR 18
+/* Time for a change to take effect before lowering again. */
+#define BITPOOL_LOWER_INTERVAL_MS 200
+/* Time without congestion before raising the bitpool. */
+#define BITPOOL_RAISE_INTERVAL_MS 5000
 
 struct a2dp_io {
 	struct cras_iodev base;
@@ -32,11 +45,11 @@ struct a2dp_io {
 	struct cras_bt_transport *transport;
 	a2dp_force_suspend_cb force_suspend_cb;
 
-	/* To hold the pcm samples. */
-	struct byte_buffer *pcm_buf;
+	/* Encodes the pcm samples into packets on its own thread. */
+	struct a2dp_encoder *encoder;
 
-	/* Has the socket been filled once. */
-	int pre_fill_complete;
+	/* Has the first buffer been put since the device was opened. */
+	int started;
 
 	/* Accumulated frames written to a2dp socket. Will need this info
 	 * together with the device open time stamp to get how many virtual
@@ -44,6 +57,14 @@ struct a2dp_io {
 	 */
 	uint64_t bt_written_frames;
 	struct timespec dev_open_time;
+
+	/* Link congestion control. The bitpool asked of the encoder, the
+	 * bytes left in the socket by the last flush, and when the link was
+	 * last congested and the bitpool last changed. */
+	int bitpool;
+	int queued_bytes;
+	struct timespec last_congested;
+	struct timespec last_bitpool_change;
 };
 
 static int flush_data(void *arg);
@@ -124,16 +145,78 @@ static int bt_queued_frames(const struct cras_iodev *iodev, int fr)
 }
 
 
+/* Returns the number of frames waiting in the encoder, either as pcm
+ * samples or as packets not sent yet.
+ */
+static int encoder_queued_frames(const struct a2dp_io *a2dpio)
+{
+	return a2dp_encoder_pcm_queued_bytes(a2dpio->encoder) /
+			cras_get_format_bytes(a2dpio->base.format) +
+		a2dp_encoder_queued_frames(a2dpio->encoder);
+}
+
 static int frames_queued(const struct cras_iodev *iodev)
 {
 	struct a2dp_io *a2dpio = (struct a2dp_io *)iodev;
 	unsigned int n = MAX(bt_queued_frames(iodev, 0),
-			     buf_queued_bytes(a2dpio->pcm_buf) /
-				cras_get_format_bytes(iodev->format));
+			     encoder_queued_frames(a2dpio));
 
 	return MIN(iodev->buffer_size, n);
 }
 
+/* Fills the socket with silence, sent in one batch. The socket is set up to
+ * hold two MTUs.
+ */
+static int pre_fill_socket(struct a2dp_io *a2dpio)
+{
+	static const uint16_t zero_buffer[1024 * 2];
+	size_t link_mtu = cras_bt_transport_write_mtu(a2dpio->transport);
+	struct a2dp_packet packets[PRE_FILL_PACKETS];
+	struct a2dp_packet *to_send[PRE_FILL_PACKETS];
+	unsigned int num_packets = 0;
+	uint8_t *buf;
+	int processed;
+	int rc = 0;
+
+	buf = (uint8_t *)malloc(PRE_FILL_PACKETS * link_mtu);
+	if (!buf)
+		return -ENOMEM;
+
+	while (num_packets < PRE_FILL_PACKETS) {
+		processed = a2dp_encode(
+				&a2dpio->a2dp,
+				zero_buffer,
+				sizeof(zero_buffer),
+				cras_get_format_bytes(a2dpio->base.format),
+				link_mtu);
+		if (processed < 0) {
+			rc = processed;
+			goto done;
+		}
+
+		packets[num_packets].data = buf + num_packets * link_mtu;
+		rc = a2dp_take_packet(&a2dpio->a2dp, link_mtu,
+				      &packets[num_packets], link_mtu);
+		if (rc < 0)
+			goto done;
+		if (rc > 0) {
+			to_send[num_packets] = &packets[num_packets];
+			num_packets++;
+		} else if (processed == 0) {
+			break;
+		}
+	}
+
+	rc = a2dp_send_packets(cras_bt_transport_fd(a2dpio->transport),
+			       to_send, num_packets);
+	/* Full when EAGAIN is returned. */
+	if (rc == -EAGAIN)
+		rc = 0;
+done:
+	free(buf);
+	return rc < 0 ? rc : 0;
+}
+
 static int open_dev(struct cras_iodev *iodev)
 {
 	struct a2dp_io *a2dpio = (struct a2dp_io *)iodev;
@@ -147,34 +230,65 @@ static int open_dev(struct cras_iodev *iodev)
 	}
 
 	/* Assert format is set before opening device. */
-	if (iodev->format == NULL)
-		return -EINVAL;
+	if (iodev->format == NULL) {
+		err = -EINVAL;
+		goto release_transport;
+	}
 	iodev->format->format = SND_PCM_FORMAT_S16_LE;
 	cras_iodev_init_audio_area(iodev, iodev->format->num_channels);
 
-	a2dpio->pcm_buf = byte_buffer_create(PCM_BUF_MAX_SIZE_BYTES);
-	if (!a2dpio->pcm_buf)
-		return -ENOMEM;
+	/* Packets can be as large as the link allows. */
+	err = a2dp_set_link_mtu(&a2dpio->a2dp,
+				cras_bt_transport_write_mtu(a2dpio->transport));
+	if (err < 0)
+		goto release_transport;
+
+	/* Set up the socket to hold two MTUs full of data before returning
+	 * EAGAIN.  This will allow the write to be throttled when a reasonable
+	 * amount of data is queued. */
+	sock_depth = 2 * cras_bt_transport_write_mtu(a2dpio->transport);
+	setsockopt(cras_bt_transport_fd(a2dpio->transport),
+		   SOL_SOCKET, SO_SNDBUF, &sock_depth, sizeof(sock_depth));
+
+	/* Start at the best quality the link allows. */
+	err = a2dp_set_bitpool(&a2dpio->a2dp, a2dpio->a2dp.sbc.max_bitpool);
+	if (err < 0)
+		syslog(LOG_ERR, "a2dp reset bitpool failed %d", err);
+	a2dpio->bitpool = a2dpio->a2dp.bitpool;
+	a2dpio->queued_bytes = 0;
+	clock_gettime(CLOCK_MONOTONIC, &a2dpio->last_congested);
+	a2dpio->last_bitpool_change = a2dpio->last_congested;
+
+	/* Fill the socket before the encoder thread takes over the codec. */
+	err = pre_fill_socket(a2dpio);
+	if (err < 0)
+		syslog(LOG_ERR, "a2dp pre fill failed %d", err);
+
+	a2dpio->encoder = a2dp_encoder_create(
+			&a2dpio->a2dp, PCM_BUF_MAX_SIZE_BYTES,
+			cras_get_format_bytes(iodev->format),
+			cras_bt_transport_write_mtu(a2dpio->transport));
+	if (!a2dpio->encoder) {
+		err = -ENOMEM;
+		goto release_transport;
+	}
 
 	iodev->buffer_size = PCM_BUF_MAX_SIZE_FRAMES;
 	/* TODO(dgreid) - this should be 2 * (mtu size in frames) */
 	iodev->min_buffer_level = 4096;
-	a2dpio->pre_fill_complete = 0;
-	buf_increment_write(a2dpio->pcm_buf,
-			    iodev->min_buffer_level *
-				cras_get_format_bytes(iodev->format));
+	a2dpio->started = 0;
+	a2dp_encoder_pcm_commit(a2dpio->encoder,
+				iodev->min_buffer_level *
+					cras_get_format_bytes(iodev->format));
 
 	/* Initialize variables for bt_queued_frames() */
 	a2dpio->bt_written_frames = 0;
 	clock_gettime(CLOCK_MONOTONIC, &a2dpio->dev_open_time);
 
-	/* Set up the socket to hold two MTUs full of data before returning
-	 * EAGAIN.  This will allow the write to be throttled when a reasonable
-	 * amount of data is queued. */
-	sock_depth = 2 * cras_bt_transport_write_mtu(a2dpio->transport);
-	setsockopt(cras_bt_transport_fd(a2dpio->transport),
-		   SOL_SOCKET, SO_SNDBUF, &sock_depth, sizeof(sock_depth));
-
+	/* Packets are sent when the encoder has queued some, and when the
+	 * socket becomes writable again after being full. */
+	audio_thread_add_callback(a2dp_encoder_fd(a2dpio->encoder),
+				  flush_data, iodev);
 	audio_thread_add_write_callback(cras_bt_transport_fd(a2dpio->transport),
 					flush_data, iodev);
 	audio_thread_enable_callback(cras_bt_transport_fd(a2dpio->transport),
@@ -183,6 +297,14 @@ static int open_dev(struct cras_iodev *iodev)
 	syslog(LOG_ERR, "a2dp iodev buf size %lu %u", iodev->buffer_size,
 		cras_bt_transport_write_mtu(a2dpio->transport));
 	return 0;
+
+release_transport:
+	/* The device isn't open, close_dev won't be called. */
+	a2dp_drain(&a2dpio->a2dp);
+	cras_iodev_free_audio_area(iodev);
+	if (cras_bt_transport_release(a2dpio->transport) < 0)
+		syslog(LOG_ERR, "transport_release failed");
+	return err;
 }
 
 static int close_dev(struct cras_iodev *iodev)
@@ -194,13 +316,17 @@ static int close_dev(struct cras_iodev *iodev)
 		return 0;
 
 	audio_thread_rm_callback(cras_bt_transport_fd(a2dpio->transport));
+	if (a2dpio->encoder) {
+		audio_thread_rm_callback(a2dp_encoder_fd(a2dpio->encoder));
+		a2dp_encoder_destroy(a2dpio->encoder);
+		a2dpio->encoder = NULL;
+	}
 
 	err = cras_bt_transport_release(a2dpio->transport);
 	if (err < 0)
 		syslog(LOG_ERR, "transport_release failed");
 
 	a2dp_drain(&a2dpio->a2dp);
-	byte_buffer_destroy(a2dpio->pcm_buf);
 	cras_iodev_free_format(iodev);
 	cras_iodev_free_audio_area(iodev);
 	return 0;
@@ -212,98 +338,98 @@ static int is_open(const struct cras_iodev *iodev)
 	return cras_bt_transport_fd(a2dpio->transport) > 0;
 }
 
-static int pre_fill_socket(struct a2dp_io *a2dpio)
+static unsigned int ms_since(const struct timespec *ts,
+			     const struct timespec *now)
 {
-	static const uint16_t zero_buffer[1024 * 2];
-	int processed;
-	int written = 0;
+	struct timespec diff;
 
-	while (1) {
-		processed = a2dp_encode(
-				&a2dpio->a2dp,
-				zero_buffer,
-				sizeof(zero_buffer),
-				cras_get_format_bytes(a2dpio->base.format),
-				cras_bt_transport_write_mtu(a2dpio->transport));
-		if (processed < 0)
-			return processed;
-		if (processed == 0)
-			break;
+	subtract_timespecs(now, ts, &diff);
+	return diff.tv_sec * 1000 + diff.tv_nsec / 1000000;
+}
 
-		written = a2dp_write(
-				&a2dpio->a2dp,
-				cras_bt_transport_fd(a2dpio->transport),
-				cras_bt_transport_write_mtu(a2dpio->transport));
-		/* Full when EAGAIN is returned. */
-		if (written == -EAGAIN)
-			break;
-		else if (written < 0)
-			return written;
-		else if (written == 0)
-			break;
-	};
+/* Adapts the bitpool to the link. The socket holds two MTUs, packets are
+ * sent as soon as they are encoded, so when more than a packet is still in
+ * the socket at the next flush or the socket is full, the link isn't keeping
+ * up with the bitrate.
+ * Args:
+ *    a2dpio - The a2dp iodev.
+ *    queued - Bytes in the socket before sending, negative if unknown.
+ *    full - Set when the socket couldn't take all the packets.
+ */
+static void update_bitpool(struct a2dp_io *a2dpio, int queued, int full)
+{
+	const a2dp_sbc_t *sbc = &a2dpio->a2dp.sbc;
+	int mtu = cras_bt_transport_write_mtu(a2dpio->transport);
+	int floor = MIN(MAX(sbc->min_bitpool, BITPOOL_FLOOR), sbc->max_bitpool);
+	int bitpool = a2dpio->bitpool;
+	struct timespec now;
+
+	if (queued < 0 && !full)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (full || queued > mtu) {
+		a2dpio->last_congested = now;
+		if (ms_since(&a2dpio->last_bitpool_change, &now) >=
+				BITPOOL_LOWER_INTERVAL_MS)
+			bitpool = MAX(bitpool - BITPOOL_LOWER_STEP, floor);
+	} else if (ms_since(&a2dpio->last_congested, &now) >=
+			BITPOOL_RAISE_INTERVAL_MS &&
+		   ms_since(&a2dpio->last_bitpool_change, &now) >=
+			BITPOOL_RAISE_INTERVAL_MS) {
+		bitpool = MIN(bitpool + BITPOOL_RAISE_STEP, sbc->max_bitpool);
+	}
 
-	return 0;
+	if (bitpool == a2dpio->bitpool)
+		return;
+
+	syslog(LOG_DEBUG, "a2dp bitpool %d -> %d, %d bytes queued",
+	       a2dpio->bitpool, bitpool, queued);
+	a2dpio->bitpool = bitpool;
+	a2dpio->last_bitpool_change = now;
+	a2dp_encoder_set_bitpool(a2dpio->encoder, bitpool);
 }
 
-/* Flushes queued buffer, including pcm and a2dp buffer.
+/* Sends the packets queued by the encoder thread.
  * Returns:
  *    0 when the flush succeeded, -1 when error occurred.
  */
 static int flush_data(void *arg)
 {
 	const struct cras_iodev *iodev = (const struct cras_iodev *)arg;
-	int processed;
-	size_t format_bytes;
-	int written = 0;
+	int written;
+	int queued;
+	uint16_t seq_num;
+	uint32_t timestamp;
 	struct a2dp_io *a2dpio;
 
 	a2dpio = (struct a2dp_io *)iodev;
-	format_bytes = cras_get_format_bytes(iodev->format);
-
-encode_more:
-	while (buf_queued_bytes(a2dpio->pcm_buf)) {
-		processed = a2dp_encode(
-				&a2dpio->a2dp,
-				buf_read_pointer(a2dpio->pcm_buf),
-				buf_readable_bytes(a2dpio->pcm_buf),
-				format_bytes,
-				cras_bt_transport_write_mtu(a2dpio->transport));
-		audio_thread_event_log_data(atlog, AUDIO_THREAD_A2DP_ENCODE,
-					    processed,
-					    buf_queued_bytes(a2dpio->pcm_buf),
-					    buf_readable_bytes(a2dpio->pcm_buf)
-					    );
-		if (processed == -ENOSPC || processed == 0)
-			break;
-		if (processed < 0)
-			return 0;
 
-		buf_increment_read(a2dpio->pcm_buf, processed);
-	}
+	/* What's left of the previous flush tells how the link is doing. */
+	if (ioctl(cras_bt_transport_fd(a2dpio->transport), SIOCOUTQ,
+		  &queued) < 0)
+		queued = -1;
+	else
+		a2dpio->queued_bytes = queued;
 
-	written = a2dp_write(&a2dpio->a2dp,
-			     cras_bt_transport_fd(a2dpio->transport),
-			     cras_bt_transport_write_mtu(a2dpio->transport));
+	written = a2dp_encoder_send(a2dpio->encoder,
+				    cras_bt_transport_fd(a2dpio->transport));
+	update_bitpool(a2dpio, queued, written == -EAGAIN);
+	a2dp_encoder_last_sent(a2dpio->encoder, &seq_num, &timestamp);
 	audio_thread_event_log_data(atlog, AUDIO_THREAD_A2DP_WRITE,
 				    written,
-				    a2dp_queued_frames(&a2dpio->a2dp), 0);
+				    a2dp_encoder_queued_frames(a2dpio->encoder),
+				    seq_num);
 	if (written == -EAGAIN) {
+		/* Socket is full, send the rest when it is writable. */
 		audio_thread_enable_callback(
 				cras_bt_transport_fd(a2dpio->transport), 1);
 		return 0;
 	} else if (written < 0) {
 		if (a2dpio->force_suspend_cb)
 			a2dpio->force_suspend_cb(&a2dpio->base);
-		goto write_done;
-	} else if (written == 0) {
-		goto write_done;
 	}
 
-	if (buf_queued_bytes(a2dpio->pcm_buf))
-		goto encode_more;
-
-write_done:
 	/* everything written. */
 	audio_thread_enable_callback(
 			cras_bt_transport_fd(a2dpio->transport), 0);
@@ -320,7 +446,7 @@ static int delay_frames(const struct cras_iodev *iodev)
 {
 	const struct a2dp_io *a2dpio = (struct a2dp_io *)iodev;
 
-	/* The number of frames in the pcm buffer plus two mtu packets */
+	/* The number of frames waiting in the encoder plus two mtu packets */
 	return frames_queued(iodev)
 		+ 2 * cras_bt_transport_write_mtu(a2dpio->transport) /
 			cras_get_format_bytes(iodev->format);
@@ -331,6 +457,8 @@ static int get_buffer(struct cras_iodev *iodev,
 		      unsigned *frames)
 {
 	size_t format_bytes;
+	unsigned int writable;
+	uint8_t *buf;
 	struct a2dp_io *a2dpio;
 
 	a2dpio = (struct a2dp_io *)iodev;
@@ -340,12 +468,10 @@ static int get_buffer(struct cras_iodev *iodev,
 	if (iodev->direction != CRAS_STREAM_OUTPUT)
 		return 0;
 
-	*frames = MIN(*frames, buf_writable_bytes(a2dpio->pcm_buf) /
-					format_bytes);
+	buf = a2dp_encoder_pcm_write_pointer(a2dpio->encoder, &writable);
+	*frames = MIN(*frames, writable / format_bytes);
 	iodev->area->frames = *frames;
-	cras_audio_area_config_buf_pointers(
-			iodev->area, iodev->format,
-			buf_write_pointer(a2dpio->pcm_buf));
+	cras_audio_area_config_buf_pointers(iodev->area, iodev->format, buf);
 	*area = iodev->area;
 	return 0;
 }
@@ -359,22 +485,23 @@ static int put_buffer(struct cras_iodev *iodev, unsigned nwritten)
 	format_bytes = cras_get_format_bytes(iodev->format);
 	written_bytes = nwritten * format_bytes;
 
-	if (written_bytes > buf_writable_bytes(a2dpio->pcm_buf))
+	/* Hand the samples over to the encoder thread. */
+	if (a2dp_encoder_pcm_commit(a2dpio->encoder, written_bytes))
 		return -EINVAL;
-
-	buf_increment_write(a2dpio->pcm_buf, written_bytes);
+	audio_thread_event_log_data(atlog, AUDIO_THREAD_A2DP_ENCODE,
+				    written_bytes,
+				    a2dp_encoder_pcm_queued_bytes(a2dpio->encoder),
+				    a2dp_encoder_queued_frames(a2dpio->encoder));
 
 	bt_queued_frames(iodev, nwritten);
 
-	/* Until the minimum number of frames have been queued, don't send
-	 * anything. */
-	if (!a2dpio->pre_fill_complete) {
-		pre_fill_socket(a2dpio);
-		a2dpio->pre_fill_complete = 1;
+	if (!a2dpio->started) {
+		a2dpio->started = 1;
 		/* Start measuring frames_consumed from now. */
 		clock_gettime(CLOCK_MONOTONIC, &a2dpio->dev_open_time);
 	}
 
+	/* Send what the encoder has already finished. */
 	flush_data(iodev);
 	return 0;
 }
@@ -383,6 +510,17 @@ static void update_active_node(struct cras_iodev *iodev)
 {
 }
 
+static void fill_debug_info(const struct cras_iodev *iodev,
+			    struct audio_debug_info *info)
+{
+	const struct a2dp_io *a2dpio = (const struct a2dp_io *)iodev;
+
+	if (!a2dpio->encoder)
+		return;
+	info->output_bt_bitpool = a2dp_encoder_bitpool(a2dpio->encoder);
+	info->output_bt_queued_bytes = a2dpio->queued_bytes;
+}
+
 void free_resources(struct a2dp_io *a2dpio)
 {
 	struct cras_ionode *node;
@@ -449,6 +587,7 @@ struct cras_iodev *a2dp_iodev_create(struct cras_bt_transport *transport,
 	iodev->close_dev = close_dev;
 	iodev->update_supported_formats = update_supported_formats;
 	iodev->update_active_node = update_active_node;
+	iodev->fill_debug_info = fill_debug_info;
 	iodev->software_volume_needed = 1;
 
 	/* Create a dummy ionode */
@@ -8,10 +8,10 @@
 #include <syslog.h>
 
 #include "cras_alsa_card.h"
+#include "cras_alsa_card_probe.h"
 #include "cras_alsa_io.h"
 #include "cras_alsa_mixer.h"
 #include "cras_alsa_ucm.h"
-#include "cras_device_blacklist.h"
 #include "cras_card_config.h"
 #include "cras_config.h"
 #include "cras_iodev.h"
@@ -20,7 +20,6 @@
 #include "cras_util.h"
 #include "utlist.h"
 
-#define MAX_ALSA_CARDS 32 /* Alsa limit on number of cards. */
 #define MAX_ALSA_PCM_NAME_LENGTH 6 /* Alsa names "hw:XX" + 1 for null. */
 #define MAX_INI_NAME_LENGTH 63 /* 63 chars + 1 for null where declared. */
 
@@ -65,67 +64,48 @@ int is_first_dev(struct cras_alsa_card *alsa_card,
  *    alsa_card - the alsa_card the device will be added to.
  *    info - Information about the card type and priority.
  *    card_name - The name of the card.
- *    dev_name - The name of the device.
- *    device_index - 0 based index, value of "YY" in "hw:XX,YY".
- *    direction - Input or output.
+ *    caps - The probed device, its capability lists are moved to the iodev.
  */
 void create_iodev_for_device(struct cras_alsa_card *alsa_card,
-			     struct cras_alsa_card_info *info,
+			     const struct cras_alsa_card_info *info,
 			     const char *card_name,
-			     const char *dev_name,
-			     unsigned device_index,
-			     enum CRAS_STREAM_DIRECTION direction)
+			     struct cras_alsa_pcm_caps *caps)
 {
 	struct iodev_list_node *new_dev;
 	int first;
 
-	first = is_first_dev(alsa_card, direction);
+	first = is_first_dev(alsa_card, caps->direction);
 
 	new_dev = calloc(1, sizeof(*new_dev));
 	if (new_dev == NULL)
 		return;
 
-	new_dev->direction = direction;
+	new_dev->direction = caps->direction;
 	new_dev->iodev = alsa_iodev_create(info->card_index,
 					   card_name,
-					   device_index,
-					   dev_name,
+					   caps->device_index,
+					   caps->dev_name,
 					   info->card_type,
 					   first,
 					   alsa_card->mixer,
 					   alsa_card->ucm,
-					   direction);
+					   caps,
+					   caps->direction);
 	if (new_dev->iodev == NULL) {
-		syslog(LOG_ERR, "Couldn't create alsa_iodev for %u:%u\n",
-		       info->card_index, device_index);
+		syslog(LOG_ERR, "Couldn't create alsa_iodev for %u:%zu\n",
+		       info->card_index, caps->device_index);
 		free(new_dev);
 		return;
 	}
 
-	syslog(LOG_DEBUG, "New %s device %u:%d",
-	       direction == CRAS_STREAM_OUTPUT ? "playback" : "capture",
+	syslog(LOG_DEBUG, "New %s device %u:%zu",
+	       caps->direction == CRAS_STREAM_OUTPUT ? "playback" : "capture",
 	       info->card_index,
-	       device_index);
+	       caps->device_index);
 
 	DL_APPEND(alsa_card->iodevs, new_dev);
 }
 
-/* Check if a device should be ignored for this card. Returns non-zero if the
- * device is in the blacklist and should be ignored.
- */
-static int should_ignore_dev(struct cras_alsa_card_info *info,
-			     struct cras_device_blacklist *blacklist,
-			     size_t device_index)
-{
-	if (info->card_type == ALSA_CARD_TYPE_USB)
-		return cras_device_blacklist_check(blacklist,
-						   info->usb_vendor_id,
-						   info->usb_product_id,
-						   info->usb_desc_checksum,
-						   device_index);
-	return 0;
-}
-
 /* Filters an array of mixer control names. Keep a name if it is
  * specified in the ucm config, otherwise set it to NULL */
 static void filter_mixer_names(snd_use_case_mgr_t *ucm,
@@ -151,64 +131,46 @@ struct cras_alsa_card *cras_alsa_card_create(
 		struct cras_alsa_card_info *info,
 		struct cras_device_blacklist *blacklist)
 {
-	snd_ctl_t *handle = NULL;
-	int rc, dev_idx;
-	snd_ctl_card_info_t *card_info;
-	const char *card_name;
-	snd_pcm_info_t *dev_info;
+	struct cras_alsa_card_probe *probe;
+	struct cras_alsa_card *alsa_card;
+
+	probe = cras_alsa_card_probe_run(info, blacklist, NULL);
+	if (probe == NULL)
+		return NULL;
+	alsa_card = cras_alsa_card_create_from_probe(probe);
+	cras_alsa_card_probe_destroy(probe);
+	return alsa_card;
+}
+
+struct cras_alsa_card *cras_alsa_card_create_from_probe(
+		struct cras_alsa_card_probe *probe)
+{
 	struct cras_alsa_card *alsa_card;
 	const char *output_names_extra[] = {
 		"IEC958",
 	};
 	size_t output_names_extra_size = ARRAY_SIZE(output_names_extra);
 	char *extra_main_volume = NULL;
-
-	if (info->card_index >= MAX_ALSA_CARDS) {
-		syslog(LOG_ERR,
-		       "Invalid alsa card index %u",
-		       info->card_index);
-		return NULL;
-	}
-
-	snd_ctl_card_info_alloca(&card_info);
-	snd_pcm_info_alloca(&dev_info);
+	size_t i;
 
 	alsa_card = calloc(1, sizeof(*alsa_card));
 	if (alsa_card == NULL)
 		return NULL;
-	alsa_card->card_index = info->card_index;
+	alsa_card->card_index = probe->info.card_index;
 
 	snprintf(alsa_card->name,
 		 MAX_ALSA_PCM_NAME_LENGTH,
 		 "hw:%u",
-		 info->card_index);
-
-	rc = snd_ctl_open(&handle, alsa_card->name, 0);
-	if (rc < 0) {
-		syslog(LOG_ERR, "Fail opening control %s.", alsa_card->name);
-		goto error_bail;
-	}
-
-	rc = snd_ctl_card_info(handle, card_info);
-	if (rc < 0) {
-		syslog(LOG_ERR, "Error getting card info.");
-		goto error_bail;
-	}
-
-	card_name = snd_ctl_card_info_get_name(card_info);
-	if (card_name == NULL) {
-		syslog(LOG_ERR, "Error getting card name.");
-		goto error_bail;
-	}
+		 probe->info.card_index);
 
 	/* Read config file for this card if it exists. */
 	alsa_card->config = cras_card_config_create(CRAS_CONFIG_FILE_DIR,
-						    card_name);
+						    probe->card_name);
 	if (alsa_card->config == NULL)
 		syslog(LOG_DEBUG, "No config file for %s", alsa_card->name);
 
 	/* Create a use case manager if a configuration is available. */
-	alsa_card->ucm = ucm_create(card_name);
+	alsa_card->ucm = ucm_create(probe->card_name);
 
 	/* Filter the extra output mixer names */
 	if (alsa_card->ucm)
@@ -233,52 +195,17 @@ struct cras_alsa_card *cras_alsa_card_create(
 		goto error_bail;
 	}
 
-	dev_idx = -1;
-	while (1) {
-		rc = snd_ctl_pcm_next_device(handle, &dev_idx);
-		if (rc < 0) {
-			cras_alsa_card_destroy(alsa_card);
-			snd_ctl_close(handle);
-			return NULL;
-		}
-		if (dev_idx < 0)
-			break;
-
-		snd_pcm_info_set_device(dev_info, dev_idx);
-		snd_pcm_info_set_subdevice(dev_info, 0);
-
-		/* Check for playback devices. */
-		snd_pcm_info_set_stream(dev_info, SND_PCM_STREAM_PLAYBACK);
-		if (snd_ctl_pcm_info(handle, dev_info) == 0 &&
-		    !should_ignore_dev(info, blacklist, dev_idx))
-			create_iodev_for_device(alsa_card,
-						info,
-						card_name,
-						snd_pcm_info_get_name(dev_info),
-						dev_idx,
-						CRAS_STREAM_OUTPUT);
-
-		/* Check for capture devices. */
-		snd_pcm_info_set_stream(dev_info, SND_PCM_STREAM_CAPTURE);
-		if (snd_ctl_pcm_info(handle, dev_info) == 0)
-			create_iodev_for_device(alsa_card,
-						info,
-						card_name,
-						snd_pcm_info_get_name(dev_info),
-						dev_idx,
-						CRAS_STREAM_INPUT);
-	}
+	for (i = 0; i < probe->num_pcms; i++)
+		create_iodev_for_device(alsa_card,
+					&probe->info,
+					probe->card_name,
+					&probe->pcms[i]);
 
-	snd_ctl_close(handle);
 	return alsa_card;
 
 error_bail:
-	if (handle != NULL)
-		snd_ctl_close(handle);
 	if (alsa_card->ucm)
 		ucm_destroy(alsa_card->ucm);
-	if (alsa_card->mixer)
-		cras_alsa_mixer_destroy(alsa_card->mixer);
 	if (alsa_card->config)
 		cras_card_config_destroy(alsa_card->config);
 	free(alsa_card);
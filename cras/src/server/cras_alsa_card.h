@@ -15,6 +15,7 @@
  */
 
 struct cras_alsa_card;
+struct cras_alsa_card_probe;
 struct cras_device_blacklist;
 
 /* Creates a cras_alsa_card instance for the given alsa device.  Enumerates the
@@ -31,6 +32,19 @@ struct cras_alsa_card *cras_alsa_card_create(
 		struct cras_alsa_card_info *info,
 		struct cras_device_blacklist *blacklist);
 
+/* Creates a cras_alsa_card instance from a card probed with
+ * cras_alsa_card_probe_run.  Adds the probed devices to the system without
+ * opening them again.  Must be called on the main thread.
+ * Args:
+ *    probe - The probed card, capability lists of the devices created are
+ *        moved from it.
+ * Returns:
+ *    A pointer to the newly created cras_alsa_card which must later be freed
+ *    by calling cras_alsa_card_destroy or NULL on error.
+ */
+struct cras_alsa_card *cras_alsa_card_create_from_probe(
+		struct cras_alsa_card_probe *probe);
+
 /* Destroys a cras_alsa_card that was returned from cras_alsa_card_create.
  * Args:
  *    alsa_card - The cras_alsa_card pointer returned from
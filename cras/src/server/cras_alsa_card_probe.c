@@ -0,0 +1,719 @@
+/* Copyright (c) 2015 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#define _GNU_SOURCE /* For pipe2. */
+#include <alsa/asoundlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "cras_alsa_card_probe.h"
+#include "cras_alsa_helpers.h"
+#include "cras_device_blacklist.h"
+#include "cras_system_state.h"
+#include "cras_types.h"
+#include "utlist.h"
+
+#define MAX_ALSA_CARDS 32 /* Alsa limit on number of cards. */
+#define MAX_ALSA_PCM_NAME_LENGTH 6 /* Alsa names "hw:XX" + 1 for null. */
+#define MAX_ALSA_DEV_NAME_LENGTH 9 /* Alsa names "hw:XX,YY" + 1 for null. */
+#define PROBE_CACHE_VERSION 1
+#define PROBE_CACHE_LINE_LENGTH 256
+
+/* A card waiting to be probed, or probed and waiting to be handed back to
+ * the main thread. */
+struct probe_job {
+	struct cras_alsa_card_info info;
+	struct cras_device_blacklist *blacklist;
+	cras_alsa_card_probe_cb cb;
+	void *arg;
+	struct cras_alsa_card_probe *probe;
+	struct probe_job *prev, *next;
+};
+
+/* The worker threads.
+ * Members:
+ *    threads - The running workers.
+ *    num_threads - Number of entries in threads.
+ *    settle_us - Delay before probing each card.
+ *    cache_dir - Directory of the capability cache, or NULL.
+ *    mutex - Protects queued, done and stopping.
+ *    cond - Signaled when a job is queued or the pool is stopping.
+ *    queued - Cards not picked up by a worker yet.
+ *    done - Probed cards for the main thread.
+ *    done_fds - Pipe written once per done job, the read side is in the
+ *        main loop.
+ *    running - Set while the workers are running.
+ *    stopping - Tells the workers to exit.
+ */
+static struct {
+	pthread_t *threads;
+	unsigned int num_threads;
+	unsigned int settle_us;
+	char *cache_dir;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	struct probe_job *queued;
+	struct probe_job *done;
+	int done_fds[2];
+	int running;
+	int stopping;
+} pool = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
+
+/* Check if a device should be ignored for this card. Returns non-zero if the
+ * device is in the blacklist and should be ignored.
+ */
+static int should_ignore_dev(const struct cras_alsa_card_info *info,
+			     struct cras_device_blacklist *blacklist,
+			     size_t device_index)
+{
+	if (info->card_type == ALSA_CARD_TYPE_USB)
+		return cras_device_blacklist_check(blacklist,
+						   info->usb_vendor_id,
+						   info->usb_product_id,
+						   info->usb_desc_checksum,
+						   device_index);
+	return 0;
+}
+
+/* Copies a card or device name, truncated to fit the probe. */
+static void copy_name(char *dst, const char *src)
+{
+	size_t len = strnlen(src, CRAS_ALSA_PROBE_NAME_LENGTH - 1);
+
+	memcpy(dst, src, len);
+	dst[len] = '\0';
+}
+
+static void free_caps(struct cras_alsa_pcm_caps *caps)
+{
+	free(caps->rates);
+	free(caps->channel_counts);
+	free(caps->formats);
+}
+
+static void free_pcms(struct cras_alsa_card_probe *probe)
+{
+	size_t i;
+
+	for (i = 0; i < probe->num_pcms; i++)
+		free_caps(&probe->pcms[i]);
+	free(probe->pcms);
+	probe->pcms = NULL;
+	probe->num_pcms = 0;
+}
+
+/* Appends an empty entry to the PCM list of the probe. */
+static struct cras_alsa_pcm_caps *add_pcm(struct cras_alsa_card_probe *probe,
+					  size_t device_index,
+					  enum CRAS_STREAM_DIRECTION direction,
+					  const char *dev_name)
+{
+	struct cras_alsa_pcm_caps *pcms, *caps;
+
+	pcms = realloc(probe->pcms, (probe->num_pcms + 1) * sizeof(*pcms));
+	if (!pcms)
+		return NULL;
+	probe->pcms = pcms;
+	caps = &pcms[probe->num_pcms++];
+	memset(caps, 0, sizeof(*caps));
+	caps->device_index = device_index;
+	caps->direction = direction;
+	if (dev_name)
+		copy_name(caps->dev_name, dev_name);
+	return caps;
+}
+
+static int caps_valid(const struct cras_alsa_pcm_caps *caps)
+{
+	return caps->rates && caps->rates[0] &&
+	       caps->channel_counts && caps->channel_counts[0] &&
+	       caps->formats && caps->formats[0];
+}
+
+/*
+ * Capability cache.  One text file per USB device:
+ *
+ *   version 1
+ *   card <card name>
+ *   pcm <device index> <output|input> <device name>
+ *   rates <rate> ...
+ *   channels <count> ...
+ *   formats <snd_pcm_format_t> ...
+ *
+ * with the last four lines repeated for each PCM.
+ */
+
+/* Only USB cards with a descriptor checksum have a key for the cache. */
+static int cache_usable(const struct cras_alsa_card_info *info)
+{
+	return info->card_type == ALSA_CARD_TYPE_USB &&
+	       info->usb_desc_checksum != 0;
+}
+
+static int cache_path(char *path, size_t len, const char *cache_dir,
+		      const struct cras_alsa_card_info *info)
+{
+	int rc;
+
+	rc = snprintf(path, len, "%s/usb-%04x-%04x-%08x", cache_dir,
+		      info->usb_vendor_id, info->usb_product_id,
+		      info->usb_desc_checksum);
+	return rc < 0 || (size_t)rc >= len ? -ENAMETOOLONG : 0;
+}
+
+static void cache_write_list(FILE *f, const char *name, const size_t *list)
+{
+	fprintf(f, "%s", name);
+	while (*list)
+		fprintf(f, " %zu", *list++);
+	fprintf(f, "\n");
+}
+
+static void cache_save(const struct cras_alsa_card_probe *probe,
+		       const char *cache_dir)
+{
+	char path[PATH_MAX];
+	char tmp_path[PATH_MAX];
+	const struct cras_alsa_pcm_caps *caps;
+	const snd_pcm_format_t *fmt;
+	FILE *f;
+	size_t i;
+
+	if (cache_path(path, sizeof(path), cache_dir, &probe->info))
+		return;
+	/* Identical devices can be probed at the same time, each writes its
+	 * own file and moves it in place. */
+	if (snprintf(tmp_path, sizeof(tmp_path), "%s.%u", path,
+		     probe->info.card_index) >= sizeof(tmp_path))
+		return;
+
+	f = fopen(tmp_path, "w");
+	if (!f) {
+		syslog(LOG_DEBUG, "Can't write probe cache %s", tmp_path);
+		return;
+	}
+
+	fprintf(f, "version %d\n", PROBE_CACHE_VERSION);
+	fprintf(f, "card %s\n", probe->card_name);
+	for (i = 0; i < probe->num_pcms; i++) {
+		caps = &probe->pcms[i];
+		fprintf(f, "pcm %zu %s %s\n", caps->device_index,
+			caps->direction == CRAS_STREAM_OUTPUT ?
+				"output" : "input",
+			caps->dev_name);
+		cache_write_list(f, "rates", caps->rates);
+		cache_write_list(f, "channels", caps->channel_counts);
+		fprintf(f, "formats");
+		for (fmt = caps->formats; *fmt; fmt++)
+			fprintf(f, " %d", *fmt);
+		fprintf(f, "\n");
+	}
+
+	if (fclose(f) != 0 || rename(tmp_path, path) != 0) {
+		syslog(LOG_WARNING, "Failed to save probe cache %s", path);
+		unlink(tmp_path);
+	}
+}
+
+/* Parses a space separated list of non-zero numbers into a zero terminated
+ * array. */
+static int cache_parse_list(const char *s, size_t **list)
+{
+	size_t *l;
+	size_t n = 0;
+	unsigned long v;
+	char *end;
+
+	/* Each number takes at least two characters with its separator. */
+	l = calloc(strlen(s) / 2 + 2, sizeof(*l));
+	if (!l)
+		return -ENOMEM;
+
+	while (1) {
+		v = strtoul(s, &end, 10);
+		if (end == s)
+			break;
+		if (v == 0) {
+			free(l);
+			return -EINVAL;
+		}
+		l[n++] = v;
+		s = end;
+	}
+	if (n == 0 || s[strspn(s, " ")] != '\0') {
+		free(l);
+		return -EINVAL;
+	}
+
+	free(*list);
+	*list = l;
+	return 0;
+}
+
+static int cache_parse_formats(const char *s, snd_pcm_format_t **formats)
+{
+	size_t *list = NULL;
+	size_t i, n;
+	int rc;
+
+	rc = cache_parse_list(s, &list);
+	if (rc)
+		return rc;
+	for (n = 0; list[n]; n++)
+		;
+	free(*formats);
+	*formats = calloc(n + 1, sizeof(**formats));
+	if (!*formats) {
+		free(list);
+		return -ENOMEM;
+	}
+	for (i = 0; i < n; i++)
+		(*formats)[i] = (snd_pcm_format_t)list[i];
+	free(list);
+	return 0;
+}
+
+static int cache_parse_pcm(struct cras_alsa_card_probe *probe,
+			   const char *s)
+{
+	size_t device_index;
+	char dir[8];
+	int name_pos = 0;
+
+	if (sscanf(s, "%zu %7s %n", &device_index, dir, &name_pos) != 2 ||
+	    name_pos == 0)
+		return -EINVAL;
+	if (strcmp(dir, "output") == 0)
+		return add_pcm(probe, device_index, CRAS_STREAM_OUTPUT,
+			       s + name_pos) ? 0 : -ENOMEM;
+	if (strcmp(dir, "input") == 0)
+		return add_pcm(probe, device_index, CRAS_STREAM_INPUT,
+			       s + name_pos) ? 0 : -ENOMEM;
+	return -EINVAL;
+}
+
+static int cache_load(struct cras_alsa_card_probe *probe,
+		      struct cras_device_blacklist *blacklist,
+		      const char *cache_dir)
+{
+	char path[PATH_MAX];
+	char line[PROBE_CACHE_LINE_LENGTH];
+	struct cras_alsa_pcm_caps *caps;
+	int version = 0;
+	size_t i;
+	FILE *f;
+	int rc = 0;
+
+	if (cache_path(path, sizeof(path), cache_dir, &probe->info))
+		return -ENAMETOOLONG;
+	f = fopen(path, "r");
+	if (!f)
+		return -ENOENT;
+
+	while (rc == 0 && fgets(line, sizeof(line), f)) {
+		line[strcspn(line, "\n")] = '\0';
+		caps = probe->num_pcms ? &probe->pcms[probe->num_pcms - 1]
+				       : NULL;
+
+		if (sscanf(line, "version %d", &version) == 1)
+			continue;
+		if (strncmp(line, "card ", 5) == 0)
+			copy_name(probe->card_name, line + 5);
+		else if (strncmp(line, "pcm ", 4) == 0)
+			rc = cache_parse_pcm(probe, line + 4);
+		else if (caps && strncmp(line, "rates ", 6) == 0)
+			rc = cache_parse_list(line + 6, &caps->rates);
+		else if (caps && strncmp(line, "channels ", 9) == 0)
+			rc = cache_parse_list(line + 9,
+					      &caps->channel_counts);
+		else if (caps && strncmp(line, "formats ", 8) == 0)
+			rc = cache_parse_formats(line + 8, &caps->formats);
+		else
+			rc = -EINVAL;
+	}
+	fclose(f);
+
+	if (rc == 0 && (version != PROBE_CACHE_VERSION ||
+			probe->card_name[0] == '\0'))
+		rc = -EINVAL;
+	for (i = 0; rc == 0 && i < probe->num_pcms; i++) {
+		caps = &probe->pcms[i];
+		if (!caps_valid(caps))
+			rc = -EINVAL;
+		/* Blacklisted devices are never cached, a device that was
+		 * blacklisted since the cache was written needs a probe. */
+		else if (caps->direction == CRAS_STREAM_OUTPUT &&
+			 should_ignore_dev(&probe->info, blacklist,
+					   caps->device_index))
+			rc = -EINVAL;
+	}
+
+	if (rc) {
+		syslog(LOG_WARNING, "Ignoring probe cache %s", path);
+		free_pcms(probe);
+		memset(probe->card_name, 0, sizeof(probe->card_name));
+	}
+	return rc;
+}
+
+/*
+ * Probing from ALSA.
+ */
+
+/* Opens the PCM to find its capabilities, it is left out of the probe if it
+ * can't be opened or doesn't support anything. */
+static void probe_pcm(struct cras_alsa_card_probe *probe,
+		      size_t device_index,
+		      enum CRAS_STREAM_DIRECTION direction,
+		      const char *dev_name)
+{
+	struct cras_alsa_pcm_caps *caps;
+	char dev[MAX_ALSA_DEV_NAME_LENGTH];
+	int rc;
+
+	caps = add_pcm(probe, device_index, direction, dev_name);
+	if (!caps)
+		return;
+
+	snprintf(dev, sizeof(dev), "hw:%u,%zu", probe->info.card_index,
+		 device_index);
+	rc = cras_alsa_fill_properties(dev,
+				       direction == CRAS_STREAM_OUTPUT ?
+						SND_PCM_STREAM_PLAYBACK :
+						SND_PCM_STREAM_CAPTURE,
+				       &caps->rates,
+				       &caps->channel_counts,
+				       &caps->formats);
+	if (rc < 0 || !caps_valid(caps)) {
+		syslog(LOG_ERR, "Couldn't probe %s: %s", dev,
+		       rc < 0 ? strerror(-rc) : "no supported format");
+		free_caps(caps);
+		probe->num_pcms--;
+	}
+}
+
+/* Reads the card name and probes each PCM device of the card. Sets
+ * skipped_dev if a device was left out because of the blacklist. */
+static int probe_alsa(struct cras_alsa_card_probe *probe,
+		      struct cras_device_blacklist *blacklist,
+		      int *skipped_dev)
+{
+	snd_ctl_t *handle = NULL;
+	snd_ctl_card_info_t *card_info;
+	snd_pcm_info_t *dev_info;
+	char name[MAX_ALSA_PCM_NAME_LENGTH];
+	const char *card_name;
+	int rc, dev_idx;
+
+	snd_ctl_card_info_alloca(&card_info);
+	snd_pcm_info_alloca(&dev_info);
+
+	snprintf(name, sizeof(name), "hw:%u", probe->info.card_index);
+	rc = snd_ctl_open(&handle, name, 0);
+	if (rc < 0) {
+		syslog(LOG_ERR, "Fail opening control %s.", name);
+		return rc;
+	}
+
+	rc = snd_ctl_card_info(handle, card_info);
+	if (rc < 0) {
+		syslog(LOG_ERR, "Error getting card info.");
+		goto done;
+	}
+
+	card_name = snd_ctl_card_info_get_name(card_info);
+	if (card_name == NULL) {
+		syslog(LOG_ERR, "Error getting card name.");
+		rc = -EINVAL;
+		goto done;
+	}
+	copy_name(probe->card_name, card_name);
+
+	dev_idx = -1;
+	while (1) {
+		rc = snd_ctl_pcm_next_device(handle, &dev_idx);
+		if (rc < 0)
+			goto done;
+		if (dev_idx < 0)
+			break;
+
+		snd_pcm_info_set_device(dev_info, dev_idx);
+		snd_pcm_info_set_subdevice(dev_info, 0);
+
+		/* Check for playback devices. */
+		snd_pcm_info_set_stream(dev_info, SND_PCM_STREAM_PLAYBACK);
+		if (snd_ctl_pcm_info(handle, dev_info) == 0) {
+			if (should_ignore_dev(&probe->info, blacklist,
+					      dev_idx))
+				*skipped_dev = 1;
+			else
+				probe_pcm(probe, dev_idx, CRAS_STREAM_OUTPUT,
+					  snd_pcm_info_get_name(dev_info));
+		}
+
+		/* Check for capture devices. */
+		snd_pcm_info_set_stream(dev_info, SND_PCM_STREAM_CAPTURE);
+		if (snd_ctl_pcm_info(handle, dev_info) == 0)
+			probe_pcm(probe, dev_idx, CRAS_STREAM_INPUT,
+				  snd_pcm_info_get_name(dev_info));
+	}
+	rc = 0;
+
+done:
+	snd_ctl_close(handle);
+	return rc;
+}
+
+/*
+ * Worker pool.
+ */
+
+static void *probe_worker(void *arg)
+{
+	struct probe_job *job;
+	const char token = 0;
+
+	pthread_mutex_lock(&pool.mutex);
+	while (1) {
+		while (!pool.queued && !pool.stopping)
+			pthread_cond_wait(&pool.cond, &pool.mutex);
+		if (pool.stopping)
+			break;
+		job = pool.queued;
+		DL_DELETE(pool.queued, job);
+		pthread_mutex_unlock(&pool.mutex);
+
+		if (pool.settle_us)
+			usleep(pool.settle_us);
+		job->probe = cras_alsa_card_probe_run(&job->info,
+						      job->blacklist,
+						      pool.cache_dir);
+
+		pthread_mutex_lock(&pool.mutex);
+		DL_APPEND(pool.done, job);
+		/* A full pipe already has the main thread woken up. */
+		if (write(pool.done_fds[1], &token, 1) < 0 && errno != EAGAIN)
+			syslog(LOG_ERR, "Failed to signal probe done: %d",
+			       errno);
+	}
+	pthread_mutex_unlock(&pool.mutex);
+	return NULL;
+}
+
+/* Runs the callbacks of the jobs in the list and frees them. */
+static void run_callbacks(struct probe_job *jobs)
+{
+	struct probe_job *job;
+
+	while ((job = jobs)) {
+		DL_DELETE(jobs, job);
+		job->cb(job->probe, job->arg);
+		free(job);
+	}
+}
+
+/* Called in the main loop when workers have finished probing cards. */
+static void probe_done_callback(void *arg)
+{
+	struct probe_job *done;
+	char buf[16];
+
+	while (read(pool.done_fds[0], buf, sizeof(buf)) > 0)
+		;
+
+	pthread_mutex_lock(&pool.mutex);
+	done = pool.done;
+	pool.done = NULL;
+	pthread_mutex_unlock(&pool.mutex);
+
+	run_callbacks(done);
+}
+
+/*
+ * Exported Interface.
+ */
+
+struct cras_alsa_card_probe *cras_alsa_card_probe_run(
+		const struct cras_alsa_card_info *info,
+		struct cras_device_blacklist *blacklist,
+		const char *cache_dir)
+{
+	struct cras_alsa_card_probe *probe;
+	int skipped_dev = 0;
+
+	if (info->card_index >= MAX_ALSA_CARDS) {
+		syslog(LOG_ERR,
+		       "Invalid alsa card index %u",
+		       info->card_index);
+		return NULL;
+	}
+
+	probe = calloc(1, sizeof(*probe));
+	if (probe == NULL)
+		return NULL;
+	probe->info = *info;
+
+	if (cache_dir && cache_usable(info) &&
+	    cache_load(probe, blacklist, cache_dir) == 0) {
+		probe->from_cache = 1;
+		return probe;
+	}
+
+	if (probe_alsa(probe, blacklist, &skipped_dev)) {
+		cras_alsa_card_probe_destroy(probe);
+		return NULL;
+	}
+
+	if (cache_dir && cache_usable(info) && !skipped_dev)
+		cache_save(probe, cache_dir);
+	return probe;
+}
+
+void cras_alsa_card_probe_destroy(struct cras_alsa_card_probe *probe)
+{
+	if (probe == NULL)
+		return;
+	free_pcms(probe);
+	free(probe);
+}
+
+int cras_alsa_card_probe_pool_start(unsigned int num_workers,
+				    unsigned int settle_us,
+				    const char *cache_dir)
+{
+	unsigned int i;
+	int rc;
+
+	if (pool.running)
+		return -EEXIST;
+	if (num_workers == 0)
+		return -EINVAL;
+
+	if (cache_dir && mkdir(cache_dir, 0755) && errno != EEXIST)
+		syslog(LOG_WARNING, "Can't create probe cache dir %s: %d",
+		       cache_dir, errno);
+
+	if (pipe2(pool.done_fds, O_NONBLOCK | O_CLOEXEC))
+		return -errno;
+	rc = cras_system_add_select_fd(pool.done_fds[0], probe_done_callback,
+				       NULL);
+	if (rc < 0)
+		goto close_pipe;
+
+	pool.threads = calloc(num_workers, sizeof(*pool.threads));
+	if (!pool.threads) {
+		rc = -ENOMEM;
+		goto rm_fd;
+	}
+	pool.cache_dir = cache_dir ? strdup(cache_dir) : NULL;
+	pool.settle_us = settle_us;
+	pool.stopping = 0;
+
+	/* Run with fewer workers if some of them can't be started. */
+	for (i = 0; i < num_workers; i++) {
+		rc = pthread_create(&pool.threads[pool.num_threads], NULL,
+				    probe_worker, NULL);
+		if (rc) {
+			syslog(LOG_ERR, "Failed to start probe worker: %d",
+			       rc);
+			rc = -rc;
+			break;
+		}
+		pool.num_threads++;
+	}
+	if (pool.num_threads == 0) {
+		free(pool.threads);
+		pool.threads = NULL;
+		free(pool.cache_dir);
+		pool.cache_dir = NULL;
+		goto rm_fd;
+	}
+
+	pool.running = 1;
+	return 0;
+
+rm_fd:
+	cras_system_rm_select_fd(pool.done_fds[0]);
+close_pipe:
+	close(pool.done_fds[0]);
+	close(pool.done_fds[1]);
+	return rc;
+}
+
+void cras_alsa_card_probe_pool_stop()
+{
+	struct probe_job *done, *queued;
+	unsigned int i;
+
+	if (!pool.running)
+		return;
+
+	pthread_mutex_lock(&pool.mutex);
+	pool.stopping = 1;
+	pthread_cond_broadcast(&pool.cond);
+	pthread_mutex_unlock(&pool.mutex);
+
+	/* Workers finish the card they are probing before exiting. */
+	for (i = 0; i < pool.num_threads; i++)
+		pthread_join(pool.threads[i], NULL);
+	free(pool.threads);
+	pool.threads = NULL;
+	pool.num_threads = 0;
+
+	cras_system_rm_select_fd(pool.done_fds[0]);
+	close(pool.done_fds[0]);
+	close(pool.done_fds[1]);
+	free(pool.cache_dir);
+	pool.cache_dir = NULL;
+	pool.running = 0;
+
+	done = pool.done;
+	queued = pool.queued;
+	pool.done = NULL;
+	pool.queued = NULL;
+	run_callbacks(done);
+	run_callbacks(queued);
+}
+
+int cras_alsa_card_probe_pool_running()
+{
+	return pool.running;
+}
+
+int cras_alsa_card_probe_queue(const struct cras_alsa_card_info *info,
+			       struct cras_device_blacklist *blacklist,
+			       cras_alsa_card_probe_cb cb,
+			       void *arg)
+{
+	struct probe_job *job;
+
+	if (!pool.running)
+		return -ENODEV;
+
+	job = calloc(1, sizeof(*job));
+	if (!job)
+		return -ENOMEM;
+	job->info = *info;
+	job->blacklist = blacklist;
+	job->cb = cb;
+	job->arg = arg;
+
+	pthread_mutex_lock(&pool.mutex);
+	DL_APPEND(pool.queued, job);
+	pthread_cond_signal(&pool.cond);
+	pthread_mutex_unlock(&pool.mutex);
+	return 0;
+}
@@ -0,0 +1,120 @@
+/* Copyright (c) 2015 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef _CRAS_ALSA_CARD_PROBE_H
+#define _CRAS_ALSA_CARD_PROBE_H
+
+#include <alsa/asoundlib.h>
+
+#include "cras_types.h"
+
+/* Probing a card enumerates its PCM devices and opens each of them to find
+ * the supported rates, channel counts and formats.  None of that touches the
+ * main loop state, so it can run on worker threads, leaving the mixer, UCM,
+ * jacks and iodev list work for the main thread once the probe is done.
+ * Results for USB cards are cached on disk keyed by vendor, product and the
+ * checksum of the USB descriptors, so a known device doesn't need to open
+ * its PCMs again when it is plugged in.
+ */
+
+#define CRAS_ALSA_PROBE_NAME_LENGTH 80
+
+struct cras_device_blacklist;
+
+/* Capabilities of one PCM device.
+ * device_index - 0 based index, value of "YY" in "hw:XX,YY".
+ * direction - Input or output.
+ * dev_name - The name of the device.
+ * rates, channel_counts, formats - Zero terminated lists, as filled by
+ *     cras_alsa_fill_properties.  Can be handed over to the iodev, in which
+ *     case they are set to NULL.
+ */
+struct cras_alsa_pcm_caps {
+	size_t device_index;
+	enum CRAS_STREAM_DIRECTION direction;
+	char dev_name[CRAS_ALSA_PROBE_NAME_LENGTH];
+	size_t *rates;
+	size_t *channel_counts;
+	snd_pcm_format_t *formats;
+};
+
+/* The result of probing a card.
+ * info - The card info the probe was started with.
+ * card_name - The name of the card.
+ * num_pcms - Number of entries in pcms.
+ * pcms - The usable PCM devices of the card, blacklisted ones are left out.
+ * from_cache - Non-zero if the result was read from the cache.
+ */
+struct cras_alsa_card_probe {
+	struct cras_alsa_card_info info;
+	char card_name[CRAS_ALSA_PROBE_NAME_LENGTH];
+	size_t num_pcms;
+	struct cras_alsa_pcm_caps *pcms;
+	int from_cache;
+};
+
+/* Called on the main thread when a queued probe is done.
+ * Args:
+ *    probe - The result, owned by the callback, or NULL if probing failed
+ *        or the pool was stopped before the card was probed.
+ *    arg - The argument passed to cras_alsa_card_probe_queue.
+ */
+typedef void (*cras_alsa_card_probe_cb)(struct cras_alsa_card_probe *probe,
+					void *arg);
+
+/* Probes a card on the calling thread.
+ * Args:
+ *    info - Contains the card index, type, and USB ids.
+ *    blacklist - List of devices that should be ignored.
+ *    cache_dir - Directory of the capability cache, NULL to not use it.
+ * Returns:
+ *    The probe result, free it with cras_alsa_card_probe_destroy.  NULL on
+ *    error.
+ */
+struct cras_alsa_card_probe *cras_alsa_card_probe_run(
+		const struct cras_alsa_card_info *info,
+		struct cras_device_blacklist *blacklist,
+		const char *cache_dir);
+
+/* Frees a probe result and the capability lists still attached to it. */
+void cras_alsa_card_probe_destroy(struct cras_alsa_card_probe *probe);
+
+/* Starts the worker threads that probe queued cards.
+ * Args:
+ *    num_workers - Number of threads.
+ *    settle_us - Time to wait before probing a card, to let ALSA finish
+ *        setting it up.
+ *    cache_dir - Directory of the capability cache, NULL to not use it.
+ * Returns:
+ *    0 on success, negative error code on failure.
+ */
+int cras_alsa_card_probe_pool_start(unsigned int num_workers,
+				    unsigned int settle_us,
+				    const char *cache_dir);
+
+/* Stops the worker threads.  Results that are ready are handed to their
+ * callbacks, and callbacks of cards that were not probed yet are run with a
+ * NULL probe. */
+void cras_alsa_card_probe_pool_stop();
+
+/* Returns non-zero if the worker threads are running. */
+int cras_alsa_card_probe_pool_running();
+
+/* Queues a card to be probed by the worker threads.
+ * Args:
+ *    info - Contains the card index, type, and USB ids.
+ *    blacklist - List of devices that should be ignored, must stay valid
+ *        until the callback runs.
+ *    cb - Called on the main thread with the result.
+ *    arg - Passed to cb.
+ * Returns:
+ *    0 if queued, -ENODEV if the pool isn't running or -ENOMEM.
+ */
+int cras_alsa_card_probe_queue(const struct cras_alsa_card_info *info,
+			       struct cras_device_blacklist *blacklist,
+			       cras_alsa_card_probe_cb cb,
+			       void *arg);
+
+#endif /* _CRAS_ALSA_CARD_PROBE_H */
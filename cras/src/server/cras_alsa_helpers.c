@@ -254,6 +254,16 @@ int cras_alsa_pcm_drain(snd_pcm_t *handle)
 	return snd_pcm_drain(handle);
 }
 
+int cras_alsa_pcm_stop(snd_pcm_t *handle)
+{
+	int rc;
+
+	rc = snd_pcm_drop(handle);
+	if (rc < 0)
+		return rc;
+	return snd_pcm_prepare(handle);
+}
+
 int cras_alsa_set_channel_map(snd_pcm_t *handle,
 			      struct cras_audio_format *fmt)
 {
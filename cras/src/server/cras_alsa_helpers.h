@@ -73,6 +73,16 @@ int cras_alsa_pcm_start(snd_pcm_t *handle);
  */
 int cras_alsa_pcm_drain(snd_pcm_t *handle);
 
+/* Stops an alsa device and drops the queued samples, leaving it prepared so
+ * it can be started again without setting the parameters.
+ * Args:
+ *    handle - Filled with a pointer to the opened pcm.
+ * Returns:
+ *    0 on success, negative error code from snd_pcm_drop or snd_pcm_prepare
+ *    on failure.
+ */
+int cras_alsa_pcm_stop(snd_pcm_t *handle);
+
 /* Probes properties of the alsa device.
  * Args:
  *    dev - Path to the alsa device to test.
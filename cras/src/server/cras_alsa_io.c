@@ -15,6 +15,7 @@
 #include <syslog.h>
 #include <time.h>
 
+#include "cras_alsa_card_probe.h"
 #include "cras_alsa_helpers.h"
 #include "cras_alsa_io.h"
 #include "cras_alsa_jack.h"
@@ -209,6 +210,25 @@ static int open_dev(struct cras_iodev *iodev)
 	return 0;
 }
 
+/* Stops playback and leaves the pcm prepared with the current parameters, the
+ * next stream only has to fill the buffer before dev_running starts it. */
+static int standby_dev(struct cras_iodev *iodev)
+{
+	struct alsa_io *aio = (struct alsa_io *)iodev;
+	int rc;
+
+	if (!aio->handle || aio->alsa_stream != SND_PCM_STREAM_PLAYBACK)
+		return -EINVAL;
+
+	rc = cras_alsa_pcm_stop(aio->handle);
+	if (rc < 0) {
+		syslog(LOG_ERR, "Standby error: %s", snd_strerror(rc));
+		return rc;
+	}
+	cras_iodev_reset_rate_estimator(iodev);
+	return 0;
+}
+
 static int is_open(const struct cras_iodev *iodev)
 {
 	struct alsa_io *aio = (struct alsa_io *)iodev;
@@ -1004,6 +1024,7 @@ struct cras_iodev *alsa_iodev_create(size_t card_index,
 				     int is_first,
 				     struct cras_alsa_mixer *mixer,
 				     snd_use_case_mgr_t *ucm,
+				     struct cras_alsa_pcm_caps *caps,
 				     enum CRAS_STREAM_DIRECTION direction)
 {
 	struct alsa_io *aio;
@@ -1040,6 +1061,7 @@ struct cras_iodev *alsa_iodev_create(size_t card_index,
 		aio->alsa_stream = SND_PCM_STREAM_PLAYBACK;
 		aio->base.set_volume = set_alsa_volume;
 		aio->base.set_mute = set_alsa_volume;
+		aio->base.standby_dev = standby_dev;
 	}
 	iodev->open_dev = open_dev;
 	iodev->close_dev = close_dev;
@@ -1056,10 +1078,21 @@ struct cras_iodev *alsa_iodev_create(size_t card_index,
 	if (card_type == ALSA_CARD_TYPE_USB)
 		iodev->min_buffer_level = USB_EXTRA_BUFFER_FRAMES;
 
-	err = cras_alsa_fill_properties(aio->dev, aio->alsa_stream,
-					&iodev->supported_rates,
-					&iodev->supported_channel_counts,
-					&iodev->supported_formats);
+	if (caps) {
+		/* Probed when the card was added, maybe on another thread. */
+		iodev->supported_rates = caps->rates;
+		iodev->supported_channel_counts = caps->channel_counts;
+		iodev->supported_formats = caps->formats;
+		caps->rates = NULL;
+		caps->channel_counts = NULL;
+		caps->formats = NULL;
+		err = 0;
+	} else {
+		err = cras_alsa_fill_properties(aio->dev, aio->alsa_stream,
+						&iodev->supported_rates,
+						&iodev->supported_channel_counts,
+						&iodev->supported_formats);
+	}
 	if (err < 0 || iodev->supported_rates[0] == 0 ||
 	    iodev->supported_channel_counts[0] == 0 ||
 	    iodev->supported_formats[0] == 0) {
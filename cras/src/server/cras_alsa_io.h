@@ -13,6 +13,7 @@
 
 struct cras_alsa_mixer;
 struct cras_alsa_mixer_output;
+struct cras_alsa_pcm_caps;
 struct cras_ionode;
 
 /* Initializes an alsa iodev.
@@ -25,6 +26,8 @@ struct cras_ionode;
  *    is_first - if this is the first iodev on the card.
  *    mixer - The mixer for the alsa device.
  *    ucm - ALSA use case manager if available.
+ *    caps - Capabilities found when the card was probed, the lists are moved
+ *        to the iodev.  NULL to open the device and probe them now.
  *    direciton - input or output.
  * Returns:
  *    A pointer to the newly created iodev if successful, NULL otherwise.
@@ -37,6 +40,7 @@ struct cras_iodev *alsa_iodev_create(size_t card_index,
 				     int is_first,
 				     struct cras_alsa_mixer *mixer,
 				     snd_use_case_mgr_t *ucm,
+				     struct cras_alsa_pcm_caps *caps,
 				     enum CRAS_STREAM_DIRECTION direction);
 
 /* Destroys an alsa_iodev created with alsa_iodev_create. */
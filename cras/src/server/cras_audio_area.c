@@ -22,6 +22,40 @@ struct cras_audio_area *cras_audio_area_create(int num_channels)
 	return area;
 }
 
+/* Checks if the channels of an area are interleaved, one after the other in
+ * each frame with nothing in between. */
+static int area_interleaved(const struct cras_audio_area *area,
+			    unsigned int sample_bytes)
+{
+	unsigned int i;
+
+	for (i = 0; i < area->num_channels; i++) {
+		if (area->channels[i].step_bytes !=
+				area->num_channels * sample_bytes ||
+		    area->channels[i].buf !=
+				area->channels[0].buf + i * sample_bytes)
+			return 0;
+	}
+	return 1;
+}
+
+/* Checks if src and dst hold the same channels in the same order, so the
+ * frames can be copied as they are. */
+static int same_interleaved_layout(const struct cras_audio_area *dst,
+				   const struct cras_audio_area *src,
+				   unsigned int sample_bytes)
+{
+	unsigned int i;
+
+	if (src->num_channels != dst->num_channels)
+		return 0;
+	for (i = 0; i < src->num_channels; i++)
+		if (src->channels[i].ch_set != dst->channels[i].ch_set)
+			return 0;
+	return area_interleaved(src, sample_bytes) &&
+	       area_interleaved(dst, sample_bytes);
+}
+
 unsigned int cras_audio_area_copy(const struct cras_audio_area *dst,
 				  unsigned int dst_offset,
 				  const struct cras_audio_format *dst_fmt,
@@ -32,10 +66,22 @@ unsigned int cras_audio_area_copy(const struct cras_audio_area *dst,
 	unsigned int src_idx, dst_idx;
 	unsigned int ncopy;
 	unsigned int dst_format_bytes = cras_get_format_bytes(dst_fmt);
+	unsigned int sample_bytes = dst_format_bytes / dst_fmt->num_channels;
 	uint8_t *schan, *dchan;
 
 	ncopy = MIN(src->frames - src_offset, dst->frames - dst_offset);
 
+	/* Same channels in both, a memcpy or one add over all the samples. */
+	if (same_interleaved_layout(dst, src, sample_bytes)) {
+		schan = src->channels[0].buf +
+			src_offset * src->channels[0].step_bytes;
+		dchan = dst->channels[0].buf +
+			dst_offset * dst->channels[0].step_bytes;
+		cras_mix_add(dst_fmt->format, dchan, schan,
+			     ncopy * dst->num_channels, skip_zero, 0, 1.0);
+		return ncopy;
+	}
+
 	/* TODO(dgreid) - make it so this isn't needed, can copy first stream of
 	 * each channel. */
 	if (!skip_zero)
@@ -43,7 +89,6 @@ unsigned int cras_audio_area_copy(const struct cras_audio_area *dst,
 				dst_offset * dst->channels[0].step_bytes, 0,
 		       ncopy * dst_format_bytes);
 
-	/* TODO(dgreid) - this replaces a memcpy, it needs to be way faster. */
 	for (src_idx = 0; src_idx < src->num_channels; src_idx++) {
 
 		for (dst_idx = 0; dst_idx < dst->num_channels; dst_idx++) {
@@ -11,6 +11,7 @@
 #include <string.h>
 #include <sys/socket.h>
 #include <syslog.h>
+#include <unistd.h>
 
 #include "audio_thread.h"
 #include "cras_bt_adapter.h"
@@ -26,6 +27,13 @@
 #include "utlist.h"
 
 #define BTPROTO_SCO 2
+#define SOL_BLUETOOTH 274
+#define BT_VOICE 11
+#define BT_VOICE_TRANSPARENT 0x0003
+
+struct bt_voice {
+	uint16_t setting;
+};
 
 
 struct cras_bt_device {
@@ -454,11 +462,12 @@ static int bt_address(const char *str, struct sockaddr *addr)
 	return 0;
 }
 
-int cras_bt_device_sco_connect(struct cras_bt_device *device)
+int cras_bt_device_sco_connect(struct cras_bt_device *device, int codec)
 {
 	int sk, err;
 	struct sockaddr addr;
 	struct cras_bt_adapter *adapter;
+	struct bt_voice voice;
 
 	adapter = cras_bt_device_adapter(device);
 
@@ -478,6 +487,18 @@ int cras_bt_device_sco_connect(struct cras_bt_device *device)
 		goto error;
 	}
 
+	/* mSBC frames are encoded here, the controller must not touch the
+	 * data. */
+	if (codec == HFP_CODEC_ID_MSBC) {
+		voice.setting = BT_VOICE_TRANSPARENT;
+		if (setsockopt(sk, SOL_BLUETOOTH, BT_VOICE, &voice,
+			       sizeof(voice)) < 0) {
+			syslog(LOG_ERR, "Failed to set transparent voice: "
+					"%s (%d)", strerror(errno), errno);
+			goto error;
+		}
+	}
+
 	/* Connect to remote */
 	if (bt_address(cras_bt_device_address(device), &addr))
 		goto error;
@@ -491,9 +512,21 @@ int cras_bt_device_sco_connect(struct cras_bt_device *device)
 	return sk;
 
 error:
+	close(sk);
 	return -1;
 }
 
+int cras_bt_device_get_sco_codec(struct cras_bt_device *device)
+{
+	struct hfp_slc_handle *slc_handle;
+
+	slc_handle = cras_hfp_ag_get_slc(device);
+	if (!slc_handle)
+		return HFP_CODEC_ID_CVSD;
+
+	return hfp_slc_get_selected_codec(slc_handle);
+}
+
 int cras_bt_device_set_speaker_gain(struct cras_bt_device *device, int gain)
 {
 	struct hfp_slc_handle *slc_handle;
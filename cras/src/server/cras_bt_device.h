@@ -48,8 +48,15 @@ void cras_bt_device_update_properties(struct cras_bt_device *device,
 /* Gets the SCO socket for the device.
  * Args:
  *     device - The device object to get SCO socket for.
+ *     codec - The codec negotiated for the SCO link. With mSBC the socket
+ *         carries the encoded frames transparently.
  */
-int cras_bt_device_sco_connect(struct cras_bt_device *device);
+int cras_bt_device_sco_connect(struct cras_bt_device *device, int codec);
+
+/* Gets the codec negotiated on the service level connection of the device,
+ * HFP_CODEC_ID_CVSD if there is none.
+ */
+int cras_bt_device_get_sco_codec(struct cras_bt_device *device);
 
 /* Sets the speaker gain for bt device, note this is for HFP/HSP mode.
  * Args:
@@ -42,6 +42,7 @@ enum dsp_command {
 	DSP_CMD_FREE_CONTEXT,
 	DSP_CMD_RELOAD_INI,
 	DSP_CMD_DUMP_INFO,
+	DSP_CMD_GET_DEBUG_INFO,
 	DSP_CMD_SYNC,
 	DSP_CMD_QUIT,
 };
@@ -51,7 +52,8 @@ struct dsp_request {
 	struct cras_dsp_context *ctx;
 	const char *key;  /* for DSP_CMD_SET_VARIABLE */
 	const char *value;  /* for DSP_CMD_SET_VARIABLE */
-	sem_t *finished;  /* for DSP_CMD_SYNC */
+	sem_t *finished;  /* for DSP_CMD_SYNC and DSP_CMD_GET_DEBUG_INFO */
+	struct dsp_debug_info *debug_info;  /* for DSP_CMD_GET_DEBUG_INFO */
 	struct dsp_request *prev, *next;
 };
 
@@ -194,6 +196,35 @@ static void cmd_dump_info()
 	}
 }
 
+/* Copies the statistics of all pipelines. The audio thread updates them
+ * while holding the context mutex, so take it for the copy. */
+static void cmd_get_debug_info(struct dsp_request *req)
+{
+	struct dsp_debug_info *info = req->debug_info;
+	struct cras_dsp_context *ctx;
+
+	info->num_pipelines = 0;
+	DL_FOREACH(context_list, ctx) {
+		if (info->num_pipelines >= MAX_DEBUG_DSP_PIPELINES)
+			break;
+		pthread_mutex_lock(&ctx->mutex);
+		if (ctx->pipeline)
+			cras_dsp_pipeline_get_debug_info(
+				ctx->pipeline,
+				&info->pipelines[info->num_pipelines++]);
+		pthread_mutex_unlock(&ctx->mutex);
+	}
+	sem_post(req->finished);
+}
+
+static void queue_dsp_request(struct dsp_request *req)
+{
+	pthread_mutex_lock(&req_mutex);
+	DL_APPEND(req_list, req);
+	pthread_cond_signal(&req_cond);
+	pthread_mutex_unlock(&req_mutex);
+}
+
 static void send_dsp_request(enum dsp_command code,
 			     struct cras_dsp_context *ctx,
 			     const char *key, const char *value,
@@ -206,11 +237,7 @@ static void send_dsp_request(enum dsp_command code,
 	req->key = key ? strdup(key) : NULL;
 	req->value = value ? strdup(value) : NULL;
 	req->finished = finished;
-
-	pthread_mutex_lock(&req_mutex);
-	DL_APPEND(req_list, req);
-	pthread_cond_signal(&req_cond);
-	pthread_mutex_unlock(&req_mutex);
+	queue_dsp_request(req);
 }
 
 static void send_dsp_request_simple(enum dsp_command code,
@@ -254,6 +281,9 @@ static void *dsp_thread_function(void *arg)
 		case DSP_CMD_DUMP_INFO:
 			cmd_dump_info();
 			break;
+		case DSP_CMD_GET_DEBUG_INFO:
+			cmd_get_debug_info(req);
+			break;
 		case DSP_CMD_QUIT:
 			quit = 1;
 			break;
@@ -344,6 +374,20 @@ void cras_dsp_dump_info()
 	send_dsp_request_simple(DSP_CMD_DUMP_INFO, NULL);
 }
 
+void cras_dsp_get_debug_info(struct dsp_debug_info *info)
+{
+	sem_t finished;
+	struct dsp_request *req = calloc(1, sizeof(*req));
+
+	sem_init(&finished, 0, 0);
+	req->code = DSP_CMD_GET_DEBUG_INFO;
+	req->finished = &finished;
+	req->debug_info = info;
+	queue_dsp_request(req);
+	sem_wait(&finished);
+	sem_destroy(&finished);
+}
+
 unsigned int cras_dsp_num_output_channels(const struct cras_dsp_context *ctx)
 {
 	return cras_dsp_pipeline_get_num_output_channels(ctx->pipeline);
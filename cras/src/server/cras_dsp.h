@@ -66,6 +66,10 @@ void cras_dsp_reload_ini();
 /* Dump current dsp information to syslog. */
 void cras_dsp_dump_info();
 
+/* Copies the run time statistics of the loaded pipelines to info. This
+ * waits for the requests queued before it to finish. */
+void cras_dsp_get_debug_info(struct dsp_debug_info *info);
+
 /* Number of channels output. */
 unsigned int cras_dsp_num_output_channels(const struct cras_dsp_context *ctx);
 
@@ -4,6 +4,7 @@
  */
 
 #include <stdlib.h>
+#include <syslog.h>
 #include "cras_dsp_module.h"
 #include "drc.h"
 #include "dsp_util.h"
@@ -43,6 +44,11 @@ static void empty_dump(struct dsp_module *module, struct dumper *d)
 	dumpf(d, "built-in module\n");
 }
 
+static int empty_is_noop(struct dsp_module *module)
+{
+	return 1;
+}
+
 static void empty_init_module(struct dsp_module *module)
 {
 	module->instantiate = &empty_instantiate;
@@ -53,6 +59,7 @@ static void empty_init_module(struct dsp_module *module)
 	module->free_module = &empty_free_module;
 	module->get_properties = &empty_get_properties;
 	module->dump = &empty_dump;
+	module->is_noop = &empty_is_noop;
 }
 
 /*
@@ -182,7 +189,7 @@ static void eq_init_module(struct dsp_module *module)
  */
 struct eq2_data {
 	int sample_rate;
-	struct eq2 *eq2;  /* Initialized in the first call of eq2_run() */
+	struct eq2 *eq2;  /* Created on first use by eq2_create_eq2() */
 
 	/* Two ports for input, two for output, and 8 parameters per eq pair */
 	float *ports[4 + MAX_BIQUADS_PER_EQ2 * 8];
@@ -205,29 +212,36 @@ static void eq2_connect_port(struct dsp_module *module,
 	data->ports[port] = data_location;
 }
 
-static void eq2_run(struct dsp_module *module, unsigned long sample_count)
+/* Creates the eq2 from the values on the control ports, if not done yet */
+static void eq2_create_eq2(struct eq2_data *data)
 {
-	struct eq2_data *data = (struct eq2_data *) module->data;
-	if (!data->eq2) {
-		float nyquist = data->sample_rate / 2;
-		int i, channel;
+	float nyquist = data->sample_rate / 2;
+	int i, channel;
 
-		data->eq2 = eq2_new();
-		for (i = 4; i < 4 + MAX_BIQUADS_PER_EQ2 * 8; i += 8) {
-			if (!data->ports[i])
-				break;
-			for (channel = 0; channel < 2; channel++) {
-				int k = i + channel * 4;
-				int type = (int) *data->ports[k];
-				float freq = *data->ports[k+1];
-				float Q = *data->ports[k+2];
-				float gain = *data->ports[k+3];
-				eq2_append_biquad(data->eq2, channel, type,
-						  freq / nyquist, Q, gain);
-			}
+	if (data->eq2)
+		return;
+
+	data->eq2 = eq2_new();
+	for (i = 4; i < 4 + MAX_BIQUADS_PER_EQ2 * 8; i += 8) {
+		if (!data->ports[i])
+			break;
+		for (channel = 0; channel < 2; channel++) {
+			int k = i + channel * 4;
+			int type = (int) *data->ports[k];
+			float freq = *data->ports[k+1];
+			float Q = *data->ports[k+2];
+			float gain = *data->ports[k+3];
+			eq2_append_biquad(data->eq2, channel, type,
+					  freq / nyquist, Q, gain);
 		}
 	}
+}
 
+static void eq2_run(struct dsp_module *module, unsigned long sample_count)
+{
+	struct eq2_data *data = (struct eq2_data *) module->data;
+
+	eq2_create_eq2(data);
 
 	if (data->ports[0] != data->ports[2])
 		memcpy(data->ports[2], data->ports[0],
@@ -240,6 +254,58 @@ static void eq2_run(struct dsp_module *module, unsigned long sample_count)
 		    (int) sample_count);
 }
 
+static int eq2_is_noop(struct dsp_module *module)
+{
+	struct eq2_data *data = (struct eq2_data *) module->data;
+
+	if (data->ports[0] != data->ports[2] ||
+	    data->ports[1] != data->ports[3])
+		return 0;
+
+	eq2_create_eq2(data);
+	return eq2_len(data->eq2, 0) == 0 && eq2_len(data->eq2, 1) == 0;
+}
+
+static int eq2_absorb(struct dsp_module *module, struct dsp_module *prev)
+{
+	struct eq2_data *data = (struct eq2_data *) module->data;
+	struct eq2_data *prev_data;
+	struct eq2 *merged;
+	int i, channel;
+
+	if (prev->run != &eq2_run)
+		return -1;
+	prev_data = (struct eq2_data *) prev->data;
+
+	eq2_create_eq2(data);
+	eq2_create_eq2(prev_data);
+
+	for (channel = 0; channel < 2; channel++)
+		if (eq2_len(prev_data->eq2, channel) +
+		    eq2_len(data->eq2, channel) > MAX_BIQUADS_PER_EQ2)
+			return -1;
+
+	/* Runs the biquads of prev first, then ours. */
+	merged = eq2_new();
+	for (channel = 0; channel < 2; channel++) {
+		struct eq2 *eq2 = prev_data->eq2;
+		for (i = 0; i < eq2_len(eq2, channel); i++)
+			eq2_append_biquad_direct(merged, channel,
+						 eq2_get_bq(eq2, channel, i));
+		eq2 = data->eq2;
+		for (i = 0; i < eq2_len(eq2, channel); i++)
+			eq2_append_biquad_direct(merged, channel,
+						 eq2_get_bq(eq2, channel, i));
+	}
+	eq2_free(data->eq2);
+	data->eq2 = merged;
+
+	/* Read directly from the input of prev. */
+	data->ports[0] = prev_data->ports[0];
+	data->ports[1] = prev_data->ports[1];
+	return 0;
+}
+
 static void eq2_deinstantiate(struct dsp_module *module)
 {
 	struct eq2_data *data = (struct eq2_data *) module->data;
@@ -258,26 +324,34 @@ static void eq2_init_module(struct dsp_module *module)
 	module->free_module = &empty_free_module;
 	module->get_properties = &empty_get_properties;
 	module->dump = &empty_dump;
+	module->is_noop = &eq2_is_noop;
+	module->absorb = &eq2_absorb;
 }
 
 /*
  *  drc module functions
  */
+#define DRC_PARAMS_PER_BAND 8
+
 struct drc_data {
 	int sample_rate;
-	struct drc *drc;  /* Initialized in the first call of drc_run() */
+	struct drc *drc;  /* Created on first use by drc_create_drc() */
 
-	/* Two ports for input, two for output, one for disable_emphasis,
-	 * and 8 parameters each band */
-	float *ports[4 + 1 + 8 * 3];
+	/* The port layout, set by drc_init_module() from the ports of the
+	 * plugin in the ini file. */
+	int num_channels;
+	int num_bands;
+
+	/* num_channels ports for input, num_channels for output, one for
+	 * disable_emphasis, and 8 parameters each band */
+	float *ports[DRC_MAX_CHANNELS * 2 + 1 +
+		     DRC_PARAMS_PER_BAND * DRC_MAX_KERNELS];
 };
 
 static int drc_instantiate(struct dsp_module *module, unsigned long sample_rate)
 {
-	struct drc_data *data;
+	struct drc_data *data = (struct drc_data *) module->data;
 
-	module->data = calloc(1, sizeof(struct drc_data));
-	data = (struct drc_data *) module->data;
 	data->sample_rate = (int) sample_rate;
 	return 0;
 }
@@ -295,46 +369,81 @@ static int drc_get_delay(struct dsp_module *module)
 	return DRC_DEFAULT_PRE_DELAY * data->sample_rate;
 }
 
+/* Creates the drc from the values on the control ports, if not done yet */
+static void drc_create_drc(struct drc_data *data)
+{
+	int i;
+	float nyquist = data->sample_rate / 2;
+	int base = data->num_channels * 2;
+	struct drc *drc;
+
+	if (data->drc)
+		return;
+
+	drc = drc_new_layout(data->sample_rate, data->num_channels,
+			     data->num_bands);
+	data->drc = drc;
+	drc->emphasis_disabled = (int) *data->ports[base];
+	for (i = 0; i < data->num_bands; i++) {
+		int k = base + 1 + i * DRC_PARAMS_PER_BAND;
+		float f = *data->ports[k];
+		float enable = *data->ports[k+1];
+		float threshold = *data->ports[k+2];
+		float knee = *data->ports[k+3];
+		float ratio = *data->ports[k+4];
+		float attack = *data->ports[k+5];
+		float release = *data->ports[k+6];
+		float boost = *data->ports[k+7];
+		drc_set_param(drc, i, PARAM_CROSSOVER_LOWER_FREQ,
+			      f / nyquist);
+		drc_set_param(drc, i, PARAM_ENABLED, enable);
+		drc_set_param(drc, i, PARAM_THRESHOLD, threshold);
+		drc_set_param(drc, i, PARAM_KNEE, knee);
+		drc_set_param(drc, i, PARAM_RATIO, ratio);
+		drc_set_param(drc, i, PARAM_ATTACK, attack);
+		drc_set_param(drc, i, PARAM_RELEASE, release);
+		drc_set_param(drc, i, PARAM_POST_GAIN, boost);
+	}
+	drc_init(drc);
+}
+
 static void drc_run(struct dsp_module *module, unsigned long sample_count)
 {
 	struct drc_data *data = (struct drc_data *) module->data;
-	if (!data->drc) {
-		int i;
-		float nyquist = data->sample_rate / 2;
-		struct drc *drc = drc_new(data->sample_rate);
-
-		data->drc = drc;
-		drc->emphasis_disabled = (int) *data->ports[4];
-		for (i = 0; i < 3; i++) {
-			int k = 5 + i * 8;
-			float f = *data->ports[k];
-			float enable = *data->ports[k+1];
-			float threshold = *data->ports[k+2];
-			float knee = *data->ports[k+3];
-			float ratio = *data->ports[k+4];
-			float attack = *data->ports[k+5];
-			float release = *data->ports[k+6];
-			float boost = *data->ports[k+7];
-			drc_set_param(drc, i, PARAM_CROSSOVER_LOWER_FREQ,
-				      f / nyquist);
-			drc_set_param(drc, i, PARAM_ENABLED, enable);
-			drc_set_param(drc, i, PARAM_THRESHOLD, threshold);
-			drc_set_param(drc, i, PARAM_KNEE, knee);
-			drc_set_param(drc, i, PARAM_RATIO, ratio);
-			drc_set_param(drc, i, PARAM_ATTACK, attack);
-			drc_set_param(drc, i, PARAM_RELEASE, release);
-			drc_set_param(drc, i, PARAM_POST_GAIN, boost);
-		}
-		drc_init(drc);
-	}
-	if (data->ports[0] != data->ports[2])
-		memcpy(data->ports[2], data->ports[0],
-		       sizeof(float) * sample_count);
-	if (data->ports[1] != data->ports[3])
-		memcpy(data->ports[3], data->ports[1],
-		       sizeof(float) * sample_count);
+	float **outputs = &data->ports[data->num_channels];
+	int i;
+
+	drc_create_drc(data);
+
+	for (i = 0; i < data->num_channels; i++)
+		if (data->ports[i] != outputs[i])
+			memcpy(outputs[i], data->ports[i],
+			       sizeof(float) * sample_count);
+
+	drc_process(data->drc, outputs, (int) sample_count);
+}
 
-	drc_process(data->drc, &data->ports[2], (int) sample_count);
+/* A drc can absorb an eq2 in front of it by folding the eq2 biquads into its
+ * emphasis filter. */
+static int drc_absorb(struct dsp_module *module, struct dsp_module *prev)
+{
+	struct drc_data *data = (struct drc_data *) module->data;
+	struct eq2_data *prev_data;
+
+	if (prev->run != &eq2_run)
+		return -1;
+	prev_data = (struct eq2_data *) prev->data;
+
+	drc_create_drc(data);
+	eq2_create_eq2(prev_data);
+
+	if (drc_prepend_eq2(data->drc, prev_data->eq2) != 0)
+		return -1;
+
+	/* Read directly from the input of prev. */
+	data->ports[0] = prev_data->ports[0];
+	data->ports[1] = prev_data->ports[1];
+	return 0;
 }
 
 static void drc_deinstantiate(struct dsp_module *module)
@@ -342,19 +451,84 @@ static void drc_deinstantiate(struct dsp_module *module)
 	struct drc_data *data = (struct drc_data *) module->data;
 	if (data->drc)
 		drc_free(data->drc);
-	free(data);
+	data->drc = NULL;
 }
 
-static void drc_init_module(struct dsp_module *module)
+static void drc_free_module(struct dsp_module *module)
 {
+	free(module->data);
+	free(module);
+}
+
+/* Finds the number of channels and bands from the ports of the plugin. The
+ * ports must be the audio inputs, the audio outputs, disable_emphasis, then
+ * the parameters of each band. */
+static int drc_get_layout(struct plugin *plugin, int *num_channels,
+			  int *num_bands)
+{
+	int n = ARRAY_COUNT(&plugin->ports);
+	int channels = 0;
+	int i;
+	struct port *port;
+
+	FOR_ARRAY_ELEMENT(&plugin->ports, i, port) {
+		if (port->direction != PORT_INPUT || port->type != PORT_AUDIO)
+			break;
+		channels++;
+	}
+	if (channels < 1 || channels > DRC_MAX_CHANNELS ||
+	    (n - 2 * channels - 1) % DRC_PARAMS_PER_BAND)
+		return -1;
+
+	FOR_ARRAY_ELEMENT(&plugin->ports, i, port) {
+		enum port_direction direction;
+		enum port_type type;
+
+		if (i < channels) {
+			continue;
+		} else if (i < 2 * channels) {
+			direction = PORT_OUTPUT;
+			type = PORT_AUDIO;
+		} else {
+			direction = PORT_INPUT;
+			type = PORT_CONTROL;
+		}
+		if (port->direction != direction || port->type != type)
+			return -1;
+	}
+
+	*num_channels = channels;
+	*num_bands = (n - 2 * channels - 1) / DRC_PARAMS_PER_BAND;
+	if (*num_bands < 1 || *num_bands > DRC_MAX_KERNELS)
+		return -1;
+	return 0;
+}
+
+static int drc_init_module(struct dsp_module *module, struct plugin *plugin)
+{
+	struct drc_data *data;
+	int num_channels, num_bands;
+
+	if (drc_get_layout(plugin, &num_channels, &num_bands)) {
+		syslog(LOG_ERR, "bad drc ports in %s", plugin->title);
+		return -1;
+	}
+
+	data = calloc(1, sizeof(struct drc_data));
+	data->num_channels = num_channels;
+	data->num_bands = num_bands;
+	module->data = data;
+
 	module->instantiate = &drc_instantiate;
 	module->connect_port = &drc_connect_port;
 	module->get_delay = &drc_get_delay;
 	module->run = &drc_run;
 	module->deinstantiate = &drc_deinstantiate;
-	module->free_module = &empty_free_module;
+	module->free_module = &drc_free_module;
 	module->get_properties = &empty_get_properties;
 	module->dump = &empty_dump;
+	module->absorb = &drc_absorb;
+	return 0;
 }
 
 /*
@@ -375,7 +549,10 @@ struct dsp_module *cras_dsp_module_load_builtin(struct plugin *plugin)
 	} else if (strcmp(plugin->label, "eq2") == 0) {
 		eq2_init_module(module);
 	} else if (strcmp(plugin->label, "drc") == 0) {
-		drc_init_module(module);
+		if (drc_init_module(module, plugin)) {
+			free(module);
+			return NULL;
+		}
 	} else {
 		empty_init_module(module);
 	}
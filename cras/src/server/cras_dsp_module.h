@@ -68,6 +68,26 @@ struct dsp_module {
 
 	/* Dumps the information about current state of this module */
 	void (*dump)(struct dsp_module *mod, struct dumper *d);
+
+	/* Optional, may be NULL. Returns 1 if run() would not change the
+	 * data on any output port, so the pipeline can skip calling
+	 * it. This is called after all ports have been connected, and
+	 * only when the values of the input control ports are constant.
+	 */
+	int (*is_noop)(struct dsp_module *mod);
+
+	/* Optional, may be NULL. Takes over the processing of the
+	 * module "prev" which runs right before this module and whose
+	 * audio outputs are exactly the audio inputs of this module. On
+	 * success, running this module on the input buffers of "prev"
+	 * produces the same output as running both, and the pipeline
+	 * skips calling run() on "prev". This is called after all
+	 * ports of both modules have been connected, and only when the
+	 * values of their input control ports are constant.
+	 * Returns:
+	 *    0 if "prev" has been absorbed. -1 otherwise.
+	 */
+	int (*absorb)(struct dsp_module *mod, struct dsp_module *prev);
 };
 
 enum {
@@ -4,6 +4,7 @@
  */
 
 #include <inttypes.h>
+#include <string.h>
 #include <sys/param.h>
 #include <syslog.h>
 
@@ -62,6 +63,20 @@ struct control_port {
 DECLARE_ARRAY_TYPE(struct audio_port, audio_port_array);
 DECLARE_ARRAY_TYPE(struct control_port, control_port_array);
 
+/* Only one in this many calls to cras_dsp_pipeline_run() times the modules,
+ * so the accounting costs a couple of clock reads per module every few
+ * blocks. */
+#define MODULE_STATS_SAMPLE_PERIOD 16
+
+/* The sampled run time of a module. See struct dsp_module_debug_info. */
+struct module_stats {
+	int64_t blocks;
+	int64_t frames;
+	int64_t total_time;
+	int64_t max_time;
+	uint32_t histogram[DSP_TIME_HISTOGRAM_BUCKETS];
+};
+
 /* An instance is a dynamic representation of a plugin. We only create
  * an instance when a plugin is needed (data actually flows through it
  * and it is not disabled). An instance also contains a pointer to a
@@ -92,6 +107,14 @@ struct instance {
 	/* This is the total buffering delay from source to this instance. It is
 	 * in number of frames. */
 	int total_delay;
+
+	/* Set by compile_pipeline() if run() of this module is not needed,
+	 * because it does nothing or because the next instance has absorbed
+	 * its processing. */
+	int skipped;
+
+	/* The run time of this module, updated by cras_dsp_pipeline_run() */
+	struct module_stats stats;
 };
 
 DECLARE_ARRAY_TYPE(struct instance, instance_array)
@@ -113,8 +136,19 @@ struct pipeline {
 	 * the same time for this pipeline */
 	int peak_buf;
 
-	/* The audio data buffers */
+	/* The audio data buffers. They are carved out of one contiguous
+	 * allocation, buffer_mem. */
 	float **buffers;
+	float *buffer_mem;
+
+	/* The instances to run, in order, built by compile_pipeline() when
+	 * the pipeline is instantiated. */
+	struct instance **plan;
+	int plan_len;
+
+	/* The number of times cras_dsp_pipeline_run() has been called. Used
+	 * to pick the blocks for which the modules are timed. */
+	unsigned int run_count;
 
 	/* The instance where the audio data flow in */
 	struct instance *source_instance;
@@ -489,6 +523,29 @@ static void use_buffers(char *busy, audio_port_array *audio_ports)
 	}
 }
 
+/* Like use_buffers(), but the k-th output port reuses the buffer of the k-th
+ * input port, so the module processes the data in place and the same buffer
+ * stays hot in the cache along a chain of modules. The input buffers must have
+ * been released by unuse_buffers(). */
+static void use_buffers_inplace(char *busy, audio_port_array *in_ports,
+				audio_port_array *out_ports)
+{
+	int i, k = 0;
+	struct audio_port *audio_port;
+
+	FOR_ARRAY_ELEMENT(out_ports, i, audio_port) {
+		if (i < ARRAY_COUNT(in_ports)) {
+			k = ARRAY_ELEMENT(in_ports, i)->buf_index;
+		} else {
+			k = 0;
+			while (busy[k])
+				k++;
+		}
+		audio_port->buf_index = k;
+		busy[k] = 1;
+	}
+}
+
 static void unuse_buffers(char *busy, audio_port_array *audio_ports)
 {
 	int i;
@@ -533,16 +590,17 @@ static int allocate_buffers(struct pipeline *pipeline)
 		return -1;
 	}
 
-	for (i = 0; i < peak_buf; i++) {
-		size_t size = DSP_BUFFER_SIZE * sizeof(float);
-		float *buf = calloc(1, size);
-		if (!buf) {
-			syslog(LOG_ERR, "failed to allocate buf");
-			return -1;
-		}
-		pipeline->buffers[i] = buf;
+	pipeline->buffer_mem = (float *)calloc((size_t)peak_buf *
+					       DSP_BUFFER_SIZE, sizeof(float));
+	if (peak_buf && !pipeline->buffer_mem) {
+		syslog(LOG_ERR, "failed to allocate buf");
+		return -1;
 	}
 
+	for (i = 0; i < peak_buf; i++)
+		pipeline->buffers[i] =
+			pipeline->buffer_mem + (size_t)i * DSP_BUFFER_SIZE;
+
 	/* Now assign buffer index for each instance's input/output ports */
 	busy = calloc(peak_buf, sizeof(*busy));
 	FOR_ARRAY_ELEMENT(&pipeline->instances, i, instance) {
@@ -585,7 +643,8 @@ static int allocate_buffers(struct pipeline *pipeline)
 			unuse_buffers(busy, &instance->input_audio_ports);
 		} else {
 			unuse_buffers(busy, &instance->input_audio_ports);
-			use_buffers(busy, &instance->output_audio_ports);
+			use_buffers_inplace(busy, &instance->input_audio_ports,
+					    &instance->output_audio_ports);
 		}
 	}
 	free(busy);
@@ -635,6 +694,125 @@ static void calculate_audio_delay(struct pipeline *pipeline)
 	}
 }
 
+/* Returns 1 if all input control ports of the instance hold constant values,
+ * which means modules can look at them before the pipeline runs. */
+static int has_constant_controls(struct instance *instance)
+{
+	int i;
+	struct control_port *control_port;
+
+	FOR_ARRAY_ELEMENT(&instance->input_control_ports, i, control_port) {
+		if (control_port->peer)
+			return 0;
+	}
+	return 1;
+}
+
+/* Checks if "next" can absorb "prev". prev must run right before next, feed
+ * all its audio outputs to next in port order, and both must process the data
+ * in place, so when prev is skipped its input buffers are exactly the buffers
+ * next reads from and writes to. */
+static int can_absorb(struct instance *prev, struct instance *next)
+{
+	int i, n;
+	struct control_port *control_port;
+
+	if (!next->module->absorb || prev->skipped)
+		return 0;
+	if ((prev->properties | next->properties) & MODULE_INPLACE_BROKEN)
+		return 0;
+	if (!has_constant_controls(prev) || !has_constant_controls(next))
+		return 0;
+	FOR_ARRAY_ELEMENT(&prev->output_control_ports, i, control_port) {
+		if (control_port->peer)
+			return 0;
+	}
+
+	n = ARRAY_COUNT(&prev->input_audio_ports);
+	if (n == 0 ||
+	    ARRAY_COUNT(&prev->output_audio_ports) != n ||
+	    ARRAY_COUNT(&next->input_audio_ports) != n ||
+	    ARRAY_COUNT(&next->output_audio_ports) != n)
+		return 0;
+
+	for (i = 0; i < n; i++) {
+		struct audio_port *prev_in =
+			ARRAY_ELEMENT(&prev->input_audio_ports, i);
+		struct audio_port *prev_out =
+			ARRAY_ELEMENT(&prev->output_audio_ports, i);
+		struct audio_port *next_in =
+			ARRAY_ELEMENT(&next->input_audio_ports, i);
+		struct audio_port *next_out =
+			ARRAY_ELEMENT(&next->output_audio_ports, i);
+		if (prev_out->peer != next_in)
+			return 0;
+		if (prev_in->buf_index != prev_out->buf_index ||
+		    next_in->buf_index != next_out->buf_index)
+			return 0;
+	}
+
+	return 1;
+}
+
+static void free_plan(struct pipeline *pipeline)
+{
+	int i;
+	struct instance *instance;
+
+	FOR_ARRAY_ELEMENT(&pipeline->instances, i, instance)
+		instance->skipped = 0;
+	free(pipeline->plan);
+	pipeline->plan = NULL;
+	pipeline->plan_len = 0;
+}
+
+/* Builds the list of modules cras_dsp_pipeline_run() calls. Adjacent modules
+ * which can be fused are merged into one, and modules which do nothing are
+ * left out. This must be done after all the ports are connected. */
+static int compile_pipeline(struct pipeline *pipeline)
+{
+	int i;
+	struct instance *instance, *prev = NULL;
+
+	FOR_ARRAY_ELEMENT(&pipeline->instances, i, instance) {
+		struct dsp_module *module = instance->module;
+
+		if (prev && can_absorb(prev, instance) &&
+		    module->absorb(module, prev->module) == 0) {
+			prev->skipped = 1;
+			syslog(LOG_DEBUG, "fuse %s into %s",
+			       prev->plugin->title, instance->plugin->title);
+		}
+		prev = instance;
+	}
+
+	FOR_ARRAY_ELEMENT(&pipeline->instances, i, instance) {
+		struct dsp_module *module = instance->module;
+
+		if (!instance->skipped && module->is_noop &&
+		    has_constant_controls(instance) &&
+		    module->is_noop(module)) {
+			instance->skipped = 1;
+			syslog(LOG_DEBUG, "skip %s", instance->plugin->title);
+		}
+	}
+
+	pipeline->plan = (struct instance **)calloc(
+		ARRAY_COUNT(&pipeline->instances) + 1,
+		sizeof(struct instance *));
+	if (!pipeline->plan) {
+		syslog(LOG_ERR, "failed to allocate plan");
+		return -1;
+	}
+
+	FOR_ARRAY_ELEMENT(&pipeline->instances, i, instance) {
+		if (!instance->skipped)
+			pipeline->plan[pipeline->plan_len++] = instance;
+	}
+
+	return 0;
+}
+
 int cras_dsp_pipeline_instantiate(struct pipeline *pipeline, int sample_rate)
 {
 	int i;
@@ -709,7 +887,7 @@ int cras_dsp_pipeline_instantiate(struct pipeline *pipeline, int sample_rate)
 	}
 
 	calculate_audio_delay(pipeline);
-	return 0;
+	return compile_pipeline(pipeline);
 }
 
 void cras_dsp_pipeline_deinstantiate(struct pipeline *pipeline)
@@ -717,6 +895,7 @@ void cras_dsp_pipeline_deinstantiate(struct pipeline *pipeline)
 	int i;
 	struct instance *instance;
 
+	free_plan(pipeline);
 	FOR_ARRAY_ELEMENT(&pipeline->instances, i, instance) {
 		struct dsp_module *module = instance->module;
 		if (instance->instantiated) {
@@ -780,14 +959,52 @@ float *cras_dsp_pipeline_get_sink_buffer(struct pipeline *pipeline, int index)
 			   index);
 }
 
+static void add_module_statistic(struct module_stats *stats,
+				 const struct timespec *begin,
+				 const struct timespec *end,
+				 int samples)
+{
+	struct timespec delta;
+	int64_t t;
+	int bucket = 0;
+
+	subtract_timespecs(end, begin, &delta);
+	t = delta.tv_sec * 1000000000LL + delta.tv_nsec;
+	if (t > 0)
+		bucket = MIN(63 - __builtin_clzll(t),
+			     DSP_TIME_HISTOGRAM_BUCKETS - 1);
+
+	stats->blocks++;
+	stats->frames += samples;
+	stats->total_time += t;
+	stats->max_time = MAX(stats->max_time, t);
+	stats->histogram[bucket]++;
+}
+
 void cras_dsp_pipeline_run(struct pipeline *pipeline, int sample_count)
 {
 	int i;
-	struct instance *instance;
+	struct timespec begin, end;
 
-	FOR_ARRAY_ELEMENT(&pipeline->instances, i, instance) {
+	if (pipeline->run_count++ % MODULE_STATS_SAMPLE_PERIOD) {
+		for (i = 0; i < pipeline->plan_len; i++) {
+			struct dsp_module *module = pipeline->plan[i]->module;
+			module->run(module, sample_count);
+		}
+		return;
+	}
+
+	/* Time each module of this block. The end of one module is the
+	 * beginning of the next, so it is one clock read per module. */
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (i = 0; i < pipeline->plan_len; i++) {
+		struct instance *instance = pipeline->plan[i];
 		struct dsp_module *module = instance->module;
 		module->run(module, sample_count);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		add_module_statistic(&instance->stats, &begin, &end,
+				     sample_count);
+		begin = end;
 	}
 }
 
@@ -887,15 +1104,49 @@ void cras_dsp_pipeline_free(struct pipeline *pipeline)
 		}
 	}
 
+	free_plan(pipeline);
 	pipeline->ini = NULL;
 	ARRAY_FREE(&pipeline->instances);
 
-	for (i = 0; i < pipeline->peak_buf; i++)
-		free(pipeline->buffers[i]);
+	free(pipeline->buffer_mem);
 	free(pipeline->buffers);
 	free(pipeline);
 }
 
+void cras_dsp_pipeline_get_debug_info(struct pipeline *pipeline,
+				      struct dsp_pipeline_debug_info *info)
+{
+	int i;
+	struct instance *instance;
+
+	memset(info, 0, sizeof(*info));
+	strncpy(info->purpose, pipeline->purpose, sizeof(info->purpose) - 1);
+	info->sample_rate = pipeline->sample_rate;
+	info->total_blocks = pipeline->total_blocks;
+	info->total_frames = pipeline->total_samples;
+	info->total_time_ns = pipeline->total_time;
+	info->min_time_ns = pipeline->min_time;
+	info->max_time_ns = pipeline->max_time;
+
+	FOR_ARRAY_ELEMENT(&pipeline->instances, i, instance) {
+		struct dsp_module_debug_info *mi;
+
+		if (i >= MAX_DEBUG_DSP_MODULES)
+			break;
+		mi = &info->modules[i];
+		strncpy(mi->title, instance->plugin->title,
+			sizeof(mi->title) - 1);
+		mi->skipped = instance->skipped;
+		mi->sampled_blocks = instance->stats.blocks;
+		mi->sampled_frames = instance->stats.frames;
+		mi->total_time_ns = instance->stats.total_time;
+		mi->max_time_ns = instance->stats.max_time;
+		memcpy(mi->histogram, instance->stats.histogram,
+		       sizeof(mi->histogram));
+		info->num_modules++;
+	}
+}
+
 static void dump_audio_ports(struct dumper *d, const char *name,
 			     audio_port_array *audio_ports)
 {
@@ -932,6 +1183,25 @@ static void dump_control_ports(struct dumper *d, const char *name,
 	}
 }
 
+static void dump_module_stats(struct dumper *d, struct module_stats *stats)
+{
+	int i;
+
+	if (stats->blocks == 0)
+		return;
+	dumpf(d, "   sampled blocks: %" PRId64 ", frames: %" PRId64 "\n",
+	      stats->blocks, stats->frames);
+	dumpf(d, "   avg/max time per block: %" PRId64 "/%" PRId64 "ns\n",
+	      stats->total_time / stats->blocks, stats->max_time);
+	if (stats->total_time)
+		dumpf(d, "   throughput: %g frames/s\n",
+		      stats->frames * 1e9 / stats->total_time);
+	for (i = 0; i < DSP_TIME_HISTOGRAM_BUCKETS; i++)
+		if (stats->histogram[i])
+			dumpf(d, "   < %" PRId64 "ns: %u\n", 2LL << i,
+			      stats->histogram[i]);
+}
+
 void cras_dsp_pipeline_dump(struct dumper *d, struct pipeline *pipeline)
 {
 	int i;
@@ -962,11 +1232,13 @@ void cras_dsp_pipeline_dump(struct dumper *d, struct pipeline *pipeline)
 	      ARRAY_COUNT(&pipeline->instances));
 	FOR_ARRAY_ELEMENT(&pipeline->instances, i, instance) {
 		struct dsp_module *module = instance->module;
-		dumpf(d, "  [%d]%s mod=%p, total delay=%d\n",
+		dumpf(d, "  [%d]%s mod=%p, total delay=%d%s\n",
 		      i, instance->plugin->title, module,
-		      instance->total_delay);
+		      instance->total_delay,
+		      instance->skipped ? ", skipped" : "");
 		if (module)
 			module->dump(module, d);
+		dump_module_stats(d, &instance->stats);
 		dump_audio_ports(d, "input_audio_ports",
 				 &instance->input_audio_ports);
 		dump_audio_ports(d, "output_audio_ports",
@@ -977,5 +1249,6 @@ void cras_dsp_pipeline_dump(struct dumper *d, struct pipeline *pipeline)
 				   &instance->output_control_ports);
 	}
 	dumpf(d, " peak_buf = %d\n", pipeline->peak_buf);
+	dumpf(d, " modules to run = %d\n", pipeline->plan_len);
 	dumpf(d, "---- pipeline dump end ----\n");
 }
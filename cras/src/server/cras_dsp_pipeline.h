@@ -14,6 +14,7 @@ extern "C" {
 
 #include "dumper.h"
 #include "cras_dsp_ini.h"
+#include "cras_types.h"
 
 /* These are the functions to create and use dsp pipelines. A dsp
  * pipeline is a collection of dsp plugins that process audio
@@ -55,7 +56,10 @@ void cras_dsp_pipeline_free(struct pipeline *pipeline);
  */
 int cras_dsp_pipeline_load(struct pipeline *pipeline);
 
-/* Instantiates the pipeline given the sampling rate.
+/* Instantiates the pipeline given the sampling rate. This also builds
+ * the list of modules cras_dsp_pipeline_run() calls: adjacent builtin
+ * modules which can be fused are merged, and modules which do nothing
+ * are skipped.
  * Args:
  *    sample_rate - The audio sampling rate.
  * Returns:
@@ -132,6 +136,13 @@ void cras_dsp_pipeline_add_statistic(struct pipeline *pipeline,
 void cras_dsp_pipeline_apply(struct pipeline *pipeline,
 			     uint8_t *buf, unsigned int frames);
 
+/* Copies the run time statistics of the pipeline and its modules to info.
+ * The modules are timed on a sample of the blocks processed by
+ * cras_dsp_pipeline_run(). At most MAX_DEBUG_DSP_MODULES modules are
+ * reported. */
+void cras_dsp_pipeline_get_debug_info(struct pipeline *pipeline,
+				      struct dsp_pipeline_debug_info *info);
+
 /* Dumps the current state of the pipeline. For debugging only */
 void cras_dsp_pipeline_dump(struct dumper *d, struct pipeline *pipeline);
 
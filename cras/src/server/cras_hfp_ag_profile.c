@@ -185,7 +185,7 @@ static struct cras_bt_profile cras_hfp_ag_profile = {
 	.uuid = HFP_AG_UUID,
 	.version = HFP_VERSION_1_6,
 	.role = NULL,
-	.features = HFP_SUPPORTED_FEATURE & 0x1F,
+	.features = (HFP_SUPPORTED_FEATURE & 0x1F) | HFP_SDP_WIDE_BAND_SPEECH,
 	.record = NULL,
 	.release = cras_hfp_ag_release,
 	.new_connection = cras_hfp_ag_new_connection,
@@ -34,7 +34,12 @@
 /* Codec negotiation */
 #define HFP_CODEC_NEGOTIATION           0x0200
 
-#define HFP_SUPPORTED_FEATURE           (HFP_ENHANCED_CALL_STATUS)
+#define HFP_SUPPORTED_FEATURE           (HFP_ENHANCED_CALL_STATUS | \
+					 HFP_CODEC_NEGOTIATION)
+
+/* Wide band speech bit of the SupportedFeatures attribute in the SDP
+ * record, which doesn't follow the order above. */
+#define HFP_SDP_WIDE_BAND_SPEECH        0x0020
 
 struct hfp_slc_handle;
 
@@ -3,120 +3,198 @@
  * found in the LICENSE file.
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* for sendmmsg and recvmmsg */
+#endif
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/param.h>
 #include <sys/socket.h>
+#include <sys/time.h>
 #include <syslog.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "audio_thread.h"
+#include "byte_buffer.h"
 #include "cras_hfp_info.h"
+#include "cras_hfp_slc.h"
+#include "cras_msbc_plc.h"
+#include "cras_sbc_codec.h"
+#include "cras_util.h"
+#include "rate_estimator.h"
 
 /* Make buffer size of multiple MTUs (= 48 bytes * 21) */
 #define HFP_BUF_SIZE_BYTES 1008
+/* With mSBC, buffer size of multiple frames (= 240 bytes * 8), 60ms at
+ * 16kHz like the CVSD buffer at 8kHz. */
+#define HFP_MSBC_BUF_SIZE_BYTES 1920
 
 /* rate(8kHz) * sample_size(2 bytes) * channels(1) */
 #define HFP_BYTE_RATE 16000
 #define HFP_MTU_BYTES 48
-
-/* Ring buffer storing samples for transmission. */
-struct pcm_buf {
-	uint8_t *buf;
-	size_t read_idx;
-	size_t write_idx;
-	size_t used_size;
-};
-
-static struct pcm_buf *create_buf()
+/* One 60 bytes mSBC packet every 7.5ms. */
+#define HFP_MSBC_LINK_BYTE_RATE 8000
+
+/* Maximum number of SCO packets read or written in one system call. */
+#define HFP_MAX_PACKETS 8
+/* Largest SCO packet accepted, adapters use 24 to 72 bytes for mSBC. */
+#define HFP_MAX_PACKET_SIZE 120
+
+/* An mSBC packet is an H2 header, a 57 bytes frame and one padding byte,
+ * HFP spec 5.7.4. Each frame holds 240 bytes of PCM. */
+#define MSBC_H2_HEADER_LEN 2
+#define MSBC_FRAME_LEN 57
+#define MSBC_PKT_SIZE 60
+#define MSBC_CODE_SIZE (MSBC_FRAME_SAMPLES * 2)
+#define MSBC_SYNC_WORD 0xAD
+
+/* The jitter allowance starts at half a packet, grows by half a packet
+ * each time a packet concealed as lost arrives after all, up to
+ * HFP_JITTER_MAX_PACKETS, and shrinks by a quarter packet after every
+ * HFP_JITTER_DECAY_PACKETS packets on time. */
+#define HFP_JITTER_MAX_PACKETS 8
+#define HFP_JITTER_DECAY_PACKETS 1000
+/* Enough control message space for the SO_TIMESTAMP of a packet. */
+#define HFP_CMSG_SIZE CMSG_SPACE(sizeof(struct timeval))
+
+/* The SCO link clock is estimated over windows of 10 seconds. */
+static const struct timespec link_rate_window = { 10, 0 };
+static const double link_rate_smooth_factor = 0.9;
+
+/* Second byte of the H2 header, for sequence numbers 0 to 3. */
+static const uint8_t h2_header_frames_count[] = { 0x08, 0x38, 0xc8, 0xf8 };
+
+/* Creates a ring buffer storing samples for transmission, large enough for
+ * either codec. It is mirrored when possible, so the iodevs and the SCO
+ * packets always see their samples in one piece. */
+static struct byte_buffer *create_buf()
 {
-	struct pcm_buf *pb;
-	pb = (struct pcm_buf *)calloc(1, sizeof(*pb));
-	if (!pb)
-		return NULL;
+	struct byte_buffer *pb;
 
-	pb->buf = (uint8_t *)calloc(HFP_BUF_SIZE_BYTES,
-				    sizeof(*pb->buf));
-	if (!pb->buf)
+	pb = byte_buffer_create_mirrored(HFP_MSBC_BUF_SIZE_BYTES);
+	if (!pb)
+		pb = byte_buffer_create(HFP_MSBC_BUF_SIZE_BYTES);
+	if (!pb)
 		return NULL;
 
+	buf_set_size(pb, HFP_BUF_SIZE_BYTES);
 	return pb;
 }
 
-static void destroy_buf(struct pcm_buf *pb)
+static int queued_bytes(struct byte_buffer *pb)
 {
-	free(pb->buf);
-	free(pb);
+	return buf_queued_bytes(pb);
 }
 
-static void init_buf(struct pcm_buf *pb)
+static void get_read_buf_bytes(struct byte_buffer *pb, uint8_t **b,
+			       unsigned *count)
 {
-	pb->read_idx = 0;
-	pb->write_idx = 0;
-	pb->used_size = 0;
-}
-
-static int queued_bytes(struct pcm_buf *pb)
-{
-	return pb->used_size;
-}
-
-static void get_read_buf_bytes(struct pcm_buf *pb, uint8_t **b, unsigned *count)
-{
-	int avail;
-
-	*b = pb->buf + pb->read_idx;
-	if (pb->used_size == HFP_BUF_SIZE_BYTES
-			|| pb->read_idx > pb->write_idx)
-		avail = HFP_BUF_SIZE_BYTES - pb->read_idx;
-	else
-		avail = pb->write_idx - pb->read_idx;
+	unsigned int avail;
 
-	if ((int)*count > avail)
+	*b = buf_read_pointer_size(pb, &avail);
+	if (*count > avail)
 		*count = avail;
 }
 
-static void put_read_buf_bytes(struct pcm_buf *pb, unsigned nread)
+static void put_read_buf_bytes(struct byte_buffer *pb, unsigned nread)
 {
-	pb->read_idx += nread;
-	if (pb->read_idx == HFP_BUF_SIZE_BYTES)
-		pb->read_idx = 0;
-	pb->used_size -= nread;
+	buf_increment_read(pb, nread);
 }
 
-static void get_write_buf_bytes(struct pcm_buf *pb, uint8_t **b,
+static void get_write_buf_bytes(struct byte_buffer *pb, uint8_t **b,
 				unsigned *count)
 {
-	size_t avail;
-
-	*b = pb->buf + pb->write_idx;
-	if (pb->used_size == HFP_BUF_SIZE_BYTES
-			|| pb->read_idx > pb->write_idx)
-		avail = pb->read_idx - pb->write_idx;
-	else
-		avail = HFP_BUF_SIZE_BYTES - pb->write_idx;
+	unsigned int avail;
 
+	*b = buf_write_pointer_size(pb, &avail);
 	if (*count > avail)
 		*count = avail;
 }
 
-static void put_write_buf_bytes(struct pcm_buf *pb, unsigned nwrite)
+static void put_write_buf_bytes(struct byte_buffer *pb, unsigned nwrite)
 {
-	pb->write_idx += nwrite;
-	if (pb->write_idx == HFP_BUF_SIZE_BYTES)
-		pb->write_idx = 0;
-	pb->used_size += nwrite;
+	buf_increment_write(pb, nwrite);
 }
 
 /* Structure to hold variables for a HFP connection. Since HFP supports
  * bi-direction audio, two iodevs should share one hfp_info if they
  * represent two directions of the same HFP headset
+ * Members:
+ *    fd - The SCO socket.
+ *    started - If the SCO socket is being polled.
+ *    codec - HFP_CODEC_ID_CVSD or HFP_CODEC_ID_MSBC.
+ *    packet_size - Size of the SCO packets to write, follows the size of
+ *        the packets read.
+ *    capture_buf - PCM samples read from the socket for the input iodev.
+ *    playback_buf - PCM samples of the output iodev to write to the socket.
+ *    msbc_read - mSBC decoder.
+ *    msbc_write - mSBC encoder.
+ *    msbc_plc - Conceals lost mSBC frames.
+ *    msbc_read_seq - Expected sequence number of the next mSBC frame read,
+ *        -1 when not known yet.
+ *    msbc_write_seq - Sequence number of the next mSBC frame written.
+ *    msbc_in - Bytes read and not parsed into mSBC frames yet. A frame can
+ *        span SCO packets.
+ *    msbc_in_len - Number of bytes in msbc_in.
+ *    msbc_out - Encoded mSBC packets not written yet.
+ *    msbc_out_len - Number of bytes in msbc_out.
+ *    msbc_lost_bytes - Link bytes found missing from the arrival times, to
+ *        conceal with the next mSBC frame. Sequence numbers alone can't
+ *        tell a loss of four frames.
+ *    msbc_drop_bytes - Link bytes that arrived too late, the mSBC frames
+ *        they carry are dropped.
+ *    link_est - Estimates the byte rate of the SCO link against the local
+ *        monotonic clock, from the arrival time of the packets.
+ *    link_last - Arrival time of the last packet, zero before the first
+ *        packet since start.
+ *    link_level - Bytes received ahead of the estimated link clock,
+ *        negative while packets are late or lost.
+ *    jitter - How many bytes late a packet can be, on top of half a packet,
+ *        before it is concealed.
+ *    jitter_debt - Bytes concealed that may still arrive late, and then are
+ *        dropped to keep the latency.
+ *    jitter_quiet - Packets since the last late one.
+ *    cvsd_last - The last CVSD packet, repeated to conceal lost ones.
+ *    cvsd_last_len - Number of bytes in cvsd_last.
+ *    cvsd_concealed - Number of CVSD packets concealed since the last
+ *        received.
+ *    idev - The input iodev.
+ *    odev - The output iodev.
  */
 struct hfp_info {
 	int fd;
 	int started;
-
-	struct pcm_buf *capture_buf;
-	struct pcm_buf *playback_buf;
+	int codec;
+	unsigned int packet_size;
+
+	struct byte_buffer *capture_buf;
+	struct byte_buffer *playback_buf;
+
+	struct cras_audio_codec *msbc_read;
+	struct cras_audio_codec *msbc_write;
+	struct cras_msbc_plc *msbc_plc;
+	int msbc_read_seq;
+	unsigned int msbc_write_seq;
+	uint8_t msbc_in[HFP_MAX_PACKET_SIZE + MSBC_PKT_SIZE];
+	unsigned int msbc_in_len;
+	uint8_t msbc_out[HFP_MAX_PACKETS * HFP_MAX_PACKET_SIZE +
+			 MSBC_PKT_SIZE];
+	unsigned int msbc_out_len;
+	unsigned int msbc_lost_bytes;
+	unsigned int msbc_drop_bytes;
+
+	struct rate_estimator *link_est;
+	struct timespec link_last;
+	double link_level;
+	unsigned int jitter;
+	unsigned int jitter_debt;
+	unsigned int jitter_quiet;
+
+	uint8_t cvsd_last[HFP_MAX_PACKET_SIZE];
+	unsigned int cvsd_last_len;
+	unsigned int cvsd_concealed;
 
 	struct cras_iodev *idev;
 	struct cras_iodev *odev;
@@ -129,13 +207,13 @@ int hfp_info_add_iodev(struct hfp_info *info, struct cras_iodev *dev)
 			goto invalid;
 		info->odev = dev;
 
-		init_buf(info->playback_buf);
+		buf_reset(info->playback_buf);
 	} else if (dev->direction == CRAS_STREAM_INPUT) {
 		if (info->idev)
 			goto invalid;
 		info->idev = dev;
 
-		init_buf(info->capture_buf);
+		buf_reset(info->capture_buf);
 	}
 
 	return 0;
@@ -180,7 +258,7 @@ void hfp_buf_acquire(struct hfp_info *info, struct cras_iodev *dev,
 
 int hfp_buf_size(struct hfp_info *info, struct cras_iodev *dev)
 {
-	return HFP_BUF_SIZE_BYTES / cras_get_format_bytes(dev->format);
+	return info->playback_buf->size / cras_get_format_bytes(dev->format);
 }
 
 void hfp_buf_release(struct hfp_info *info, struct cras_iodev *dev,
@@ -208,70 +286,478 @@ int hfp_buf_queued(struct hfp_info *info, const struct cras_iodev *dev)
 		return queued_bytes(info->capture_buf) / format_bytes;
 }
 
-int hfp_write(struct hfp_info *info)
+/* Sends the packets in one system call, without blocking the audio thread.
+ * Each packet is made of iovs_per_packet consecutive entries of iovs.
+ * Returns the number of packets sent, or negative error code. */
+static int send_packets(int fd, struct iovec *iovs,
+			unsigned int iovs_per_packet, unsigned int num)
+{
+	struct mmsghdr msgs[HFP_MAX_PACKETS];
+	unsigned int i;
+	int rc;
+
+	memset(msgs, 0, sizeof(msgs));
+	for (i = 0; i < num; i++) {
+		msgs[i].msg_hdr.msg_iov = &iovs[i * iovs_per_packet];
+		msgs[i].msg_hdr.msg_iovlen = iovs_per_packet;
+	}
+
+	do {
+		rc = sendmmsg(fd, msgs, num, MSG_DONTWAIT);
+	} while (rc < 0 && errno == EINTR);
+
+	if (rc < 0)
+		return errno == EAGAIN ? 0 : -errno;
+	return rc;
+}
+
+/* Writes CVSD samples straight from the playback buffer, in packets of the
+ * size read. Unless the buffer is mirrored, a packet that wraps the end of
+ * the buffer is sent from its two parts. */
+static int hfp_write_cvsd(struct hfp_info *info, unsigned int num_packets)
 {
-	int err = 0;
-	unsigned to_send;
-	uint8_t *samples;
+	struct byte_buffer *pb = info->playback_buf;
+	struct iovec iovs[HFP_MAX_PACKETS * 2];
+	unsigned int i, offset, len = info->packet_size;
+	int rc;
 
-	/* Write something */
-	to_send = HFP_MTU_BYTES;
-	get_read_buf_bytes(info->playback_buf, &samples, &to_send);
-	if (to_send != HFP_MTU_BYTES) {
+	num_packets = MIN(num_packets, queued_bytes(pb) / len);
+	if (num_packets == 0) {
 		syslog(LOG_ERR, "Buffer not enough for write.");
 		return 0;
 	}
 
-send_sample:
-	err = send(info->fd, samples, to_send, 0);
-	if (err < 0) {
-		if (errno == EINTR)
-			goto send_sample;
+	for (i = 0; i < num_packets; i++) {
+		offset = (pb->read_idx + i * len) % pb->max_size;
+		iovs[2 * i].iov_base = pb->bytes + offset;
+		iovs[2 * i].iov_len = pb->mirrored ?
+				len : MIN(len, pb->max_size - offset);
+		iovs[2 * i + 1].iov_base = pb->bytes;
+		iovs[2 * i + 1].iov_len = len - iovs[2 * i].iov_len;
+	}
+
+	rc = send_packets(info->fd, iovs, 2, num_packets);
+	if (rc <= 0)
+		return rc;
 
-		return err;
+	buf_increment_read(pb, rc * len);
+	return rc * len;
+}
+
+/* Encodes queued playback samples until there are bytes enough to write, or
+ * less than one frame queued. */
+static void msbc_encode_queued(struct hfp_info *info, unsigned int bytes)
+{
+	uint8_t *samples, *pkt;
+	unsigned int to_encode;
+	size_t encoded;
+	int processed;
+
+	while (info->msbc_out_len < bytes &&
+	       info->msbc_out_len + MSBC_PKT_SIZE <= sizeof(info->msbc_out)) {
+		to_encode = MSBC_CODE_SIZE;
+		get_read_buf_bytes(info->playback_buf, &samples, &to_encode);
+		if (to_encode != MSBC_CODE_SIZE)
+			break;
+
+		pkt = info->msbc_out + info->msbc_out_len;
+		pkt[0] = 0x01;
+		pkt[1] = h2_header_frames_count[info->msbc_write_seq];
+		processed = info->msbc_write->encode(
+				info->msbc_write, samples, MSBC_CODE_SIZE,
+				pkt + MSBC_H2_HEADER_LEN, MSBC_FRAME_LEN,
+				&encoded);
+		if (processed != MSBC_CODE_SIZE || encoded != MSBC_FRAME_LEN) {
+			syslog(LOG_ERR, "mSBC encode failed %d", processed);
+			break;
+		}
+		pkt[MSBC_PKT_SIZE - 1] = 0;
+
+		put_read_buf_bytes(info->playback_buf, MSBC_CODE_SIZE);
+		info->msbc_write_seq = (info->msbc_write_seq + 1) % 4;
+		info->msbc_out_len += MSBC_PKT_SIZE;
+	}
+}
+
+/* Writes encoded mSBC frames, cut to the packet size of the link. */
+static int hfp_write_msbc(struct hfp_info *info, unsigned int num_packets)
+{
+	struct iovec iovs[HFP_MAX_PACKETS];
+	unsigned int i, sent;
+	int rc;
+
+	msbc_encode_queued(info, num_packets * info->packet_size);
+	num_packets = MIN(num_packets, info->msbc_out_len / info->packet_size);
+	if (num_packets == 0) {
+		syslog(LOG_ERR, "Buffer not enough for write.");
+		return 0;
 	}
 
-	if (err != HFP_MTU_BYTES) {
-		syslog(LOG_ERR, "Partially write %d bytes", err);
+	for (i = 0; i < num_packets; i++) {
+		iovs[i].iov_base = info->msbc_out + i * info->packet_size;
+		iovs[i].iov_len = info->packet_size;
+	}
+
+	rc = send_packets(info->fd, iovs, 1, num_packets);
+	if (rc <= 0)
+		return rc;
+
+	sent = rc * info->packet_size;
+	info->msbc_out_len -= sent;
+	memmove(info->msbc_out, info->msbc_out + sent, info->msbc_out_len);
+	return sent;
+}
+
+/* Writes as many bytes of SCO packets as the link consumed, the bytes read
+ * and the ones concealed, to keep pace with the link clock. Returns the
+ * number of bytes written. */
+int hfp_write(struct hfp_info *info, unsigned int bytes)
+{
+	unsigned int num_packets;
+
+	num_packets = MIN(bytes / info->packet_size, HFP_MAX_PACKETS);
+	if (num_packets == 0)
+		return 0;
+
+	if (info->codec == HFP_CODEC_ID_MSBC)
+		return hfp_write_msbc(info, num_packets);
+	return hfp_write_cvsd(info, num_packets);
+}
+
+/* Returns the sequence number in an H2 header, or -1 if it isn't one. */
+static int h2_header_seq(const uint8_t *header)
+{
+	int i;
+
+	if (header[0] != 0x01)
 		return -1;
+	for (i = 0; i < 4; i++)
+		if (header[1] == h2_header_frames_count[i])
+			return i;
+	return -1;
+}
+
+/* Decodes one mSBC frame to the capture buffer, or conceals it if frame is
+ * NULL or corrupted. */
+static void msbc_decode_frame(struct hfp_info *info, const uint8_t *frame)
+{
+	uint8_t *capture;
+	unsigned int to_write = MSBC_CODE_SIZE;
+	size_t decoded = 0;
+	int processed = 0;
+
+	get_write_buf_bytes(info->capture_buf, &capture, &to_write);
+	if (to_write != MSBC_CODE_SIZE) {
+		syslog(LOG_ERR, "Buffer not enough for read.");
+		return;
 	}
 
-	put_read_buf_bytes(info->playback_buf, to_send);
+	if (frame)
+		processed = info->msbc_read->decode(info->msbc_read, frame,
+						    MSBC_FRAME_LEN, capture,
+						    MSBC_CODE_SIZE, &decoded);
+	if (processed == MSBC_FRAME_LEN && decoded == MSBC_CODE_SIZE)
+		cras_msbc_plc_handle_good_frame(info->msbc_plc,
+						(int16_t *)capture);
+	else
+		cras_msbc_plc_handle_bad_frame(info->msbc_plc,
+					       (int16_t *)capture);
 
-	return err;
+	put_write_buf_bytes(info->capture_buf, MSBC_CODE_SIZE);
 }
 
-int hfp_read(struct hfp_info *info)
+/* Appends bytes read from the socket and decodes the complete mSBC frames.
+ * Frames are found by their H2 header and mSBC sync word, so packets
+ * dropped or cut by the controller only lose the frames they carry, which
+ * are concealed based on the sequence numbers and the arrival times. */
+static void msbc_receive(struct hfp_info *info, const uint8_t *data,
+			 unsigned int len)
 {
-	int err = 0;
-	unsigned to_read;
-	uint8_t *capture_buf;
+	uint8_t *in = info->msbc_in;
+	unsigned int i, lost, time_lost;
+	int seq;
+
+	if (info->msbc_in_len + len > sizeof(info->msbc_in))
+		info->msbc_in_len = 0;
+	memcpy(in + info->msbc_in_len, data, len);
+	info->msbc_in_len += len;
+
+	while (1) {
+		for (i = 0; i + 2 < info->msbc_in_len; i++)
+			if (h2_header_seq(in + i) >= 0 &&
+			    in[i + MSBC_H2_HEADER_LEN] == MSBC_SYNC_WORD)
+				break;
+		/* Keep what could be the start of a header. */
+		if (i + 2 >= info->msbc_in_len)
+			i = info->msbc_in_len > 2 ? info->msbc_in_len - 2 : 0;
+		info->msbc_in_len -= i;
+		memmove(in, in + i, info->msbc_in_len);
+
+		if (info->msbc_in_len < MSBC_H2_HEADER_LEN + MSBC_FRAME_LEN)
+			break;
+
+		seq = h2_header_seq(in);
+		lost = info->msbc_read_seq < 0 ? 0 :
+			(seq - info->msbc_read_seq) & 3;
+		/* The arrival times count the frames lost, the sequence
+		 * number tells the remainder of four exactly. */
+		time_lost = (info->msbc_lost_bytes + MSBC_PKT_SIZE / 2) /
+				MSBC_PKT_SIZE;
+		if (time_lost > lost)
+			lost += (time_lost - lost + 2) / 4 * 4;
+		info->msbc_lost_bytes = 0;
+
+		if (info->msbc_drop_bytes >= MSBC_PKT_SIZE) {
+			info->msbc_drop_bytes -= MSBC_PKT_SIZE;
+		} else if (info->idev) {
+			while (lost--)
+				msbc_decode_frame(info, NULL);
+			msbc_decode_frame(info, in + MSBC_H2_HEADER_LEN);
+		}
+		info->msbc_read_seq = (seq + 1) & 3;
 
-	to_read = HFP_MTU_BYTES;
-	get_write_buf_bytes(info->capture_buf, &capture_buf, &to_read);
-	if (to_read != HFP_MTU_BYTES) {
+		/* The padding byte is skipped by the next sync search. */
+		info->msbc_in_len -= MSBC_H2_HEADER_LEN + MSBC_FRAME_LEN;
+		memmove(in, in + MSBC_H2_HEADER_LEN + MSBC_FRAME_LEN,
+			info->msbc_in_len);
+	}
+}
+
+/* Copies bytes to the capture buffer, across its end if needed. */
+static void capture_write(struct hfp_info *info, const uint8_t *data,
+			  unsigned int len)
+{
+	uint8_t *capture;
+	unsigned int to_write;
+
+	if (buf_available_bytes(info->capture_buf) < len) {
 		syslog(LOG_ERR, "Buffer not enough for read.");
-		return 0;
+		return;
 	}
 
-recv_sample:
-	err = recv(info->fd, capture_buf, to_read, 0);
-	if (err < 0) {
-		syslog(LOG_ERR, "Read error %s", strerror(errno));
-		if (errno == EINTR)
-			goto recv_sample;
+	while (len) {
+		to_write = len;
+		get_write_buf_bytes(info->capture_buf, &capture, &to_write);
+		memcpy(capture, data, to_write);
+		put_write_buf_bytes(info->capture_buf, to_write);
+		data += to_write;
+		len -= to_write;
+	}
+}
 
-		return err;
+/* Stores a CVSD packet read. An odd trailing byte is a sample cut by the
+ * controller and dropped, to keep the next packets aligned. */
+static void cvsd_receive(struct hfp_info *info, const uint8_t *data,
+			 unsigned int len)
+{
+	len &= ~1;
+	if (len == 0)
+		return;
+
+	memcpy(info->cvsd_last, data, len);
+	info->cvsd_last_len = len;
+	info->cvsd_concealed = 0;
+	if (info->idev)
+		capture_write(info, data, len);
+}
+
+/* Conceals lost CVSD bytes by repeating the last packet, at half the level
+ * for each repetition, until it fades to silence. */
+static void cvsd_conceal(struct hfp_info *info, unsigned int len)
+{
+	int16_t samples[HFP_MAX_PACKET_SIZE / 2];
+	const int16_t *last = (const int16_t *)info->cvsd_last;
+	unsigned int i, n, count;
+
+	len &= ~1;
+	while (len) {
+		count = info->cvsd_last_len ?
+			MIN(len, info->cvsd_last_len) : MIN(len, sizeof(samples));
+		info->cvsd_concealed++;
+		for (i = 0; i < count / 2; i++) {
+			n = info->cvsd_concealed;
+			samples[i] = (info->cvsd_last_len && n < 16) ?
+					last[i] >> n : 0;
+		}
+		if (info->idev)
+			capture_write(info, (uint8_t *)samples, count);
+		len -= count;
 	}
+}
 
-	if (err != HFP_MTU_BYTES) {
-		syslog(LOG_ERR, "Partially read %d bytes", err);
-		return -1;
+/* Places a packet of len bytes, arrived at the given time, on the link clock.
+ * The link level drains at the estimated link rate and fills with the
+ * packets. When it drops below the jitter allowance the packets missing are
+ * concealed, and when packets concealed arrive after all they are dropped,
+ * so late packets cost neither audio nor latency.
+ * Args:
+ *    info - The hfp_info of the link.
+ *    len - Bytes of the packet.
+ *    arrival - Time the packet arrived, CLOCK_MONOTONIC.
+ *    conceal - Filled with the bytes to conceal before this packet.
+ * Returns:
+ *    1 if the packet is to be dropped, otherwise 0.
+ */
+static int jitter_update(struct hfp_info *info, unsigned int len,
+			 struct timespec *arrival, unsigned int *conceal)
+{
+	unsigned int max_bytes = HFP_JITTER_MAX_PACKETS * info->packet_size;
+	int last_level, lost, drop = 0;
+	struct timespec elapsed;
+
+	*conceal = 0;
+	if (info->link_last.tv_sec == 0 && info->link_last.tv_nsec == 0) {
+		info->link_last = *arrival;
+		info->link_level = 0;
+	}
+	last_level = info->link_level + max_bytes;
+
+	if (timespec_after(arrival, &info->link_last)) {
+		subtract_timespecs(arrival, &info->link_last, &elapsed);
+		info->link_level -= rate_estimator_get_rate(info->link_est) *
+				(elapsed.tv_sec + elapsed.tv_nsec / 1e9);
+		info->link_last = *arrival;
 	}
 
-	put_write_buf_bytes(info->capture_buf, err);
+	/* Packets more than the jitter allowance late, rounded to the
+	 * nearest, are lost. */
+	lost = (-info->link_level - info->jitter) / len + 0.5;
+	if (lost > 0) {
+		*conceal = lost * len;
+		info->link_level += *conceal;
+		info->jitter_debt = MIN(info->jitter_debt + *conceal,
+					max_bytes);
+	}
 
-	return err;
+	/* A packet more than half a packet early, while some are owed, is
+	 * one concealed arriving after all. Allow more jitter. */
+	if (info->link_level > len / 2 && info->jitter_debt >= len) {
+		drop = 1;
+		info->jitter_debt -= len;
+		info->jitter = MIN(info->jitter + info->packet_size / 2,
+				   max_bytes - info->packet_size);
+		info->jitter_quiet = 0;
+	} else {
+		info->link_level += len;
+		if (++info->jitter_quiet >= HFP_JITTER_DECAY_PACKETS) {
+			info->jitter_quiet = 0;
+			info->jitter_debt = 0;
+			if (info->jitter > info->packet_size * 3 / 4)
+				info->jitter -= info->packet_size / 4;
+		}
+	}
+
+	/* Early bursts with nothing owed come from a late first packet, follow
+	 * the link instead of building up latency. */
+	if (info->link_level > max_bytes)
+		info->link_level = max_bytes;
+
+	/* Only the packet arrived, dropped or not, is counted. Whatever else
+	 * moved the level was done here. */
+	rate_estimator_add_frames(info->link_est,
+				  (int)(info->link_level + max_bytes) -
+				  last_level - len);
+	rate_estimator_check(info->link_est, info->link_level + max_bytes,
+			     arrival);
+
+	return drop;
+}
+
+/* Finds when a packet arrived, from its SO_TIMESTAMP if any, converted from
+ * CLOCK_REALTIME to CLOCK_MONOTONIC. Falls back to now. */
+static void packet_arrival(struct msghdr *msg, const struct timespec *now,
+			   const struct timespec *now_real,
+			   struct timespec *arrival)
+{
+	struct cmsghdr *cmsg;
+	struct timespec stamp, ago;
+	struct timeval tv;
+
+	*arrival = *now;
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET ||
+		    cmsg->cmsg_type != SCM_TIMESTAMP)
+			continue;
+		memcpy(&tv, CMSG_DATA(cmsg), sizeof(tv));
+		stamp.tv_sec = tv.tv_sec;
+		stamp.tv_nsec = tv.tv_usec * 1000;
+		if (!timespec_after(now_real, &stamp))
+			return;
+		subtract_timespecs(now_real, &stamp, &ago);
+		if (timespec_after(now, &ago))
+			subtract_timespecs(now, &ago, arrival);
+		return;
+	}
+}
+
+/* Reads all the SCO packets queued in the socket, up to HFP_MAX_PACKETS,
+ * in one system call. Packets of any size are taken, and placed on the link
+ * clock by their arrival time to conceal the ones lost and drop the ones
+ * concealed that arrive late. Samples are dropped when there is no input
+ * iodev.
+ * Returns the number of link bytes the packets read cover, lost ones
+ * included. */
+int hfp_read(struct hfp_info *info)
+{
+	uint8_t packets[HFP_MAX_PACKETS][HFP_MAX_PACKET_SIZE];
+	uint8_t cmsgs[HFP_MAX_PACKETS][HFP_CMSG_SIZE];
+	struct mmsghdr msgs[HFP_MAX_PACKETS];
+	struct iovec iovs[HFP_MAX_PACKETS];
+	struct timespec now, now_real, arrival;
+	unsigned int i, len, conceal;
+	int rc, drop, bytes = 0;
+
+	memset(msgs, 0, sizeof(msgs));
+	for (i = 0; i < HFP_MAX_PACKETS; i++) {
+		iovs[i].iov_base = packets[i];
+		iovs[i].iov_len = HFP_MAX_PACKET_SIZE;
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		msgs[i].msg_hdr.msg_control = cmsgs[i];
+		msgs[i].msg_hdr.msg_controllen = HFP_CMSG_SIZE;
+	}
+
+	do {
+		rc = recvmmsg(info->fd, msgs, HFP_MAX_PACKETS, MSG_DONTWAIT,
+			      NULL);
+	} while (rc < 0 && errno == EINTR);
+
+	if (rc < 0) {
+		rc = -errno;
+		if (rc == -EAGAIN)
+			return 0;
+		syslog(LOG_ERR, "Read error %s", strerror(-rc));
+		return rc;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	clock_gettime(CLOCK_REALTIME, &now_real);
+
+	for (i = 0; i < (unsigned int)rc; i++) {
+		len = msgs[i].msg_len;
+		if (len == 0)
+			continue;
+		info->packet_size = len;
+
+		packet_arrival(&msgs[i].msg_hdr, &now, &now_real, &arrival);
+		drop = jitter_update(info, len, &arrival, &conceal);
+		bytes += conceal + (drop ? 0 : len);
+
+		if (info->codec == HFP_CODEC_ID_MSBC) {
+			info->msbc_lost_bytes += conceal;
+			if (drop)
+				info->msbc_drop_bytes += len;
+			msbc_receive(info, packets[i], len);
+			continue;
+		}
+
+		if (conceal)
+			cvsd_conceal(info, conceal);
+		if (!drop)
+			cvsd_receive(info, packets[i], len);
+	}
+
+	return bytes;
 }
 
 /* Callback function to handle sample read and write.
@@ -279,9 +765,11 @@ recv_sample:
  * there is actual some sample to read while the socket always reports
  * writable even when device buffer is full.
  * The strategy is to synchronize read & write operations:
- * 1. Read one chunk of MTU bytes of data.
+ * 1. Read all the SCO packets queued, in one system call, and conceal the
+ *    ones their arrival times show lost.
  * 2. When input device not attached, ignore the data just read.
- * 3. When output device attached, write one chunk of MTU bytes of data.
+ * 3. When output device attached, write as many bytes as the link consumed
+ *    meanwhile, read and lost, also in one system call.
  */
 static int hfp_info_callback(void *arg)
 {
@@ -297,12 +785,8 @@ static int hfp_info_callback(void *arg)
 		goto read_write_error;
 	}
 
-	/* Ignore the MTU bytes just read if input dev not in present */
-	if (!info->idev)
-		put_read_buf_bytes(info->capture_buf, HFP_MTU_BYTES);
-
-	if (info->odev) {
-		err = hfp_write(info);
+	if (info->odev && err > 0) {
+		err = hfp_write(info, err);
 		if (err < 0) {
 			syslog(LOG_ERR, "Write error");
 			goto read_write_error;
@@ -332,17 +816,26 @@ struct hfp_info *hfp_info_create()
 	if (!info->playback_buf)
 		goto error;
 
-	init_buf(info->playback_buf);
-	init_buf(info->capture_buf);
+	info->link_est = rate_estimator_create(HFP_BYTE_RATE,
+					       &link_rate_window,
+					       link_rate_smooth_factor);
+	if (!info->link_est)
+		goto error;
+
+	buf_reset(info->playback_buf);
+	buf_reset(info->capture_buf);
+	info->codec = HFP_CODEC_ID_CVSD;
+	info->packet_size = HFP_MTU_BYTES;
 
 	return info;
 
 error:
 	if (info) {
 		if (info->capture_buf)
-			destroy_buf(info->capture_buf);
+			byte_buffer_destroy(info->capture_buf);
 		if (info->playback_buf)
-			destroy_buf(info->playback_buf);
+			byte_buffer_destroy(info->playback_buf);
+		rate_estimator_destroy(info->link_est);
 		free(info);
 	}
 	return NULL;
@@ -353,11 +846,68 @@ int hfp_info_running(struct hfp_info *info)
 	return info->started;
 }
 
-int hfp_info_start(int fd, struct hfp_info *info)
+/* Frees the mSBC codecs, if any. */
+static void msbc_destroy(struct hfp_info *info)
+{
+	if (info->msbc_read)
+		cras_sbc_codec_destroy(info->msbc_read);
+	if (info->msbc_write)
+		cras_sbc_codec_destroy(info->msbc_write);
+	if (info->msbc_plc)
+		cras_msbc_plc_destroy(info->msbc_plc);
+	info->msbc_read = NULL;
+	info->msbc_write = NULL;
+	info->msbc_plc = NULL;
+}
+
+int hfp_info_start(int fd, int codec, struct hfp_info *info)
 {
+	size_t buf_size = HFP_BUF_SIZE_BYTES;
+	int on = 1;
+
+	if (codec == HFP_CODEC_ID_MSBC) {
+		info->msbc_read = cras_msbc_codec_create();
+		info->msbc_write = cras_msbc_codec_create();
+		info->msbc_plc = cras_msbc_plc_create();
+		if (!info->msbc_read || !info->msbc_write || !info->msbc_plc) {
+			msbc_destroy(info);
+			return -ENOMEM;
+		}
+		buf_size = HFP_MSBC_BUF_SIZE_BYTES;
+	}
+
 	info->fd = fd;
-	init_buf(info->playback_buf);
-	init_buf(info->capture_buf);
+	info->codec = codec;
+	info->packet_size = codec == HFP_CODEC_ID_MSBC ?
+			MSBC_PKT_SIZE : HFP_MTU_BYTES;
+	info->msbc_read_seq = -1;
+	info->msbc_write_seq = 0;
+	info->msbc_in_len = 0;
+	info->msbc_out_len = 0;
+	info->msbc_lost_bytes = 0;
+	info->msbc_drop_bytes = 0;
+	info->cvsd_last_len = 0;
+	info->cvsd_concealed = 0;
+
+	rate_estimator_reset_rate(info->link_est,
+				  codec == HFP_CODEC_ID_MSBC ?
+					HFP_MSBC_LINK_BYTE_RATE :
+					HFP_BYTE_RATE);
+	info->link_last.tv_sec = 0;
+	info->link_last.tv_nsec = 0;
+	info->link_level = 0;
+	info->jitter = info->packet_size / 2;
+	info->jitter_debt = 0;
+	info->jitter_quiet = 0;
+
+	/* Arrival times place the packets on the link clock. Without them
+	 * the time read is used, which only hides more jitter. */
+	if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMP, &on, sizeof(on)))
+		syslog(LOG_WARNING, "Failed to enable SCO timestamps: %s",
+		       strerror(errno));
+
+	buf_set_size(info->playback_buf, buf_size);
+	buf_set_size(info->capture_buf, buf_size);
 
 	audio_thread_add_callback(info->fd, hfp_info_callback, info);
 
@@ -376,6 +926,7 @@ int hfp_info_stop(struct hfp_info *info)
 	close(info->fd);
 	info->fd = 0;
 	info->started = 0;
+	msbc_destroy(info);
 
 	return 0;
 }
@@ -383,10 +934,11 @@ int hfp_info_stop(struct hfp_info *info)
 void hfp_info_destroy(struct hfp_info *info)
 {
 	if (info->capture_buf)
-		destroy_buf(info->capture_buf);
+		byte_buffer_destroy(info->capture_buf);
 
 	if (info->playback_buf)
-		destroy_buf(info->playback_buf);
+		byte_buffer_destroy(info->playback_buf);
 
+	rate_estimator_destroy(info->link_est);
 	free(info);
 }
@@ -26,8 +26,13 @@ int hfp_info_running(struct hfp_info *info);
 
 /* Starts the hfp_info to transmit and reveice samples to and from the file
  * descriptor of a SCO socket.
+ * Args:
+ *    fd - The SCO socket.
+ *    codec - HFP_CODEC_ID_CVSD to carry 8kHz samples, or HFP_CODEC_ID_MSBC
+ *        to encode and decode 16kHz samples.
+ *    info - The hfp_info to start.
  */
-int hfp_info_start(int fd, struct hfp_info *info);
+int hfp_info_start(int fd, int codec, struct hfp_info *info);
 
 /* Stops given hfp_info. This implies sample transmission will
  * stop and socket be closed.
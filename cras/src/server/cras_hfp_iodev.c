@@ -5,31 +5,45 @@
 
 #include <sys/socket.h>
 #include <syslog.h>
+#include <unistd.h>
 
 #include "cras_audio_area.h"
 #include "cras_hfp_iodev.h"
 #include "cras_hfp_info.h"
+#include "cras_hfp_slc.h"
 #include "cras_iodev.h"
 #include "cras_system_state.h"
 #include "cras_util.h"
 #include "utlist.h"
 
 
+/* Members:
+ *    base - The cras_iodev structure base class.
+ *    device - The bt device this iodev belongs to.
+ *    info - The hfp_info shared with the iodev of the other direction.
+ *    opened - If the iodev is open.
+ *    codec - The codec negotiated when the formats were last updated.
+ */
 struct hfp_io {
 	struct cras_iodev base;
 	struct cras_bt_device *device;
 	struct hfp_info *info;
 	int opened;
+	int codec;
 };
 
 static int update_supported_formats(struct cras_iodev *iodev)
 {
-	// 16 bit, mono, 8kHz
+	struct hfp_io *hfpio = (struct hfp_io *)iodev;
+
+	// 16 bit, mono, 8kHz for CVSD or 16kHz for mSBC
 	iodev->format->format = SND_PCM_FORMAT_S16_LE;
+	hfpio->codec = cras_bt_device_get_sco_codec(hfpio->device);
 
 	free(iodev->supported_rates);
 	iodev->supported_rates = (size_t *)malloc(2 * sizeof(size_t));
-	iodev->supported_rates[0] = 8000;
+	iodev->supported_rates[0] =
+		hfpio->codec == HFP_CODEC_ID_MSBC ? 16000 : 8000;
 	iodev->supported_rates[1] = 0;
 
 	free(iodev->supported_channel_counts);
@@ -70,14 +84,16 @@ static int open_dev(struct cras_iodev *iodev)
 	if (hfp_info_running(hfpio->info))
 		goto add_dev;
 
-	sk = cras_bt_device_sco_connect(hfpio->device);
+	sk = cras_bt_device_sco_connect(hfpio->device, hfpio->codec);
 	if (sk < 0)
 		goto error;
 
 	/* Start hfp_info */
-	err = hfp_info_start(sk, hfpio->info);
-	if (err)
+	err = hfp_info_start(sk, hfpio->codec, hfpio->info);
+	if (err) {
+		close(sk);
 		goto error;
+	}
 
 add_dev:
 	hfp_info_add_iodev(hfpio->info, iodev);
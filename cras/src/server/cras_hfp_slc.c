@@ -47,6 +47,8 @@
  *    signal - Current signal strength of AG stored in SLC.
  *    service - Current service availability of AG stored in SLC.
  *    callheld - Current callheld status of AG stored in SLC.
+ *    hf_supports_msbc - The HF listed mSBC in AT+BAC.
+ *    selected_codec - The codec confirmed by the HF in AT+BCS.
  *    telephony - A reference of current telephony handle.
  */
 struct hfp_slc_handle {
@@ -64,6 +66,8 @@ struct hfp_slc_handle {
 	int signal;
 	int service;
 	int callheld;
+	int hf_supports_msbc;
+	int selected_codec;
 
 	struct cras_telephony_handle *telephony;
 };
@@ -137,6 +141,16 @@ static int hfp_send_calling_line_identification(struct hfp_slc_handle *handle,
 	return hfp_send(handle, cmd);
 }
 
+/* Sends +BCS to start codec connection with the preferred codec. */
+static int select_codec(struct hfp_slc_handle *handle)
+{
+	char cmd[16];
+
+	snprintf(cmd, 16, "+BCS:%d", handle->hf_supports_msbc ?
+			HFP_CODEC_ID_MSBC : HFP_CODEC_ID_CVSD);
+	return hfp_send(handle, cmd);
+}
+
 /* ATA command to accept an incoming call. Mandatory support per spec 4.13. */
 static int answer_call(struct hfp_slc_handle *handle, const char *cmd)
 {
@@ -148,6 +162,65 @@ static int answer_call(struct hfp_slc_handle *handle, const char *cmd)
 	return cras_telephony_event_answer_call();
 }
 
+/* AT+BAC command notifies the codecs the HF supports. Mandatory when both
+ * sides support codec negotiation, spec 4.34.1.
+ */
+static int available_codecs(struct hfp_slc_handle *handle, const char *cmd)
+{
+	char *tokens, *id;
+
+	tokens = strdup(cmd);
+	if (!tokens)
+		return -ENOMEM;
+	strtok(tokens, "=");
+
+	handle->hf_supports_msbc = 0;
+	while ((id = strtok(NULL, ",")))
+		if (atoi(id) == HFP_CODEC_ID_MSBC)
+			handle->hf_supports_msbc = 1;
+
+	free(tokens);
+	return hfp_send(handle, "OK");
+}
+
+/* AT+BCC command from the HF to trigger codec connection, spec 4.11.2. */
+static int bluetooth_codec_connection(struct hfp_slc_handle *handle,
+				      const char *cmd)
+{
+	int err;
+
+	err = hfp_send(handle, "OK");
+	if (err)
+		return err;
+
+	return select_codec(handle);
+}
+
+/* AT+BCS command confirms the codec sent in +BCS, spec 4.11.3. */
+static int bluetooth_codec_selection(struct hfp_slc_handle *handle,
+				     const char *cmd)
+{
+	static const char prefix[] = "AT+BCS=";
+	const char *start = cmd + sizeof(prefix) - 1;
+	char *end;
+	long id;
+
+	if (strncmp(cmd, prefix, sizeof(prefix) - 1))
+		return hfp_send(handle, "ERROR");
+
+	id = strtol(start, &end, 10);
+	if (end == start || *end != '\0')
+		return hfp_send(handle, "ERROR");
+	if (id != HFP_CODEC_ID_CVSD &&
+	    !(id == HFP_CODEC_ID_MSBC && handle->hf_supports_msbc)) {
+		syslog(LOG_ERR, "Unexpected codec %ld selected", id);
+		return hfp_send(handle, "ERROR");
+	}
+
+	handle->selected_codec = id;
+	return hfp_send(handle, "OK");
+}
+
 /* AT+CCWA command to enable the "Call Waiting notification" function.
  * Mandatory support per spec 4.21. */
 static int call_waiting_notify(struct hfp_slc_handle *handle, const char *buf)
@@ -237,6 +310,10 @@ static int event_reporting(struct hfp_slc_handle *handle, const char *cmd)
 				handle->init_cb(handle);
 				handle->initialized = 1;
 			}
+			/* Propose mSBC now, the SCO link uses CVSD until
+			 * the HF confirms it. */
+			if (err == 0 && handle->hf_supports_msbc)
+				err = select_codec(handle);
 		}
 	} else {
 		syslog(LOG_ERR, "No service level connection established,"
@@ -502,10 +579,22 @@ static int terminate_call(struct hfp_slc_handle *handle, const char *cmd)
  * HF(hands-free)                             AG(audio gateway)
  *                     AT+CMER= -->
  *                 <-- OK
+ *
+ * When both sides support codec negotiation, the HF lists its codecs with
+ * AT+BAC=<codec ids> after step 1. If mSBC is one of them, the AG proposes
+ * it once the service level connection is established.
+ *
+ * HF(hands-free)                             AG(audio gateway)
+ *                 <-- +BCS:2
+ *                     AT+BCS=2 -->
+ *                 <-- OK
  */
 static struct at_command at_commands[] = {
 	{ "ATA", answer_call },
 	{ "ATD", dial_number },
+	{ "AT+BAC", available_codecs },
+	{ "AT+BCC", bluetooth_codec_connection },
+	{ "AT+BCS", bluetooth_codec_selection },
 	{ "AT+BIA", indicator_activation },
 	{ "AT+BLDN", last_dialed_number },
 	{ "AT+BRSF", supported_features },
@@ -614,6 +703,7 @@ struct hfp_slc_handle *hfp_slc_create(int fd,
 	handle->battery = 5;
 	handle->signal = 5;
 	handle->service = 1;
+	handle->selected_codec = HFP_CODEC_ID_CVSD;
 	handle->telephony = cras_telephony_get();
 
 	cras_system_add_select_fd(handle->rfcomm_fd,
@@ -629,6 +719,11 @@ void hfp_slc_destroy(struct hfp_slc_handle *slc_handle)
 	free(slc_handle);
 }
 
+int hfp_slc_get_selected_codec(struct hfp_slc_handle *handle)
+{
+	return handle->selected_codec;
+}
+
 /* Procedure to setup a call when AG sees incoming call.
  *
  * HF(hands-free)                             AG(audio gateway)
@@ -6,6 +6,10 @@
 #ifndef CRAS_HFP_SLC_H_
 #define CRAS_HFP_SLC_H_
 
+/* Codec ids of HFP codec negotiation, HFP spec 10. */
+#define HFP_CODEC_ID_CVSD 1
+#define HFP_CODEC_ID_MSBC 2
+
 struct hfp_slc_handle;
 
 /* Callback to call when service level connection initialized. */
@@ -59,4 +63,8 @@ int hfp_event_set_service(struct hfp_slc_handle *handle, int value);
 /* Sets speaker gain value to headsfree device. */
 int hfp_event_speaker_gain(struct hfp_slc_handle *handle, int gain);
 
+/* Gets the codec to use on the SCO link, HFP_CODEC_ID_MSBC once the HF has
+ * confirmed it in codec negotiation, HFP_CODEC_ID_CVSD otherwise. */
+int hfp_slc_get_selected_codec(struct hfp_slc_handle *handle);
+
 #endif /* CRAS_HFP_SLC_H_ */
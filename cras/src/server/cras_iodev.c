@@ -550,24 +550,61 @@ int cras_iodev_close(struct cras_iodev *iodev)
 		return 0;
 	buffer_share_destroy(iodev->buf_state);
 	iodev->buf_state = NULL;
+	iodev->is_standby = 0;
 	return iodev->close_dev(iodev);
 }
 
+int cras_iodev_standby(struct cras_iodev *iodev)
+{
+	int rc;
+
+	if (!iodev->standby_dev || !iodev->is_open(iodev))
+		return -EINVAL;
+	rc = iodev->standby_dev(iodev);
+	if (rc < 0)
+		return rc;
+	iodev->is_standby = 1;
+	return 0;
+}
+
 int cras_iodev_put_input_buffer(struct cras_iodev *iodev, unsigned int nframes)
 {
 	rate_estimator_add_frames(iodev->rate_est, -nframes);
 	return iodev->put_buffer(iodev, nframes);
 }
 
+void cras_iodev_register_pre_dsp_hook(struct cras_iodev *iodev,
+				      loopback_hook_t loop_cb,
+				      void *cb_data)
+{
+	iodev->pre_dsp_hook = loop_cb;
+	iodev->pre_dsp_hook_cb_data = cb_data;
+}
+
+void cras_iodev_register_post_dsp_hook(struct cras_iodev *iodev,
+				       loopback_hook_t loop_cb,
+				       void *cb_data)
+{
+	iodev->post_dsp_hook = loop_cb;
+	iodev->post_dsp_hook_cb_data = cb_data;
+}
+
 int cras_iodev_put_output_buffer(struct cras_iodev *iodev, uint8_t *frames,
 				 unsigned int nframes)
 {
 	const struct cras_audio_format *fmt = iodev->format;
+	const int muted = cras_system_get_mute();
 
-	if (cras_system_get_mute()) {
+	if (muted) {
 		const unsigned int frame_bytes = cras_get_format_bytes(fmt);
 		cras_mix_mute_buffer(frames, frame_bytes, nframes);
-	} else {
+	}
+
+	if (iodev->pre_dsp_hook)
+		iodev->pre_dsp_hook(frames, nframes, iodev->ext_format,
+				    iodev->pre_dsp_hook_cb_data);
+
+	if (!muted) {
 		apply_dsp(iodev, frames, nframes);
 
 		if (cras_iodev_software_volume_needed(iodev)) {
@@ -580,6 +617,10 @@ int cras_iodev_put_output_buffer(struct cras_iodev *iodev, uint8_t *frames,
 		}
 	}
 
+	if (iodev->post_dsp_hook)
+		iodev->post_dsp_hook(frames, nframes, fmt,
+				     iodev->post_dsp_hook_cb_data);
+
 	rate_estimator_add_frames(iodev->rate_est, nframes);
 	return iodev->put_buffer(iodev, nframes);
 }
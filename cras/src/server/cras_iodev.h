@@ -26,6 +26,17 @@ struct audio_thread;
 struct cras_iodev;
 struct rate_estimator;
 
+/* Callback type for a tap on the samples written to an output device.
+ * Args:
+ *    frames - The samples being written, interleaved.
+ *    nframes - The number of frames in frames.
+ *    fmt - The format of the samples.
+ *    cb_data - The data registered with the hook.
+ */
+typedef void (*loopback_hook_t)(const uint8_t *frames, unsigned int nframes,
+				const struct cras_audio_format *fmt,
+				void *cb_data);
+
 /* Holds an output/input node for this device.  An ionode is a control that
  * can be switched on and off such as headphones or speakers.
  * Members:
@@ -62,6 +73,8 @@ struct cras_ionode {
  * set_swap_mode_for_node - Function to call to set swap mode for the node.
  * open_dev - Opens the device.
  * close_dev - Closes the device if it is open.
+ * standby_dev - Optional, stops an open device and drops the queued samples
+ *     but keeps it configured, so it can be started again quickly.
  * is_open - Checks if the device has been openned.
  * update_supported_formats - Refresh supported frame rates and channel counts.
  * set_as_default - Function to call when this device is set as system default.
@@ -74,6 +87,8 @@ struct cras_ionode {
  * update_active_node - Update the active node using the selected/plugged state.
  * update_channel_layout - Update the channel layout base on set iodev->format,
  *     expect the best available layout be filled to iodev->format.
+ * fill_debug_info - Optional, fills in the device specific fields of the
+ *     audio debug info.
  * format - The audio format being rendered or captured to hardware.
  * ext_format - The audio format that is visible to the rest of the system.
  *     This can be different than the hardware if the device dsp changes it.
@@ -96,11 +111,20 @@ struct cras_ionode {
  *     hardware buffer.
  * extra_silent_frames - In draining, the number of silent frames filled in to
  *     prevent buffer underrun.
+ * is_standby - The device has been drained and stopped but is kept open for
+ *     the next stream.
+ * standby_deadline - When the device in standby will be closed.
  * streams - List of audio streams serviced by dev.
  * min_cb_level - min callback level of any stream attached.
  * max_cb_level - max callback level of any stream attached.
  * buf_state - If multiple streams are writing to this device, then this
  *     keeps track of how much each stream has written.
+ * pre_dsp_hook - Called with the mixed samples before DSP and volume are
+ *     applied, in ext_format.
+ * pre_dsp_hook_cb_data - Callback data for pre_dsp_hook.
+ * post_dsp_hook - Called with the samples after DSP and volume are applied,
+ *     in format.
+ * post_dsp_hook_cb_data - Callback data for post_dsp_hook.
  */
 struct cras_iodev {
 	void (*set_volume)(struct cras_iodev *iodev);
@@ -112,6 +136,7 @@ struct cras_iodev {
 				      int enable);
 	int (*open_dev)(struct cras_iodev *iodev);
 	int (*close_dev)(struct cras_iodev *iodev);
+	int (*standby_dev)(struct cras_iodev *iodev);
 	int (*is_open)(const struct cras_iodev *iodev);
 	int (*update_supported_formats)(struct cras_iodev *iodev);
 	void (*set_as_default)(struct cras_iodev *iodev);
@@ -124,6 +149,8 @@ struct cras_iodev {
 	int (*dev_running)(const struct cras_iodev *iodev);
 	void (*update_active_node)(struct cras_iodev *iodev);
 	int (*update_channel_layout)(struct cras_iodev *iodev);
+	void (*fill_debug_info)(const struct cras_iodev *iodev,
+				struct audio_debug_info *info);
 	struct cras_audio_format *format;
 	struct cras_audio_format *ext_format;
 	struct rate_estimator *rate_est;
@@ -143,10 +170,16 @@ struct cras_iodev {
 	int software_volume_needed;
 	int is_draining;
 	size_t extra_silent_frames;
+	int is_standby;
+	struct timespec standby_deadline;
 	struct dev_stream *streams;
 	unsigned int min_cb_level;
 	unsigned int max_cb_level;
 	struct buffer_share *buf_state;
+	loopback_hook_t pre_dsp_hook;
+	void *pre_dsp_hook_cb_data;
+	loopback_hook_t post_dsp_hook;
+	void *post_dsp_hook_cb_data;
 	struct cras_iodev *prev, *next;
 };
 
@@ -333,9 +366,33 @@ int cras_iodev_open(struct cras_iodev *iodev);
 /* Open an iodev, does teardown and invokes the close_dev callback. */
 int cras_iodev_close(struct cras_iodev *iodev);
 
+/* Puts an open iodev in standby, invokes the standby_dev callback.
+ * Returns:
+ *    0 on success, -EINVAL if the device doesn't support standby or isn't
+ *    open, or the error from standby_dev.
+ */
+int cras_iodev_standby(struct cras_iodev *iodev);
+
 /* Marks a buffer from get_buffer as read. */
 int cras_iodev_put_input_buffer(struct cras_iodev *iodev, unsigned int nframes);
 
+/* Registers a tap on the mixed output of an iodev, called before DSP and
+ * software volume are applied.  Pass a NULL loop_cb to remove the tap.
+ * Args:
+ *    iodev - The output device to tap.
+ *    loop_cb - Called from the audio thread each time samples are written.
+ *    cb_data - Passed back to loop_cb.
+ */
+void cras_iodev_register_pre_dsp_hook(struct cras_iodev *iodev,
+				      loopback_hook_t loop_cb,
+				      void *cb_data);
+
+/* Same as above, but the tap sees the samples after DSP and software volume,
+ * as they are written to the hardware. */
+void cras_iodev_register_post_dsp_hook(struct cras_iodev *iodev,
+				       loopback_hook_t loop_cb,
+				       void *cb_data);
+
 /* Marks a buffer from get_buffer as written. */
 int cras_iodev_put_output_buffer(struct cras_iodev *iodev, uint8_t *frames,
 				 unsigned int nframes);
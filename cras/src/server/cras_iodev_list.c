@@ -6,6 +6,7 @@
 #include <syslog.h>
 
 #include "audio_thread.h"
+#include "cras_config.h"
 #include "cras_empty_iodev.h"
 #include "cras_iodev.h"
 #include "cras_iodev_info.h"
@@ -30,8 +31,7 @@ static struct iodev_list inputs;
 /* Keep an active input and output. */
 static struct cras_iodev *active_output;
 static struct cras_iodev *active_input;
-/* Keep loopback input and output. */
-static struct cras_iodev *loopback_output;
+/* Keep loopback input, fed from the active output device. */
 static struct cras_iodev *loopback_input;
 /* Keep a constantly increasing index for iodevs. Index 0 is reserved
  * to mean "no device". */
@@ -49,6 +49,9 @@ static node_volume_callback_t node_input_gain_callback;
 static node_left_right_swapped_callback_t node_left_right_swapped_callback;
 /* Thread that handles audio input and output. */
 static struct audio_thread *audio_thread;
+/* Standby of output devices, applied to the audio thread when it is created. */
+static unsigned int output_standby_ms = CRAS_OUTPUT_STANDBY_MS;
+static int output_prewarm;
 
 static void nodes_changed_prepare(struct cras_alert *alert);
 static void active_node_changed_prepare(struct cras_alert *alert);
@@ -319,9 +322,11 @@ void cras_iodev_list_init()
 	 * capture from. */
 	fallback_output = empty_iodev_create(CRAS_STREAM_OUTPUT);
 	fallback_input = empty_iodev_create(CRAS_STREAM_INPUT);
-	loopback_iodev_create(&loopback_input, &loopback_output);
+	loopback_input = loopback_iodev_create();
 	audio_thread = audio_thread_create(fallback_output, fallback_input,
-					   loopback_output, loopback_input);
+					   loopback_input);
+	audio_thread_set_output_standby(audio_thread, output_standby_ms,
+					output_prewarm);
 	audio_thread_start(audio_thread);
 
 	/* Add loopback capture device to input device list. */
@@ -330,6 +335,12 @@ void cras_iodev_list_init()
 	cras_iodev_list_update_device_list();
 }
 
+void cras_iodev_list_set_output_standby(unsigned int standby_ms, int prewarm)
+{
+	output_standby_ms = standby_ms;
+	output_prewarm = prewarm;
+}
+
 void cras_iodev_list_deinit()
 {
 	cras_system_remove_volume_changed_cb(sys_vol_change, NULL);
@@ -340,8 +351,9 @@ void cras_iodev_list_deinit()
 	cras_alert_destroy(active_node_changed_alert);
 	nodes_changed_alert = NULL;
 	active_node_changed_alert = NULL;
-	loopback_iodev_destroy(loopback_input, loopback_output);
+	/* The audio thread removes its tap from the output device. */
 	audio_thread_destroy(audio_thread);
+	loopback_iodev_destroy(loopback_input);
 }
 
 /* Finds the current device for a stream of "type", only default streams are
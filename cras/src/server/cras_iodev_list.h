@@ -30,6 +30,16 @@ void cras_iodev_list_init();
 /* Clean up any resources used by iodev. */
 void cras_iodev_list_deinit();
 
+/* Sets how output devices are kept in standby, call before
+ * cras_iodev_list_init.
+ * Args:
+ *    standby_ms - Time to keep an output device open after its last stream
+ *        is removed, 0 to close it once drained.
+ *    prewarm - Non-zero to open the default output in standby when it is
+ *        first selected, before any stream is added.
+ */
+void cras_iodev_list_set_output_standby(unsigned int standby_ms, int prewarm);
+
 /* Gets the iodev that should be used for a stream of given type.
  * Args:
  *    type - The type of stream to find the output for. (media, voice).
@@ -9,193 +9,305 @@
 
 #include "cras_audio_area.h"
 #include "cras_config.h"
+#include "cras_fmt_conv.h"
 #include "cras_iodev.h"
 #include "cras_iodev_list.h"
+#include "cras_loopback_iodev.h"
 #include "cras_types.h"
 #include "cras_util.h"
 #include "utlist.h"
 
 #define LOOPBACK_BUFFER_SIZE 8192
 
-static size_t loopback_supported_rates[] = {
-	44100, 0
+/* Used until an output device has been opened to follow. */
+static const struct cras_audio_format loopback_default_format = {
+	.format = SND_PCM_FORMAT_S16_LE,
+	.frame_rate = 44100,
+	.num_channels = 2,
 };
 
-static size_t loopback_supported_channel_counts[] = {
-	2, 0
-};
-
-static snd_pcm_format_t loopback_supported_formats[] = {
-	SND_PCM_FORMAT_S16_LE, 0
-};
-
-/* Shared buffer between loopback devices.
+/* Ring of samples tapped from the output device.  Only the tap writes to it,
+ * both the tap and the readers run in the audio thread.
  *    buffer - The audio samples being looped.
  *    buffer_frames - Number of audio frames that fit in the buffer.
- *    read_offset - Current read pointer.
- *    write_offset - Current write pointer.
- *    write_ahead - True if write offset is ahead of read and wrapped.
+ *    format - Format of the samples in buffer, the one of the reader that
+ *        opened it.
+ *    write_pos - Total frames written since the ring was opened, the write
+ *        offset is write_pos modulo buffer_frames.
+ *    num_readers - Number of open loopback devices reading from the ring.
+ *    tap_dev - The output device the ring is filled from.
+ *    conv - Converts the tapped samples when their format isn't format.
+ *    conv_buffer - Converted samples before they are copied to buffer.
+ *    conv_buffer_frames - Number of frames that fit in conv_buffer.
  */
-struct shared_buffer {
+struct loopback_ring {
 	uint8_t *buffer;
 	unsigned int buffer_frames;
-	unsigned int read_offset;
-	unsigned int write_offset;
-	int write_ahead;
+	struct cras_audio_format format;
+	uint64_t write_pos;
+	unsigned int num_readers;
+	struct cras_iodev *tap_dev;
+	struct cras_fmt_conv *conv;
+	uint8_t *conv_buffer;
+	unsigned int conv_buffer_frames;
 };
 
 /* loopack iodev.  Keep state of a loopback device.
  *    open - Is the device open.
- *    shared_buffer - Pointer to shared buffer between loopback devices.
+ *    ring - The ring this device reads from, shared with other readers.
+ *    read_pos - Total frames read from the ring, each reader has its own.
+ *    supported_rates - Rates supported, follows the tapped device.
+ *    supported_channel_counts - Channel counts supported, as above.
+ *    supported_formats - Sample formats supported, as above.
  */
 struct loopback_iodev {
 	struct cras_iodev base;
 	int open;
-	struct shared_buffer *shared_buffer;
+	struct loopback_ring *ring;
+	uint64_t read_pos;
+	size_t supported_rates[2];
+	size_t supported_channel_counts[2];
+	snd_pcm_format_t supported_formats[2];
 };
 
+static int formats_equal(const struct cras_audio_format *a,
+			 const struct cras_audio_format *b)
+{
+	return a->format == b->format &&
+	       a->frame_rate == b->frame_rate &&
+	       a->num_channels == b->num_channels;
+}
+
 /*
- * iodev callbacks.
+ * Ring functions, all called from the audio thread.
  */
 
-static int is_open(const struct cras_iodev *iodev)
+static void ring_free_conv(struct loopback_ring *ring)
 {
-	struct loopback_iodev *loopdev = (struct loopback_iodev *)iodev;
-
-	return loopdev && loopdev->open;
+	if (ring->conv)
+		cras_fmt_conv_destroy(ring->conv);
+	ring->conv = NULL;
+	free(ring->conv_buffer);
+	ring->conv_buffer = NULL;
+	ring->conv_buffer_frames = 0;
 }
 
-static int dev_running(const struct cras_iodev *iodev)
+/* Gets a converter from fmt to the ring format, only needed while the tapped
+ * device runs at a different format than the reader was opened with.  It
+ * converts up to LOOPBACK_BUFFER_SIZE frames at once. */
+static struct cras_fmt_conv *ring_get_conv(struct loopback_ring *ring,
+					   const struct cras_audio_format *fmt)
 {
-	return is_open(iodev);
+	if (ring->conv &&
+	    formats_equal(cras_fmt_conv_in_format(ring->conv), fmt))
+		return ring->conv;
+
+	ring_free_conv(ring);
+	ring->conv = cras_fmt_conv_create(fmt, &ring->format,
+					  LOOPBACK_BUFFER_SIZE, 0);
+	if (!ring->conv)
+		return NULL;
+	ring->conv_buffer_frames = cras_fmt_conv_in_frames_to_out(
+			ring->conv, LOOPBACK_BUFFER_SIZE) + 1;
+	ring->conv_buffer = malloc(ring->conv_buffer_frames *
+				   cras_get_format_bytes(&ring->format));
+	if (!ring->conv_buffer) {
+		ring_free_conv(ring);
+		return NULL;
+	}
+	return ring->conv;
 }
 
-static int frames_queued(const struct cras_iodev *iodev)
+static void ring_write(struct loopback_ring *ring, const uint8_t *frames,
+		       unsigned int nframes)
 {
-	struct loopback_iodev *loopdev = (struct loopback_iodev *)iodev;
-	struct shared_buffer *sbuf = loopdev->shared_buffer;
+	unsigned int frame_bytes = cras_get_format_bytes(&ring->format);
+	unsigned int offset, chunk;
+
+	/* Only the newest buffer_frames can be kept. */
+	if (nframes > ring->buffer_frames) {
+		frames += (nframes - ring->buffer_frames) * frame_bytes;
+		ring->write_pos += nframes - ring->buffer_frames;
+		nframes = ring->buffer_frames;
+	}
 
-	if (sbuf->write_ahead)
-		return sbuf->write_offset +
-		       (sbuf->buffer_frames - sbuf->read_offset);
-	if (sbuf->write_offset > sbuf->read_offset)
-		return sbuf->write_offset - sbuf->read_offset;
-	return 0;
+	offset = ring->write_pos % ring->buffer_frames;
+	chunk = MIN(nframes, ring->buffer_frames - offset);
+	memcpy(ring->buffer + offset * frame_bytes, frames,
+	       chunk * frame_bytes);
+	memcpy(ring->buffer, frames + chunk * frame_bytes,
+	       (nframes - chunk) * frame_bytes);
+	ring->write_pos += nframes;
 }
 
-static int delay_frames(const struct cras_iodev *iodev)
+/* Tap registered on the output device, copies the mixed samples once for all
+ * the readers. */
+static void loopback_hook(const uint8_t *frames, unsigned int nframes,
+			  const struct cras_audio_format *fmt, void *cb_data)
 {
-	return frames_queued(iodev);
+	struct loopback_ring *ring = (struct loopback_ring *)cb_data;
+	struct cras_fmt_conv *conv;
+	unsigned int in_frames, out_frames;
+
+	if (!ring->num_readers || !ring->buffer || !fmt)
+		return;
+
+	if (formats_equal(fmt, &ring->format)) {
+		ring_write(ring, frames, nframes);
+		return;
+	}
+
+	conv = ring_get_conv(ring, fmt);
+	if (!conv)
+		return;
+	while (nframes) {
+		in_frames = MIN(nframes, LOOPBACK_BUFFER_SIZE);
+		out_frames = cras_fmt_conv_convert_frames(
+				conv, frames, ring->conv_buffer, &in_frames,
+				ring->conv_buffer_frames);
+		ring_write(ring, ring->conv_buffer, out_frames);
+		if (!in_frames)
+			break;
+		frames += in_frames * cras_get_format_bytes(fmt);
+		nframes -= in_frames;
+	}
 }
 
-static int close_record_dev(struct cras_iodev *iodev)
+static int ring_open(struct loopback_ring *ring,
+		     const struct cras_audio_format *fmt)
 {
-	struct loopback_iodev *loopdev = (struct loopback_iodev *)iodev;
+	if (ring->num_readers++)
+		return 0;
 
-	loopdev->open = 0;
-	cras_iodev_free_format(iodev);
-	cras_iodev_free_audio_area(iodev);
+	ring->format = *fmt;
+	ring->buffer = malloc(cras_get_format_bytes(fmt) *
+			      LOOPBACK_BUFFER_SIZE);
+	if (!ring->buffer) {
+		ring->num_readers = 0;
+		return -ENOMEM;
+	}
+	ring->buffer_frames = LOOPBACK_BUFFER_SIZE;
+	ring->write_pos = 0;
 	return 0;
 }
 
-static int open_record_dev(struct cras_iodev *iodev)
+static void ring_close(struct loopback_ring *ring)
 {
-	struct loopback_iodev *loopdev = (struct loopback_iodev *)iodev;
+	if (--ring->num_readers)
+		return;
 
-	cras_iodev_init_audio_area(iodev, iodev->format->num_channels);
-	loopdev->open = 1;
-	return 0;
+	ring_free_conv(ring);
+	free(ring->buffer);
+	ring->buffer = NULL;
 }
 
-static int get_record_buffer(struct cras_iodev *iodev,
-		      struct cras_audio_area **area,
-		      unsigned *frames)
+/*
+ * iodev callbacks.
+ */
+
+static int is_open(const struct cras_iodev *iodev)
 {
 	struct loopback_iodev *loopdev = (struct loopback_iodev *)iodev;
-	struct shared_buffer *sbuf = loopdev->shared_buffer;
-	unsigned int frame_bytes = cras_get_format_bytes(iodev->format);
 
-	*frames = MIN(*frames, sbuf->buffer_frames - sbuf->read_offset);
-	*frames = MIN(*frames, frames_queued(iodev));
+	return loopdev && loopdev->open;
+}
 
-	iodev->area->frames = *frames;
-	cras_audio_area_config_buf_pointers(iodev->area, iodev->format,
-			sbuf->buffer + sbuf->read_offset * frame_bytes);
-	*area = iodev->area;
-	return 0;
+static int dev_running(const struct cras_iodev *iodev)
+{
+	return is_open(iodev);
 }
 
-static int put_record_buffer(struct cras_iodev *iodev, unsigned nwritten)
+static int frames_queued(const struct cras_iodev *iodev)
 {
 	struct loopback_iodev *loopdev = (struct loopback_iodev *)iodev;
-	struct shared_buffer *sbuf = loopdev->shared_buffer;
+	struct loopback_ring *ring = loopdev->ring;
 
-	sbuf->read_offset += nwritten;
-	if (sbuf->read_offset >= sbuf->buffer_frames) {
-		sbuf->read_offset = 0;
-		sbuf->write_ahead = 0;
-	}
+	if (!loopdev->open)
+		return 0;
+	return MIN(ring->write_pos - loopdev->read_pos, ring->buffer_frames);
+}
+
+static int delay_frames(const struct cras_iodev *iodev)
+{
+	return frames_queued(iodev);
+}
+
+static int update_supported_formats(struct cras_iodev *iodev)
+{
+	struct loopback_iodev *loopdev = (struct loopback_iodev *)iodev;
+	struct loopback_ring *ring = loopdev->ring;
+	const struct cras_audio_format *fmt = &loopback_default_format;
+
+	/* Follow the format of the ring if another reader has it open, else
+	 * the one of the tapped device so its samples are copied as is. */
+	if (ring->num_readers)
+		fmt = &ring->format;
+	else if (ring->tap_dev && ring->tap_dev->ext_format)
+		fmt = ring->tap_dev->ext_format;
+
+	loopdev->supported_rates[0] = fmt->frame_rate;
+	loopdev->supported_channel_counts[0] = fmt->num_channels;
+	loopdev->supported_formats[0] = fmt->format;
 	return 0;
 }
 
-static int close_playback_dev(struct cras_iodev *iodev)
+static int close_record_dev(struct cras_iodev *iodev)
 {
 	struct loopback_iodev *loopdev = (struct loopback_iodev *)iodev;
-	struct shared_buffer *sbuf = loopdev->shared_buffer;
 
+	if (loopdev->open)
+		ring_close(loopdev->ring);
 	loopdev->open = 0;
 	cras_iodev_free_format(iodev);
 	cras_iodev_free_audio_area(iodev);
-
-	free(sbuf->buffer);
-	sbuf->buffer = NULL;
 	return 0;
 }
 
-static int open_playback_dev(struct cras_iodev *iodev)
+static int open_record_dev(struct cras_iodev *iodev)
 {
 	struct loopback_iodev *loopdev = (struct loopback_iodev *)iodev;
-	struct shared_buffer *sbuf = loopdev->shared_buffer;
+	struct loopback_ring *ring = loopdev->ring;
+	int rc;
+
+	rc = ring_open(ring, iodev->format);
+	if (rc)
+		return rc;
 
 	cras_iodev_init_audio_area(iodev, iodev->format->num_channels);
+	loopdev->read_pos = ring->write_pos;
 	loopdev->open = 1;
-
-	sbuf->buffer = malloc(cras_get_format_bytes(iodev->format) *
-			      LOOPBACK_BUFFER_SIZE);
-	sbuf->buffer_frames = LOOPBACK_BUFFER_SIZE;
-	sbuf->read_offset = 0;
-	sbuf->write_offset = 0;
-	sbuf->write_ahead = 0;
 	return 0;
 }
 
-static int get_playback_buffer(struct cras_iodev *iodev,
+static int get_record_buffer(struct cras_iodev *iodev,
 		      struct cras_audio_area **area,
 		      unsigned *frames)
 {
 	struct loopback_iodev *loopdev = (struct loopback_iodev *)iodev;
-	struct shared_buffer *sbuf = loopdev->shared_buffer;
+	struct loopback_ring *ring = loopdev->ring;
 	unsigned int frame_bytes = cras_get_format_bytes(iodev->format);
+	unsigned int read_offset;
 
-	*frames = MIN(*frames, sbuf->buffer_frames - sbuf->write_offset);
+	/* A reader that fell behind skips to the oldest frames still kept. */
+	if (ring->write_pos - loopdev->read_pos > ring->buffer_frames)
+		loopdev->read_pos = ring->write_pos - ring->buffer_frames;
+
+	read_offset = loopdev->read_pos % ring->buffer_frames;
+	*frames = MIN(*frames, ring->buffer_frames - read_offset);
+	*frames = MIN(*frames, frames_queued(iodev));
 
 	iodev->area->frames = *frames;
 	cras_audio_area_config_buf_pointers(iodev->area, iodev->format,
-			sbuf->buffer + sbuf->write_offset * frame_bytes);
+			ring->buffer + read_offset * frame_bytes);
 	*area = iodev->area;
 	return 0;
 }
 
-static int put_playback_buffer(struct cras_iodev *iodev, unsigned nwritten)
+static int put_record_buffer(struct cras_iodev *iodev, unsigned nwritten)
 {
 	struct loopback_iodev *loopdev = (struct loopback_iodev *)iodev;
-	struct shared_buffer *sbuf = loopdev->shared_buffer;
 
-	sbuf->write_offset += nwritten;
-	if (sbuf->write_offset >= sbuf->buffer_frames) {
-		sbuf->write_offset = 0;
-		sbuf->write_ahead = 1;
-	}
+	loopdev->read_pos += nwritten;
 	return 0;
 }
 
@@ -203,87 +315,81 @@ static void update_active_node(struct cras_iodev *iodev)
 {
 }
 
-static struct cras_iodev *create_loopback_iodev(enum CRAS_STREAM_DIRECTION dir,
-						const char *name,
-						struct shared_buffer *sbuf)
+/*
+ * Exported Interface.
+ */
+
+struct cras_iodev *loopback_iodev_create()
 {
-	struct loopback_iodev *loopback_iodev;
+	struct loopback_iodev *loopdev;
 	struct cras_iodev *iodev;
 
-	loopback_iodev = calloc(1, sizeof(*loopback_iodev));
-	if (loopback_iodev == NULL)
+	loopdev = calloc(1, sizeof(*loopdev));
+	if (loopdev == NULL)
 		return NULL;
 
-	loopback_iodev->shared_buffer = sbuf;
+	loopdev->ring = calloc(1, sizeof(*loopdev->ring));
+	if (loopdev->ring == NULL) {
+		free(loopdev);
+		return NULL;
+	}
 
-	iodev = &loopback_iodev->base;
-	iodev->direction = dir;
-	snprintf(iodev->info.name, ARRAY_SIZE(iodev->info.name), "%s", name);
+	iodev = &loopdev->base;
+	iodev->direction = CRAS_STREAM_INPUT;
+	snprintf(iodev->info.name, ARRAY_SIZE(iodev->info.name), "%s",
+		 "Loopback record device.");
 	iodev->info.name[ARRAY_SIZE(iodev->info.name) - 1] = '\0';
+	iodev->info.idx = LOOPBACK_RECORD_DEVICE;
 
-	iodev->supported_rates = loopback_supported_rates;
-	iodev->supported_channel_counts = loopback_supported_channel_counts;
-	iodev->supported_formats = loopback_supported_formats;
+	iodev->supported_rates = loopdev->supported_rates;
+	iodev->supported_channel_counts = loopdev->supported_channel_counts;
+	iodev->supported_formats = loopdev->supported_formats;
 	iodev->buffer_size = LOOPBACK_BUFFER_SIZE;
+	update_supported_formats(iodev);
 
 	iodev->is_open = is_open;
 	iodev->dev_running = dev_running;
 	iodev->frames_queued = frames_queued;
 	iodev->delay_frames = delay_frames;
+	iodev->update_supported_formats = update_supported_formats;
 	iodev->update_active_node = update_active_node;
+	iodev->open_dev = open_record_dev;
+	iodev->close_dev = close_record_dev;
+	iodev->get_buffer = get_record_buffer;
+	iodev->put_buffer = put_record_buffer;
 
 	return iodev;
 }
 
-/*
- * Exported Interface.
- */
-
-void loopback_iodev_create(struct cras_iodev **loopback_input,
-			   struct cras_iodev **loopback_output)
+void loopback_iodev_destroy(struct cras_iodev *loopback_input)
 {
-	struct shared_buffer *sbuf;
-	struct cras_iodev *iodev;
-
-	sbuf = calloc(1, sizeof(*sbuf));
-	if (sbuf == NULL)
-		return;
+	struct loopback_iodev *loopdev =
+			(struct loopback_iodev *)loopback_input;
+	struct loopback_ring *ring = loopdev->ring;
 
-	iodev = create_loopback_iodev(CRAS_STREAM_INPUT,
-				      "Loopback record device.",
-				      sbuf);
-	if (iodev == NULL)
-		return;
-	iodev->info.idx = LOOPBACK_RECORD_DEVICE;
-	iodev->open_dev = open_record_dev;
-	iodev->close_dev = close_record_dev;
-	iodev->get_buffer = get_record_buffer;
-	iodev->put_buffer = put_record_buffer;
-	*loopback_input = iodev;
+	cras_iodev_list_rm_input(loopback_input);
 
-	iodev = create_loopback_iodev(CRAS_STREAM_OUTPUT,
-				      "Loopback playback device.",
-				      sbuf);
-	if (iodev == NULL)
-		return;
-	iodev->open_dev = open_playback_dev;
-	iodev->close_dev = close_playback_dev;
-	iodev->get_buffer = get_playback_buffer;
-	iodev->put_buffer = put_playback_buffer;
-	*loopback_output = iodev;
+	if (ring->tap_dev)
+		cras_iodev_register_pre_dsp_hook(ring->tap_dev, NULL, NULL);
+	ring_free_conv(ring);
+	free(ring->buffer);
+	free(ring);
+	free(loopdev);
 }
 
-void loopback_iodev_destroy(struct cras_iodev *loopback_input,
-			    struct cras_iodev *loopback_output)
+void loopback_iodev_set_tap(struct cras_iodev *loopback_input,
+			    struct cras_iodev *odev)
 {
 	struct loopback_iodev *loopdev =
-			(struct loopback_iodev *)loopback_output;
-	struct shared_buffer *sbuf = loopdev->shared_buffer;
+			(struct loopback_iodev *)loopback_input;
+	struct loopback_ring *ring = loopdev->ring;
 
-	cras_iodev_list_rm_input(loopback_input);
+	if (ring->tap_dev == odev)
+		return;
 
-	free(sbuf->buffer);
-	free(sbuf);
-	free(loopback_input);
-	free(loopback_output);
+	if (ring->tap_dev)
+		cras_iodev_register_pre_dsp_hook(ring->tap_dev, NULL, NULL);
+	ring->tap_dev = odev;
+	if (odev)
+		cras_iodev_register_pre_dsp_hook(odev, loopback_hook, ring);
 }
@@ -10,14 +10,23 @@
 
 struct cras_iodev;
 
-/* Initializes loopback iodevs.  loopback iodevs provide the ability to
- * capture exactly what is being output by the system.
+/* Initializes a loopback record iodev.  loopback iodevs provide the ability
+ * to capture exactly what is being output by the system, they are fed by a
+ * tap on an output device set with loopback_iodev_set_tap.
  */
-void loopback_iodev_create(struct cras_iodev **loopback_input,
-			   struct cras_iodev **loopback_output);
+struct cras_iodev *loopback_iodev_create();
 
-/* Destroys loopback_iodevs created with loopback_iodev_create. */
-void loopback_iodev_destroy(struct cras_iodev *loopback_input,
-			    struct cras_iodev *loopback_output);
+/* Destroys a loopback iodev created with loopback_iodev_create. */
+void loopback_iodev_destroy(struct cras_iodev *loopback_input);
+
+/* Sets the output device whose mixed samples are looped back.  The samples
+ * are copied once from the output device, however many loopback streams
+ * are reading them.  Called from the audio thread.
+ * Args:
+ *    loopback_input - The loopback device created above.
+ *    odev - The output device to tap, NULL to stop looping back.
+ */
+void loopback_iodev_set_tap(struct cras_iodev *loopback_input,
+			    struct cras_iodev *odev);
 
 #endif /* CRAS_LOOPBACK_IO_H_ */
@@ -109,6 +109,31 @@ static void cras_mix_add_s16_le(uint8_t *dst, uint8_t *src,
 	scale_add_clip_s16_le(out, in, count, mix_vol);
 }
 
+/* Adds src into dst, scaling each frame by vol and incrementing vol by step
+ * after each frame. */
+static void cras_mix_add_ramp_s16_le(uint8_t *dst, uint8_t *src,
+				     unsigned int frames,
+				     unsigned int num_channels,
+				     float vol, float step)
+{
+	int16_t *out = (int16_t *)dst;
+	int16_t *in = (int16_t *)src;
+	int32_t sum;
+	unsigned int i, c;
+
+	for (i = 0; i < frames; i++) {
+		for (c = 0; c < num_channels; c++) {
+			sum = *out + (int16_t)(*in++ * vol);
+			if (sum > INT16_MAX)
+				sum = INT16_MAX;
+			else if (sum < INT16_MIN)
+				sum = INT16_MIN;
+			*out++ = sum;
+		}
+		vol += step;
+	}
+}
+
 void cras_mix_add_stride_s16_le(uint8_t *dst, uint8_t *src,
 				unsigned int dst_stride,
 				unsigned int src_stride,
@@ -228,6 +253,29 @@ static void cras_mix_add_s24_le(uint8_t *dst, uint8_t *src,
 	scale_add_clip_s24_le(out, in, count, mix_vol);
 }
 
+static void cras_mix_add_ramp_s24_le(uint8_t *dst, uint8_t *src,
+				     unsigned int frames,
+				     unsigned int num_channels,
+				     float vol, float step)
+{
+	int32_t *out = (int32_t *)dst;
+	int32_t *in = (int32_t *)src;
+	int32_t sum;
+	unsigned int i, c;
+
+	for (i = 0; i < frames; i++) {
+		for (c = 0; c < num_channels; c++) {
+			sum = *out + (int32_t)(*in++ * vol);
+			if (sum > 0x007fffff)
+				sum = 0x007fffff;
+			else if (sum < (int32_t)0xff800000)
+				sum = (int32_t)0xff800000;
+			*out++ = sum;
+		}
+		vol += step;
+	}
+}
+
 void cras_mix_add_stride_s24_le(uint8_t *dst, uint8_t *src,
 				unsigned int dst_stride,
 				unsigned int src_stride,
@@ -347,6 +395,29 @@ static void cras_mix_add_s32_le(uint8_t *dst, uint8_t *src,
 	scale_add_clip_s32_le(out, in, count, mix_vol);
 }
 
+static void cras_mix_add_ramp_s32_le(uint8_t *dst, uint8_t *src,
+				     unsigned int frames,
+				     unsigned int num_channels,
+				     float vol, float step)
+{
+	int32_t *out = (int32_t *)dst;
+	int32_t *in = (int32_t *)src;
+	int64_t sum;
+	unsigned int i, c;
+
+	for (i = 0; i < frames; i++) {
+		for (c = 0; c < num_channels; c++) {
+			sum = (int64_t)*out + (int64_t)(*in++ * vol);
+			if (sum > INT32_MAX)
+				sum = INT32_MAX;
+			else if (sum < INT32_MIN)
+				sum = INT32_MIN;
+			*out++ = sum;
+		}
+		vol += step;
+	}
+}
+
 void cras_mix_add_stride_s32_le(uint8_t *dst, uint8_t *src,
 				unsigned int dst_stride,
 				unsigned int src_stride,
@@ -405,6 +476,25 @@ void cras_mix_add(snd_pcm_format_t fmt, uint8_t *dst, uint8_t *src,
 	}
 }
 
+void cras_mix_add_ramp(snd_pcm_format_t fmt, uint8_t *dst, uint8_t *src,
+		       unsigned int frames, unsigned int num_channels,
+		       float mix_vol, float step)
+{
+	switch (fmt) {
+	case SND_PCM_FORMAT_S16_LE:
+		return cras_mix_add_ramp_s16_le(dst, src, frames, num_channels,
+						mix_vol, step);
+	case SND_PCM_FORMAT_S24_LE:
+		return cras_mix_add_ramp_s24_le(dst, src, frames, num_channels,
+						mix_vol, step);
+	case SND_PCM_FORMAT_S32_LE:
+		return cras_mix_add_ramp_s32_le(dst, src, frames, num_channels,
+						mix_vol, step);
+	default:
+		break;
+	}
+}
+
 void cras_mix_add_stride(snd_pcm_format_t fmt, uint8_t *dst, uint8_t *src,
 			 unsigned int count, unsigned int dst_stride,
 			 unsigned int src_stride)
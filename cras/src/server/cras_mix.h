@@ -33,6 +33,21 @@ void cras_mix_add(snd_pcm_format_t fmt, uint8_t *dst, uint8_t *src,
 		  unsigned int count, unsigned int index,
 		  int mute, float mix_vol);
 
+/* Add src buffer to dst, scaling by a gain that changes linearly from frame
+ * to frame.
+ * Args:
+ *    fmt - The format (SND_PCM_FORMAT_*)
+ *    dst - Buffer of samples to mix to.
+ *    src - Buffer of samples to mix from.
+ *    frames - The number of frames to mix.
+ *    num_channels - Number of channels in each frame.
+ *    mix_vol - Scaler for the first frame.
+ *    step - Added to the scaler after each frame.
+ */
+void cras_mix_add_ramp(snd_pcm_format_t fmt, uint8_t *dst, uint8_t *src,
+		       unsigned int frames, unsigned int num_channels,
+		       float mix_vol, float step);
+
 /* Add src buffer to dst with independent channel strides.
  * Args:
  *    fmt - The format (SND_PCM_FORMAT_*)
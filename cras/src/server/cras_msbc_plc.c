@@ -0,0 +1,126 @@
+/* Copyright (c) 2015 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cras_msbc_plc.h"
+
+/* 30ms of good samples at 16kHz to find the pitch from. */
+#define PLC_HISTORY_SAMPLES (MSBC_FRAME_SAMPLES * 4)
+/* Pitch search range, from 400Hz down to about 66Hz. */
+#define PLC_MIN_PITCH 40
+#define PLC_MAX_PITCH 240
+/* The last samples of history compared against each candidate period. */
+#define PLC_CORR_SAMPLES MSBC_FRAME_SAMPLES
+/* The first lost frame is played at full level, then the signal fades out
+ * over the next frames and stays silent if the loss goes on. */
+#define PLC_FULL_GAIN_SAMPLES MSBC_FRAME_SAMPLES
+#define PLC_FADE_SAMPLES (MSBC_FRAME_SAMPLES * 3)
+/* Samples cross-faded when a good frame follows a loss. */
+#define PLC_OLA_SAMPLES 32
+
+/* Members:
+ *    history - The last good samples, oldest first.
+ *    pitch - Period in samples repeated during the current loss.
+ *    concealed - Samples concealed so far in the current loss, 0 when the
+ *        last frame was good.
+ */
+struct cras_msbc_plc {
+	int16_t history[PLC_HISTORY_SAMPLES];
+	unsigned int pitch;
+	unsigned int concealed;
+};
+
+struct cras_msbc_plc *cras_msbc_plc_create()
+{
+	return (struct cras_msbc_plc *)calloc(1, sizeof(struct cras_msbc_plc));
+}
+
+void cras_msbc_plc_destroy(struct cras_msbc_plc *plc)
+{
+	free(plc);
+}
+
+/* Finds the period that best matches the end of history with itself. */
+static unsigned int find_pitch(const int16_t *history)
+{
+	const int16_t *x = history + PLC_HISTORY_SAMPLES - PLC_CORR_SAMPLES;
+	unsigned int p, i, best_pitch = PLC_MAX_PITCH;
+	float best = 0;
+
+	for (p = PLC_MIN_PITCH; p <= PLC_MAX_PITCH; p++) {
+		float corr = 0, energy = 0;
+
+		for (i = 0; i < PLC_CORR_SAMPLES; i++) {
+			corr += (float)x[i] * x[(int)i - (int)p];
+			energy += (float)x[(int)i - (int)p] *
+				  x[(int)i - (int)p];
+		}
+		if (energy <= 0 || corr <= 0)
+			continue;
+		corr /= sqrtf(energy);
+		if (corr > best) {
+			best = corr;
+			best_pitch = p;
+		}
+	}
+	return best_pitch;
+}
+
+/* Returns the n-th concealed sample of the current loss. */
+static int16_t conceal_sample(const struct cras_msbc_plc *plc, unsigned int n)
+{
+	float gain = 1;
+	int16_t sample;
+
+	sample = plc->history[PLC_HISTORY_SAMPLES - plc->pitch +
+			      n % plc->pitch];
+	if (n >= PLC_FULL_GAIN_SAMPLES) {
+		n -= PLC_FULL_GAIN_SAMPLES;
+		if (n >= PLC_FADE_SAMPLES)
+			return 0;
+		gain = 1.0f - (float)n / PLC_FADE_SAMPLES;
+	}
+	return sample * gain;
+}
+
+void cras_msbc_plc_handle_good_frame(struct cras_msbc_plc *plc,
+				     int16_t *frame)
+{
+	unsigned int i;
+
+	if (plc->concealed) {
+		for (i = 0; i < PLC_OLA_SAMPLES; i++) {
+			float w = (float)(i + 1) / (PLC_OLA_SAMPLES + 1);
+			frame[i] = w * frame[i] + (1 - w) *
+				conceal_sample(plc, plc->concealed + i);
+		}
+		plc->concealed = 0;
+	}
+
+	memmove(plc->history, plc->history + MSBC_FRAME_SAMPLES,
+		(PLC_HISTORY_SAMPLES - MSBC_FRAME_SAMPLES) *
+		sizeof(plc->history[0]));
+	memcpy(plc->history + PLC_HISTORY_SAMPLES - MSBC_FRAME_SAMPLES, frame,
+	       MSBC_FRAME_SAMPLES * sizeof(plc->history[0]));
+}
+
+void cras_msbc_plc_handle_bad_frame(struct cras_msbc_plc *plc,
+				    int16_t *output)
+{
+	unsigned int i;
+
+	if (plc->concealed == 0)
+		plc->pitch = find_pitch(plc->history);
+
+	for (i = 0; i < MSBC_FRAME_SAMPLES; i++)
+		output[i] = conceal_sample(plc, plc->concealed + i);
+
+	/* Stop counting once silent, a long loss must not overflow. */
+	if (plc->concealed < PLC_FULL_GAIN_SAMPLES + PLC_FADE_SAMPLES)
+		plc->concealed += MSBC_FRAME_SAMPLES;
+}
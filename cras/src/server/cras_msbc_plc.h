@@ -0,0 +1,44 @@
+/* Copyright (c) 2015 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef CRAS_MSBC_PLC_H_
+#define CRAS_MSBC_PLC_H_
+
+#include <stdint.h>
+
+/* Number of 16 bit mono samples in one decoded mSBC frame. */
+#define MSBC_FRAME_SAMPLES 120
+
+/* Packet loss concealment for mSBC. A lost frame is replaced by repeating
+ * the last pitch period of the good samples, fading out if the loss goes
+ * on, and the first good frame after a loss is cross-faded with the
+ * concealed signal.
+ */
+struct cras_msbc_plc;
+
+/* Creates a plc instance. */
+struct cras_msbc_plc *cras_msbc_plc_create();
+
+/* Destroys a plc instance. */
+void cras_msbc_plc_destroy(struct cras_msbc_plc *plc);
+
+/* Handles a frame decoded successfully. The frame is kept as history and,
+ * right after a loss, smoothed in place.
+ * Args:
+ *    plc - The plc instance.
+ *    frame - MSBC_FRAME_SAMPLES samples of the decoded frame.
+ */
+void cras_msbc_plc_handle_good_frame(struct cras_msbc_plc *plc,
+				     int16_t *frame);
+
+/* Conceals a lost or corrupted frame.
+ * Args:
+ *    plc - The plc instance.
+ *    output - Filled with MSBC_FRAME_SAMPLES samples to play instead.
+ */
+void cras_msbc_plc_handle_bad_frame(struct cras_msbc_plc *plc,
+				    int16_t *output);
+
+#endif /* CRAS_MSBC_PLC_H_ */
@@ -42,6 +42,14 @@ static int handle_client_stream_connect(struct cras_rclient *client,
 
 	unpack_cras_audio_format(&remote_fmt, &msg->format);
 
+	/* The shm layout depends on the protocol version. */
+	if (msg->proto_version != CRAS_PROTO_VER) {
+		syslog(LOG_ERR, "Stream connect with protocol version %u, "
+		       "expected %u.\n", msg->proto_version, CRAS_PROTO_VER);
+		rc = -EINVAL;
+		goto reply_err;
+	}
+
 	/* check the aud_fd is valid. */
 	if (aud_fd < 0) {
 		syslog(LOG_ERR, "Invalid fd in stream connect.\n");
@@ -175,6 +183,31 @@ static void dump_audio_thread_info(struct cras_rclient *client)
 	cras_rclient_send_message(client, &msg.header);
 }
 
+/* Handles copying the dsp pipeline statistics back to the client. */
+static void update_dsp_debug_info(struct cras_rclient *client)
+{
+	struct cras_client_dsp_debug_info_ready msg;
+	struct cras_server_state *state;
+
+	cras_fill_client_dsp_debug_info_ready(&msg);
+	state = cras_system_state_get_no_lock();
+	cras_dsp_get_debug_info(&state->dsp_debug_info);
+	cras_rclient_send_message(client, &msg.header);
+}
+
+/* Handles copying the stream latency statistics back to the client. */
+static void update_stream_latency_info(struct cras_rclient *client)
+{
+	struct cras_client_stream_latency_info_ready msg;
+	struct cras_server_state *state;
+
+	cras_fill_client_stream_latency_info_ready(&msg);
+	state = cras_system_state_get_no_lock();
+	audio_thread_dump_stream_latency(cras_iodev_list_get_audio_thread(),
+					 &state->stream_latency_info);
+	cras_rclient_send_message(client, &msg.header);
+}
+
 /*
  * Exported Functions.
  */
@@ -303,6 +336,12 @@ int cras_rclient_message_from_client(struct cras_rclient *client,
 	case CRAS_SERVER_DUMP_AUDIO_THREAD:
 		dump_audio_thread_info(client);
 		break;
+	case CRAS_SERVER_UPDATE_DSP_DEBUG_INFO:
+		update_dsp_debug_info(client);
+		break;
+	case CRAS_SERVER_UPDATE_STREAM_LATENCY_INFO:
+		update_stream_latency_info(client);
+		break;
 	case CRAS_SERVER_ADD_TEST_DEV: {
 		const struct cras_add_test_dev *m =
 			(const struct cras_add_test_dev *)msg;
@@ -15,6 +15,101 @@
 #include "cras_types.h"
 #include "buffer_share.h"
 
+/* The shm pool holds segments created when the server starts, attached and
+ * faulted in, for streams whose buffers fit in SHM_POOL_REGION_SIZE. The keys
+ * are fixed so that a restarted server reclaims the regions of the previous
+ * one instead of leaking them. */
+#define SHM_POOL_MAX_REGIONS 16
+#define SHM_POOL_REGION_SIZE (64 * 1024)
+#define SHM_POOL_KEY_BASE 0x43520000
+
+/* A region of the shm pool.
+ *    shm_id - Returned from shmget.
+ *    area - Where the server has the region attached.
+ *    in_use - Non-zero while a stream uses the region.
+ */
+struct shm_pool_region {
+	int shm_id;
+	void *area;
+	int in_use;
+};
+
+static struct shm_pool_region shm_pool[SHM_POOL_MAX_REGIONS];
+static unsigned int shm_pool_size;
+
+/* Takes a free pool region for a segment of total_size bytes. Returns the
+ * index of the region, or -1 if none fits. */
+static int shm_pool_take(size_t total_size)
+{
+	struct shmid_ds ds;
+	unsigned int i;
+
+	if (total_size > SHM_POOL_REGION_SIZE)
+		return -1;
+
+	for (i = 0; i < shm_pool_size; i++) {
+		if (shm_pool[i].in_use)
+			continue;
+		/* The client of the last stream might not have detached yet,
+		 * it mustn't see the samples of the next one. */
+		if (shmctl(shm_pool[i].shm_id, IPC_STAT, &ds) ||
+		    ds.shm_nattch > 1)
+			continue;
+		shm_pool[i].in_use = 1;
+		return i;
+	}
+	return -1;
+}
+
+int cras_rstream_shm_pool_init(unsigned int num_regions)
+{
+	struct shm_pool_region *region;
+	int key, shm_id;
+
+	if (num_regions > SHM_POOL_MAX_REGIONS)
+		num_regions = SHM_POOL_MAX_REGIONS;
+	while (shm_pool_size < num_regions) {
+		key = SHM_POOL_KEY_BASE + shm_pool_size;
+
+		/* Remove a region left by a server that didn't exit. */
+		shm_id = shmget(key, 0, 0);
+		if (shm_id >= 0)
+			shmctl(shm_id, IPC_RMID, NULL);
+
+		shm_id = shmget(key, SHM_POOL_REGION_SIZE,
+				IPC_CREAT | IPC_EXCL | 0660);
+		if (shm_id < 0) {
+			syslog(LOG_ERR, "shmget for shm pool failed");
+			break;
+		}
+
+		region = &shm_pool[shm_pool_size];
+		region->area = shmat(shm_id, NULL, 0);
+		if (region->area == (void *)-1) {
+			shmctl(shm_id, IPC_RMID, NULL);
+			break;
+		}
+		/* Fault in the pages now rather than when a stream starts. */
+		memset(region->area, 0, SHM_POOL_REGION_SIZE);
+		region->shm_id = shm_id;
+		region->in_use = 0;
+		shm_pool_size++;
+	}
+
+	return shm_pool_size;
+}
+
+void cras_rstream_shm_pool_deinit()
+{
+	unsigned int i;
+
+	for (i = 0; i < shm_pool_size; i++) {
+		shmdt(shm_pool[i].area);
+		shmctl(shm_pool[i].shm_id, IPC_RMID, NULL);
+	}
+	shm_pool_size = 0;
+}
+
 /* Configure the shm area for the stream. */
 static int setup_shm(struct cras_rstream *stream,
 		     struct cras_audio_shm *shm,
@@ -33,6 +128,17 @@ static int setup_shm(struct cras_rstream *stream,
 	samples_size = used_size * CRAS_NUM_SHM_BUFFERS;
 	total_size = sizeof(struct cras_audio_shm_area) + samples_size;
 
+	shm_info->pool_idx = shm_pool_take(total_size);
+	if (shm_info->pool_idx >= 0) {
+		shm_info->shm_key = SHM_POOL_KEY_BASE + shm_info->pool_idx;
+		shm_info->shm_id = shm_pool[shm_info->pool_idx].shm_id;
+		shm->area = shm_pool[shm_info->pool_idx].area;
+		/* The client attaches the whole region, clear all of it so
+		 * nothing is left from the stream that used it before. */
+		total_size = SHM_POOL_REGION_SIZE;
+		goto clear_area;
+	}
+
 	/* Find an available shm key. */
 	do {
 		shm_info->shm_key = getpid() + stream->stream_id + loops;
@@ -49,6 +155,7 @@ static int setup_shm(struct cras_rstream *stream,
 	shm->area = shmat(shm_info->shm_id, NULL, 0);
 	if (shm->area == (void *)-1)
 		return -ENOMEM;
+clear_area:
 	memset(shm->area, 0, total_size);
 	cras_shm_set_volume_scaler(shm, 1.0);
 	/* Set up config and copy to shared area. */
@@ -175,9 +282,13 @@ int cras_rstream_create(cras_stream_id_t stream_id,
 void cras_rstream_destroy(struct cras_rstream *stream)
 {
 	if (stream->shm.area != NULL) {
-		shmdt(stream->shm.area);
-		shmctl(stream->shm_info.shm_id, IPC_RMID,
-		       (void *)stream->shm.area);
+		if (stream->shm_info.pool_idx >= 0) {
+			shm_pool[stream->shm_info.pool_idx].in_use = 0;
+		} else {
+			shmdt(stream->shm.area);
+			shmctl(stream->shm_info.shm_id, IPC_RMID,
+			       (void *)stream->shm.area);
+		}
 		cras_audio_area_destroy(stream->audio_area);
 	}
 	buffer_share_destroy(stream->buf_state);
@@ -317,3 +428,11 @@ int cras_rstream_get_mute(const struct cras_rstream *rstream)
 {
 	return cras_shm_get_mute(&rstream->shm);
 }
+
+int cras_rstream_get_volume_ramp(const struct cras_rstream *rstream,
+				 float *volume_scaler,
+				 unsigned int *ramp_frames)
+{
+	return cras_shm_get_volume_ramp(&rstream->shm, volume_scaler,
+					ramp_frames);
+}
@@ -18,10 +18,12 @@ struct dev_mix;
 /* Holds identifiers for an shm segment.
  *  shm_key - Key shared with client to access shm.
  *  shm_id - Returned from shmget.
+ *  pool_idx - Index of the region in the shm pool, -1 if it isn't pooled.
  */
 struct rstream_shm_info {
 	int shm_key;
 	int shm_id;
+	int pool_idx;
 };
 
 /* Holds informations about the master active device.
@@ -57,6 +59,12 @@ struct master_dev_info {
  *    buf_state - State of the buffer from all devices for this stream.
  *    is_pinned - True if the stream is a pinned stream, false otherwise.
  *    pinned_dev_idx - device the stream is pinned, 0 if none.
+ *    num_underruns, latency, cb_lateness, fetch_to_ready - Latency
+ *        statistics recorded by the audio thread, see
+ *        stream_latency_debug_info.
+ *    fetch_ts - When samples were last requested from the client.
+ *    fetch_budget_us - How long the samples queued when they were requested
+ *        last, the client has to answer within that time.
  */
 struct cras_rstream {
 	cras_stream_id_t stream_id;
@@ -78,9 +86,28 @@ struct cras_rstream {
 	struct buffer_share *buf_state;
 	int is_pinned;
 	uint32_t pinned_dev_idx;
+	unsigned int num_underruns;
+	struct latency_histogram latency;
+	struct latency_histogram cb_lateness;
+	struct latency_histogram fetch_to_ready;
+	struct timespec fetch_ts;
+	unsigned int fetch_budget_us;
 	struct cras_rstream *prev, *next;
 };
 
+/* Creates the pool of shm regions handed to new streams that fit in them, so
+ * that connecting a stream doesn't wait on creating a segment. Regions left
+ * by a previous server instance are reclaimed.
+ * Args:
+ *    num_regions - How many regions to create.
+ * Returns:
+ *    The number of regions created, or a negative error code.
+ */
+int cras_rstream_shm_pool_init(unsigned int num_regions);
+
+/* Removes the regions of the shm pool. */
+void cras_rstream_shm_pool_deinit();
+
 /* Creates an rstream.
  * Args:
  *    stream_type - CRAS_STREAM_TYPE.
@@ -288,4 +315,11 @@ uint8_t *cras_rstream_get_readable_frames(struct cras_rstream *rstream,
 /* Returns non-zero if the stream is muted. */
 int cras_rstream_get_mute(const struct cras_rstream *rstream);
 
+/* Gets the volume scaler the stream should be mixed at, zero if it's muted,
+ * and the number of frames to ramp to it over, at the stream's rate. Returns
+ * -EAGAIN if the client was changing the volume. */
+int cras_rstream_get_volume_ramp(const struct cras_rstream *rstream,
+				 float *volume_scaler,
+				 unsigned int *ramp_frames);
+
 #endif /* CRAS_RSTREAM_H_ */
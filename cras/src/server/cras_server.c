@@ -12,10 +12,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
 #include <sys/param.h>
-#include <sys/select.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
 #include <sys/un.h>
 #include <syslog.h>
@@ -32,6 +33,7 @@
 #include "cras_messages.h"
 #include "cras_metrics.h"
 #include "cras_rclient.h"
+#include "cras_rstream.h"
 #include "cras_server.h"
 #include "cras_server_metrics.h"
 #include "cras_system_state.h"
@@ -41,20 +43,40 @@
 #include "cras_util.h"
 #include "utlist.h"
 
+/* Max number of ready fds handled per wake up of the main loop, any others
+ * are reported again by the next epoll_wait. */
+#define MAX_EPOLL_EVENTS 32
+/* Max number of messages read from a client per wake up. A client setting up
+ * several streams sends their connect messages together, handling them in the
+ * same pass lets the server state be updated once for all of them. */
+#define MAX_CLIENT_MSGS_PER_WAKE 16
+/* Number of shm regions created ahead of time for new streams. */
+#define NUM_STREAM_SHM_POOL_REGIONS 8
+
+/* What a file descriptor registered to epoll is for. The epoll data of each
+ * fd points to the type, which is the first member of the struct it
+ * belongs to. */
+enum server_fd_type {
+	SERVER_FD_LISTEN,
+	SERVER_FD_TIMER,
+	SERVER_FD_CLIENT,
+	SERVER_FD_CALLBACK,
+};
+
 /* Store a list of clients that are attached to the server.
  * Members:
+ *    type - SERVER_FD_CLIENT, the epoll data of fd points to it.
  *    id - Unique identifier for this client.
  *    fd - socket file descriptor used to communicate with client.
  *    ucred - Process, user, and group ID of the client.
  *    client - rclient to handle messages from this client.
- *    pollfd - Pointer to struct pollfd for this callback.
  */
 struct attached_client {
+	enum server_fd_type type;
 	size_t id;
 	int fd;
 	struct ucred ucred;
 	struct cras_rclient *client;
-	struct pollfd *pollfd;
 	struct attached_client *next, *prev;
 };
 
@@ -64,33 +86,72 @@ struct attached_client {
  * it.  This allows the use of the main server loop instead of spawning a thread
  * to watch file descriptors.  The client can then read or write the fd.
  * Members:
+ *    type - SERVER_FD_CALLBACK, the epoll data of select_fd points to it.
  *    fd - The file descriptor passed to select.
  *    callack - The funciton to call when fd is ready.
  *    callback_data - Pointer passed to the callback.
- *    pollfd - Pointer to struct pollfd for this callback.
+ *    deleted - Set when removed, the callback is freed once the events
+ *        that may still refer to it have been handled.
  */
 struct client_callback {
+	enum server_fd_type type;
 	int select_fd;
 	void (*callback)(void *);
 	void *callback_data;
-	struct pollfd *pollfd;
 	int deleted;
 	struct client_callback *prev, *next;
 };
 
-/* Local server data. */
+/* Local server data.
+ * Members:
+ *    epoll_fd - Watches the listening socket, the timer, the clients and the
+ *        client callbacks. Fds are added and removed as they come and go,
+ *        so a wake up only costs as much as the fds that are ready.
+ *    clients_changed - Clients connected in this pass of the main loop, the
+ *        client and device lists are sent when the pass is done.
+ */
 struct server_data {
 	struct attached_client *clients_head;
 	size_t num_clients;
 	struct client_callback *client_callbacks;
 	size_t num_client_callbacks;
 	size_t next_client_id;
-} server_instance;
+	int epoll_fd;
+	int clients_changed;
+} server_instance = {
+	.epoll_fd = -1,
+};
+
+/* Starts watching fd for input, events will point to the given type. */
+static int server_watch_fd(int fd, enum server_fd_type *type)
+{
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = type;
+	if (epoll_ctl(server_instance.epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		syslog(LOG_ERR, "epoll add fd %d failed %d", fd, errno);
+		return -errno;
+	}
+	return 0;
+}
+
+static void server_unwatch_fd(int fd)
+{
+	/* The event argument is ignored but must be non-NULL before 2.6.9. */
+	struct epoll_event ev;
+
+	if (epoll_ctl(server_instance.epoll_fd, EPOLL_CTL_DEL, fd, &ev) < 0)
+		syslog(LOG_ERR, "epoll del fd %d failed %d", fd, errno);
+}
 
 /* Remove a client from the list and destroy it.  Calling rclient_destroy will
- * also free all the streams owned by the client */
+ * also free all the streams owned by the client. Only a client can remove
+ * itself, so no other event of this wake up refers to it. */
 static void remove_client(struct attached_client *client)
 {
+	server_unwatch_fd(client->fd);
 	close(client->fd);
 	DL_DELETE(server_instance.clients_head, client);
 	server_instance.num_clients--;
@@ -98,23 +159,39 @@ static void remove_client(struct attached_client *client)
 	free(client);
 }
 
-/* This is called when "select" indicates that the client has written data to
- * the socket.  Read out one message and pass it to the client message handler.
+/* Returns non-zero if another message from the client can be read without
+ * blocking. */
+static int client_has_message(const struct attached_client *client)
+{
+	struct pollfd pollfd;
+
+	pollfd.fd = client->fd;
+	pollfd.events = POLLIN;
+	return poll(&pollfd, 1, 0) > 0 && (pollfd.revents & POLLIN);
+}
+
+/* This is called when epoll indicates that the client has written data to
+ * the socket.  Read out the pending messages, up to MAX_CLIENT_MSGS_PER_WAKE,
+ * and pass them to the client message handler.
  */
 static void handle_message_from_client(struct attached_client *client)
 {
 	uint8_t buf[CRAS_SERV_MAX_MSG_SIZE];
 	struct cras_server_message *msg;
+	unsigned int handled = 0;
 	int nread;
 	int fd;
 
 	msg = (struct cras_server_message *)buf;
-	nread = cras_recv_with_fd(client->fd, buf, sizeof(buf), &fd);
-	if (nread < sizeof(msg->length))
-		goto read_error;
-	if (msg->length != nread)
-		goto read_error;
-	cras_rclient_message_from_client(client->client, msg, fd);
+	do {
+		nread = cras_recv_with_fd(client->fd, buf, sizeof(buf), &fd);
+		if (nread < sizeof(msg->length))
+			goto read_error;
+		if (msg->length != nread)
+			goto read_error;
+		cras_rclient_message_from_client(client->client, msg, fd);
+	} while (++handled < MAX_CLIENT_MSGS_PER_WAKE &&
+		 client_has_message(client));
 	return;
 
 read_error:
@@ -202,9 +279,9 @@ static void handle_new_connection(struct sockaddr_un *address, int fd)
 	/* When full, getting an error is preferable to blocking. */
 	cras_make_fd_nonblocking(connection_fd);
 
+	poll_client->type = SERVER_FD_CLIENT;
 	poll_client->fd = connection_fd;
 	poll_client->next = NULL;
-	poll_client->pollfd = NULL;
 	fill_client_info(poll_client);
 	poll_client->client = cras_rclient_create(connection_fd,
 						  poll_client->id);
@@ -215,11 +292,18 @@ static void handle_new_connection(struct sockaddr_un *address, int fd)
 		return;
 	}
 
+	if (server_watch_fd(connection_fd, &poll_client->type) < 0) {
+		cras_rclient_destroy(poll_client->client);
+		close(connection_fd);
+		free(poll_client);
+		return;
+	}
+
 	DL_APPEND(server_instance.clients_head, poll_client);
 	server_instance.num_clients++;
-	/* Send a current list of available inputs and outputs. */
-	cras_iodev_list_update_device_list();
-	send_client_list_to_clients(&server_instance);
+	/* The main loop sends a current list of available inputs and outputs
+	 * and of the clients once the pass is done. */
+	server_instance.clients_changed = 1;
 }
 
 /* Add a file descriptor to be passed to select in the main loop. This is
@@ -231,6 +315,7 @@ static int add_select_fd(int fd, void (*cb)(void *data),
 	struct client_callback *new_cb;
 	struct client_callback *client_cb;
 	struct server_data *serv;
+	int rc;
 
 	serv = (struct server_data *)server_data;
 	if (serv == NULL)
@@ -245,11 +330,17 @@ static int add_select_fd(int fd, void (*cb)(void *data),
 	if (new_cb == NULL)
 		return -ENOMEM;
 
+	new_cb->type = SERVER_FD_CALLBACK;
 	new_cb->select_fd = fd;
 	new_cb->callback = cb;
 	new_cb->callback_data = callback_data;
 	new_cb->deleted = 0;
-	new_cb->pollfd = NULL;
+
+	rc = server_watch_fd(fd, &new_cb->type);
+	if (rc < 0) {
+		free(new_cb);
+		return rc;
+	}
 
 	DL_APPEND(serv->client_callbacks, new_cb);
 	server_instance.num_client_callbacks++;
@@ -269,8 +360,10 @@ static void rm_select_fd(int fd, void *server_data)
 		return;
 
 	DL_FOREACH(serv->client_callbacks, client_cb)
-		if (client_cb->select_fd == fd)
+		if (client_cb->select_fd == fd && !client_cb->deleted) {
+			server_unwatch_fd(fd);
 			client_cb->deleted = 1;
+		}
 }
 
 /* Cleans up the file descriptor list removing items deleted during the main
@@ -292,6 +385,21 @@ static void cleanup_select_fds(void *server_data)
 		}
 }
 
+/* Arms the timer fd for the next cras_tm timer, or disarms it when there is
+ * none. */
+static void update_timer_fd(struct cras_tm *tm, int timer_fd)
+{
+	struct itimerspec its;
+
+	memset(&its, 0, sizeof(its));
+	if (cras_tm_get_next_timeout(tm, &its.it_value) &&
+	    its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0)
+		/* Expired already, a zero value would disarm the timer. */
+		its.it_value.tv_nsec = 1;
+	if (timerfd_settime(timer_fd, 0, &its, NULL) < 0)
+		syslog(LOG_ERR, "timerfd settime failed %d", errno);
+}
+
 /* Checks that at least two outputs are present (one will be the "empty"
  * default device. */
 void check_output_exists(struct cras_timer *t, void *data)
@@ -309,17 +417,31 @@ int cras_server_init()
 	/* Log to syslog. */
 	openlog("cras_server", LOG_PID, LOG_USER);
 
+	/* Fds can be registered before the main loop starts. */
+	server_instance.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (server_instance.epoll_fd < 0) {
+		syslog(LOG_ERR, "Main server epoll failed.");
+		return -errno;
+	}
+
 	/* Allow clients to register callbacks for file descriptors.
 	 * add_select_fd and rm_select_fd will add and remove file descriptors
-	 * from the list that are passed to select in the main loop below. */
+	 * from the epoll set of the main loop below. */
 	cras_system_set_select_handler(add_select_fd, rm_select_fd,
 				       &server_instance);
+
+	/* Not fatal, streams create their own shm when the pool is empty. */
+	if (cras_rstream_shm_pool_init(NUM_STREAM_SHM_POOL_REGIONS) <= 0)
+		syslog(LOG_WARNING, "No shm pool for streams.");
 	return 0;
 }
 
 int cras_server_run()
 {
 	static const unsigned int OUTPUT_CHECK_MS = 5 * 1000;
+	/* The epoll data of the listening socket and the timer fd. */
+	static enum server_fd_type listen_type = SERVER_FD_LISTEN;
+	static enum server_fd_type timer_type = SERVER_FD_TIMER;
 
 	DBusConnection *dbus_conn;
 	int socket_fd = -1;
@@ -329,13 +451,11 @@ int cras_server_run()
 	struct attached_client *elm;
 	struct client_callback *client_cb;
 	struct cras_tm *tm;
-	struct timespec ts;
-	int timers_active;
-	struct pollfd *pollfds;
-	unsigned int pollfds_size = 32;
-	unsigned int num_pollfds, poll_size_needed;
-
-	pollfds = malloc(sizeof(*pollfds) * pollfds_size);
+	struct epoll_event events[MAX_EPOLL_EVENTS];
+	enum server_fd_type *type;
+	int timer_fd = -1;
+	uint64_t expirations;
+	int i, num_events;
 
 	cras_udev_start_sound_subsystem_monitor();
 	cras_bt_device_start_monitor();
@@ -405,60 +525,77 @@ int cras_server_run()
 	/* After a delay, make sure there is at least one real output device. */
 	cras_tm_create_timer(tm, OUTPUT_CHECK_MS, check_output_exists, 0);
 
-	/* Main server loop - client callbacks are run from this context. */
-	while (1) {
-		poll_size_needed = 1 + server_instance.num_clients +
-					server_instance.num_client_callbacks;
-		if (poll_size_needed > pollfds_size) {
-			pollfds_size = 2 * poll_size_needed;
-			pollfds = realloc(pollfds,
-					sizeof(*pollfds) * pollfds_size);
-		}
-
-		pollfds[0].fd = socket_fd;
-		pollfds[0].events = POLLIN;
-		num_pollfds = 1;
+	timer_fd = timerfd_create(CLOCK_MONOTONIC,
+				  TFD_NONBLOCK | TFD_CLOEXEC);
+	if (timer_fd < 0) {
+		syslog(LOG_ERR, "Main server timerfd failed.");
+		rc = -errno;
+		goto bail;
+	}
 
-		DL_FOREACH(server_instance.clients_head, elm) {
-			pollfds[num_pollfds].fd = elm->fd;
-			pollfds[num_pollfds].events = POLLIN;
-			elm->pollfd = &pollfds[num_pollfds];
-			num_pollfds++;
-		}
-		DL_FOREACH(server_instance.client_callbacks, client_cb) {
-			if (client_cb->deleted)
-				continue;
-			pollfds[num_pollfds].fd = client_cb->select_fd;
-			pollfds[num_pollfds].events = POLLIN;
-			client_cb->pollfd = &pollfds[num_pollfds];
-			num_pollfds++;
-		}
+	rc = server_watch_fd(socket_fd, &listen_type);
+	if (rc < 0)
+		goto bail;
+	rc = server_watch_fd(timer_fd, &timer_type);
+	if (rc < 0)
+		goto bail;
 
-		timers_active = cras_tm_get_next_timeout(tm, &ts);
+	/* Main server loop - client callbacks are run from this context. */
+	while (1) {
+		update_timer_fd(tm, timer_fd);
 
-		rc = ppoll(pollfds, num_pollfds,
-			   timers_active ? &ts : NULL, NULL);
-		if  (rc < 0)
+		num_events = epoll_wait(server_instance.epoll_fd, events,
+					MAX_EPOLL_EVENTS, -1);
+		if (num_events < 0)
 			continue;
 
 		cras_tm_call_callbacks(tm);
 
-		/* Check for new connections. */
-		if (pollfds[0].revents & POLLIN)
-			handle_new_connection(&addr, socket_fd);
-		/* Check if there are messages pending for any clients. */
-		DL_FOREACH(server_instance.clients_head, elm)
-			if (elm->pollfd && elm->pollfd->revents & POLLIN)
+		for (i = 0; i < num_events; i++) {
+			type = (enum server_fd_type *)events[i].data.ptr;
+			switch (*type) {
+			case SERVER_FD_LISTEN:
+				/* Check for new connections. */
+				handle_new_connection(&addr, socket_fd);
+				break;
+			case SERVER_FD_TIMER:
+				/* Timers were run above, clear the
+				 * expiration. */
+				if (read(timer_fd, &expirations,
+					 sizeof(expirations)) < 0 &&
+				    errno != EAGAIN)
+					syslog(LOG_ERR, "timerfd read %d",
+					       errno);
+				break;
+			case SERVER_FD_CLIENT:
+				/* A message is pending, or the client hung
+				 * up and reading fails. */
+				elm = (struct attached_client *)type;
 				handle_message_from_client(elm);
-		/* Check any client-registered fd/callback pairs. */
-		DL_FOREACH(server_instance.client_callbacks, client_cb)
-			if (!client_cb->deleted &&
-			    client_cb->pollfd &&
-			    (client_cb->pollfd->revents & POLLIN))
-				client_cb->callback(client_cb->callback_data);
+				break;
+			case SERVER_FD_CALLBACK:
+				/* A client-registered fd/callback pair. */
+				client_cb = (struct client_callback *)type;
+				if (!client_cb->deleted &&
+				    (events[i].events & EPOLLIN))
+					client_cb->callback(
+						client_cb->callback_data);
+				break;
+			}
+		}
 
 		cleanup_select_fds(&server_instance);
 
+		/* The connections accepted in this pass reach clients as one
+		 * state update. */
+		if (server_instance.clients_changed) {
+			server_instance.clients_changed = 0;
+			cras_system_state_batch_begin();
+			cras_iodev_list_update_device_list();
+			send_client_list_to_clients(&server_instance);
+			cras_system_state_batch_end();
+		}
+
 		if (dbus_conn)
 			cras_dbus_dispatch(dbus_conn);
 
@@ -470,7 +607,8 @@ bail:
 		close(socket_fd);
 		unlink(addr.sun_path);
 	}
-	free(pollfds);
+	if (timer_fd >= 0)
+		close(timer_fd);
 	return rc;
 }
 
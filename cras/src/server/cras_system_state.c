@@ -12,6 +12,7 @@
 #include <syslog.h>
 
 #include "cras_alsa_card.h"
+#include "cras_alsa_card_probe.h"
 #include "cras_config.h"
 #include "cras_device_blacklist.h"
 #include "cras_system_state.h"
@@ -20,8 +21,18 @@
 #include "cras_util.h"
 #include "utlist.h"
 
+/* A sound card of the system.
+ * card - The card, NULL while it is being probed.
+ * card_index - 0 based ALSA index of the card.
+ * probing - Set while the card is queued to or probed by the probe workers.
+ * removed - The card was removed while probing, free it when the probe is
+ *     done.
+ */
 struct card_list {
 	struct cras_alsa_card *card;
+	size_t card_index;
+	int probing;
+	int removed;
 	struct card_list *prev, *next;
 };
 
@@ -40,6 +51,11 @@ struct card_list {
  *    cards - A list of active sound cards in the system.
  *    update_lock - Protects the update_count, as audio threads can update the
  *      stream count.
+ *    batch_depth - Nesting of cras_system_state_batch_begin calls.
+ *    batch_thread - The thread that started the batch, updates from other
+ *      threads aren't part of it.
+ *    batch_dirty - The state changed in the current batch, the update_count
+ *      is odd until the batch ends or another thread publishes an update.
  *    tm - The system-wide timer manager.
  */
 static struct {
@@ -55,6 +71,9 @@ static struct {
 	struct cras_alert *active_streams_alert;
 	struct card_list *cards;
 	pthread_mutex_t update_lock;
+	unsigned int batch_depth;
+	pthread_t batch_thread;
+	int batch_dirty;
 	struct cras_tm *tm;
 	/* Select loop callback registration. */
 	int (*fd_add)(int fd, void (*cb)(void *data),
@@ -340,6 +359,30 @@ long cras_system_get_max_capture_gain()
 	return state.exp_state->max_capture_gain;
 }
 
+/* Called in the main loop when a card queued by cras_system_add_alsa_card
+ * has been probed. */
+static void alsa_card_probed(struct cras_alsa_card_probe *probe, void *arg)
+{
+	struct card_list *card = (struct card_list *)arg;
+
+	if (probe && !card->removed)
+		card->card = cras_alsa_card_create_from_probe(probe);
+	cras_alsa_card_probe_destroy(probe);
+
+	/* Already off the list if it was removed. */
+	if (card->removed) {
+		free(card);
+		return;
+	}
+	card->probing = 0;
+	if (card->card == NULL) {
+		syslog(LOG_ERR, "Failed to add alsa card %zu",
+		       card->card_index);
+		DL_DELETE(state.cards, card);
+		free(card);
+	}
+}
+
 int cras_system_add_alsa_card(struct cras_alsa_card_info *alsa_card_info)
 {
 	struct card_list *card;
@@ -352,16 +395,29 @@ int cras_system_add_alsa_card(struct cras_alsa_card_info *alsa_card_info)
 	card_index = alsa_card_info->card_index;
 
 	DL_FOREACH(state.cards, card) {
-		if (card_index == cras_alsa_card_get_index(card->card))
+		if (card_index == card->card_index)
 			return -EINVAL;
 	}
-	alsa_card = cras_alsa_card_create(alsa_card_info,
-					  state.device_blacklist);
-	if (alsa_card == NULL)
-		return -ENOMEM;
 	card = calloc(1, sizeof(*card));
 	if (card == NULL)
 		return -ENOMEM;
+	card->card_index = card_index;
+
+	/* Devices of the card are added when the probe completes. */
+	if (cras_alsa_card_probe_queue(alsa_card_info,
+				       state.device_blacklist,
+				       alsa_card_probed, card) == 0) {
+		card->probing = 1;
+		DL_APPEND(state.cards, card);
+		return 0;
+	}
+
+	alsa_card = cras_alsa_card_create(alsa_card_info,
+					  state.device_blacklist);
+	if (alsa_card == NULL) {
+		free(card);
+		return -ENOMEM;
+	}
 	card->card = alsa_card;
 	DL_APPEND(state.cards, card);
 	return 0;
@@ -372,12 +428,16 @@ int cras_system_remove_alsa_card(size_t alsa_card_index)
 	struct card_list *card;
 
 	DL_FOREACH(state.cards, card) {
-		if (alsa_card_index == cras_alsa_card_get_index(card->card))
+		if (alsa_card_index == card->card_index)
 			break;
 	}
 	if (card == NULL)
 		return -EINVAL;
 	DL_DELETE(state.cards, card);
+	if (card->probing) {
+		card->removed = 1;
+		return 0;
+	}
 	cras_alsa_card_destroy(card->card);
 	free(card);
 	return 0;
@@ -388,7 +448,7 @@ int cras_system_alsa_card_exists(unsigned alsa_card_index)
 	struct card_list *card;
 
 	DL_FOREACH(state.cards, card)
-		if (alsa_card_index == cras_alsa_card_get_index(card->card))
+		if (alsa_card_index == card->card_index)
 			return 1;
 	return 0;
 }
@@ -516,6 +576,14 @@ int cras_system_state_get_input_nodes(const struct cras_ionode_info **nodes)
 	return state.exp_state->num_input_nodes;
 }
 
+/* Returns non-zero if updates from this thread are part of a batch. Called
+ * with update_lock held. */
+static int in_batch()
+{
+	return state.batch_depth &&
+	       pthread_equal(state.batch_thread, pthread_self());
+}
+
 struct cras_server_state *cras_system_state_update_begin()
 {
 	if (pthread_mutex_lock(&state.update_lock)) {
@@ -523,13 +591,50 @@ struct cras_server_state *cras_system_state_update_begin()
 		return NULL;
 	}
 
-	__sync_fetch_and_add(&state.exp_state->update_count, 1);
+	/* Inside a batch the count stays odd from the first update until the
+	 * batch ends. */
+	if (!state.batch_dirty)
+		__sync_fetch_and_add(&state.exp_state->update_count, 1);
+	if (in_batch())
+		state.batch_dirty = 1;
 	return state.exp_state;
 }
 
-void cras_system_state_update_complete()
+/* Marks the end of an update, and wakes clients waiting for it. Called with
+ * update_lock held. */
+static void finish_update()
 {
 	__sync_fetch_and_add(&state.exp_state->update_count, 1);
+	cras_futex_wake(&state.exp_state->update_count);
+}
+
+void cras_system_state_update_complete()
+{
+	/* An update from another thread also publishes the updates made so
+	 * far in the batch, each of them is complete. */
+	if (!in_batch()) {
+		state.batch_dirty = 0;
+		finish_update();
+	}
+	pthread_mutex_unlock(&state.update_lock);
+}
+
+void cras_system_state_batch_begin()
+{
+	pthread_mutex_lock(&state.update_lock);
+	if (!state.batch_depth++)
+		state.batch_thread = pthread_self();
+	pthread_mutex_unlock(&state.update_lock);
+}
+
+void cras_system_state_batch_end()
+{
+	pthread_mutex_lock(&state.update_lock);
+	if (state.batch_depth && --state.batch_depth == 0 &&
+	    state.batch_dirty) {
+		state.batch_dirty = 0;
+		finish_update();
+	}
 	pthread_mutex_unlock(&state.update_lock);
 }
 
@@ -171,7 +171,9 @@ long cras_system_get_max_capture_gain();
 
 /* Adds a card at the given index to the system.  When a new card is found
  * (through a udev event notification) this will add the card to the system,
- * causing its devices to become available for playback/capture.
+ * causing its devices to become available for playback/capture.  If the card
+ * probe workers are running the card is probed on them and its devices are
+ * added to the system later, from the main loop.
  * Args:
  *    alsa_card_info - Info about the alsa card (Index, type, etc.).
  * Returns:
@@ -327,6 +329,20 @@ struct cras_server_state *cras_system_state_update_begin();
  */
 void cras_system_state_update_complete();
 
+/* Starts grouping state updates. Until the matching
+ * cras_system_state_batch_end, all updates from the calling thread are seen by
+ * clients as a single one and clients are woken once. Calls can nest, but only
+ * one thread can batch at a time. Clients wait while a batch is open, so keep
+ * it around the few updates to merge. The main loop only batches the device
+ * and client lists sent for new connections. Other updates, e.g. volume and
+ * node changes, are published one by one: the server reads back and writes
+ * debug info to the shared state in between, so they can't be staged.
+ */
+void cras_system_state_batch_begin();
+
+/* Ends a group of updates started by cras_system_state_batch_begin. */
+void cras_system_state_batch_end();
+
 /* Gets a pointer to the system state without locking it.  Only used for debug
  * log.  Don't add calls to this function. */
 struct cras_server_state *cras_system_state_get_no_lock();
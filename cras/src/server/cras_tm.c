@@ -5,26 +5,60 @@
 
 #include "cras_types.h"
 #include "cras_util.h"
-#include "utlist.h"
 
+#include <errno.h>
+#include <stdlib.h>
 #include <time.h>
 
+/* Number of timers allocated at once when the free list runs out. */
+#define TIMER_SLAB_SIZE 64
+/* Initial number of timers the heap holds, it doubles when full. */
+#define TIMER_HEAP_INIT_SIZE 64
+
 /* Represents an armed timer.
  * Members:
  *    ts - timespec at which the timer should fire.
  *    cb - Callback to call when the timer expires.
  *    cb_data - Data passed to the callback.
+ *    heap_idx - Position in the heap, -1 once expired and waiting for its
+ *        callback to be run.
+ *    next_free - Next unused timer of the free list, or next expired timer
+ *        while callbacks are run.
  */
 struct cras_timer {
 	struct timespec ts;
 	void (*cb)(struct cras_timer *t, void *data);
 	void *cb_data;
-	struct cras_timer *next, *prev;
+	int heap_idx;
+	struct cras_timer *next_free;
 };
 
-/* Timer Manager, keeps a list of active timers. */
+/* A block of timers allocated at once.
+ * Members:
+ *    timers - The timers in this slab.
+ *    next - The next slab allocated.
+ */
+struct cras_timer_slab {
+	struct cras_timer timers[TIMER_SLAB_SIZE];
+	struct cras_timer_slab *next;
+};
+
+/* Timer Manager, keeps the active timers in a binary min heap ordered by
+ * expiration, so the next one to fire is always at the top. Timers come from
+ * slabs and go back to a free list when done instead of being freed.
+ * Members:
+ *    heap - Active timers, heap[0] expires first.
+ *    num_timers - Number of timers in the heap.
+ *    heap_size - Number of timers the heap can hold.
+ *    slabs - Every slab of timers allocated.
+ *    free_timers - Timers not in use.
+ */
 struct cras_tm {
-	struct cras_timer *timers;
+	struct cras_timer **heap;
+	unsigned int num_timers;
+	unsigned int heap_size;
+	struct cras_timer_slab *slabs;
+	struct cras_timer *free_timers;
 };
 
 /* Local Functions. */
@@ -51,6 +85,117 @@ static inline int timespec_sooner(const struct timespec *a,
 		(a->tv_sec == b->tv_sec && a->tv_nsec <= b->tv_nsec));
 }
 
+static struct cras_timer *alloc_timer(struct cras_tm *tm)
+{
+	struct cras_timer_slab *slab;
+	struct cras_timer *t;
+	unsigned int i;
+
+	if (!tm->free_timers) {
+		slab = calloc(1, sizeof(*slab));
+		if (!slab)
+			return NULL;
+		slab->next = tm->slabs;
+		tm->slabs = slab;
+		for (i = 0; i < TIMER_SLAB_SIZE; i++) {
+			slab->timers[i].next_free = tm->free_timers;
+			tm->free_timers = &slab->timers[i];
+		}
+	}
+
+	t = tm->free_timers;
+	tm->free_timers = t->next_free;
+	return t;
+}
+
+static void free_timer(struct cras_tm *tm, struct cras_timer *t)
+{
+	t->cb = NULL;
+	t->next_free = tm->free_timers;
+	tm->free_timers = t;
+}
+
+static inline void heap_set(struct cras_tm *tm, unsigned int idx,
+			    struct cras_timer *t)
+{
+	tm->heap[idx] = t;
+	t->heap_idx = idx;
+}
+
+/* Moves the timer at idx up until its parent expires before it. */
+static void sift_up(struct cras_tm *tm, unsigned int idx)
+{
+	struct cras_timer *t = tm->heap[idx];
+	unsigned int parent;
+
+	while (idx > 0) {
+		parent = (idx - 1) / 2;
+		if (timespec_sooner(&tm->heap[parent]->ts, &t->ts))
+			break;
+		heap_set(tm, idx, tm->heap[parent]);
+		idx = parent;
+	}
+	heap_set(tm, idx, t);
+}
+
+/* Moves the timer at idx down until both children expire after it. */
+static void sift_down(struct cras_tm *tm, unsigned int idx)
+{
+	struct cras_timer *t = tm->heap[idx];
+	unsigned int child;
+
+	while ((child = 2 * idx + 1) < tm->num_timers) {
+		if (child + 1 < tm->num_timers &&
+		    !timespec_sooner(&tm->heap[child]->ts,
+				     &tm->heap[child + 1]->ts))
+			child++;
+		if (timespec_sooner(&t->ts, &tm->heap[child]->ts))
+			break;
+		heap_set(tm, idx, tm->heap[child]);
+		idx = child;
+	}
+	heap_set(tm, idx, t);
+}
+
+static int heap_insert(struct cras_tm *tm, struct cras_timer *t)
+{
+	struct cras_timer **heap;
+	unsigned int size;
+
+	if (tm->num_timers == tm->heap_size) {
+		size = tm->heap_size ? 2 * tm->heap_size :
+				       TIMER_HEAP_INIT_SIZE;
+		heap = realloc(tm->heap, size * sizeof(*heap));
+		if (!heap)
+			return -ENOMEM;
+		tm->heap = heap;
+		tm->heap_size = size;
+	}
+
+	heap_set(tm, tm->num_timers++, t);
+	sift_up(tm, t->heap_idx);
+	return 0;
+}
+
+static void heap_remove(struct cras_tm *tm, struct cras_timer *t)
+{
+	unsigned int idx = t->heap_idx;
+	struct cras_timer *last = tm->heap[--tm->num_timers];
+
+	t->heap_idx = -1;
+	if (last == t)
+		return;
+
+	/* Fill the hole with the last timer, which may belong either above
+	 * or below it. */
+	heap_set(tm, idx, last);
+	if (idx > 0 && timespec_sooner(&last->ts,
+				       &tm->heap[(idx - 1) / 2]->ts))
+		sift_up(tm, idx);
+	else
+		sift_down(tm, idx);
+}
+
 /* Exported Interface. */
 
 struct cras_timer *cras_tm_create_timer(
@@ -61,7 +206,7 @@ struct cras_timer *cras_tm_create_timer(
 {
 	struct cras_timer *t;
 
-	t = calloc(1, sizeof(*t));
+	t = alloc_timer(tm);
 	if (!t)
 		return NULL;
 
@@ -71,15 +216,24 @@ struct cras_timer *cras_tm_create_timer(
 	clock_gettime(CLOCK_MONOTONIC, &t->ts);
 	add_ms_ts(&t->ts, ms);
 
-	DL_APPEND(tm->timers, t);
+	if (heap_insert(tm, t)) {
+		free_timer(tm, t);
+		return NULL;
+	}
 
 	return t;
 }
 
 void cras_tm_cancel_timer(struct cras_tm *tm, struct cras_timer *t)
 {
-	DL_DELETE(tm->timers, t);
-	free(t);
+	/* An expired timer is released by cras_tm_call_callbacks(), it only
+	 * has to be kept from firing. */
+	if (t->heap_idx < 0) {
+		t->cb = NULL;
+		return;
+	}
+	heap_remove(tm, t);
+	free_timer(tm, t);
 }
 
 struct cras_tm *cras_tm_init()
@@ -89,28 +243,26 @@ struct cras_tm *cras_tm_init()
 
 void cras_tm_deinit(struct cras_tm *tm)
 {
-	struct cras_timer *t;
+	struct cras_timer_slab *slab;
 
-	DL_FOREACH(tm->timers, t) {
-		DL_DELETE(tm->timers, t);
-		free(t);
+	while (tm->slabs) {
+		slab = tm->slabs;
+		tm->slabs = slab->next;
+		free(slab);
 	}
+	free(tm->heap);
 	free(tm);
 }
 
 int cras_tm_get_next_timeout(const struct cras_tm *tm, struct timespec *ts)
 {
-	struct cras_timer *t;
 	struct timespec now;
-	struct timespec *min;
+	const struct timespec *min;
 
-	if (!tm->timers)
+	if (!tm->num_timers)
 		return 0;
 
-	min = &tm->timers->ts;
-	DL_FOREACH(tm->timers, t)
-		if (timespec_sooner(&t->ts, min))
-			min = &t->ts;
+	min = &tm->heap[0]->ts;
 
 	clock_gettime(CLOCK_MONOTONIC, &now);
 
@@ -127,13 +279,25 @@ int cras_tm_get_next_timeout(const struct cras_tm *tm, struct timespec *ts)
 void cras_tm_call_callbacks(struct cras_tm *tm)
 {
 	struct timespec now;
-	struct cras_timer *t;
+	struct cras_timer *t, *expired = NULL, **tail = &expired;
 
 	clock_gettime(CLOCK_MONOTONIC, &now);
 
-	DL_FOREACH(tm->timers, t)
-		if (timespec_sooner(&t->ts, &now)) {
+	/* Take the expired timers out first, in order, so timers added by the
+	 * callbacks wait for the next call. */
+	while (tm->num_timers && timespec_sooner(&tm->heap[0]->ts, &now)) {
+		t = tm->heap[0];
+		heap_remove(tm, t);
+		t->next_free = NULL;
+		*tail = t;
+		tail = &t->next_free;
+	}
+
+	while (expired) {
+		t = expired;
+		expired = t->next_free;
+		if (t->cb)
 			t->cb(t, t->cb_data);
-			cras_tm_cancel_timer(tm, t);
-		}
+		free_timer(tm, t);
+	}
 }
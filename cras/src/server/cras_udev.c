@@ -14,6 +14,8 @@
 #include <regex.h>
 #include <syslog.h>
 
+#include "cras_alsa_card_probe.h"
+#include "cras_config.h"
 #include "cras_system_state.h"
 #include "cras_types.h"
 #include "cras_util.h"
@@ -167,6 +169,10 @@ static void set_factory_default(unsigned card_number)
 	}
 }
 
+#define ALSA_SETTLE_US 125000 /* 0.125 second */
+/* Number of threads probing cards, boards have a few cards at most. */
+#define NUM_CARD_PROBE_WORKERS 4
+
 static inline void udev_delay_for_alsa()
 {
 	/* Provide a small delay so that the udev message can
@@ -178,7 +184,7 @@ static inline void udev_delay_for_alsa()
 	 *
 	 * will be produced by cras_alsa_card_create().
 	 */
-	usleep(125000);		/* 0.125 second */
+	usleep(ALSA_SETTLE_US);
 }
 
 /* Reads the "descriptors" file of the usb device and returns the
@@ -279,7 +285,10 @@ static void device_add_alsa(struct udev_device *dev,
 {
 	struct cras_alsa_card_info card_info;
 
-	udev_delay_for_alsa();
+	/* Probe workers wait for ALSA themselves, off the main loop. */
+	if (!cras_alsa_card_probe_pool_running())
+		udev_delay_for_alsa();
+	memset(&card_info, 0, sizeof(card_info));
 	card_info.card_index = card;
 	if (internal) {
 		card_info.card_type = ALSA_CARD_TYPE_INTERNAL;
@@ -408,11 +417,20 @@ void cras_udev_start_sound_subsystem_monitor()
 	compile_regex(&pcm_regex, pcm_regex_string);
 	compile_regex(&card_regex, card_regex_string);
 
+	/* Cards found below and hotplugged later are probed in parallel and
+	 * show up as each probe completes. */
+	r = cras_alsa_card_probe_pool_start(NUM_CARD_PROBE_WORKERS,
+					    ALSA_SETTLE_US,
+					    CRAS_CARD_PROBE_CACHE_DIR);
+	if (r < 0)
+		syslog(LOG_WARNING, "Probing sound cards on the main thread.");
+
 	enumerate_devices(&udev_data);
 }
 
 void cras_udev_stop_sound_subsystem_monitor()
 {
+	cras_alsa_card_probe_pool_stop();
 	udev_unref(udev_data.udev);
 	regfree(&pcm_regex);
 	regfree(&card_regex);
@@ -32,6 +32,8 @@ struct dev_stream *dev_stream_create(struct cras_rstream *stream,
 	struct cras_audio_format *stream_fmt = &stream->format;
 	int rc = 0;
 	unsigned int max_frames;
+	unsigned int ramp_frames;
+	float volume;
 
 	out = calloc(1, sizeof(*out));
 	out->dev_id = dev_id;
@@ -100,6 +102,12 @@ struct dev_stream *dev_stream_create(struct cras_rstream *stream,
 		add_timespecs(&stream->next_cb_ts, &extra_sleep);
 	}
 
+	/* Start at the current volume, ramps only follow later changes. */
+	if (cras_rstream_get_volume_ramp(stream, &volume, &ramp_frames))
+		volume = 1.0;
+	out->mix_gain = volume;
+	out->ramp_target = volume;
+
 	if (dev_ptr)
 		cras_rstream_dev_attach(stream, dev_id, dev_ptr);
 
@@ -144,6 +152,68 @@ void dev_stream_set_dev_rate(struct dev_stream *dev_stream,
 
 }
 
+/* Starts a ramp from the current gain when the client changed the volume or
+ * mute state of the stream. */
+static void update_volume_ramp(struct dev_stream *dev_stream,
+			       unsigned int dev_rate)
+{
+	struct cras_rstream *rstream = dev_stream->stream;
+	unsigned int ramp_frames;
+	float target;
+
+	if (cras_rstream_get_volume_ramp(rstream, &target, &ramp_frames))
+		return; /* Being changed, try again on the next mix. */
+	if (target == dev_stream->ramp_target)
+		return;
+
+	dev_stream->ramp_target = target;
+	if (ramp_frames)
+		ramp_frames = cras_frames_at_rate(rstream->format.frame_rate,
+						  ramp_frames, dev_rate);
+	if (ramp_frames == 0) {
+		dev_stream->mix_gain = target;
+		dev_stream->ramp_frames_left = 0;
+		return;
+	}
+	dev_stream->ramp_step = (target - dev_stream->mix_gain) / ramp_frames;
+	dev_stream->ramp_frames_left = ramp_frames;
+}
+
+/* Mixes frames from src into dst at the stream's gain, following the ramp if
+ * one is in progress. */
+static void mix_with_gain(struct dev_stream *dev_stream,
+			  const struct cras_audio_format *fmt,
+			  uint8_t *dst,
+			  uint8_t *src,
+			  unsigned int frames)
+{
+	unsigned int ramp_frames;
+	size_t frame_bytes;
+
+	ramp_frames = MIN(frames, dev_stream->ramp_frames_left);
+	if (ramp_frames) {
+		cras_mix_add_ramp(fmt->format, dst, src, ramp_frames,
+				  fmt->num_channels, dev_stream->mix_gain,
+				  dev_stream->ramp_step);
+		dev_stream->ramp_frames_left -= ramp_frames;
+		if (dev_stream->ramp_frames_left)
+			dev_stream->mix_gain +=
+				dev_stream->ramp_step * ramp_frames;
+		else
+			dev_stream->mix_gain = dev_stream->ramp_target;
+
+		frame_bytes = cras_get_format_bytes(fmt);
+		dst += ramp_frames * frame_bytes;
+		src += ramp_frames * frame_bytes;
+		frames -= ramp_frames;
+	}
+
+	if (frames)
+		cras_mix_add(fmt->format, dst, src,
+			     frames * fmt->num_channels, 1, 0,
+			     dev_stream->mix_gain);
+}
+
 int dev_stream_mix(struct dev_stream *dev_stream,
 		   const struct cras_audio_format *fmt,
 		   uint8_t *dst,
@@ -155,10 +225,8 @@ int dev_stream_mix(struct dev_stream *dev_stream,
 	unsigned int fr_written, fr_read;
 	unsigned int buffer_offset;
 	int fr_in_buf;
-	unsigned int num_samples;
 	size_t frames = 0;
 	unsigned int dev_frames;
-	float mix_vol;
 
 	fr_in_buf = dev_stream_playback_frames(dev_stream);
 	if (fr_in_buf <= 0)
@@ -168,8 +236,7 @@ int dev_stream_mix(struct dev_stream *dev_stream,
 
 	buffer_offset = cras_rstream_dev_offset(rstream, dev_stream->dev_id);
 
-	/* Stream volume scaler. */
-	mix_vol = cras_rstream_get_volume_scaler(dev_stream->stream);
+	update_volume_ramp(dev_stream, fmt->frame_rate);
 
 	fr_written = 0;
 	fr_read = 0;
@@ -192,9 +259,7 @@ int dev_stream_mix(struct dev_stream *dev_stream,
 			dev_frames = MIN(frames, num_to_write - fr_written);
 			read_frames = dev_frames;
 		}
-		num_samples = dev_frames * fmt->num_channels;
-		cras_mix_add(fmt->format, target, src, num_samples, 1,
-			     cras_rstream_get_mute(rstream), mix_vol);
+		mix_with_gain(dev_stream, fmt, target, src, dev_frames);
 		target += dev_frames * cras_get_format_bytes(fmt);
 		fr_written += dev_frames;
 		fr_read += read_frames;
@@ -37,6 +37,10 @@ struct dev_stream {
 	struct cras_audio_area *conv_area;
 	unsigned int conv_buffer_size_frames;
 	unsigned int skip_mix;
+	float mix_gain;
+	float ramp_target;
+	float ramp_step;
+	unsigned int ramp_frames_left;
 	struct dev_stream *prev, *next;
 };
 
@@ -0,0 +1,372 @@
+// Copyright (c) 2015 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <gtest/gtest.h>
+
+extern "C" {
+#include "cras_a2dp_encoder.h"
+#include "cras_a2dp_info.h"
+}
+
+#define PCM_BUF_SIZE 4096
+#define FORMAT_BYTES 4
+#define CODESIZE 512
+/* Number of codesize chunks in a packet. */
+#define CHUNKS_PER_PACKET 2
+#define PACKET_SIZE 100
+
+static struct a2dp_info a2dp;
+static volatile int a2dp_encode_called;
+static int encoded_chunks;
+static int packets_taken;
+static int a2dp_send_packets_called;
+static volatile unsigned int a2dp_encode_max_num_pcm;
+static volatile int a2dp_set_bitpool_called;
+static int a2dp_set_bitpool_queued_val;
+static int a2dp_set_bitpool_return_val;
+
+void ResetStubData() {
+  a2dp_send_packets_called = 0;
+  a2dp_encode_max_num_pcm = 0;
+  a2dp_set_bitpool_called = 0;
+  a2dp_set_bitpool_queued_val = -1;
+  a2dp_set_bitpool_return_val = 0;
+  a2dp.bitpool = 53;
+  a2dp_encode_called = 0;
+  encoded_chunks = 0;
+  packets_taken = 0;
+}
+
+/* Waits for the encoder to notify queued packets. */
+static int WaitForPackets(struct a2dp_encoder *enc, int timeout_ms) {
+  struct pollfd pfd;
+
+  pfd.fd = a2dp_encoder_fd(enc);
+  pfd.events = POLLIN;
+  return poll(&pfd, 1, timeout_ms);
+}
+
+/* Waits for the encoder to consume pcm until only the given bytes are
+ * left. */
+static void WaitForPcmLevel(struct a2dp_encoder *enc, unsigned int level) {
+  for (int i = 0; i < 1000; i++) {
+    if (a2dp_encoder_pcm_queued_bytes(enc) <= level)
+      return;
+    usleep(1000);
+  }
+}
+
+/* Waits for the encoder to finish with the samples it has consumed, until
+ * the given number of frames are encoded and not sent. */
+static void WaitForQueuedFrames(struct a2dp_encoder *enc, int frames) {
+  for (int i = 0; i < 1000; i++) {
+    if (a2dp_encoder_queued_frames(enc) == frames)
+      return;
+    usleep(1000);
+  }
+}
+
+/* Writes the given number of bytes to the pcm ring, in two parts if it
+ * wraps. */
+static void WritePcm(struct a2dp_encoder *enc, unsigned int bytes) {
+  unsigned int writable;
+
+  while (bytes) {
+    uint8_t *buf = a2dp_encoder_pcm_write_pointer(enc, &writable);
+    unsigned int n = std::min(bytes, writable);
+    ASSERT_NE(0, n);
+    memset(buf, 0, n);
+    ASSERT_EQ(0, a2dp_encoder_pcm_commit(enc, n));
+    bytes -= n;
+  }
+}
+
+namespace {
+
+TEST(A2dpEncoder, CreateInvalidSize) {
+  EXPECT_EQ(NULL, a2dp_encoder_create(&a2dp, 3000, FORMAT_BYTES, 1024));
+  EXPECT_EQ(NULL, a2dp_encoder_create(&a2dp, 0, FORMAT_BYTES, 1024));
+}
+
+TEST(A2dpEncoder, EncodeAndSend) {
+  struct a2dp_encoder *enc;
+  int sock[2];
+  uint8_t packet[PACKET_SIZE * 2];
+  unsigned int writable;
+  uint16_t seq_num;
+  uint32_t timestamp;
+
+  ResetStubData();
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sock));
+  enc = a2dp_encoder_create(&a2dp, PCM_BUF_SIZE, FORMAT_BYTES, 1024);
+  ASSERT_NE((void *)NULL, enc);
+
+  a2dp_encoder_pcm_write_pointer(enc, &writable);
+  EXPECT_EQ(PCM_BUF_SIZE, writable);
+  EXPECT_EQ(-EINVAL, a2dp_encoder_pcm_commit(enc, PCM_BUF_SIZE + 1));
+
+  /* Two packets and a half. */
+  WritePcm(enc, CODESIZE * 5);
+  ASSERT_EQ(1, WaitForPackets(enc, 1000));
+  WaitForPcmLevel(enc, 0);
+  WaitForQueuedFrames(enc, 5 * CODESIZE / FORMAT_BYTES);
+  EXPECT_EQ(0, a2dp_encoder_pcm_queued_bytes(enc));
+  EXPECT_EQ(5 * CODESIZE / FORMAT_BYTES, a2dp_encoder_queued_frames(enc));
+
+  /* Both packets go in one call. */
+  EXPECT_EQ(2 * PACKET_SIZE, a2dp_encoder_send(enc, sock[0]));
+  EXPECT_EQ(1, a2dp_send_packets_called);
+  EXPECT_EQ(CODESIZE / FORMAT_BYTES, a2dp_encoder_queued_frames(enc));
+  a2dp_encoder_last_sent(enc, &seq_num, &timestamp);
+  EXPECT_EQ(1, seq_num);
+  for (int i = 0; i < 2; i++) {
+    ASSERT_EQ(PACKET_SIZE, recv(sock[1], packet, sizeof(packet), 0));
+    EXPECT_EQ(i, packet[0]);
+  }
+
+  /* Notification is cleared by send. */
+  EXPECT_EQ(0, WaitForPackets(enc, 0));
+  EXPECT_EQ(0, a2dp_encoder_send(enc, sock[0]));
+
+  /* Samples across the end of the ring. */
+  WritePcm(enc, PCM_BUF_SIZE - CODESIZE);
+  WaitForPcmLevel(enc, 0);
+  WaitForQueuedFrames(enc, 8 * CODESIZE / FORMAT_BYTES);
+  EXPECT_EQ(0, a2dp_encoder_pcm_queued_bytes(enc));
+  EXPECT_EQ(4 * PACKET_SIZE, a2dp_encoder_send(enc, sock[0]));
+
+  a2dp_encoder_destroy(enc);
+  close(sock[0]);
+  close(sock[1]);
+}
+
+TEST(A2dpEncoder, SocketFull) {
+  struct a2dp_encoder *enc;
+  int sock[2];
+  int sock_depth = 4096;
+  uint8_t packet[PACKET_SIZE];
+  int sent = 0;
+  int received = 0;
+  int rc;
+
+  ResetStubData();
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sock));
+  setsockopt(sock[0], SOL_SOCKET, SO_SNDBUF, &sock_depth, sizeof(sock_depth));
+  enc = a2dp_encoder_create(&a2dp, PCM_BUF_SIZE, FORMAT_BYTES, 1024);
+  ASSERT_NE((void *)NULL, enc);
+
+  /* Keep encoding until the socket is full. */
+  do {
+    WritePcm(enc, CODESIZE * CHUNKS_PER_PACKET);
+    ASSERT_EQ(1, WaitForPackets(enc, 1000));
+    rc = a2dp_encoder_send(enc, sock[0]);
+    if (rc > 0)
+      sent += rc / PACKET_SIZE;
+  } while (rc > 0);
+  EXPECT_EQ(-EAGAIN, rc);
+  EXPECT_EQ(CODESIZE * CHUNKS_PER_PACKET / FORMAT_BYTES,
+            a2dp_encoder_queued_frames(enc));
+
+  /* The encoder stops when the packet queue is full, and leaves the rest
+   * in the pcm ring. The unsent packet and these seven fill the queue. */
+  WritePcm(enc, PCM_BUF_SIZE);
+  WaitForPcmLevel(enc, 0);
+  WritePcm(enc, PCM_BUF_SIZE);
+  WaitForPcmLevel(enc, PCM_BUF_SIZE - 3 * CHUNKS_PER_PACKET * CODESIZE);
+  WaitForQueuedFrames(enc, 8 * CODESIZE * CHUNKS_PER_PACKET / FORMAT_BYTES);
+  usleep(10000);
+  EXPECT_EQ(PCM_BUF_SIZE - 3 * CHUNKS_PER_PACKET * CODESIZE,
+            a2dp_encoder_pcm_queued_bytes(enc));
+  EXPECT_EQ(8 * CODESIZE * CHUNKS_PER_PACKET / FORMAT_BYTES,
+            a2dp_encoder_queued_frames(enc));
+
+  /* Packets come out in order as the socket is drained, and the encoder
+   * resumes as the queue empties. */
+  while (received < sent + 9) {
+    rc = recv(sock[1], packet, sizeof(packet), MSG_DONTWAIT);
+    if (rc < 0) {
+      WaitForPackets(enc, 10);
+      rc = a2dp_encoder_send(enc, sock[0]);
+      ASSERT_TRUE(rc >= 0 || rc == -EAGAIN);
+      continue;
+    }
+    ASSERT_EQ(PACKET_SIZE, rc);
+    EXPECT_EQ(received & 0xff, packet[0]);
+    received++;
+  }
+  EXPECT_EQ(0, a2dp_encoder_pcm_queued_bytes(enc));
+  EXPECT_EQ(0, a2dp_encoder_queued_frames(enc));
+
+  a2dp_encoder_destroy(enc);
+  close(sock[0]);
+  close(sock[1]);
+}
+
+TEST(A2dpEncoder, MirroredPcmRing) {
+  struct a2dp_encoder *enc;
+  int sock[2];
+  unsigned int writable;
+  uint8_t *buf;
+
+  ResetStubData();
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sock));
+  enc = a2dp_encoder_create(&a2dp, PCM_BUF_SIZE, FORMAT_BYTES, 1024);
+  ASSERT_NE((void *)NULL, enc);
+
+  WritePcm(enc, 7 * CODESIZE);
+  WaitForPcmLevel(enc, 0);
+  WaitForQueuedFrames(enc, 7 * CODESIZE / FORMAT_BYTES);
+  EXPECT_EQ(3 * PACKET_SIZE, a2dp_encoder_send(enc, sock[0]));
+
+  /* The whole ring is writable in one piece, across its end. */
+  buf = a2dp_encoder_pcm_write_pointer(enc, &writable);
+  ASSERT_EQ(PCM_BUF_SIZE, writable);
+  memset(buf, 0x55, writable);
+  ASSERT_EQ(0, a2dp_encoder_pcm_commit(enc, 2 * CODESIZE + CODESIZE / 2));
+  EXPECT_EQ(0x55, buf[-7 * (int)CODESIZE]);
+
+  /* And samples across the end are encoded from one buffer. */
+  WaitForPcmLevel(enc, CODESIZE / 2);
+  WaitForQueuedFrames(enc, 5 * CODESIZE / FORMAT_BYTES);
+  EXPECT_EQ(1, a2dp_encode_max_num_pcm);
+
+  a2dp_encoder_destroy(enc);
+  close(sock[0]);
+  close(sock[1]);
+}
+
+TEST(A2dpEncoder, SetBitpoolBetweenPackets) {
+  struct a2dp_encoder *enc;
+
+  ResetStubData();
+  enc = a2dp_encoder_create(&a2dp, PCM_BUF_SIZE, FORMAT_BYTES, 1024);
+  ASSERT_NE((void *)NULL, enc);
+  EXPECT_EQ(53, a2dp_encoder_bitpool(enc));
+
+  /* Half a packet encoded, the change waits for it to be taken. */
+  WritePcm(enc, CODESIZE);
+  WaitForQueuedFrames(enc, CODESIZE / FORMAT_BYTES);
+  a2dp_encoder_set_bitpool(enc, 30);
+  usleep(10000);
+  EXPECT_EQ(0, a2dp_set_bitpool_called);
+  EXPECT_EQ(53, a2dp_encoder_bitpool(enc));
+
+  WritePcm(enc, CODESIZE);
+  ASSERT_EQ(1, WaitForPackets(enc, 1000));
+  for (int i = 0; i < 1000 && a2dp_encoder_bitpool(enc) != 30; i++)
+    usleep(1000);
+  EXPECT_EQ(30, a2dp_encoder_bitpool(enc));
+  EXPECT_EQ(1, a2dp_set_bitpool_called);
+  EXPECT_EQ(0, a2dp_set_bitpool_queued_val);
+
+  a2dp_encoder_destroy(enc);
+}
+
+TEST(A2dpEncoder, SetBitpoolFailureNotRetried) {
+  struct a2dp_encoder *enc;
+
+  ResetStubData();
+  enc = a2dp_encoder_create(&a2dp, PCM_BUF_SIZE, FORMAT_BYTES, 1024);
+  ASSERT_NE((void *)NULL, enc);
+
+  a2dp_set_bitpool_return_val = -EINVAL;
+  a2dp_encoder_set_bitpool(enc, 30);
+  for (int i = 0; i < 1000 && a2dp_set_bitpool_called == 0; i++)
+    usleep(1000);
+  EXPECT_EQ(1, a2dp_set_bitpool_called);
+  EXPECT_EQ(53, a2dp_encoder_bitpool(enc));
+
+  /* Waking the encoder again doesn't retry the failed bitpool. */
+  a2dp_set_bitpool_return_val = 0;
+  WritePcm(enc, CODESIZE);
+  WaitForPcmLevel(enc, 0);
+  usleep(10000);
+  EXPECT_EQ(1, a2dp_set_bitpool_called);
+  EXPECT_EQ(53, a2dp_encoder_bitpool(enc));
+
+  /* A different one is asked for once the packet is taken. */
+  WritePcm(enc, CODESIZE);
+  ASSERT_EQ(1, WaitForPackets(enc, 1000));
+  a2dp_encoder_set_bitpool(enc, 40);
+  for (int i = 0; i < 1000 && a2dp_encoder_bitpool(enc) != 40; i++)
+    usleep(1000);
+  EXPECT_EQ(40, a2dp_encoder_bitpool(enc));
+  EXPECT_EQ(2, a2dp_set_bitpool_called);
+
+  a2dp_encoder_destroy(enc);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+
+extern "C" {
+
+int a2dp_encode_iov(struct a2dp_info *a2dp, const struct iovec *pcm,
+                    unsigned int num_pcm, int format_bytes, size_t link_mtu) {
+  int pcm_buf_size = 0;
+
+  for (unsigned int i = 0; i < num_pcm; i++)
+    pcm_buf_size += pcm[i].iov_len;
+  if (num_pcm > a2dp_encode_max_num_pcm)
+    a2dp_encode_max_num_pcm = num_pcm;
+  a2dp_encode_called++;
+  if (pcm_buf_size < CODESIZE || encoded_chunks == CHUNKS_PER_PACKET)
+    return 0;
+  encoded_chunks++;
+  return CODESIZE;
+}
+
+int a2dp_take_packet(struct a2dp_info *a2dp, size_t link_mtu,
+                     struct a2dp_packet *packet, size_t buf_size) {
+  if (encoded_chunks < CHUNKS_PER_PACKET)
+    return 0;
+  memset(packet->data, 0, PACKET_SIZE);
+  packet->data[0] = packets_taken;
+  packet->len = PACKET_SIZE;
+  packet->frames = encoded_chunks * CODESIZE / FORMAT_BYTES;
+  packet->seq_num = packets_taken++;
+  encoded_chunks = 0;
+  return PACKET_SIZE;
+}
+
+int a2dp_send_packets(int stream_fd, struct a2dp_packet *const *packets,
+                      unsigned int num_packets) {
+  unsigned int i;
+
+  a2dp_send_packets_called++;
+  for (i = 0; i < num_packets; i++) {
+    if (send(stream_fd, packets[i]->data, packets[i]->len, MSG_DONTWAIT) < 0)
+      return i ? i : -errno;
+  }
+  return num_packets;
+}
+
+int a2dp_queued_frames(const struct a2dp_info *a2dp) {
+  return encoded_chunks * CODESIZE / FORMAT_BYTES;
+}
+
+int a2dp_set_bitpool(struct a2dp_info *a2dp, int bitpool) {
+  a2dp_set_bitpool_queued_val = encoded_chunks;
+  a2dp_set_bitpool_called++;
+  if (a2dp_set_bitpool_return_val)
+    return a2dp_set_bitpool_return_val;
+  a2dp->bitpool = bitpool;
+  return 0;
+}
+
+int cras_set_thread_priority(int priority) {
+  return 0;
+}
+
+}  // extern "C"
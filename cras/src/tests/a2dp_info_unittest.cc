@@ -2,6 +2,7 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <errno.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <sys/socket.h>
@@ -29,6 +30,7 @@ static size_t a2dp_write_link_mtu_val;
 static size_t encode_out_encoded_return_val;
 static struct cras_audio_codec *sbc_codec;
 static int cras_sbc_codec_create_fail;
+static unsigned int encode_iov_num_input_val;
 static struct a2dp_info a2dp;
 static a2dp_sbc_t sbc;
 
@@ -56,6 +58,7 @@ void ResetStubData() {
   sbc.allocation_method = SBC_ALLOCATION_LOUDNESS;
   sbc.subbands = SBC_SUBBANDS_8;
   sbc.block_length = SBC_BLOCK_LENGTH_16;
+  sbc.min_bitpool = 2;
   sbc.max_bitpool = 50;
 
   a2dp.a2dp_buf_used = 0;
@@ -124,6 +127,45 @@ TEST(A2dpInfoInit, DrainA2dp) {
   destroy_a2dp(&a2dp);
 }
 
+TEST(A2dpInfoInit, SetBitpool) {
+  ResetStubData();
+  init_a2dp(&a2dp, &sbc);
+  EXPECT_EQ(50, a2dp.bitpool);
+  a2dp.seq_num = 7;
+  a2dp.nsamples = 1000;
+
+  // Out of the negotiated range.
+  EXPECT_EQ(-EINVAL, a2dp_set_bitpool(&a2dp, 51));
+  EXPECT_EQ(-EINVAL, a2dp_set_bitpool(&a2dp, 1));
+
+  // Not while a packet is being filled.
+  a2dp.frame_count = 1;
+  EXPECT_EQ(-EBUSY, a2dp_set_bitpool(&a2dp, 30));
+  EXPECT_EQ(1, cras_sbc_codec_create_called);
+
+  // The codec is rebuilt, the rtp state is kept.
+  a2dp.frame_count = 0;
+  cras_sbc_get_frame_length_val = 3;
+  EXPECT_EQ(0, a2dp_set_bitpool(&a2dp, 30));
+  EXPECT_EQ(2, cras_sbc_codec_create_called);
+  EXPECT_EQ(1, cras_sbc_codec_destroy_called);
+  EXPECT_EQ(30, codec_create_bitpool_val);
+  EXPECT_EQ(SBC_FREQ_48000, codec_create_freq_val);
+  EXPECT_EQ(30, a2dp.bitpool);
+  EXPECT_EQ(3, a2dp.frame_length);
+  EXPECT_EQ(7, a2dp.seq_num);
+  EXPECT_EQ(1000, a2dp.nsamples);
+
+  // The old codec is kept on failure.
+  cras_sbc_codec_create_fail = 1;
+  sbc_codec = NULL;
+  EXPECT_EQ(-ENOMEM, a2dp_set_bitpool(&a2dp, 40));
+  EXPECT_EQ(30, a2dp.bitpool);
+  ASSERT_NE(a2dp.codec, (void *)NULL);
+
+  destroy_a2dp(&a2dp);
+}
+
 TEST(A2dpEncode, WriteA2dp) {
   unsigned int processed;
 
@@ -151,6 +193,135 @@ TEST(A2dpEncode, WriteA2dp) {
   ASSERT_EQ(0, a2dp.seq_num);
 }
 
+TEST(A2dpEncode, EncodeIov) {
+  struct iovec iov[2];
+  unsigned int processed;
+
+  ResetStubData();
+  init_a2dp(&a2dp, &sbc);
+
+  // Both parts are encoded in one call.
+  iov[0].iov_base = NULL;
+  iov[0].iov_len = 12;
+  iov[1].iov_base = NULL;
+  iov[1].iov_len = 8;
+  encode_out_encoded_return_val = 4;
+  processed = a2dp_encode_iov(&a2dp, iov, 2, 4, (size_t)40);
+
+  ASSERT_EQ(2, encode_iov_num_input_val);
+  ASSERT_EQ(20, processed);
+  ASSERT_EQ(4, a2dp.frame_count);
+  ASSERT_EQ(17, a2dp.a2dp_buf_used);
+  ASSERT_EQ(5, a2dp.samples);
+
+  destroy_a2dp(&a2dp);
+}
+
+TEST(A2dpEncode, TakePacket) {
+  uint8_t buf[A2DP_BUF_SIZE_BYTES];
+  struct a2dp_packet packet;
+  int len;
+
+  ResetStubData();
+  init_a2dp(&a2dp, &sbc);
+  packet.data = buf;
+
+  encode_out_encoded_return_val = 4;
+  a2dp_encode(&a2dp, NULL, 20, 4, (size_t)40);
+
+  // 13 + 4 used, room for another frame of length 5.
+  len = a2dp_take_packet(&a2dp, 40, &packet, sizeof(buf));
+  ASSERT_EQ(0, len);
+  ASSERT_EQ(17, a2dp.a2dp_buf_used);
+
+  encode_out_encoded_return_val = 15;
+  a2dp_encode(&a2dp, NULL, 20, 4, (size_t)40);
+
+  // Too small to hold the packet.
+  len = a2dp_take_packet(&a2dp, 40, &packet, 16);
+  ASSERT_EQ(-ENOSPC, len);
+
+  len = a2dp_take_packet(&a2dp, 40, &packet, sizeof(buf));
+  ASSERT_EQ(32, len);
+  ASSERT_EQ(32, packet.len);
+  ASSERT_EQ(10, packet.frames);
+  ASSERT_EQ(0, packet.seq_num);
+  ASSERT_EQ(10, packet.timestamp);
+  // Version 2 and payload type 1 in the rtp header, 8 sbc frames queued.
+  ASSERT_EQ(0x80, buf[0]);
+  ASSERT_EQ(1, buf[1]);
+  ASSERT_EQ(8, buf[12]);
+
+  // Next packet started.
+  ASSERT_EQ(13, a2dp.a2dp_buf_used);
+  ASSERT_EQ(0, a2dp.samples);
+  ASSERT_EQ(0, a2dp.frame_count);
+  ASSERT_EQ(1, a2dp.seq_num);
+  ASSERT_EQ(10, a2dp.nsamples);
+
+  destroy_a2dp(&a2dp);
+}
+
+TEST(A2dpEncode, LinkMtu) {
+  ResetStubData();
+  init_a2dp(&a2dp, &sbc);
+
+  // Clipped to the buffer size until the mtu is set.
+  encode_out_encoded_return_val = 4;
+  a2dp_encode(&a2dp, NULL, 20, 4, (size_t)2048);
+  ASSERT_EQ(A2DP_BUF_SIZE_BYTES, a2dp.a2dp_buf_size);
+
+  ASSERT_EQ(0, a2dp_set_link_mtu(&a2dp, 512));
+  ASSERT_EQ(A2DP_BUF_SIZE_BYTES, a2dp.a2dp_buf_size);
+  ASSERT_EQ(0, a2dp_set_link_mtu(&a2dp, 2048));
+  ASSERT_EQ(2048, a2dp.a2dp_buf_size);
+  // Pending data is kept.
+  ASSERT_EQ(17, a2dp.a2dp_buf_used);
+
+  destroy_a2dp(&a2dp);
+}
+
+TEST(A2dpEncode, SendPackets) {
+  uint8_t bufs[3][32];
+  uint8_t recv_buf[64];
+  struct a2dp_packet packets[3];
+  struct a2dp_packet *to_send[3];
+  int sock[2];
+  int sock_depth = 4096;
+  int sent = 0;
+  int rc;
+
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sock));
+  for (int i = 0; i < 3; i++) {
+    memset(bufs[i], i, sizeof(bufs[i]));
+    packets[i].data = bufs[i];
+    packets[i].len = 10 + i;
+    to_send[i] = &packets[i];
+  }
+
+  ASSERT_EQ(0, a2dp_send_packets(sock[0], to_send, 0));
+  ASSERT_EQ(3, a2dp_send_packets(sock[0], to_send, 3));
+  for (int i = 0; i < 3; i++) {
+    ASSERT_EQ(10 + i, recv(sock[1], recv_buf, sizeof(recv_buf), 0));
+    ASSERT_EQ(i, recv_buf[0]);
+  }
+
+  // Partial send when the socket fills up, then EAGAIN.
+  setsockopt(sock[0], SOL_SOCKET, SO_SNDBUF, &sock_depth, sizeof(sock_depth));
+  do {
+    rc = a2dp_send_packets(sock[0], to_send, 3);
+    if (rc > 0)
+      sent += rc;
+  } while (rc == 3);
+  if (rc >= 0)
+    rc = a2dp_send_packets(sock[0], to_send, 3);
+  ASSERT_EQ(-EAGAIN, rc);
+  ASSERT_GT(sent, 0);
+
+  close(sock[0]);
+  close(sock[1]);
+}
+
 } // namespace
 
 int main(int argc, char **argv) {
@@ -174,6 +345,18 @@ int encode(struct cras_audio_codec *codec, const void *input,
   return input_len;
 }
 
+int cras_sbc_encode_iov(struct cras_audio_codec *codec,
+                        const struct iovec *input, unsigned int num_input,
+                        void *output, size_t output_len, size_t *count)
+{
+  size_t input_len = 0;
+
+  for (unsigned int i = 0; i < num_input; i++)
+    input_len += input[i].iov_len;
+  encode_iov_num_input_val = num_input;
+  return codec->encode(codec, NULL, input_len, output, output_len, count);
+}
+
 struct cras_audio_codec *cras_sbc_codec_create(uint8_t freq,
 		uint8_t mode, uint8_t subbands, uint8_t alloc,
 		uint8_t blocks, uint8_t bitpool)
@@ -2,19 +2,23 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <sys/ioctl.h>
+#include <linux/sockios.h>
 #include <gtest/gtest.h>
 
 extern "C" {
 
-#include "a2dp-codecs.h"
 #include "cras_audio_area.h"
 #include "audio_thread.h"
 #include "audio_thread_log.h"
 #include "cras_bt_transport.h"
 #include "cras_iodev.h"
 
+#include "cras_a2dp_encoder.h"
+#include "cras_a2dp_info.h"
 #include "cras_a2dp_iodev.h"
 }
 
@@ -22,7 +26,6 @@ extern "C" {
 #define FAKE_OBJECT_PATH "/fake/obj/path"
 
 #define MAX_A2DP_ENCODE_CALLS 2
-#define MAX_A2DP_WRITE_CALLS 4
 
 static struct cras_bt_transport *fake_transport;
 static struct cras_bt_device *fake_device;
@@ -46,11 +49,29 @@ static size_t cras_iodev_free_resources_called;
 static int pcm_buf_size_val[MAX_A2DP_ENCODE_CALLS];
 static unsigned int a2dp_encode_processed_bytes_val[MAX_A2DP_ENCODE_CALLS];
 static unsigned int a2dp_encode_index;
-static int a2dp_write_return_val[MAX_A2DP_WRITE_CALLS];
-static unsigned int a2dp_write_index;
+static size_t a2dp_set_link_mtu_val;
+static int a2dp_set_link_mtu_return_val;
+static unsigned int a2dp_take_packet_index;
+static unsigned int a2dp_send_packets_num_val;
 static cras_audio_area *dummy_audio_area;
 static thread_callback write_callback;
 static void *write_callback_data;
+static thread_callback encoder_callback;
+static int audio_thread_enable_callback_val;
+static size_t a2dp_encoder_create_called;
+static int a2dp_encoder_create_fail;
+static size_t cras_iodev_free_audio_area_called;
+static size_t a2dp_encoder_destroy_called;
+static uint8_t a2dp_encoder_pcm_buf[16384 * 4];
+static unsigned int a2dp_encoder_pcm_written;
+static unsigned int a2dp_encoder_pcm_queued_bytes_val;
+static int a2dp_encoder_queued_frames_val;
+static size_t a2dp_encoder_send_called;
+static int a2dp_encoder_send_return_val;
+static size_t force_suspend_called;
+static size_t a2dp_set_bitpool_called;
+static int ioctl_outq_val;
+static unsigned int a2dp_encoder_bitpool_val;
 
 void ResetStubData() {
   cras_bt_device_append_iodev_called = 0;
@@ -72,7 +93,10 @@ void ResetStubData() {
   memset(a2dp_encode_processed_bytes_val, 0,
          sizeof(a2dp_encode_processed_bytes_val));
   a2dp_encode_index = 0;
-  a2dp_write_index = 0;
+  a2dp_set_link_mtu_val = 0;
+  a2dp_set_link_mtu_return_val = 0;
+  a2dp_take_packet_index = 0;
+  a2dp_send_packets_num_val = 0;
 
   fake_transport = reinterpret_cast<struct cras_bt_transport *>(0x123);
   fake_device = NULL;
@@ -83,6 +107,25 @@ void ResetStubData() {
   }
 
   write_callback = NULL;
+  encoder_callback = NULL;
+  audio_thread_enable_callback_val = -1;
+  a2dp_encoder_create_called = 0;
+  a2dp_encoder_create_fail = 0;
+  cras_iodev_free_audio_area_called = 0;
+  a2dp_encoder_destroy_called = 0;
+  a2dp_encoder_pcm_written = 0;
+  a2dp_encoder_pcm_queued_bytes_val = 0;
+  a2dp_encoder_queued_frames_val = 0;
+  a2dp_encoder_send_called = 0;
+  a2dp_encoder_send_return_val = 0;
+  force_suspend_called = 0;
+  a2dp_set_bitpool_called = 0;
+  ioctl_outq_val = 0;
+  a2dp_encoder_bitpool_val = 0;
+}
+
+void force_suspend(struct cras_iodev *iodev) {
+  force_suspend_called++;
 }
 
 int iodev_set_format(struct cras_iodev *iodev,
@@ -161,8 +204,15 @@ TEST(A2dpIoInit, OpenIodev) {
   iodev->open_dev(iodev);
 
   ASSERT_EQ(1, cras_bt_transport_acquire_called);
+  ASSERT_EQ(1024 + 13, a2dp_set_link_mtu_val);
+  ASSERT_EQ(1, a2dp_encoder_create_called);
+  ASSERT_NE(write_callback, (void *)NULL);
+  ASSERT_NE(encoder_callback, (void *)NULL);
+  // Starts with min_buffer_level of silence handed to the encoder.
+  EXPECT_EQ(4096 * 4, a2dp_encoder_pcm_written);
 
   iodev->close_dev(iodev);
+  ASSERT_EQ(1, a2dp_encoder_destroy_called);
   ASSERT_EQ(1, cras_bt_transport_release_called);
   ASSERT_EQ(1, drain_a2dp_called);
   ASSERT_EQ(1, cras_iodev_free_format_called);
@@ -170,9 +220,63 @@ TEST(A2dpIoInit, OpenIodev) {
   a2dp_iodev_destroy(iodev);
 }
 
+TEST(A2dpIoInit, OpenIodevEncoderCreateFails) {
+  struct cras_iodev *iodev;
+
+  ResetStubData();
+  iodev = a2dp_iodev_create(fake_transport, NULL);
+
+  iodev_set_format(iodev, &format);
+  a2dp_encoder_create_fail = 1;
+  EXPECT_EQ(-ENOMEM, iodev->open_dev(iodev));
+
+  // The transport and the area don't outlive the failed open.
+  EXPECT_EQ(1, cras_bt_transport_acquire_called);
+  EXPECT_EQ(1, cras_bt_transport_release_called);
+  EXPECT_EQ(1, cras_iodev_free_audio_area_called);
+  EXPECT_EQ(encoder_callback, (void *)NULL);
+
+  a2dp_iodev_destroy(iodev);
+}
+
+TEST(A2dpIoInit, OpenIodevSetLinkMtuFails) {
+  struct cras_iodev *iodev;
+
+  ResetStubData();
+  iodev = a2dp_iodev_create(fake_transport, NULL);
+
+  iodev_set_format(iodev, &format);
+  a2dp_set_link_mtu_return_val = -EINVAL;
+  EXPECT_EQ(-EINVAL, iodev->open_dev(iodev));
+
+  EXPECT_EQ(1, cras_bt_transport_acquire_called);
+  EXPECT_EQ(1, cras_bt_transport_release_called);
+  EXPECT_EQ(1, cras_iodev_free_audio_area_called);
+  EXPECT_EQ(0, a2dp_encoder_create_called);
+
+  a2dp_iodev_destroy(iodev);
+}
+
+TEST(A2dpIoInit, PreFillSocket) {
+  struct cras_iodev *iodev;
+
+  ResetStubData();
+  iodev = a2dp_iodev_create(fake_transport, NULL);
+
+  /* Silence for two packets is sent in one batch. */
+  a2dp_encode_processed_bytes_val[0] = 4096;
+  a2dp_encode_processed_bytes_val[1] = 4096;
+  iodev_set_format(iodev, &format);
+  iodev->open_dev(iodev);
+  EXPECT_EQ(2, a2dp_encode_index);
+  EXPECT_EQ(2, a2dp_send_packets_num_val);
+
+  a2dp_iodev_destroy(iodev);
+}
+
 TEST(A2dpIoInit, GetPutBuffer) {
   struct cras_iodev *iodev;
-  struct cras_audio_area *area1, *area2, *area3;
+  struct cras_audio_area *area1, *area2;
   uint8_t *area1_buf;
   unsigned frames;
 
@@ -188,47 +292,54 @@ TEST(A2dpIoInit, GetPutBuffer) {
   ASSERT_EQ(256, frames);
   ASSERT_EQ(256, area1->frames);
   area1_buf = area1->channels[0].buf;
+  EXPECT_EQ(a2dp_encoder_pcm_buf + 4096 * 4, area1_buf);
 
-  /* Test 100 frames(400 bytes) put and all processed. */
-  a2dp_encode_processed_bytes_val[0] = 4096 * 4;
-  a2dp_encode_processed_bytes_val[1] = 400;
-  a2dp_write_index = 0;
-  a2dp_write_return_val[0] = -EAGAIN;
-  a2dp_write_return_val[1] = 400;
+  /* Put 100 frames, the encoder hasn't queued any packet yet. */
   iodev->put_buffer(iodev, 100);
-  write_callback(write_callback_data);
-  // Start with 4k frames.
-  EXPECT_EQ(4096, pcm_buf_size_val[0]);
-  EXPECT_EQ(16384 + 400, pcm_buf_size_val[1]);
+  EXPECT_EQ(4096 * 4 + 400, a2dp_encoder_pcm_written);
+  EXPECT_EQ(1, a2dp_encoder_send_called);
+  EXPECT_EQ(0, audio_thread_enable_callback_val);
 
   iodev->get_buffer(iodev, &area2, &frames);
   ASSERT_EQ(256, frames);
-  ASSERT_EQ(256, area2->frames);
+  EXPECT_EQ(400, area2->channels[0].buf - area1_buf);
 
-  /* Assert buf2 points to the same position as buf1 */
-  ASSERT_EQ(400, area2->channels[0].buf - area1_buf);
+  /* More frames than writable are rejected. */
+  frames = 16384;
+  iodev->get_buffer(iodev, &area2, &frames);
+  EXPECT_EQ(16384 - 4096 - 100, frames);
+  EXPECT_EQ(-EINVAL, iodev->put_buffer(iodev, frames + 1));
 
-  /* Test 100 frames(400 bytes) put, only 360 bytes processed,
-   * 40 bytes left in pcm buffer.
-   */
-  a2dp_encode_index = 0;
-  a2dp_encode_processed_bytes_val[0] = 360;
-  a2dp_encode_processed_bytes_val[1] = 0;
-  a2dp_write_index = 0;
-  a2dp_write_return_val[0] = 360;
-  a2dp_write_return_val[1] = 0;
-  iodev->put_buffer(iodev, 100);
-  write_callback(write_callback_data);
-  EXPECT_EQ(16384 + 400, pcm_buf_size_val[0]);
-  ASSERT_EQ(16384 + 40, pcm_buf_size_val[1]);
+  a2dp_iodev_destroy(iodev);
+}
 
-  iodev->get_buffer(iodev, &area3, &frames);
+TEST(A2dpIoInit, SendPackets) {
+  struct cras_iodev *iodev;
 
-  /* Existing buffer not completed processed, assert new buffer starts from
-   * current write pointer.
-   */
-  ASSERT_EQ(256, frames);
-  EXPECT_EQ(800, area3->channels[0].buf - area1_buf);
+  ResetStubData();
+  iodev = a2dp_iodev_create(fake_transport, force_suspend);
+
+  iodev_set_format(iodev, &format);
+  iodev->open_dev(iodev);
+  ASSERT_NE(encoder_callback, (void *)NULL);
+
+  /* Socket full, wait for it to be writable. */
+  a2dp_encoder_send_return_val = -EAGAIN;
+  encoder_callback(write_callback_data);
+  EXPECT_EQ(1, a2dp_encoder_send_called);
+  EXPECT_EQ(1, audio_thread_enable_callback_val);
+
+  /* All queued packets sent. */
+  a2dp_encoder_send_return_val = 400;
+  write_callback(write_callback_data);
+  EXPECT_EQ(2, a2dp_encoder_send_called);
+  EXPECT_EQ(0, audio_thread_enable_callback_val);
+  EXPECT_EQ(0, force_suspend_called);
+
+  /* Send error suspends the device. */
+  a2dp_encoder_send_return_val = -EPIPE;
+  encoder_callback(write_callback_data);
+  EXPECT_EQ(1, force_suspend_called);
 
   a2dp_iodev_destroy(iodev);
 }
@@ -245,51 +356,90 @@ TEST(A2dpIoInif, FramesQueued) {
   time_now.tv_sec = 0;
   time_now.tv_nsec = 0;
   iodev->open_dev(iodev);
-  ASSERT_NE(write_callback, (void *)NULL);
 
   frames = 256;
   iodev->get_buffer(iodev, &area, &frames);
-  ASSERT_EQ(256, frames);
-  ASSERT_EQ(256, area->frames);
-
-  /* Put 100 frames, proccessed 400 bytes to a2dp buffer.
-   * Assume 200 bytes written out, queued 50 frames in a2dp buffer.
-   */
-  a2dp_encode_processed_bytes_val[0] = 400;
-  a2dp_encode_processed_bytes_val[1] = 0;
-  a2dp_write_return_val[0] = 200;
-  a2dp_write_return_val[1] = -EAGAIN;
-  a2dp_queued_frames_val = 50;
+
+  /* Put 100 frames, 50 frames already encoded but not sent. */
+  a2dp_encoder_queued_frames_val = 50;
   time_now.tv_sec = 0;
   time_now.tv_nsec = 1000000;
   iodev->put_buffer(iodev, 100);
-  write_callback(write_callback_data);
-  EXPECT_EQ(4096 + 100, iodev->frames_queued(iodev));
+  EXPECT_EQ(4096 + 100 + 50, iodev->frames_queued(iodev));
+  EXPECT_EQ(4096 + 100 + 50 + 2 * (1024 + 13) / 4,
+            iodev->delay_frames(iodev));
 
-  /* After writing another 200 frames, check for correct buffer level. */
+  /* Encoder consumed all pcm and the packets are sent, 100 frames are
+   * still estimated to be queued at the bluetooth device. */
+  a2dp_encoder_pcm_queued_bytes_val = 0;
+  a2dp_encoder_queued_frames_val = 0;
+  EXPECT_EQ(100, iodev->frames_queued(iodev));
+
+  /* After 1ms at 44100, 44 of them have been played. */
   time_now.tv_sec = 0;
   time_now.tv_nsec = 2000000;
-  a2dp_encode_index = 0;
-  a2dp_write_index = 0;
-  a2dp_encode_processed_bytes_val[0] = 800;
-  write_callback(write_callback_data);
-  EXPECT_EQ(4096 + 100 - 200, iodev->frames_queued(iodev));
+  EXPECT_EQ(100 - 44, iodev->frames_queued(iodev));
 
-  /* Queued frames and new put buffer are all written */
-  a2dp_encode_processed_bytes_val[0] = 400;
-  a2dp_encode_processed_bytes_val[1] = 0;
-  a2dp_queued_frames_val = 50;
-  a2dp_encode_index = 0;
-  a2dp_write_return_val[0] = 400;
-  a2dp_write_return_val[1] = -EAGAIN;
-  a2dp_write_index = 0;
+  a2dp_iodev_destroy(iodev);
+}
+
+TEST(A2dpIoInit, AdaptBitpool) {
+  struct cras_iodev *iodev;
+  struct audio_debug_info info;
+
+  ResetStubData();
+  iodev = a2dp_iodev_create(fake_transport, NULL);
 
-  /* Add wnother 200 samples, get back to the original level. */
+  iodev_set_format(iodev, &format);
   time_now.tv_sec = 0;
-  time_now.tv_nsec = 3000000;
-  iodev->put_buffer(iodev, 200);
-  EXPECT_EQ(16784, pcm_buf_size_val[0]);
-  EXPECT_EQ(4096, iodev->frames_queued(iodev));
+  time_now.tv_nsec = 0;
+  iodev->open_dev(iodev);
+  EXPECT_EQ(1, a2dp_set_bitpool_called);
+  ASSERT_NE(encoder_callback, (void *)NULL);
+  a2dp_encoder_send_return_val = 400;
+
+  /* More than a packet left in the socket, but too soon after the last
+   * change. */
+  ioctl_outq_val = 2000;
+  time_now.tv_nsec = 100000000;
+  encoder_callback(write_callback_data);
+  EXPECT_EQ(0, a2dp_encoder_bitpool_val);
+
+  time_now.tv_nsec = 300000000;
+  encoder_callback(write_callback_data);
+  EXPECT_EQ(53 - 8, a2dp_encoder_bitpool_val);
+
+  /* A full socket is congestion too. */
+  ioctl_outq_val = 0;
+  a2dp_encoder_send_return_val = -EAGAIN;
+  time_now.tv_nsec = 600000000;
+  encoder_callback(write_callback_data);
+  EXPECT_EQ(53 - 16, a2dp_encoder_bitpool_val);
+
+  /* Raised slowly once the link is clear. */
+  a2dp_encoder_send_return_val = 400;
+  time_now.tv_sec = 5;
+  time_now.tv_nsec = 500000000;
+  write_callback(write_callback_data);
+  EXPECT_EQ(53 - 16, a2dp_encoder_bitpool_val);
+  time_now.tv_nsec = 700000000;
+  write_callback(write_callback_data);
+  EXPECT_EQ(53 - 12, a2dp_encoder_bitpool_val);
+
+  /* Not lowered past the floor. */
+  ioctl_outq_val = 2000;
+  for (int i = 0; i < 10; i++) {
+    time_now.tv_sec++;
+    encoder_callback(write_callback_data);
+  }
+  EXPECT_EQ(18, a2dp_encoder_bitpool_val);
+
+  ASSERT_NE((void *)NULL, iodev->fill_debug_info);
+  iodev->fill_debug_info(iodev, &info);
+  EXPECT_EQ(18, info.output_bt_bitpool);
+  EXPECT_EQ(2000, info.output_bt_queued_bytes);
+
+  a2dp_iodev_destroy(iodev);
 }
 
 } // namespace
@@ -304,7 +454,12 @@ extern "C" {
 int cras_bt_transport_configuration(const struct cras_bt_transport *transport,
                                     void *configuration, int len)
 {
+  a2dp_sbc_t *sbc = (a2dp_sbc_t *)configuration;
+
   cras_bt_transport_configuration_called++;
+  memset(configuration, 0, len);
+  sbc->min_bitpool = 2;
+  sbc->max_bitpool = 53;
   return 0;
 }
 
@@ -403,9 +558,18 @@ void cras_bt_device_rm_iodev(struct cras_bt_device *device,
 int init_a2dp(struct a2dp_info *a2dp, a2dp_sbc_t *sbc)
 {
   init_a2dp_called++;
+  a2dp->sbc = *sbc;
+  a2dp->bitpool = sbc->max_bitpool;
   return init_a2dp_return_val;
 }
 
+int a2dp_set_bitpool(struct a2dp_info *a2dp, int bitpool)
+{
+  a2dp_set_bitpool_called++;
+  a2dp->bitpool = bitpool;
+  return 0;
+}
+
 void destroy_a2dp(struct a2dp_info *a2dp)
 {
   destroy_a2dp_called++;
@@ -424,7 +588,7 @@ int a2dp_block_size(struct a2dp_info *a2dp, int encoded_bytes)
   return encoded_bytes;
 }
 
-int a2dp_queued_frames(struct a2dp_info *a2dp)
+int a2dp_queued_frames(const struct a2dp_info *a2dp)
 {
   return a2dp_queued_frames_val;
 }
@@ -446,8 +610,37 @@ int a2dp_encode(struct a2dp_info *a2dp, const void *pcm_buf, int pcm_buf_size,
   return processed;
 }
 
-int a2dp_write(struct a2dp_info *a2dp, int stream_fd, size_t link_mtu) {
-  return a2dp_write_return_val[a2dp_write_index++];;
+int a2dp_set_link_mtu(struct a2dp_info *a2dp, size_t link_mtu) {
+  a2dp_set_link_mtu_val = link_mtu;
+  return a2dp_set_link_mtu_return_val;
+}
+
+int a2dp_take_packet(struct a2dp_info *a2dp, size_t link_mtu,
+                     struct a2dp_packet *packet, size_t buf_size) {
+  if (a2dp_take_packet_index == a2dp_encode_index)
+    return 0;
+  a2dp_take_packet_index++;
+  packet->len = link_mtu;
+  return link_mtu;
+}
+
+int a2dp_send_packets(int stream_fd, struct a2dp_packet *const *packets,
+                      unsigned int num_packets) {
+  a2dp_send_packets_num_val = num_packets;
+  return num_packets;
+}
+
+int ioctl(int fd, unsigned long request, ...) throw() {
+  va_list ap;
+  int *arg;
+
+  if (request != SIOCOUTQ)
+    return -1;
+  va_start(ap, request);
+  arg = va_arg(ap, int *);
+  va_end(ap);
+  *arg = ioctl_outq_val;
+  return 0;
 }
 
 int clock_gettime(clockid_t clk_id, struct timespec *tp) {
@@ -461,6 +654,7 @@ void cras_iodev_init_audio_area(struct cras_iodev *iodev,
 }
 
 void cras_iodev_free_audio_area(struct cras_iodev *iodev) {
+  cras_iodev_free_audio_area_called++;
 }
 
 void cras_audio_area_config_buf_pointers(struct cras_audio_area *area,
@@ -473,6 +667,10 @@ void cras_audio_area_config_buf_pointers(struct cras_audio_area *area,
 // From audio_thread
 struct audio_thread_event_log *atlog;
 
+void audio_thread_add_callback(int fd, thread_callback cb, void *data) {
+  encoder_callback = cb;
+}
+
 void audio_thread_add_write_callback(int fd, thread_callback cb, void *data) {
   write_callback = cb;
   write_callback_data = data;
@@ -482,6 +680,67 @@ void audio_thread_rm_callback(int fd) {
 }
 
 void audio_thread_enable_callback(int fd, int enabled) {
+  audio_thread_enable_callback_val = enabled;
+}
+
+// From cras_a2dp_encoder
+struct a2dp_encoder *a2dp_encoder_create(struct a2dp_info *a2dp,
+                                         size_t pcm_buf_size,
+                                         size_t format_bytes,
+                                         size_t link_mtu) {
+  a2dp_encoder_create_called++;
+  if (a2dp_encoder_create_fail)
+    return NULL;
+  return reinterpret_cast<struct a2dp_encoder *>(0x789);
+}
+
+void a2dp_encoder_destroy(struct a2dp_encoder *enc) {
+  a2dp_encoder_destroy_called++;
+}
+
+int a2dp_encoder_fd(const struct a2dp_encoder *enc) {
+  return 5;
+}
+
+uint8_t *a2dp_encoder_pcm_write_pointer(struct a2dp_encoder *enc,
+                                        unsigned int *writable) {
+  *writable = sizeof(a2dp_encoder_pcm_buf) - a2dp_encoder_pcm_written;
+  return a2dp_encoder_pcm_buf + a2dp_encoder_pcm_written;
+}
+
+int a2dp_encoder_pcm_commit(struct a2dp_encoder *enc, unsigned int bytes) {
+  if (bytes > sizeof(a2dp_encoder_pcm_buf) - a2dp_encoder_pcm_written)
+    return -EINVAL;
+  a2dp_encoder_pcm_written += bytes;
+  a2dp_encoder_pcm_queued_bytes_val += bytes;
+  return 0;
+}
+
+unsigned int a2dp_encoder_pcm_queued_bytes(const struct a2dp_encoder *enc) {
+  return a2dp_encoder_pcm_queued_bytes_val;
+}
+
+int a2dp_encoder_queued_frames(const struct a2dp_encoder *enc) {
+  return a2dp_encoder_queued_frames_val;
+}
+
+void a2dp_encoder_last_sent(const struct a2dp_encoder *enc,
+                            uint16_t *seq_num, uint32_t *timestamp) {
+  *seq_num = 0;
+  *timestamp = 0;
+}
+
+void a2dp_encoder_set_bitpool(struct a2dp_encoder *enc, unsigned int bitpool) {
+  a2dp_encoder_bitpool_val = bitpool;
+}
+
+unsigned int a2dp_encoder_bitpool(const struct a2dp_encoder *enc) {
+  return a2dp_encoder_bitpool_val;
+}
+
+int a2dp_encoder_send(struct a2dp_encoder *enc, int stream_fd) {
+  a2dp_encoder_send_called++;
+  return a2dp_encoder_send_return_val;
 }
 
 }
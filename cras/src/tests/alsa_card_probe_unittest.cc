@@ -0,0 +1,405 @@
+// Copyright (c) 2015 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <dirent.h>
+#include <limits.h>
+#include <gtest/gtest.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+extern "C" {
+#include "cras_alsa_card_probe.h"
+#include "cras_types.h"
+#include "cras_util.h"
+}
+
+namespace {
+
+static size_t snd_ctl_open_called;
+static int snd_ctl_open_return;
+static size_t snd_ctl_close_called;
+static int *snd_ctl_pcm_next_device_set_devs;
+static size_t snd_ctl_pcm_next_device_set_devs_size;
+static size_t snd_ctl_pcm_next_device_set_devs_index;
+static int *snd_ctl_pcm_info_rets;
+static size_t snd_ctl_pcm_info_rets_size;
+static size_t snd_ctl_pcm_info_rets_index;
+static size_t cras_alsa_fill_properties_called;
+static int cras_alsa_fill_properties_return;
+static struct cras_device_blacklist *fake_blacklist;
+static int cras_device_blacklist_check_retval;
+static int select_fd;
+static void (*select_callback)(void *data);
+static void *select_callback_data;
+static size_t probe_cb_called;
+static struct cras_alsa_card_probe *probe_cb_probes[4];
+
+static void ResetStubData() {
+  snd_ctl_open_called = 0;
+  snd_ctl_open_return = 0;
+  snd_ctl_close_called = 0;
+  snd_ctl_pcm_next_device_set_devs_size = 0;
+  snd_ctl_pcm_next_device_set_devs_index = 0;
+  snd_ctl_pcm_info_rets_size = 0;
+  snd_ctl_pcm_info_rets_index = 0;
+  cras_alsa_fill_properties_called = 0;
+  cras_alsa_fill_properties_return = 0;
+  fake_blacklist = reinterpret_cast<struct cras_device_blacklist *>(3);
+  cras_device_blacklist_check_retval = 0;
+  select_fd = -1;
+  select_callback = NULL;
+  select_callback_data = NULL;
+  probe_cb_called = 0;
+  memset(probe_cb_probes, 0, sizeof(probe_cb_probes));
+}
+
+static void ProbeCallback(struct cras_alsa_card_probe *probe, void *arg) {
+  if (probe_cb_called < ARRAY_SIZE(probe_cb_probes))
+    probe_cb_probes[probe_cb_called] = probe;
+  else
+    cras_alsa_card_probe_destroy(probe);
+  probe_cb_called++;
+}
+
+class AlsaCardProbeSuite : public testing::Test {
+  protected:
+    virtual void SetUp() {
+      static int dev_nums[] = {0};
+      static int info_rets[] = {0, 0};
+
+      ResetStubData();
+      snd_ctl_pcm_next_device_set_devs = dev_nums;
+      snd_ctl_pcm_next_device_set_devs_size = ARRAY_SIZE(dev_nums);
+      snd_ctl_pcm_info_rets = info_rets;
+      snd_ctl_pcm_info_rets_size = ARRAY_SIZE(info_rets);
+
+      strcpy(cache_dir_, "/tmp/cras_probe_cacheXXXXXX");
+      ASSERT_NE((char *)NULL, mkdtemp(cache_dir_));
+
+      memset(&info_, 0, sizeof(info_));
+      info_.card_type = ALSA_CARD_TYPE_USB;
+      info_.card_index = 1;
+      info_.usb_vendor_id = 0x46d;
+      info_.usb_product_id = 0xa45;
+      info_.usb_desc_checksum = 0x12345678;
+    }
+
+    virtual void TearDown() {
+      char path[PATH_MAX];
+      struct dirent *ent;
+      DIR *dir;
+
+      dir = opendir(cache_dir_);
+      while (dir && (ent = readdir(dir))) {
+        snprintf(path, sizeof(path), "%s/%s", cache_dir_, ent->d_name);
+        unlink(path);
+      }
+      if (dir)
+        closedir(dir);
+      rmdir(cache_dir_);
+    }
+
+    void RewindAlsa() {
+      snd_ctl_pcm_next_device_set_devs_index = 0;
+      snd_ctl_pcm_info_rets_index = 0;
+    }
+
+    char cache_dir_[32];
+    struct cras_alsa_card_info info_;
+};
+
+TEST_F(AlsaCardProbeSuite, ProbeFromAlsa) {
+  struct cras_alsa_card_probe *probe;
+
+  probe = cras_alsa_card_probe_run(&info_, fake_blacklist, NULL);
+  ASSERT_NE((void *)NULL, probe);
+  EXPECT_EQ(1, snd_ctl_open_called);
+  EXPECT_EQ(1, snd_ctl_close_called);
+  EXPECT_EQ(2, cras_alsa_fill_properties_called);
+  EXPECT_EQ(0, probe->from_cache);
+  EXPECT_STREQ("TestName", probe->card_name);
+  ASSERT_EQ(2, probe->num_pcms);
+  EXPECT_EQ(CRAS_STREAM_OUTPUT, probe->pcms[0].direction);
+  EXPECT_EQ(CRAS_STREAM_INPUT, probe->pcms[1].direction);
+  EXPECT_STREQ("TestPcm", probe->pcms[0].dev_name);
+  EXPECT_EQ(48000, probe->pcms[0].rates[0]);
+  cras_alsa_card_probe_destroy(probe);
+}
+
+TEST_F(AlsaCardProbeSuite, ProbeFailures) {
+  struct cras_alsa_card_probe *probe;
+
+  info_.card_index = 55;
+  EXPECT_EQ((void *)NULL,
+            cras_alsa_card_probe_run(&info_, fake_blacklist, NULL));
+  EXPECT_EQ(0, snd_ctl_open_called);
+
+  info_.card_index = 1;
+  snd_ctl_open_return = -1;
+  EXPECT_EQ((void *)NULL,
+            cras_alsa_card_probe_run(&info_, fake_blacklist, NULL));
+
+  // A device that can't be opened is left out.
+  snd_ctl_open_return = 0;
+  cras_alsa_fill_properties_return = -EBUSY;
+  probe = cras_alsa_card_probe_run(&info_, fake_blacklist, NULL);
+  ASSERT_NE((void *)NULL, probe);
+  EXPECT_EQ(0, probe->num_pcms);
+  cras_alsa_card_probe_destroy(probe);
+}
+
+TEST_F(AlsaCardProbeSuite, CacheRoundTrip) {
+  struct cras_alsa_card_probe *probe;
+
+  probe = cras_alsa_card_probe_run(&info_, fake_blacklist, cache_dir_);
+  ASSERT_NE((void *)NULL, probe);
+  EXPECT_EQ(0, probe->from_cache);
+  cras_alsa_card_probe_destroy(probe);
+
+  // The same device plugged in as another card is read from the cache.
+  ResetStubData();
+  info_.card_index = 2;
+  probe = cras_alsa_card_probe_run(&info_, fake_blacklist, cache_dir_);
+  ASSERT_NE((void *)NULL, probe);
+  EXPECT_EQ(1, probe->from_cache);
+  EXPECT_EQ(0, snd_ctl_open_called);
+  EXPECT_EQ(0, cras_alsa_fill_properties_called);
+  EXPECT_EQ(2, probe->info.card_index);
+  EXPECT_STREQ("TestName", probe->card_name);
+  ASSERT_EQ(2, probe->num_pcms);
+  EXPECT_EQ(0, probe->pcms[0].device_index);
+  EXPECT_EQ(CRAS_STREAM_OUTPUT, probe->pcms[0].direction);
+  EXPECT_EQ(CRAS_STREAM_INPUT, probe->pcms[1].direction);
+  EXPECT_STREQ("TestPcm", probe->pcms[1].dev_name);
+  EXPECT_EQ(48000, probe->pcms[1].rates[0]);
+  EXPECT_EQ(0, probe->pcms[1].rates[1]);
+  EXPECT_EQ(2, probe->pcms[1].channel_counts[0]);
+  EXPECT_EQ(SND_PCM_FORMAT_S16_LE, probe->pcms[1].formats[0]);
+  cras_alsa_card_probe_destroy(probe);
+
+  // A different descriptor checksum is another device.
+  info_.usb_desc_checksum++;
+  RewindAlsa();
+  probe = cras_alsa_card_probe_run(&info_, fake_blacklist, cache_dir_);
+  ASSERT_NE((void *)NULL, probe);
+  EXPECT_EQ(0, probe->from_cache);
+  cras_alsa_card_probe_destroy(probe);
+}
+
+TEST_F(AlsaCardProbeSuite, CacheSkipsInternalAndBlacklisted) {
+  struct cras_alsa_card_probe *probe;
+
+  info_.card_type = ALSA_CARD_TYPE_INTERNAL;
+  probe = cras_alsa_card_probe_run(&info_, fake_blacklist, cache_dir_);
+  cras_alsa_card_probe_destroy(probe);
+  RewindAlsa();
+  probe = cras_alsa_card_probe_run(&info_, fake_blacklist, cache_dir_);
+  ASSERT_NE((void *)NULL, probe);
+  EXPECT_EQ(0, probe->from_cache);
+  cras_alsa_card_probe_destroy(probe);
+
+  // The blacklisted output isn't probed and the result isn't cached.
+  info_.card_type = ALSA_CARD_TYPE_USB;
+  cras_device_blacklist_check_retval = 1;
+  RewindAlsa();
+  cras_alsa_fill_properties_called = 0;
+  probe = cras_alsa_card_probe_run(&info_, fake_blacklist, cache_dir_);
+  ASSERT_NE((void *)NULL, probe);
+  EXPECT_EQ(1, cras_alsa_fill_properties_called);
+  ASSERT_EQ(1, probe->num_pcms);
+  EXPECT_EQ(CRAS_STREAM_INPUT, probe->pcms[0].direction);
+  cras_alsa_card_probe_destroy(probe);
+
+  cras_device_blacklist_check_retval = 0;
+  RewindAlsa();
+  probe = cras_alsa_card_probe_run(&info_, fake_blacklist, cache_dir_);
+  ASSERT_NE((void *)NULL, probe);
+  EXPECT_EQ(0, probe->from_cache);
+  EXPECT_EQ(2, probe->num_pcms);
+  cras_alsa_card_probe_destroy(probe);
+}
+
+TEST_F(AlsaCardProbeSuite, CorruptCacheIgnored) {
+  struct cras_alsa_card_probe *probe;
+  char path[64];
+  FILE *f;
+
+  snprintf(path, sizeof(path), "%s/usb-046d-0a45-12345678", cache_dir_);
+  f = fopen(path, "w");
+  ASSERT_NE((FILE *)NULL, f);
+  fprintf(f, "version 1\ncard TestName\npcm 0 output TestPcm\nrates x\n");
+  fclose(f);
+
+  probe = cras_alsa_card_probe_run(&info_, fake_blacklist, cache_dir_);
+  ASSERT_NE((void *)NULL, probe);
+  EXPECT_EQ(0, probe->from_cache);
+  EXPECT_EQ(1, snd_ctl_open_called);
+  EXPECT_EQ(2, probe->num_pcms);
+  cras_alsa_card_probe_destroy(probe);
+
+  // The bad file was replaced by the probe.
+  RewindAlsa();
+  probe = cras_alsa_card_probe_run(&info_, fake_blacklist, cache_dir_);
+  ASSERT_NE((void *)NULL, probe);
+  EXPECT_EQ(1, probe->from_cache);
+  cras_alsa_card_probe_destroy(probe);
+}
+
+TEST_F(AlsaCardProbeSuite, PoolHandsResultsToMainLoop) {
+  struct cras_alsa_card_info info2 = info_;
+  struct pollfd pollfd;
+  size_t i;
+
+  EXPECT_EQ(-ENODEV, cras_alsa_card_probe_queue(&info_, fake_blacklist,
+                                                ProbeCallback, NULL));
+  ASSERT_EQ(0, cras_alsa_card_probe_pool_start(1, 0, NULL));
+  EXPECT_EQ(1, cras_alsa_card_probe_pool_running());
+  ASSERT_NE(-1, select_fd);
+  ASSERT_NE((void *)NULL, (void *)select_callback);
+
+  info2.card_index = 2;
+  EXPECT_EQ(0, cras_alsa_card_probe_queue(&info_, fake_blacklist,
+                                          ProbeCallback, NULL));
+  EXPECT_EQ(0, cras_alsa_card_probe_queue(&info2, fake_blacklist,
+                                          ProbeCallback, NULL));
+
+  // Callbacks only run from the main loop, when the fd is readable.
+  EXPECT_EQ(0, probe_cb_called);
+  pollfd.fd = select_fd;
+  pollfd.events = POLLIN;
+  for (i = 0; i < 100 && probe_cb_called < 2; i++) {
+    ASSERT_EQ(1, poll(&pollfd, 1, 1000));
+    select_callback(select_callback_data);
+  }
+  ASSERT_EQ(2, probe_cb_called);
+  ASSERT_NE((void *)NULL, probe_cb_probes[0]);
+  ASSERT_NE((void *)NULL, probe_cb_probes[1]);
+  EXPECT_EQ(1, probe_cb_probes[0]->info.card_index);
+  EXPECT_EQ(2, probe_cb_probes[1]->info.card_index);
+  cras_alsa_card_probe_destroy(probe_cb_probes[0]);
+  cras_alsa_card_probe_destroy(probe_cb_probes[1]);
+
+  cras_alsa_card_probe_pool_stop();
+  EXPECT_EQ(0, cras_alsa_card_probe_pool_running());
+  EXPECT_EQ(-1, select_fd);
+}
+
+TEST_F(AlsaCardProbeSuite, PoolStopRunsPendingCallbacks) {
+  // The worker waits before probing, the second card is still queued when
+  // the pool stops.
+  ASSERT_EQ(0, cras_alsa_card_probe_pool_start(1, 50000, NULL));
+  EXPECT_EQ(0, cras_alsa_card_probe_queue(&info_, fake_blacklist,
+                                          ProbeCallback, NULL));
+  EXPECT_EQ(0, cras_alsa_card_probe_queue(&info_, fake_blacklist,
+                                          ProbeCallback, NULL));
+  usleep(10000);
+  cras_alsa_card_probe_pool_stop();
+
+  ASSERT_EQ(2, probe_cb_called);
+  EXPECT_NE((void *)NULL, probe_cb_probes[0]);
+  EXPECT_EQ((void *)NULL, probe_cb_probes[1]);
+  cras_alsa_card_probe_destroy(probe_cb_probes[0]);
+}
+
+/* Stubs */
+
+extern "C" {
+
+int cras_alsa_fill_properties(const char *dev, snd_pcm_stream_t stream,
+                              size_t **rates, size_t **channel_counts,
+                              snd_pcm_format_t **formats) {
+  cras_alsa_fill_properties_called++;
+  if (cras_alsa_fill_properties_return)
+    return cras_alsa_fill_properties_return;
+  *rates = (size_t *)calloc(2, sizeof(**rates));
+  (*rates)[0] = 48000;
+  *channel_counts = (size_t *)calloc(2, sizeof(**channel_counts));
+  (*channel_counts)[0] = 2;
+  *formats = (snd_pcm_format_t *)calloc(2, sizeof(**formats));
+  (*formats)[0] = SND_PCM_FORMAT_S16_LE;
+  return 0;
+}
+
+int cras_device_blacklist_check(struct cras_device_blacklist *blacklist,
+                                unsigned vendor_id,
+                                unsigned product_id,
+                                unsigned desc_checksum,
+                                unsigned device_index) {
+  EXPECT_EQ(fake_blacklist, blacklist);
+  return cras_device_blacklist_check_retval;
+}
+
+int cras_system_add_select_fd(int fd,
+                              void (*callback)(void *data),
+                              void *callback_data) {
+  select_fd = fd;
+  select_callback = callback;
+  select_callback_data = callback_data;
+  return 0;
+}
+
+void cras_system_rm_select_fd(int fd) {
+  EXPECT_EQ(select_fd, fd);
+  select_fd = -1;
+}
+
+size_t snd_pcm_info_sizeof() {
+  return 10;
+}
+size_t snd_ctl_card_info_sizeof() {
+  return 10;
+}
+int snd_ctl_open(snd_ctl_t **handle, const char *name, int card) {
+  snd_ctl_open_called++;
+  if (snd_ctl_open_return == 0)
+    *handle = reinterpret_cast<snd_ctl_t*>(0xff);
+  else
+    *handle = NULL;
+  return snd_ctl_open_return;
+}
+int snd_ctl_close(snd_ctl_t *handle) {
+  snd_ctl_close_called++;
+  return 0;
+}
+int snd_ctl_pcm_next_device(snd_ctl_t *ctl, int *device) {
+  if (snd_ctl_pcm_next_device_set_devs_index >=
+      snd_ctl_pcm_next_device_set_devs_size) {
+    *device = -1;
+    return 0;
+  }
+  *device =
+      snd_ctl_pcm_next_device_set_devs[snd_ctl_pcm_next_device_set_devs_index];
+  snd_ctl_pcm_next_device_set_devs_index++;
+  return 0;
+}
+void snd_pcm_info_set_device(snd_pcm_info_t *obj, unsigned int val) {
+}
+void snd_pcm_info_set_subdevice(snd_pcm_info_t *obj, unsigned int val) {
+}
+void snd_pcm_info_set_stream(snd_pcm_info_t *obj, snd_pcm_stream_t val) {
+}
+int snd_ctl_pcm_info(snd_ctl_t *ctl, snd_pcm_info_t *info) {
+  if (snd_ctl_pcm_info_rets_index >= snd_ctl_pcm_info_rets_size)
+    return -1;
+  return snd_ctl_pcm_info_rets[snd_ctl_pcm_info_rets_index++];
+}
+const char *snd_pcm_info_get_name(const snd_pcm_info_t *obj) {
+  return "TestPcm";
+}
+int snd_ctl_card_info(snd_ctl_t *ctl, snd_ctl_card_info_t *info) {
+  return 0;
+}
+const char *snd_ctl_card_info_get_name(const snd_ctl_card_info_t *obj) {
+  return "TestName";
+}
+
+} /* extern "C" */
+
+}  //  namespace
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
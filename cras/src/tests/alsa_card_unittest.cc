@@ -8,6 +8,7 @@
 
 extern "C" {
 #include "cras_alsa_card.h"
+#include "cras_alsa_card_probe.h"
 #include "cras_alsa_io.h"
 #include "cras_alsa_mixer.h"
 #include "cras_types.h"
@@ -23,6 +24,9 @@ static size_t cras_alsa_iodev_create_called;
 static struct cras_iodev *cras_alsa_iodev_create_return;
 static size_t cras_alsa_iodev_destroy_called;
 static struct cras_iodev *cras_alsa_iodev_destroy_arg;
+static struct cras_alsa_pcm_caps *cras_alsa_iodev_create_caps;
+static size_t cras_alsa_fill_properties_called;
+static int cras_alsa_fill_properties_return;
 static size_t snd_ctl_open_called;
 static size_t snd_ctl_open_return;
 static size_t snd_ctl_close_called;
@@ -55,6 +59,9 @@ static void ResetStubData() {
   cras_alsa_iodev_create_called = 0;
   cras_alsa_iodev_create_return = reinterpret_cast<struct cras_iodev *>(2);
   cras_alsa_iodev_destroy_called = 0;
+  cras_alsa_iodev_create_caps = NULL;
+  cras_alsa_fill_properties_called = 0;
+  cras_alsa_fill_properties_return = 0;
   snd_ctl_open_called = 0;
   snd_ctl_open_return = 0;
   snd_ctl_close_called = 0;
@@ -339,6 +346,62 @@ TEST(AlsaCard, CreateOneInputAndOneOutputTwoDevices) {
   EXPECT_EQ(iniparser_load_called, iniparser_freedict_called);
 }
 
+TEST(AlsaCard, CreateOneOutputFillPropertiesFails) {
+  struct cras_alsa_card *c;
+  int dev_nums[] = {0};
+  int info_rets[] = {0, -1};
+  cras_alsa_card_info card_info;
+
+  ResetStubData();
+  snd_ctl_pcm_next_device_set_devs_size = ARRAY_SIZE(dev_nums);
+  snd_ctl_pcm_next_device_set_devs = dev_nums;
+  snd_ctl_pcm_info_rets_size = ARRAY_SIZE(info_rets);
+  snd_ctl_pcm_info_rets = info_rets;
+  cras_alsa_fill_properties_return = -EBUSY;
+  card_info.card_type = ALSA_CARD_TYPE_INTERNAL;
+  card_info.card_index = 0;
+  c = cras_alsa_card_create(&card_info, fake_blacklist);
+  EXPECT_NE(static_cast<struct cras_alsa_card *>(NULL), c);
+  EXPECT_EQ(1, cras_alsa_fill_properties_called);
+  EXPECT_EQ(0, cras_alsa_iodev_create_called);
+
+  cras_alsa_card_destroy(c);
+  EXPECT_EQ(cras_alsa_mixer_create_called, cras_alsa_mixer_destroy_called);
+}
+
+TEST(AlsaCard, CreateFromProbe) {
+  struct cras_alsa_card *c;
+  struct cras_alsa_card_probe *probe;
+
+  ResetStubData();
+  probe = static_cast<struct cras_alsa_card_probe *>(
+      calloc(1, sizeof(*probe)));
+  probe->info.card_type = ALSA_CARD_TYPE_USB;
+  probe->info.card_index = 2;
+  strcpy(probe->card_name, "TestName");
+  probe->num_pcms = 2;
+  probe->pcms = static_cast<struct cras_alsa_pcm_caps *>(
+      calloc(2, sizeof(*probe->pcms)));
+  probe->pcms[0].direction = CRAS_STREAM_OUTPUT;
+  probe->pcms[1].device_index = 1;
+  probe->pcms[1].direction = CRAS_STREAM_INPUT;
+
+  // Devices are created from the probe without going back to ALSA.
+  c = cras_alsa_card_create_from_probe(probe);
+  EXPECT_NE(static_cast<struct cras_alsa_card *>(NULL), c);
+  EXPECT_EQ(0, snd_ctl_open_called);
+  EXPECT_EQ(0, cras_alsa_fill_properties_called);
+  EXPECT_EQ(1, cras_alsa_mixer_create_called);
+  EXPECT_EQ(2, cras_alsa_iodev_create_called);
+  EXPECT_EQ(&probe->pcms[1], cras_alsa_iodev_create_caps);
+  EXPECT_EQ(2, cras_alsa_card_get_index(c));
+
+  cras_alsa_card_destroy(c);
+  cras_alsa_card_probe_destroy(probe);
+  EXPECT_EQ(2, cras_alsa_iodev_destroy_called);
+  EXPECT_EQ(cras_alsa_mixer_create_called, cras_alsa_mixer_destroy_called);
+}
+
 /* Stubs */
 
 extern "C" {
@@ -361,8 +424,10 @@ struct cras_iodev *alsa_iodev_create(size_t card_index,
 				     int is_first,
 				     struct cras_alsa_mixer *mixer,
 				     snd_use_case_mgr_t *ucm,
+				     struct cras_alsa_pcm_caps *caps,
 				     enum CRAS_STREAM_DIRECTION direction) {
   cras_alsa_iodev_create_called++;
+  cras_alsa_iodev_create_caps = caps;
   return cras_alsa_iodev_create_return;
 }
 void alsa_iodev_destroy(struct cras_iodev *iodev) {
@@ -370,6 +435,29 @@ void alsa_iodev_destroy(struct cras_iodev *iodev) {
   cras_alsa_iodev_destroy_arg = iodev;
 }
 
+int cras_alsa_fill_properties(const char *dev, snd_pcm_stream_t stream,
+                              size_t **rates, size_t **channel_counts,
+                              snd_pcm_format_t **formats) {
+  cras_alsa_fill_properties_called++;
+  if (cras_alsa_fill_properties_return)
+    return cras_alsa_fill_properties_return;
+  *rates = (size_t *)calloc(2, sizeof(**rates));
+  (*rates)[0] = 48000;
+  *channel_counts = (size_t *)calloc(2, sizeof(**channel_counts));
+  (*channel_counts)[0] = 2;
+  *formats = (snd_pcm_format_t *)calloc(2, sizeof(**formats));
+  (*formats)[0] = SND_PCM_FORMAT_S16_LE;
+  return 0;
+}
+
+int cras_system_add_select_fd(int fd,
+                              void (*callback)(void *data),
+                              void *callback_data) {
+  return 0;
+}
+void cras_system_rm_select_fd(int fd) {
+}
+
 size_t snd_pcm_info_sizeof() {
   return 10;
 }
@@ -425,6 +513,9 @@ int snd_ctl_card_info(snd_ctl_t *ctl, snd_ctl_card_info_t *info) {
   snd_ctl_card_info_called++;
   return snd_ctl_card_info_ret;
 }
+const char *snd_pcm_info_get_name(const snd_pcm_info_t *obj) {
+  return "TestPcm";
+}
 const char *snd_ctl_card_info_get_name(const snd_ctl_card_info_t *obj) {
   return "TestName";
 }
@@ -23,6 +23,7 @@ static int cras_iodev_append_stream_ret;
 static int cras_alsa_get_avail_frames_ret;
 static int cras_alsa_get_avail_frames_avail;
 static int cras_alsa_start_called;
+static int cras_alsa_stop_called;
 static uint8_t *cras_alsa_mmap_begin_buffer;
 static size_t cras_alsa_mmap_begin_frames;
 static size_t cras_alsa_fill_properties_called;
@@ -96,6 +97,7 @@ void ResetStubData() {
   cras_alsa_get_avail_frames_ret = 0;
   cras_alsa_get_avail_frames_avail = 0;
   cras_alsa_start_called = 0;
+  cras_alsa_stop_called = 0;
   cras_alsa_fill_properties_called = 0;
   sys_get_volume_called = 0;
   sys_get_capture_gain_called = 0;
@@ -147,7 +149,7 @@ TEST(AlsaIoInit, InitializeInvalidDirection) {
 
   aio = (struct alsa_io *)alsa_iodev_create(0, test_card_name, 0, test_dev_name,
                                             ALSA_CARD_TYPE_INTERNAL, 0,
-                                            fake_mixer, NULL,
+                                            fake_mixer, NULL, NULL,
                                             CRAS_NUM_DIRECTIONS);
   ASSERT_EQ(aio, (void *)NULL);
 }
@@ -159,7 +161,7 @@ TEST(AlsaIoInit, InitializePlayback) {
   ResetStubData();
   aio = (struct alsa_io *)alsa_iodev_create(0, test_card_name, 0, test_dev_name,
                                             ALSA_CARD_TYPE_INTERNAL, 0,
-                                            fake_mixer, NULL,
+                                            fake_mixer, NULL, NULL,
                                             CRAS_STREAM_OUTPUT);
   ASSERT_NE(aio, (void *)NULL);
   EXPECT_EQ(SND_PCM_STREAM_PLAYBACK, aio->alsa_stream);
@@ -176,6 +178,37 @@ TEST(AlsaIoInit, InitializePlayback) {
   EXPECT_EQ(1, cras_iodev_free_resources_called);
 }
 
+TEST(AlsaIoInit, InitializeWithProbedCaps) {
+  struct alsa_io *aio;
+  struct cras_alsa_mixer * const fake_mixer = (struct cras_alsa_mixer*)2;
+  struct cras_alsa_pcm_caps caps;
+  size_t *rates;
+
+  ResetStubData();
+  memset(&caps, 0, sizeof(caps));
+  rates = (size_t *)calloc(2, sizeof(*rates));
+  rates[0] = 48000;
+  caps.rates = rates;
+  caps.channel_counts = (size_t *)calloc(2, sizeof(size_t));
+  caps.channel_counts[0] = 2;
+  caps.formats = (snd_pcm_format_t *)calloc(2, sizeof(snd_pcm_format_t));
+  caps.formats[0] = SND_PCM_FORMAT_S16_LE;
+
+  aio = (struct alsa_io *)alsa_iodev_create(0, test_card_name, 0, test_dev_name,
+                                            ALSA_CARD_TYPE_INTERNAL, 0,
+                                            fake_mixer, NULL, &caps,
+                                            CRAS_STREAM_OUTPUT);
+  ASSERT_NE(aio, (void *)NULL);
+  // The probed lists are used as is, without opening the device again.
+  EXPECT_EQ(0, cras_alsa_fill_properties_called);
+  EXPECT_EQ(rates, aio->base.supported_rates);
+  EXPECT_EQ(NULL, caps.rates);
+  EXPECT_EQ(NULL, caps.channel_counts);
+  EXPECT_EQ(NULL, caps.formats);
+
+  alsa_iodev_destroy((struct cras_iodev *)aio);
+}
+
 TEST(AlsaIoInit, DefaultNodeInternalCard) {
   struct alsa_io *aio;
   struct cras_alsa_mixer * const fake_mixer = (struct cras_alsa_mixer*)2;
@@ -183,7 +216,7 @@ TEST(AlsaIoInit, DefaultNodeInternalCard) {
   ResetStubData();
   aio = (struct alsa_io *)alsa_iodev_create(0, test_card_name, 0, test_dev_name,
                                             ALSA_CARD_TYPE_INTERNAL, 0,
-                                            fake_mixer, NULL,
+                                            fake_mixer, NULL, NULL,
                                             CRAS_STREAM_OUTPUT);
 
   ASSERT_STREQ("(default)", aio->base.active_node->name);
@@ -192,7 +225,7 @@ TEST(AlsaIoInit, DefaultNodeInternalCard) {
 
   aio = (struct alsa_io *)alsa_iodev_create(0, test_card_name, 0, test_dev_name,
                                             ALSA_CARD_TYPE_INTERNAL, 1,
-                                            fake_mixer, NULL,
+                                            fake_mixer, NULL, NULL,
                                             CRAS_STREAM_OUTPUT);
 
   ASSERT_STREQ("Speaker", aio->base.active_node->name);
@@ -201,7 +234,7 @@ TEST(AlsaIoInit, DefaultNodeInternalCard) {
 
   aio = (struct alsa_io *)alsa_iodev_create(0, test_card_name, 0, test_dev_name,
                                             ALSA_CARD_TYPE_INTERNAL, 0,
-                                            fake_mixer, NULL,
+                                            fake_mixer, NULL, NULL,
                                             CRAS_STREAM_INPUT);
 
   ASSERT_STREQ("(default)", aio->base.active_node->name);
@@ -211,7 +244,7 @@ TEST(AlsaIoInit, DefaultNodeInternalCard) {
 
   aio = (struct alsa_io *)alsa_iodev_create(0, test_card_name, 0, test_dev_name,
                                             ALSA_CARD_TYPE_INTERNAL, 1,
-                                            fake_mixer, NULL,
+                                            fake_mixer, NULL, NULL,
                                             CRAS_STREAM_INPUT);
 
   ASSERT_STREQ("Internal Mic", aio->base.active_node->name);
@@ -223,7 +256,7 @@ TEST(AlsaIoInit, DefaultNodeInternalCard) {
   cras_alsa_jack_exists_match = "Speaker Phantom Jack";
   aio = (struct alsa_io *)alsa_iodev_create(0, test_card_name, 0, test_dev_name,
                                             ALSA_CARD_TYPE_INTERNAL, 1,
-                                            fake_mixer, NULL,
+                                            fake_mixer, NULL, NULL,
                                             CRAS_STREAM_INPUT);
 
   ASSERT_STREQ("(default)", aio->base.active_node->name);
@@ -240,7 +273,7 @@ TEST(AlsaIoInit, DefaultNodeUSBCard) {
   ResetStubData();
   aio = (struct alsa_io *)alsa_iodev_create(0, test_card_name, 0, test_dev_name,
                                             ALSA_CARD_TYPE_USB, 1,
-                                            fake_mixer, NULL,
+                                            fake_mixer, NULL, NULL,
                                             CRAS_STREAM_OUTPUT);
 
   ASSERT_STREQ("(default)", aio->base.active_node->name);
@@ -252,7 +285,7 @@ TEST(AlsaIoInit, DefaultNodeUSBCard) {
 
   aio = (struct alsa_io *)alsa_iodev_create(0, test_card_name, 0, test_dev_name,
                                             ALSA_CARD_TYPE_USB, 1,
-                                            fake_mixer, NULL,
+                                            fake_mixer, NULL, NULL,
                                             CRAS_STREAM_INPUT);
 
   ASSERT_STREQ("(default)", aio->base.active_node->name);
@@ -270,7 +303,7 @@ TEST(AlsaIoInit, OpenPlayback) {
   ResetStubData();
   iodev = alsa_iodev_create(0, test_card_name, 0, test_dev_name,
                             ALSA_CARD_TYPE_INTERNAL, 0,
-                            fake_mixer, NULL,
+                            fake_mixer, NULL, NULL,
                             CRAS_STREAM_OUTPUT);
 
   cras_iodev_set_format(iodev, format);
@@ -292,13 +325,46 @@ TEST(AlsaIoInit, OpenPlayback) {
   free(fake_format);
 }
 
+TEST(AlsaIoInit, StandbyPlayback) {
+  struct cras_iodev *iodev;
+  struct cras_audio_format *format = NULL;
+
+  ResetStubData();
+  iodev = alsa_iodev_create(0, test_card_name, 0, test_dev_name,
+                            ALSA_CARD_TYPE_INTERNAL, 0,
+                            fake_mixer, NULL, NULL,
+                            CRAS_STREAM_OUTPUT);
+  ASSERT_NE(reinterpret_cast<void *>(NULL),
+            reinterpret_cast<void *>(iodev->standby_dev));
+
+  // Can't standby a closed device.
+  EXPECT_EQ(-EINVAL, iodev->standby_dev(iodev));
+  EXPECT_EQ(0, cras_alsa_stop_called);
+
+  cras_iodev_set_format(iodev, format);
+  fake_curve =
+      static_cast<struct cras_volume_curve *>(calloc(1, sizeof(*fake_curve)));
+  fake_curve->get_dBFS = fake_get_dBFS;
+  iodev->open_dev(iodev);
+  EXPECT_EQ(0, iodev->standby_dev(iodev));
+  EXPECT_EQ(1, cras_alsa_stop_called);
+  EXPECT_EQ(1, iodev->is_open(iodev));
+  EXPECT_EQ(1, cras_alsa_open_called);
+
+  iodev->close_dev(iodev);
+  alsa_iodev_destroy(iodev);
+  free(fake_curve);
+  fake_curve = NULL;
+  free(fake_format);
+}
+
 TEST(AlsaIoInit, UsbCardAutoPlug) {
   struct cras_iodev *iodev;
 
   ResetStubData();
   iodev = alsa_iodev_create(0, test_card_name, 0, test_dev_name,
                             ALSA_CARD_TYPE_INTERNAL, 1,
-                            fake_mixer, NULL,
+                            fake_mixer, NULL, NULL,
                             CRAS_STREAM_OUTPUT);
   EXPECT_EQ(0, cras_iodev_set_node_attr_called);
   alsa_iodev_destroy(iodev);
@@ -306,7 +372,7 @@ TEST(AlsaIoInit, UsbCardAutoPlug) {
   ResetStubData();
   iodev = alsa_iodev_create(0, test_card_name, 0, test_dev_name,
                             ALSA_CARD_TYPE_USB, 0,
-                            fake_mixer, NULL,
+                            fake_mixer, NULL, NULL,
                             CRAS_STREAM_OUTPUT);
   EXPECT_EQ(0, cras_iodev_set_node_attr_called);
   alsa_iodev_destroy(iodev);
@@ -314,7 +380,7 @@ TEST(AlsaIoInit, UsbCardAutoPlug) {
   ResetStubData();
   iodev = alsa_iodev_create(0, test_card_name, 0, test_dev_name,
                             ALSA_CARD_TYPE_USB, 1,
-                            fake_mixer, NULL,
+                            fake_mixer, NULL, NULL,
                             CRAS_STREAM_OUTPUT);
   // Should assume USB devs are plugged when they appear.
   EXPECT_EQ(1, cras_iodev_set_node_attr_called);
@@ -330,7 +396,7 @@ TEST(AlsaIoInit, RouteBasedOnJackCallback) {
   ResetStubData();
   aio = (struct alsa_io *)alsa_iodev_create(0, test_card_name, 0, test_dev_name,
                                             ALSA_CARD_TYPE_INTERNAL, 0,
-                                            fake_mixer, NULL,
+                                            fake_mixer, NULL, NULL,
                                             CRAS_STREAM_OUTPUT);
   ASSERT_NE(aio, (void *)NULL);
   EXPECT_EQ(SND_PCM_STREAM_PLAYBACK, aio->alsa_stream);
@@ -366,7 +432,7 @@ TEST(AlsaIoInit, RouteBasedOnInputJackCallback) {
   ResetStubData();
   aio = (struct alsa_io *)alsa_iodev_create(0, test_card_name, 0, test_dev_name,
                                             ALSA_CARD_TYPE_INTERNAL, 0,
-                                            fake_mixer, NULL,
+                                            fake_mixer, NULL, NULL,
                                             CRAS_STREAM_INPUT);
   ASSERT_NE(aio, (void *)NULL);
   EXPECT_EQ(SND_PCM_STREAM_CAPTURE, aio->alsa_stream);
@@ -399,7 +465,7 @@ TEST(AlsaIoInit, InitializeCapture) {
   ResetStubData();
   aio = (struct alsa_io *)alsa_iodev_create(0, test_card_name, 0, test_dev_name,
                                             ALSA_CARD_TYPE_INTERNAL, 0,
-                                            fake_mixer, NULL,
+                                            fake_mixer, NULL, NULL,
                                             CRAS_STREAM_INPUT);
   ASSERT_NE(aio, (void *)NULL);
   EXPECT_EQ(SND_PCM_STREAM_CAPTURE, aio->alsa_stream);
@@ -414,7 +480,7 @@ TEST(AlsaIoInit, OpenCapture) {
 
   iodev = alsa_iodev_create(0, test_card_name, 0, test_dev_name,
                             ALSA_CARD_TYPE_INTERNAL, 0,
-                            fake_mixer, NULL,
+                            fake_mixer, NULL, NULL,
                             CRAS_STREAM_INPUT);
 
   cras_iodev_set_format(iodev, format);
@@ -442,7 +508,7 @@ TEST(AlsaIoInit, UpdateActiveNode) {
   ResetStubData();
   iodev = alsa_iodev_create(0, test_card_name, 0, test_dev_name,
                             ALSA_CARD_TYPE_INTERNAL, 0,
-                            fake_mixer, NULL,
+                            fake_mixer, NULL, NULL,
                             CRAS_STREAM_OUTPUT);
 
   EXPECT_EQ(1, cras_iodev_list_node_selected_called);
@@ -461,7 +527,7 @@ TEST(AlsaIoInit, DspNameDefault) {
   ucm_get_dsp_name_default_value = "hello";
   aio = (struct alsa_io *)alsa_iodev_create(0, test_card_name, 0, test_dev_name,
                                             ALSA_CARD_TYPE_INTERNAL, 0,
-                                            fake_mixer, fake_ucm,
+                                            fake_mixer, fake_ucm, NULL,
                                             CRAS_STREAM_OUTPUT);
   ASSERT_NE(aio, (void *)NULL);
   EXPECT_EQ(SND_PCM_STREAM_PLAYBACK, aio->alsa_stream);
@@ -483,7 +549,7 @@ TEST(AlsaIoInit, DspNameJackOverride) {
   cras_alsa_jack_get_dsp_name_value = "override_dsp";
   aio = (struct alsa_io *)alsa_iodev_create(0, test_card_name, 0, test_dev_name,
                                             ALSA_CARD_TYPE_INTERNAL, 0,
-                                            fake_mixer, fake_ucm,
+                                            fake_mixer, fake_ucm, NULL,
                                             CRAS_STREAM_OUTPUT);
   ASSERT_NE(aio, (void *)NULL);
   EXPECT_EQ(SND_PCM_STREAM_PLAYBACK, aio->alsa_stream);
@@ -521,7 +587,7 @@ TEST(AlsaIoInit, NodeTypeOverride) {
   ResetStubData();
   aio = (struct alsa_io *)alsa_iodev_create(0, test_card_name, 0, test_dev_name,
                                             ALSA_CARD_TYPE_INTERNAL, 0,
-                                            fake_mixer, fake_ucm,
+                                            fake_mixer, fake_ucm, NULL,
                                             CRAS_STREAM_OUTPUT);
   ASSERT_NE(aio, (void *)NULL);
   // Add the jack node.
@@ -544,7 +610,7 @@ TEST(AlsaIoInit, SwapMode) {
 
   aio = (struct alsa_io *)alsa_iodev_create(0, test_card_name, 0, test_dev_name,
                                             ALSA_CARD_TYPE_INTERNAL, 0,
-                                            fake_mixer, fake_ucm,
+                                            fake_mixer, fake_ucm, NULL,
                                             CRAS_STREAM_OUTPUT);
   ASSERT_NE(aio, (void *)NULL);
   EXPECT_EQ(NULL, aio->base.set_swap_mode_for_node);
@@ -554,7 +620,7 @@ TEST(AlsaIoInit, SwapMode) {
 
   aio = (struct alsa_io *)alsa_iodev_create(0, test_card_name, 0, test_dev_name,
                                             ALSA_CARD_TYPE_INTERNAL, 0,
-                                            fake_mixer, fake_ucm,
+                                            fake_mixer, fake_ucm, NULL,
                                             CRAS_STREAM_OUTPUT);
   ASSERT_NE(aio, (void *)NULL);
   // Enable swap mode.
@@ -588,7 +654,7 @@ TEST(AlsaOutputNode, SystemSettingsWhenInactive) {
   cras_alsa_mixer_list_outputs_outputs_length = ARRAY_SIZE(outputs);
   aio = (struct alsa_io *)alsa_iodev_create(0, test_card_name, 0, test_dev_name,
                                             ALSA_CARD_TYPE_INTERNAL, 0,
-                                            fake_mixer, NULL,
+                                            fake_mixer, NULL, NULL,
                                             CRAS_STREAM_OUTPUT);
   ASSERT_NE(aio, (void *)NULL);
   EXPECT_EQ(SND_PCM_STREAM_PLAYBACK, aio->alsa_stream);
@@ -637,7 +703,7 @@ TEST(AlsaOutputNode, TwoOutputs) {
   cras_alsa_mixer_list_outputs_outputs_length = ARRAY_SIZE(outputs);
   aio = (struct alsa_io *)alsa_iodev_create(0, test_card_name, 0, test_dev_name,
                                             ALSA_CARD_TYPE_INTERNAL, 0,
-                                            fake_mixer, NULL,
+                                            fake_mixer, NULL, NULL,
                                             CRAS_STREAM_OUTPUT);
   ASSERT_NE(aio, (void *)NULL);
   EXPECT_EQ(SND_PCM_STREAM_PLAYBACK, aio->alsa_stream);
@@ -786,13 +852,13 @@ class AlsaVolumeMuteSuite : public testing::Test {
       aio_output_ = (struct alsa_io *)alsa_iodev_create(
           0, test_card_name, 0, test_dev_name,
           ALSA_CARD_TYPE_INTERNAL, 0,
-          fake_mixer, NULL,
+          fake_mixer, NULL, NULL,
           CRAS_STREAM_OUTPUT);
       aio_output_->base.direction = CRAS_STREAM_OUTPUT;
       aio_input_ = (struct alsa_io *)alsa_iodev_create(
           0, test_card_name, 0, test_dev_name,
           ALSA_CARD_TYPE_INTERNAL, 0,
-          fake_mixer, NULL,
+          fake_mixer, NULL, NULL,
           CRAS_STREAM_INPUT);
       aio_input_->base.direction = CRAS_STREAM_INPUT;
       fmt_.frame_rate = 44100;
@@ -943,6 +1009,11 @@ int cras_alsa_pcm_drain(snd_pcm_t *handle)
 {
   return 0;
 }
+int cras_alsa_pcm_stop(snd_pcm_t *handle)
+{
+  cras_alsa_stop_called++;
+  return 0;
+}
 int cras_alsa_fill_properties(const char *dev,
 			      snd_pcm_stream_t stream,
 			      size_t **rates,
@@ -1234,6 +1305,11 @@ void cras_iodev_free_format(struct cras_iodev *iodev)
 {
 }
 
+int cras_iodev_reset_rate_estimator(const struct cras_iodev *iodev)
+{
+  return 0;
+}
+
 int cras_iodev_set_format(struct cras_iodev *iodev,
 			  struct cras_audio_format *fmt)
 {
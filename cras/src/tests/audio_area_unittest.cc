@@ -24,6 +24,8 @@ static uint16_t buf1[32];
 static uint16_t buf2[32];
 struct cras_audio_area *a1;
 struct cras_audio_area *a2;
+static unsigned int mix_add_called;
+static unsigned int mix_add_stride_called;
 
 namespace {
 
@@ -268,16 +270,120 @@ TEST(AudioArea, KeyboardMicCopyFrontCenter) {
   cras_audio_area_destroy(a2);
 }
 
+TEST(AudioArea, CopyAudioAreaAdd) {
+  struct cras_audio_format fmt;
+  int16_t *dst = (int16_t *)buf1;
+  int16_t *src = (int16_t *)buf2;
+  int i;
+
+  fmt.num_channels = 2;
+  fmt.format = SND_PCM_FORMAT_S16_LE;
+  for (i = 0; i < CRAS_CH_MAX; i++)
+    fmt.channel_layout[i] = stereo[i];
+
+  a1 = cras_audio_area_create(2);
+  a2 = cras_audio_area_create(2);
+  cras_audio_area_config_channels(a1, &fmt);
+  cras_audio_area_config_channels(a2, &fmt);
+  cras_audio_area_config_buf_pointers(a1, &fmt, (uint8_t *)buf1);
+  cras_audio_area_config_buf_pointers(a2, &fmt, (uint8_t *)buf2);
+  a1->frames = 16;
+  a2->frames = 16;
+
+  // Same layouts, the samples are added in one pass and clipped.
+  for (i = 0; i < 32; i++) {
+    dst[i] = i * 100;
+    src[i] = i;
+  }
+  src[0] = INT16_MAX;
+  dst[0] = 1;
+  mix_add_called = 0;
+  mix_add_stride_called = 0;
+  cras_audio_area_copy(a1, 0, &fmt, a2, 0, 1);
+  EXPECT_EQ(1, mix_add_called);
+  EXPECT_EQ(0, mix_add_stride_called);
+  EXPECT_EQ(INT16_MAX, dst[0]);
+  for (i = 1; i < 32; i++)
+    EXPECT_EQ(i * 101, dst[i]);
+
+  cras_audio_area_destroy(a1);
+  cras_audio_area_destroy(a2);
+}
+
+TEST(AudioArea, CopyNotInterleaved) {
+  struct cras_audio_format fmt;
+  int i;
+
+  fmt.num_channels = 2;
+  fmt.format = SND_PCM_FORMAT_S16_LE;
+  for (i = 0; i < CRAS_CH_MAX; i++)
+    fmt.channel_layout[i] = stereo[i];
+
+  a1 = cras_audio_area_create(2);
+  a2 = cras_audio_area_create(2);
+  cras_audio_area_config_channels(a1, &fmt);
+  cras_audio_area_config_channels(a2, &fmt);
+  cras_audio_area_config_buf_pointers(a1, &fmt, (uint8_t *)buf1);
+  a1->frames = 16;
+
+  // Source channels stored one after the other, not interleaved.
+  a2->channels[0].buf = (uint8_t *)buf2;
+  a2->channels[0].step_bytes = 2;
+  a2->channels[1].buf = (uint8_t *)(buf2 + 16);
+  a2->channels[1].step_bytes = 2;
+  a2->frames = 16;
+
+  memset(buf1, 0, 32 * 2);
+  for (i = 0; i < 32; i++)
+    buf2[i] = rand();
+  mix_add_called = 0;
+  mix_add_stride_called = 0;
+  cras_audio_area_copy(a1, 0, &fmt, a2, 0, 0);
+  EXPECT_EQ(0, mix_add_called);
+  EXPECT_EQ(2, mix_add_stride_called);
+  for (i = 0; i < 16; i++) {
+    EXPECT_EQ(buf1[i * 2], buf2[i]);
+    EXPECT_EQ(buf1[i * 2 + 1], buf2[i + 16]);
+  }
+
+  cras_audio_area_destroy(a1);
+  cras_audio_area_destroy(a2);
+}
+
 }  //  namespace
 
 extern "C" {
 
+void cras_mix_add(snd_pcm_format_t fmt, uint8_t *dst, uint8_t *src,
+		  unsigned int count, unsigned int index,
+		  int mute, float mix_vol)
+{
+	int16_t *out = (int16_t *)dst;
+	int16_t *in = (int16_t *)src;
+	unsigned int i;
+
+	mix_add_called++;
+	if (index == 0) {
+		memcpy(dst, src, count * 2);
+		return;
+	}
+	for (i = 0; i < count; i++) {
+		int32_t sum = out[i] + in[i];
+		if (sum > INT16_MAX)
+			sum = INT16_MAX;
+		else if (sum < INT16_MIN)
+			sum = INT16_MIN;
+		out[i] = sum;
+	}
+}
+
 void cras_mix_add_stride(snd_pcm_format_t fmt, uint8_t *dst, uint8_t *src,
 			 unsigned int count, unsigned int dst_stride,
 			 unsigned int src_stride)
 {
 	unsigned int i;
 
+	mix_add_stride_called++;
 	for (i = 0; i < count; i++) {
 		int32_t sum;
 		sum = *(int16_t *)dst + *(int16_t *)src;
@@ -8,20 +8,35 @@ extern "C" {
 
 #include <gtest/gtest.h>
 
+static unsigned int loopback_iodev_set_tap_called;
+static struct cras_iodev *loopback_iodev_set_tap_loopdev;
+static struct cras_iodev *loopback_iodev_set_tap_odev;
+static unsigned int cras_iodev_close_called;
+static unsigned int cras_iodev_open_called;
+static unsigned int cras_iodev_set_format_called;
+static unsigned int cras_iodev_standby_called;
+static int cras_iodev_standby_return;
+
 // Test streams and devices manipulation.
 class StreamDeviceSuite : public testing::Test {
   protected:
     virtual void SetUp() {
       device_id_ = 0;
+      cras_iodev_close_called = 0;
+      cras_iodev_open_called = 0;
+      cras_iodev_set_format_called = 0;
+      cras_iodev_standby_called = 0;
+      cras_iodev_standby_return = 0;
       SetupDevice(&fallback_output_, CRAS_STREAM_OUTPUT);
       SetupDevice(&fallback_input_, CRAS_STREAM_INPUT);
-      SetupDevice(&loopback_output_, CRAS_STREAM_OUTPUT);
       SetupDevice(&loopback_input_, CRAS_STREAM_INPUT);
       thread_ = audio_thread_create(&fallback_output_, &fallback_input_,
-                                    &loopback_output_, &loopback_input_);
+                                    &loopback_input_);
     }
 
     virtual void TearDown() {
+      is_open_ = 0;
+      frames_queued_ = 0;
     }
 
     virtual void SetupDevice(cras_iodev *iodev,
@@ -38,6 +53,8 @@ class StreamDeviceSuite : public testing::Test {
       iodev->get_buffer = get_buffer;
       iodev->put_buffer = put_buffer;
       iodev->ext_format = &format_;
+      if (direction == CRAS_STREAM_OUTPUT)
+        iodev->standby_dev = standby_dev;
     }
 
     void SetupRstream(struct cras_rstream *rstream,
@@ -69,10 +86,18 @@ class StreamDeviceSuite : public testing::Test {
       return 1;
     }
 
+    static int standby_dev(cras_iodev* iodev) {
+      return 0;
+    }
+
     static int is_open(const cras_iodev* iodev) {
       return is_open_;
     }
 
+    static int is_closed(const cras_iodev* iodev) {
+      return 0;
+    }
+
     static int frames_queued(const cras_iodev* iodev) {
       return frames_queued_;
     }
@@ -111,7 +136,6 @@ class StreamDeviceSuite : public testing::Test {
     int device_id_;
     struct cras_iodev fallback_output_;
     struct cras_iodev fallback_input_;
-    struct cras_iodev loopback_output_;
     struct cras_iodev loopback_input_;
     struct audio_thread *thread_;
 
@@ -410,6 +434,35 @@ TEST_F(StreamDeviceSuite, AddPinnedStream) {
   EXPECT_EQ(dev_stream, (void *)NULL);
 }
 
+TEST_F(StreamDeviceSuite, LoopbackTapFollowsActiveOutput) {
+  struct cras_iodev iodev;
+  struct cras_rstream lstream;
+
+  loopback_input_.info.idx = LOOPBACK_RECORD_DEVICE;
+  SetupDevice(&iodev, CRAS_STREAM_OUTPUT);
+  SetupPinnedStream(&lstream, CRAS_STREAM_INPUT, &loopback_input_);
+  loopback_iodev_set_tap_called = 0;
+
+  // A loopback stream taps the output being played, no loopback output
+  // device is added.
+  thread_add_stream(thread_, &lstream, &loopback_input_);
+  EXPECT_EQ(&loopback_input_, loopback_iodev_set_tap_loopdev);
+  EXPECT_EQ(&fallback_output_, loopback_iodev_set_tap_odev);
+  EXPECT_EQ(&fallback_output_, thread_->active_devs[CRAS_STREAM_OUTPUT]->dev);
+  EXPECT_EQ((void *)NULL, thread_->active_devs[CRAS_STREAM_OUTPUT]->next);
+
+  // The tap moves with the active output device.
+  thread_add_active_dev(thread_, &iodev);
+  EXPECT_EQ(&iodev, loopback_iodev_set_tap_odev);
+  thread_rm_active_dev(thread_, &iodev, 1);
+  EXPECT_EQ(&fallback_output_, loopback_iodev_set_tap_odev);
+
+  // And is removed with the last loopback stream.
+  thread_disconnect_stream(thread_, &lstream);
+  EXPECT_EQ((void *)NULL, loopback_iodev_set_tap_odev);
+  EXPECT_LT(0, loopback_iodev_set_tap_called);
+}
+
 TEST_F(StreamDeviceSuite, AddPinnedStreamToInactiveDevice) {
   struct cras_iodev iodev;
   struct cras_iodev iodev2;
@@ -523,6 +576,227 @@ TEST_F(StreamDeviceSuite, RemoveActiveDeviceWithPinnedStreams) {
   EXPECT_EQ(adev->for_pinned_streams, 1);
 }
 
+TEST_F(StreamDeviceSuite, DrainedOutputClosedWithoutStandby) {
+  struct cras_iodev iodev;
+  struct active_dev *adev;
+
+  SetupDevice(&iodev, CRAS_STREAM_OUTPUT);
+  thread_add_active_dev(thread_, &iodev);
+  adev = thread_->active_devs[CRAS_STREAM_OUTPUT];
+
+  is_open_ = 1;
+  iodev.is_draining = 1;
+  EXPECT_EQ(0, drain_output_buffer(thread_, adev));
+  EXPECT_EQ(0, cras_iodev_standby_called);
+  EXPECT_EQ(1, cras_iodev_close_called);
+  EXPECT_EQ(0, iodev.is_draining);
+}
+
+TEST_F(StreamDeviceSuite, DrainedOutputStandbyUntilDeadline) {
+  struct cras_iodev iodev;
+  struct active_dev *adev;
+  struct timespec now, min_ts;
+  int running_called;
+
+  SetupDevice(&iodev, CRAS_STREAM_OUTPUT);
+  audio_thread_set_output_standby(thread_, 3000, 0);
+  thread_add_active_dev(thread_, &iodev);
+  adev = thread_->active_devs[CRAS_STREAM_OUTPUT];
+  fallback_input_.is_open = is_closed;
+
+  is_open_ = 1;
+  iodev.is_draining = 1;
+  EXPECT_EQ(0, drain_output_buffer(thread_, adev));
+  EXPECT_EQ(1, cras_iodev_standby_called);
+  EXPECT_EQ(0, cras_iodev_close_called);
+  EXPECT_EQ(1, iodev.is_standby);
+
+  // Wakes up only to close the device when the standby time is over.
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  min_ts = now;
+  min_ts.tv_sec += 20;
+  EXPECT_EQ(1, get_next_dev_wake(thread_, &min_ts, &now));
+  EXPECT_EQ(iodev.standby_deadline.tv_sec, min_ts.tv_sec);
+  EXPECT_EQ(iodev.standby_deadline.tv_nsec, min_ts.tv_nsec);
+  EXPECT_GE(min_ts.tv_sec, now.tv_sec + 2);
+
+  // Nothing is written or started while in standby.
+  running_called = dev_running_called_;
+  EXPECT_EQ(0, write_output_samples(thread_, adev));
+  EXPECT_EQ(0, cras_iodev_close_called);
+  EXPECT_EQ(running_called, dev_running_called_);
+
+  iodev.standby_deadline = now;
+  EXPECT_EQ(0, write_output_samples(thread_, adev));
+  EXPECT_EQ(1, cras_iodev_close_called);
+  EXPECT_EQ(0, iodev.is_standby);
+}
+
+TEST_F(StreamDeviceSuite, DrainedOutputClosedIfStandbyFails) {
+  struct cras_iodev iodev;
+  struct active_dev *adev;
+
+  SetupDevice(&iodev, CRAS_STREAM_OUTPUT);
+  audio_thread_set_output_standby(thread_, 3000, 0);
+  thread_add_active_dev(thread_, &iodev);
+  adev = thread_->active_devs[CRAS_STREAM_OUTPUT];
+
+  is_open_ = 1;
+  iodev.is_draining = 1;
+  cras_iodev_standby_return = -EINVAL;
+  EXPECT_EQ(0, drain_output_buffer(thread_, adev));
+  EXPECT_EQ(1, cras_iodev_standby_called);
+  EXPECT_EQ(1, cras_iodev_close_called);
+  EXPECT_EQ(0, iodev.is_standby);
+}
+
+TEST_F(StreamDeviceSuite, StreamAddedToStandbyOutput) {
+  struct cras_iodev iodev;
+  struct cras_rstream rstream;
+
+  SetupDevice(&iodev, CRAS_STREAM_OUTPUT);
+  SetupRstream(&rstream, CRAS_STREAM_OUTPUT);
+  audio_thread_set_output_standby(thread_, 3000, 0);
+  thread_add_active_dev(thread_, &iodev);
+
+  is_open_ = 1;
+  iodev.is_standby = 1;
+  iodev.buffer_size = 4096;
+  iodev.min_cb_level = 480;
+  thread_add_stream(thread_, &rstream, NULL);
+
+  // The device is reused as configured, not opened again.
+  EXPECT_EQ(0, cras_iodev_open_called);
+  EXPECT_EQ(0, cras_iodev_set_format_called);
+  EXPECT_EQ(0, iodev.is_standby);
+  EXPECT_EQ(4096, iodev.min_cb_level);
+  EXPECT_EQ(&rstream, iodev.streams->stream);
+}
+
+TEST_F(StreamDeviceSuite, PrewarmFirstActiveOutput) {
+  struct cras_iodev iodev;
+  struct cras_iodev iodev2;
+
+  SetupDevice(&iodev, CRAS_STREAM_OUTPUT);
+  SetupDevice(&iodev2, CRAS_STREAM_OUTPUT);
+  audio_thread_set_output_standby(thread_, 3000, 1);
+
+  thread_add_active_dev(thread_, &iodev);
+  EXPECT_EQ(1, cras_iodev_set_format_called);
+  EXPECT_EQ(1, cras_iodev_open_called);
+  EXPECT_EQ(1, cras_iodev_standby_called);
+  EXPECT_EQ(1, iodev.is_standby);
+  EXPECT_EQ(0, thread_->prewarm_pending);
+
+  // Only the first output is pre-warmed.
+  thread_add_active_dev(thread_, &iodev2);
+  EXPECT_EQ(1, cras_iodev_open_called);
+  EXPECT_EQ(1, cras_iodev_standby_called);
+}
+
+TEST(AudioThreadLatency, HistogramBuckets) {
+  struct latency_histogram h;
+
+  memset(&h, 0, sizeof(h));
+  latency_histogram_add(&h, 0);
+  latency_histogram_add(&h, 1);
+  latency_histogram_add(&h, 3);
+  latency_histogram_add(&h, 1024);
+  latency_histogram_add(&h, 2047);
+  latency_histogram_add(&h, UINT32_MAX);
+
+  EXPECT_EQ(6, h.count);
+  EXPECT_EQ(UINT32_MAX, h.max_us);
+  EXPECT_EQ(3075ULL + UINT32_MAX, h.total_us);
+  EXPECT_EQ(2, h.buckets[0]);
+  EXPECT_EQ(1, h.buckets[1]);
+  EXPECT_EQ(2, h.buckets[10]);
+  EXPECT_EQ(1, h.buckets[LATENCY_HISTOGRAM_BUCKETS - 1]);
+}
+
+TEST(AudioThreadLatency, FetchToReadyAndUnderruns) {
+  struct cras_rstream rstream;
+  struct cras_audio_shm_area area;
+  struct timespec now, next_cb_ts;
+  struct timespec late = {0, 2000000};
+
+  memset(&rstream, 0, sizeof(rstream));
+  memset(&area, 0, sizeof(area));
+  rstream.shm.area = &area;
+
+  // Asked 2ms late with 10ms queued, the request is left pending.
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  subtract_timespecs(&now, &late, &next_cb_ts);
+  log_fetch_latency(&rstream, &now, &next_cb_ts, 10000);
+  EXPECT_EQ(1, rstream.latency.count);
+  EXPECT_EQ(10000, rstream.latency.max_us);
+  EXPECT_EQ(2000, rstream.cb_lateness.max_us);
+  EXPECT_EQ(now.tv_sec, rstream.fetch_ts.tv_sec);
+  EXPECT_EQ(now.tv_nsec, rstream.fetch_ts.tv_nsec);
+
+  // Answered in time.
+  log_data_ready(&rstream);
+  EXPECT_EQ(1, rstream.fetch_to_ready.count);
+  EXPECT_EQ(0, rstream.num_underruns);
+  EXPECT_EQ(0, rstream.fetch_ts.tv_sec);
+
+  // A second reply without a request isn't counted.
+  log_data_ready(&rstream);
+  EXPECT_EQ(1, rstream.fetch_to_ready.count);
+
+  // Asked again, but the queued samples ran out before the next request.
+  log_fetch_latency(&rstream, &now, &next_cb_ts, 0);
+  now.tv_sec++;
+  log_fetch_latency(&rstream, &now, &next_cb_ts, 10000);
+  EXPECT_EQ(1, rstream.num_underruns);
+
+  // No request is pending when the client's buffer is full.
+  area.write_offset[0] = 4;
+  log_fetch_latency(&rstream, &now, &next_cb_ts, 10000);
+  EXPECT_EQ(0, rstream.fetch_ts.tv_sec);
+  EXPECT_EQ(0, rstream.fetch_ts.tv_nsec);
+  EXPECT_EQ(1, rstream.num_underruns);
+  EXPECT_EQ(4, rstream.latency.count);
+}
+
+TEST_F(StreamDeviceSuite, DumpStreamLatency) {
+  struct cras_rstream ostream, istream;
+  struct stream_latency_info info;
+  struct audio_thread_dump_stream_latency_msg msg;
+  int rc;
+
+  SetupRstream(&ostream, CRAS_STREAM_OUTPUT);
+  SetupRstream(&istream, CRAS_STREAM_INPUT);
+  ostream.stream_id = 0x10001;
+  ostream.num_underruns = 3;
+  ostream.fetch_to_ready.count = 5;
+  istream.stream_id = 0x10002;
+  istream.latency.max_us = 20000;
+  thread_add_stream(thread_, &ostream, NULL);
+  thread_add_stream(thread_, &istream, NULL);
+
+  memset(&info, 0xff, sizeof(info));
+  msg.header.id = AUDIO_THREAD_DUMP_STREAM_LATENCY;
+  msg.header.length = sizeof(msg);
+  msg.info = &info;
+  ASSERT_EQ(sizeof(msg), write(thread_->to_thread_fds[1], &msg, sizeof(msg)));
+  handle_playback_thread_message(thread_);
+  ASSERT_EQ(sizeof(rc), read(thread_->to_main_fds[0], &rc, sizeof(rc)));
+  EXPECT_EQ(0, rc);
+
+  ASSERT_EQ(2, info.num_streams);
+  EXPECT_EQ(0x10001, info.streams[0].stream_id);
+  EXPECT_EQ(CRAS_STREAM_OUTPUT, info.streams[0].direction);
+  EXPECT_EQ(3, info.streams[0].num_underruns);
+  EXPECT_EQ(5, info.streams[0].fetch_to_ready.count);
+  EXPECT_EQ(0x10002, info.streams[1].stream_id);
+  EXPECT_EQ(CRAS_STREAM_INPUT, info.streams[1].direction);
+  EXPECT_EQ(20000, info.streams[1].latency.max_us);
+
+  thread_disconnect_stream(thread_, &ostream);
+  thread_disconnect_stream(thread_, &istream);
+}
+
 extern "C" {
 
 const char kStreamTimeoutMilliSeconds[] = "Cras.StreamTimeoutMilliSeconds";
@@ -540,9 +814,24 @@ unsigned int cras_iodev_all_streams_written(struct cras_iodev *iodev)
 
 int cras_iodev_close(struct cras_iodev *iodev)
 {
+  cras_iodev_close_called++;
+  iodev->is_standby = 0;
   return 0;
 }
 
+int cras_iodev_standby(struct cras_iodev *iodev)
+{
+  cras_iodev_standby_called++;
+  if (cras_iodev_standby_return)
+    return cras_iodev_standby_return;
+  iodev->is_standby = 1;
+  return 0;
+}
+
+void cras_iodev_free_format(struct cras_iodev *iodev)
+{
+}
+
 double cras_iodev_get_est_rate_ratio(const struct cras_iodev *iodev)
 {
   return 1.0;
@@ -555,6 +844,7 @@ unsigned int cras_iodev_max_stream_offset(const struct cras_iodev *iodev)
 
 int cras_iodev_open(struct cras_iodev *iodev)
 {
+  cras_iodev_open_called++;
   return 0;
 }
 
@@ -579,6 +869,7 @@ struct dev_stream *cras_iodev_rm_stream(struct cras_iodev *iodev,
 int cras_iodev_set_format(struct cras_iodev *iodev,
                           struct cras_audio_format *fmt)
 {
+  cras_iodev_set_format_called++;
   return 0;
 }
 
@@ -749,6 +1040,14 @@ void dev_stream_set_dev_rate(struct dev_stream *dev_stream,
 {
 }
 
+void loopback_iodev_set_tap(struct cras_iodev *loopback_input,
+                            struct cras_iodev *odev)
+{
+  loopback_iodev_set_tap_called++;
+  loopback_iodev_set_tap_loopdev = loopback_input;
+  loopback_iodev_set_tap_odev = odev;
+}
+
 }  // extern "C"
 
 int main(int argc, char **argv) {
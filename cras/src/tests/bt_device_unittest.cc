@@ -7,6 +7,7 @@
 extern "C" {
 #include "cras_bt_io.h"
 #include "cras_bt_device.h"
+#include "cras_hfp_slc.h"
 #include "cras_iodev.h"
 
 #define FAKE_OBJ_PATH "/obj/path"
@@ -249,6 +250,11 @@ int hfp_event_speaker_gain(struct hfp_slc_handle *handle, int gain)
   return 0;
 }
 
+int hfp_slc_get_selected_codec(struct hfp_slc_handle *handle)
+{
+  return HFP_CODEC_ID_CVSD;
+}
+
 /* From audio_thread */
 int audio_thread_add_active_dev(struct audio_thread *thread,
          struct cras_iodev *dev)
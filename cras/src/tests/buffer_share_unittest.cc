@@ -3,6 +3,8 @@
 // found in the LICENSE file.
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
 #include <gtest/gtest.h>
 
 extern "C" {
@@ -109,6 +111,110 @@ TEST_F(BufferShareTestSuite, TwoDevs) {
   buffer_share_destroy(dm);
 }
 
+TEST_F(BufferShareTestSuite, RmIdKeepsOthers) {
+  buffer_share *dm = buffer_share_create(1024);
+
+  // Ids colliding in the hash must still be found after removals.
+  for (unsigned int i = 0; i < 64; i++)
+    EXPECT_EQ(0, buffer_share_add_id(dm, i << 16, (void *)(uintptr_t)(i + 1)));
+  for (unsigned int i = 0; i < 64; i += 2)
+    EXPECT_EQ(0, buffer_share_rm_id(dm, i << 16));
+  for (unsigned int i = 0; i < 64; i++) {
+    if (i % 2)
+      EXPECT_EQ((void *)(uintptr_t)(i + 1), buffer_share_get_data(dm, i << 16));
+    else
+      EXPECT_EQ(NULL, buffer_share_get_data(dm, i << 16));
+  }
+
+  // The removed id held the minimum, the others decide the write point.
+  buffer_share_offset_update(dm, 1 << 16, 100);
+  for (unsigned int i = 3; i < 64; i += 2)
+    buffer_share_offset_update(dm, i << 16, 200 + i);
+  EXPECT_EQ(100, buffer_share_get_new_write_point(dm));
+  EXPECT_EQ(0, buffer_share_rm_id(dm, 1 << 16));
+  EXPECT_EQ(103, buffer_share_get_new_write_point(dm));
+  EXPECT_EQ(2, buffer_share_id_offset(dm, 5 << 16));
+
+  buffer_share_destroy(dm);
+}
+
+// Compares against the minimum over all ids computed the slow way.
+TEST_F(BufferShareTestSuite, RandomUpdates) {
+  static const unsigned int kNumIds = 40;
+  buffer_share *dm = buffer_share_create(1024);
+  unsigned int offsets[kNumIds];
+  int used[kNumIds];
+
+  srand(7);
+  memset(offsets, 0, sizeof(offsets));
+  memset(used, 0, sizeof(used));
+  for (unsigned int n = 0; n < 20000; n++) {
+    unsigned int i = rand() % kNumIds;
+    unsigned int min = 1025;
+
+    if (rand() % 16 == 0) {
+      if (used[i])
+        EXPECT_EQ(0, buffer_share_rm_id(dm, 0xf00 + i));
+      else
+        EXPECT_EQ(0, buffer_share_add_id(dm, 0xf00 + i, NULL));
+      used[i] = !used[i];
+      offsets[i] = 0;
+    } else if (used[i]) {
+      unsigned int delta = rand() % 64;
+      buffer_share_offset_update(dm, 0xf00 + i, delta);
+      offsets[i] += delta;
+    }
+
+    for (i = 0; i < kNumIds; i++)
+      if (used[i] && offsets[i] < min)
+        min = offsets[i];
+    if (min > 1024) {
+      ASSERT_EQ(0, buffer_share_get_new_write_point(dm));
+      continue;
+    }
+    ASSERT_EQ(min, buffer_share_get_new_write_point(dm));
+    for (i = 0; i < kNumIds; i++) {
+      if (!used[i])
+        continue;
+      offsets[i] -= min;
+      ASSERT_EQ(offsets[i], buffer_share_id_offset(dm, 0xf00 + i));
+    }
+  }
+
+  buffer_share_destroy(dm);
+}
+
+static double BenchmarkIds(unsigned int num_ids, unsigned int rounds) {
+  buffer_share *dm = buffer_share_create(1024);
+  struct timespec start, end;
+
+  for (unsigned int i = 0; i < num_ids; i++)
+    buffer_share_add_id(dm, (i << 16) | 1, NULL);
+
+  // One wakeup: each stream writes, then the write point is updated.
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (unsigned int r = 0; r < rounds; r++) {
+    for (unsigned int i = 0; i < num_ids; i++)
+      buffer_share_offset_update(dm, (i << 16) | 1, 256);
+    buffer_share_get_new_write_point(dm);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  buffer_share_destroy(dm);
+  return ((end.tv_sec - start.tv_sec) * 1e9 +
+          (end.tv_nsec - start.tv_nsec)) / ((double)rounds * num_ids);
+}
+
+// Not a pass/fail test, prints the cost per stream update as the number of
+// streams grows, it should stay about flat.
+TEST_F(BufferShareTestSuite, ScalingBenchmark) {
+  static const unsigned int kNumIds[] = { 2, 8, 32, 128, 512 };
+
+  for (unsigned int i = 0; i < sizeof(kNumIds) / sizeof(kNumIds[0]); i++)
+    printf("%4u ids: %6.1f ns per update\n", kNumIds[i],
+           BenchmarkIds(kNumIds[i], 200000 / kNumIds[i]));
+}
+
 }  //  namespace
 
 int main(int argc, char **argv) {
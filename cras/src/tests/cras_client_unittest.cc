@@ -24,9 +24,16 @@ static int close_called;
 static int pipe_called;
 static int sendmsg_called;
 static int write_called;
+static int sendmmsg_called;
+static unsigned int sendmmsg_vlen;
+static int sendmmsg_return_value;
 
 static void* shmat_returned_value;
 static int pthread_create_returned_value;
+static cras_stream_id_t aud_cb_order[2];
+static int aud_cb_called;
+static struct shared_audio_thread *rm_in_cb_shared;
+static struct client_stream *rm_in_cb_stream;
 
 namespace {
 
@@ -40,8 +47,42 @@ void InitStaticVariables() {
   pipe_called = 0;
   sendmsg_called = 0;
   write_called = 0;
+  sendmmsg_called = 0;
+  sendmmsg_vlen = 0;
+  sendmmsg_return_value = -1;
   shmat_returned_value = NULL;
   pthread_create_returned_value = 0;
+  aud_cb_called = 0;
+  rm_in_cb_shared = NULL;
+  rm_in_cb_stream = NULL;
+}
+
+int RecordOrderAudCb(struct cras_client *client,
+                     cras_stream_id_t stream_id,
+                     uint8_t *samples,
+                     size_t frames,
+                     const struct timespec *sample_time,
+                     void *user_arg) {
+  if (aud_cb_called < 2)
+    aud_cb_order[aud_cb_called] = stream_id;
+  aud_cb_called++;
+  return frames;
+}
+
+// Removes another stream, as cras_client_rm_stream called from a callback
+// makes the client thread do.
+int RemoveStreamAudCb(struct cras_client *client,
+                      cras_stream_id_t stream_id,
+                      uint8_t *samples,
+                      size_t frames,
+                      const struct timespec *sample_time,
+                      void *user_arg) {
+  aud_cb_called++;
+  if (rm_in_cb_stream) {
+    shared_audio_rm_stream(rm_in_cb_shared, rm_in_cb_stream);
+    rm_in_cb_stream = NULL;
+  }
+  return frames;
 }
 
 class CrasClientTestSuite : public testing::Test {
@@ -242,6 +283,323 @@ TEST_F(CrasClientTestSuite, AddAndRemoveStream) {
   EXPECT_EQ(NULL, stream_from_id(&client_, stream_id));
 }
 
+TEST_F(CrasClientTestSuite, AddStreamsInOneSend) {
+  struct client_stream* streams[2];
+  cras_stream_id_t stream_ids[2];
+
+  for (int i = 0; i < 2; i++)
+    streams[i] = client_stream_create(stream_.config, 0);
+
+  EXPECT_EQ(0, client_thread_add_streams(&client_, streams, 2, stream_ids));
+  EXPECT_EQ(1, sendmmsg_called);
+  EXPECT_EQ(2, sendmmsg_vlen);
+  EXPECT_EQ(0, sendmsg_called);
+  EXPECT_NE(stream_ids[0], stream_ids[1]);
+  for (int i = 0; i < 2; i++) {
+    EXPECT_EQ(stream_ids[i], streams[i]->id);
+    EXPECT_EQ(streams[i], stream_from_id(&client_, stream_ids[i]));
+    EXPECT_GE(streams[i]->aud_fd, 0);
+  }
+
+  for (int i = 0; i < 2; i++)
+    EXPECT_EQ(0, client_thread_rm_stream(&client_, stream_ids[i]));
+}
+
+TEST_F(CrasClientTestSuite, AddStreamsPartialSendAddsNone) {
+  struct client_stream* streams[2];
+  cras_stream_id_t stream_ids[2];
+
+  for (int i = 0; i < 2; i++)
+    streams[i] = client_stream_create(stream_.config, 1);
+  sendmmsg_return_value = 1;
+
+  EXPECT_EQ(-EIO, client_thread_add_streams(&client_, streams, 2,
+                                            stream_ids));
+  // The stream the server was told about is disconnected.
+  EXPECT_EQ(1, write_called);
+  EXPECT_EQ(NULL, client_.streams);
+  for (int i = 0; i < 2; i++) {
+    EXPECT_EQ(-1, streams[i]->aud_fd);
+    EXPECT_EQ(-1, streams[i]->pull.fd);
+    client_stream_free(streams[i]);
+  }
+}
+
+TEST_F(CrasClientTestSuite, PullStreamConnected) {
+  struct cras_client_stream_connected msg;
+  struct cras_audio_format server_format;
+  struct cras_audio_shm_area area;
+
+  stream_.direction = CRAS_STREAM_OUTPUT;
+  stream_.pull_mode = 1;
+  set_audio_format(&server_format, SND_PCM_FORMAT_S16_LE, 44100, 2);
+  memset(&area, 0, sizeof(area));
+  area.config.frame_bytes = 4;
+  area.config.used_size = shm_writable_frames_ * 4;
+  shmat_returned_value = &area;
+  cras_fill_client_stream_connected(&msg, 0, stream_.id, &server_format,
+                                    0, 1, 600);
+
+  EXPECT_EQ(0, stream_connected(&stream_, &msg));
+
+  // No audio thread, the application services the stream.
+  EXPECT_EQ(0, pipe_called);
+  EXPECT_EQ(0, pthread_create_called);
+  EXPECT_EQ(0, stream_.thread.running);
+  EXPECT_EQ(&stream_.play_shm, stream_.pull.shm);
+  EXPECT_NE(0, cras_client_pull_stream_ready(&stream_.pull));
+}
+
+TEST_F(CrasClientTestSuite, PullStreamSetVolume) {
+  struct cras_pull_stream *pull = &stream_.pull;
+  unsigned int ramp_frames;
+  float volume;
+
+  EXPECT_EQ(-EAGAIN, cras_client_stream_set_volume(pull, 0.5, 480));
+
+  InitShm(&stream_.play_shm);
+  pull->shm = &stream_.play_shm;
+  pull->connected = 1;
+
+  // Written straight to the shm, nothing is sent.
+  EXPECT_EQ(0, cras_client_stream_set_volume(pull, 0.5, 480));
+  EXPECT_EQ(0, cras_shm_get_volume_ramp(pull->shm, &volume, &ramp_frames));
+  EXPECT_EQ(0.5, volume);
+  EXPECT_EQ(480, ramp_frames);
+  EXPECT_EQ(0, cras_client_stream_set_mute(pull, 1, 48));
+  EXPECT_EQ(0, cras_shm_get_volume_ramp(pull->shm, &volume, &ramp_frames));
+  EXPECT_EQ(0.0, volume);
+  EXPECT_EQ(48, ramp_frames);
+  EXPECT_EQ(0, write_called);
+  EXPECT_EQ(0, sendmsg_called);
+
+  FreeShm(&stream_.play_shm);
+}
+
+TEST_F(CrasClientTestSuite, PullStreamWriteAndCommit) {
+  struct cras_pull_stream *pull = &stream_.pull;
+  unsigned int frames;
+  uint8_t *buf;
+
+  pull->fd = 5;
+  EXPECT_EQ(NULL, cras_client_stream_get_write_ptr(pull, &frames));
+  EXPECT_EQ(0, frames);
+
+  InitShm(&stream_.play_shm);
+  pull->shm = &stream_.play_shm;
+  pull->connected = 1;
+
+  // Writing ahead of a request doesn't talk to the server.
+  buf = cras_client_stream_get_write_ptr(pull, &frames);
+  EXPECT_EQ(cras_shm_get_write_buffer_base(&stream_.play_shm), buf);
+  EXPECT_EQ(shm_writable_frames_, frames);
+  EXPECT_EQ(0, cras_client_stream_commit(pull, 50));
+  EXPECT_EQ(0, write_called);
+  EXPECT_EQ(50, cras_shm_get_frames(&stream_.play_shm));
+
+  // The server is waiting, the commit replies to it.
+  pull->requested = 100;
+  EXPECT_NE((void *)NULL, cras_client_stream_get_write_ptr(pull, &frames));
+  EXPECT_EQ(0, cras_client_stream_commit(pull, frames));
+  EXPECT_EQ(1, write_called);
+  EXPECT_EQ(0, pull->requested);
+
+  // Both buffers are full until the server reads.
+  EXPECT_EQ(NULL, cras_client_stream_get_write_ptr(pull, &frames));
+  EXPECT_EQ(0, frames);
+
+  FreeShm(&stream_.play_shm);
+}
+
+TEST_F(CrasClientTestSuite, PullStreamReadAndConsume) {
+  struct cras_pull_stream *pull = &stream_.pull;
+  unsigned int frames;
+
+  InitShm(&stream_.capture_shm);
+  pull->shm = &stream_.capture_shm;
+  pull->connected = 1;
+
+  EXPECT_EQ(NULL, cras_client_stream_get_read_ptr(pull, &frames));
+
+  cras_shm_buffer_written_start(&stream_.capture_shm, 60);
+  EXPECT_EQ(cras_shm_get_curr_read_buffer(&stream_.capture_shm),
+            cras_client_stream_get_read_ptr(pull, &frames));
+  EXPECT_EQ(60, frames);
+  cras_client_stream_consume(pull, 20);
+  EXPECT_NE((void *)NULL, cras_client_stream_get_read_ptr(pull, &frames));
+  EXPECT_EQ(40, frames);
+  cras_client_stream_consume(pull, 40);
+  EXPECT_EQ(NULL, cras_client_stream_get_read_ptr(pull, &frames));
+
+  FreeShm(&stream_.capture_shm);
+}
+
+TEST_F(CrasClientTestSuite, PullStreamHandleFd) {
+  struct cras_pull_stream *pull = &stream_.pull;
+  struct audio_message msg;
+  int sock[2];
+
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sock));
+  pull->fd = sock[0];
+
+  EXPECT_EQ(0, cras_client_pull_stream_handle_fd(pull));
+  EXPECT_EQ(0, pull->requested);
+
+  // Only the latest of the queued requests is kept.
+  memset(&msg, 0, sizeof(msg));
+  msg.id = AUDIO_MESSAGE_REQUEST_DATA;
+  msg.frames = 128;
+  EXPECT_EQ(sizeof(msg), send(sock[1], &msg, sizeof(msg), 0));
+  msg.frames = 256;
+  EXPECT_EQ(sizeof(msg), send(sock[1], &msg, sizeof(msg), 0));
+  EXPECT_EQ(256, cras_client_pull_stream_handle_fd(pull));
+  EXPECT_EQ(256, pull->requested);
+
+  EXPECT_EQ(0, shutdown(sock[1], SHUT_WR));
+  EXPECT_EQ(-EPIPE, cras_client_pull_stream_handle_fd(pull));
+}
+
+TEST_F(CrasClientTestSuite, SharedAudioThreadAddAndRemoveStream) {
+  struct cras_client_stream_connected msg;
+  struct cras_audio_format server_format;
+  struct cras_audio_shm_area area;
+  struct audio_message aud_msg;
+  struct epoll_event ev;
+  int sock[2];
+
+  client_.shared_audio.epoll_fd = epoll_create1(0);
+  ASSERT_LE(0, client_.shared_audio.epoll_fd);
+  pthread_mutex_init(&client_.shared_audio.lock, NULL);
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sock));
+
+  stream_.direction = CRAS_STREAM_OUTPUT;
+  stream_.aud_fd = sock[0];
+  stream_.client = &client_;
+  stream_.shared_thread = 1;
+  set_audio_format(&server_format, SND_PCM_FORMAT_S16_LE, 44100, 2);
+  memset(&area, 0, sizeof(area));
+  area.config.frame_bytes = 4;
+  area.config.used_size = shm_writable_frames_ * 4;
+  shmat_returned_value = &area;
+  cras_fill_client_stream_connected(&msg, 0, stream_.id, &server_format,
+                                    0, 1, 600);
+
+  // Connecting doesn't start a thread for the stream.
+  EXPECT_EQ(0, stream_connected(&stream_, &msg));
+  EXPECT_EQ(0, pipe_called);
+  EXPECT_EQ(0, pthread_create_called);
+
+  memset(&aud_msg, 0, sizeof(aud_msg));
+  aud_msg.id = AUDIO_MESSAGE_REQUEST_DATA;
+  EXPECT_EQ(sizeof(aud_msg), send(sock[1], &aud_msg, sizeof(aud_msg), 0));
+  EXPECT_EQ(1, epoll_wait(client_.shared_audio.epoll_fd, &ev, 1, 0));
+  EXPECT_EQ(&stream_, ev.data.ptr);
+
+  // Removing drops the events gathered before.
+  shared_audio_rm_stream(&client_.shared_audio, &stream_);
+  EXPECT_EQ(1, client_.shared_audio.generation);
+  EXPECT_EQ(0, epoll_wait(client_.shared_audio.epoll_fd, &ev, 1, 0));
+
+  pthread_mutex_destroy(&client_.shared_audio.lock);
+}
+
+TEST_F(CrasClientTestSuite, SharedAudioDispatchInDeadlineOrder) {
+  struct client_stream streams[2];
+  struct epoll_event events[2];
+  struct audio_message aud_msg;
+  int sock[2][2];
+
+  memset(streams, 0, sizeof(streams));
+  memset(&aud_msg, 0, sizeof(aud_msg));
+  aud_msg.id = AUDIO_MESSAGE_REQUEST_DATA;
+  aud_msg.frames = 10;
+  for (int i = 0; i < 2; i++) {
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sock[i]));
+    streams[i].id = i + 1;
+    streams[i].direction = CRAS_STREAM_OUTPUT;
+    streams[i].aud_fd = sock[i][0];
+    streams[i].config = stream_.config;
+    InitShm(&streams[i].play_shm);
+    EXPECT_EQ(sizeof(aud_msg),
+              send(sock[i][1], &aud_msg, sizeof(aud_msg), 0));
+    events[i].events = EPOLLIN;
+    events[i].data.ptr = &streams[i];
+  }
+  stream_.config->aud_cb = RecordOrderAudCb;
+
+  // The second stream's samples play first.
+  streams[0].play_shm.area->ts.tv_sec = 2;
+  streams[1].play_shm.area->ts.tv_sec = 1;
+
+  pthread_mutex_lock(&client_.shared_audio.lock);
+  shared_audio_dispatch(&client_.shared_audio, events, 2);
+  pthread_mutex_unlock(&client_.shared_audio.lock);
+
+  EXPECT_EQ(2, aud_cb_called);
+  EXPECT_EQ(2, aud_cb_order[0]);
+  EXPECT_EQ(1, aud_cb_order[1]);
+  // Both got a reply.
+  EXPECT_EQ(2, write_called);
+  EXPECT_EQ(10, cras_shm_get_frames(&streams[0].play_shm));
+
+  for (int i = 0; i < 2; i++)
+    FreeShm(&streams[i].play_shm);
+}
+
+TEST_F(CrasClientTestSuite, SharedAudioRemoveStreamFromCallback) {
+  struct client_stream streams[2];
+  struct epoll_event events[2];
+  struct audio_message aud_msg;
+  int sock[2][2];
+
+  client_.shared_audio.epoll_fd = epoll_create1(0);
+  ASSERT_LE(0, client_.shared_audio.epoll_fd);
+  pthread_mutex_init(&client_.shared_audio.lock, NULL);
+  pthread_cond_init(&client_.shared_audio.cb_done, NULL);
+
+  memset(streams, 0, sizeof(streams));
+  memset(&aud_msg, 0, sizeof(aud_msg));
+  aud_msg.id = AUDIO_MESSAGE_REQUEST_DATA;
+  aud_msg.frames = 10;
+  for (int i = 0; i < 2; i++) {
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sock[i]));
+    streams[i].id = i + 1;
+    streams[i].direction = CRAS_STREAM_OUTPUT;
+    streams[i].aud_fd = sock[i][0];
+    streams[i].config = stream_.config;
+    InitShm(&streams[i].play_shm);
+    streams[i].play_shm.area->ts.tv_sec = i;
+    EXPECT_EQ(0, shared_audio_add_stream(&client_.shared_audio,
+                                         &streams[i]));
+    EXPECT_EQ(sizeof(aud_msg),
+              send(sock[i][1], &aud_msg, sizeof(aud_msg), 0));
+    events[i].events = EPOLLIN;
+    events[i].data.ptr = &streams[i];
+  }
+  stream_.config->aud_cb = RemoveStreamAudCb;
+
+  // The first stream's callback removes the second stream, which isn't
+  // called after that.
+  rm_in_cb_shared = &client_.shared_audio;
+  rm_in_cb_stream = &streams[1];
+  pthread_mutex_lock(&client_.shared_audio.lock);
+  shared_audio_dispatch(&client_.shared_audio, events, 2);
+  EXPECT_EQ((void *)NULL, client_.shared_audio.cb_stream);
+  EXPECT_EQ(0, client_.shared_audio.num_reqs);
+  pthread_mutex_unlock(&client_.shared_audio.lock);
+
+  EXPECT_EQ(1, aud_cb_called);
+  EXPECT_EQ(1, write_called);
+  EXPECT_EQ(1, client_.shared_audio.generation);
+  EXPECT_EQ(10, cras_shm_get_frames(&streams[0].play_shm));
+  EXPECT_EQ(0, cras_shm_get_frames(&streams[1].play_shm));
+
+  for (int i = 0; i < 2; i++)
+    FreeShm(&streams[i].play_shm);
+  pthread_cond_destroy(&client_.shared_audio.cb_done);
+  pthread_mutex_destroy(&client_.shared_audio.lock);
+}
+
 } // namepsace
 
 int main(int argc, char **argv) {
@@ -277,6 +635,15 @@ ssize_t sendmsg(int sockfd, const struct msghdr *msg, int flags) {
   return msg->msg_iov->iov_len;
 }
 
+int sendmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen,
+             int flags) {
+  ++sendmmsg_called;
+  sendmmsg_vlen = vlen;
+  if (sendmmsg_return_value >= 0)
+    return sendmmsg_return_value;
+  return vlen;
+}
+
 int pipe(int pipefd[2]) {
   pipefd[0] = 1;
   pipefd[1] = 2;
@@ -44,6 +44,7 @@ struct data {
   int out_audio[MAX_MOCK_PORTS];
   int out_control[MAX_MOCK_PORTS];
   int properties;
+  int absorbed;
 
   int instantiate_called;
   int sample_rate;
@@ -108,12 +109,13 @@ static void run(struct dsp_module *module, unsigned long sample_count)
     data->data_location[to][0] = data->data_location[from][0];
   }
 
-  /* multiply the audio port data by 2 */
+  /* multiply the audio port data by 2, once more for each absorbed module */
   for (int i = 0; i < std::min(data->nr_in_audio, data->nr_out_audio); i++) {
     int from = data->in_audio[i];
     int to = data->out_audio[i];
     for (unsigned int j = 0; j < sample_count; j++)
-      data->data_location[to][j] = data->data_location[from][j] * 2;
+      data->data_location[to][j] = data->data_location[from][j] *
+          (2 << data->absorbed);
   }
 }
 
@@ -144,6 +146,25 @@ static int get_properties(struct dsp_module *module)
 }
 static void dump(struct dsp_module *module, struct dumper *d) {}
 
+static int is_noop(struct dsp_module *module)
+{
+  return 1;
+}
+
+static int absorb(struct dsp_module *module, struct dsp_module *prev)
+{
+  struct data *data = (struct data *)module->data;
+  struct data *prev_data = (struct data *)prev->data;
+
+  if (prev->absorb != module->absorb)
+    return -1;
+  data->absorbed += 1 + prev_data->absorbed;
+  for (int i = 0; i < data->nr_in_audio; i++)
+    data->data_location[data->in_audio[i]] =
+        prev_data->data_location[prev_data->in_audio[i]];
+  return 0;
+}
+
 static struct dsp_module *create_mock_module(struct plugin *plugin)
 {
   struct data *data;
@@ -184,6 +205,10 @@ static struct dsp_module *create_mock_module(struct plugin *plugin)
   module->free_module = &free_module;
   module->get_properties = &get_properties;
   module->dump = &dump;
+  if (strcmp(plugin->label, "noop") == 0)
+    module->is_noop = &is_noop;
+  if (strcmp(plugin->label, "fusable") == 0)
+    module->absorb = &absorb;
   return module;
 }
 
@@ -504,6 +529,131 @@ TEST_F(DspPipelineTestSuite, Complex) {
   really_free_module(m5);
 }
 
+TEST_F(DspPipelineTestSuite, Compile) {
+  /*
+   *   0 ==(a0, a1)== 1 ==(b0, b1)== 2 ==(c0, c1)== 3 ==(d0, d1)== 4
+   *
+   * 1 and 2 are fused into one module, and 3 does nothing.
+   */
+  const char *content =
+      "[M0]\n"
+      "library=builtin\n"
+      "label=source\n"
+      "purpose=playback\n"
+      "output_0={a0}\n"
+      "output_1={a1}\n"
+      "[M1]\n"
+      "library=builtin\n"
+      "label=fusable\n"
+      "input_0={a0}\n"
+      "input_1={a1}\n"
+      "output_2={b0}\n"
+      "output_3={b1}\n"
+      "input_4=1.0\n"
+      "[M2]\n"
+      "library=builtin\n"
+      "label=fusable\n"
+      "input_0={b0}\n"
+      "input_1={b1}\n"
+      "output_2={c0}\n"
+      "output_3={c1}\n"
+      "[M3]\n"
+      "library=builtin\n"
+      "label=noop\n"
+      "input_0={c0}\n"
+      "input_1={c1}\n"
+      "output_2={d0}\n"
+      "output_3={d1}\n"
+      "[M4]\n"
+      "library=builtin\n"
+      "label=sink\n"
+      "purpose=playback\n"
+      "input_0={d0}\n"
+      "input_1={d1}\n";
+  fprintf(fp, "%s", content);
+  CloseFile();
+
+  struct cras_expr_env env = CRAS_EXPR_ENV_INIT;
+  struct ini *ini = cras_dsp_ini_create(filename);
+  ASSERT_TRUE(ini);
+  struct pipeline *p = cras_dsp_pipeline_create(ini, &env, "playback");
+  ASSERT_TRUE(p);
+  ASSERT_EQ(0, cras_dsp_pipeline_load(p));
+  ASSERT_EQ(5, num_modules);
+  ASSERT_EQ(0, cras_dsp_pipeline_instantiate(p, 48000));
+
+  struct dsp_module *m[5];
+  struct data *d[5];
+  for (int i = 0; i < 5; i++) {
+    char title[3] = { 'm', (char)('0' + i), '\0' };
+    m[i] = find_module(title);
+    ASSERT_TRUE(m[i]);
+    d[i] = (struct data *)m[i]->data;
+  }
+
+  /* The data is processed in place all the way down. */
+  ASSERT_EQ(2, cras_dsp_pipeline_get_peak_audio_buffers(p));
+  for (int i = 1; i <= 3; i++) {
+    ASSERT_EQ(d[i]->data_location[0], d[i]->data_location[2]);
+    ASSERT_EQ(d[i]->data_location[1], d[i]->data_location[3]);
+  }
+  ASSERT_EQ(d[0]->data_location[0], d[4]->data_location[0]);
+  ASSERT_EQ(d[0]->data_location[1], d[4]->data_location[1]);
+  ASSERT_EQ(1, d[2]->absorbed);
+
+  int16_t *samples = new int16_t[DSP_BUFFER_SIZE];
+  fill_test_data(samples, DSP_BUFFER_SIZE);
+  cras_dsp_pipeline_apply(p, (uint8_t*)samples, 100);
+  /* m1 and m2 each multiply the data by 2, m3 is skipped. */
+  verify_processed_data(samples, 200, 2);
+  delete[] samples;
+
+  ASSERT_EQ(1, d[0]->run_called);
+  ASSERT_EQ(0, d[1]->run_called);
+  ASSERT_EQ(1, d[2]->run_called);
+  ASSERT_EQ(0, d[3]->run_called);
+  ASSERT_EQ(1, d[4]->run_called);
+
+  /* The first block is timed for each module that runs. */
+  struct dsp_pipeline_debug_info info;
+  cras_dsp_pipeline_get_debug_info(p, &info);
+  EXPECT_STREQ("playback", info.purpose);
+  EXPECT_EQ(48000, info.sample_rate);
+  EXPECT_EQ(1, info.total_blocks);
+  EXPECT_EQ(100, info.total_frames);
+  ASSERT_EQ(5, info.num_modules);
+  for (int i = 0; i < 5; i++) {
+    int skipped = (i == 1 || i == 3);
+    uint32_t sum = 0;
+    char title[3] = { 'm', (char)('0' + i), '\0' };
+    EXPECT_STREQ(title, info.modules[i].title);
+    EXPECT_EQ(skipped, info.modules[i].skipped);
+    EXPECT_EQ(skipped ? 0 : 1, info.modules[i].sampled_blocks);
+    EXPECT_EQ(skipped ? 0 : 100, info.modules[i].sampled_frames);
+    EXPECT_GE(info.modules[i].total_time_ns, info.modules[i].max_time_ns);
+    for (int j = 0; j < DSP_TIME_HISTOGRAM_BUCKETS; j++)
+      sum += info.modules[i].histogram[j];
+    EXPECT_EQ(info.modules[i].sampled_blocks, sum);
+  }
+
+  /* Re-instantiating compiles the pipeline again. */
+  cras_dsp_pipeline_deinstantiate(p);
+  d[2]->absorbed = 0;
+  ASSERT_EQ(0, cras_dsp_pipeline_instantiate(p, 44100));
+  ASSERT_EQ(1, d[2]->absorbed);
+  cras_dsp_pipeline_run(p, 100);
+  ASSERT_EQ(0, d[1]->run_called);
+  ASSERT_EQ(2, d[2]->run_called);
+  ASSERT_EQ(0, d[3]->run_called);
+
+  cras_dsp_pipeline_free(p);
+  cras_dsp_ini_free(ini);
+  cras_expr_env_free(&env);
+
+  for (int i = 0; i < 5; i++)
+    really_free_module(m[i]);
+}
+
 }  //  namespace
 
 int main(int argc, char **argv) {
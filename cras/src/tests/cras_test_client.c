@@ -7,6 +7,7 @@
 #include <getopt.h>
 #include <math.h>
 #include <pthread.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <string.h>
@@ -473,8 +474,8 @@ static void show_alog_tag(const struct audio_thread_event_log *log,
 		       sec, nsec, data1, data2, data3);
 		break;
 	case AUDIO_THREAD_A2DP_WRITE:
-		printf("A2DP_WRITE: %u.%09u written %d queued %u\n",
-		       sec, nsec, data1, data2);
+		printf("A2DP_WRITE: %u.%09u written %d queued %u seq %u\n",
+		       sec, nsec, data1, data2, data3);
 		break;
 	case AUDIO_THREAD_DEV_STREAM_MIX:
 		printf("DEV_STREAM_MIX: %u.%09u written %u read %u\n",
@@ -530,6 +531,10 @@ static void show_alog_tag(const struct audio_thread_event_log *log,
 		printf("DRAIN_OUTPUT: %u.%09u id:%u hw_level:%u silent:%u\n",
 		       sec, nsec, data1, data2, data3);
 		break;
+	case AUDIO_THREAD_DEV_STANDBY:
+		printf("DEV_STANDBY: %u.%09u id:%u standby:%u\n",
+		       sec, nsec, data1, data2);
+		break;
 	default:
 		printf("Unknown alog tag %u\n", tag);
 		break;
@@ -552,6 +557,10 @@ static void audio_debug_info(struct cras_client *client)
 	       (unsigned int)info->output_buffer_size,
 	       (unsigned int)info->output_used_size,
 	       (unsigned int)info->output_cb_threshold);
+	if (info->output_bt_bitpool)
+		printf("bt bitpool %u queued bytes %u\n",
+		       (unsigned int)info->output_bt_bitpool,
+		       (unsigned int)info->output_bt_queued_bytes);
 	printf("input dev: %s\n", info->input_dev_name);
 	printf("%u %u %u\n",
 	       (unsigned int)info->input_buffer_size,
@@ -594,6 +603,118 @@ static void audio_debug_info(struct cras_client *client)
 	pthread_mutex_unlock(&done_mutex);
 }
 
+static void dsp_debug_info(struct cras_client *client)
+{
+	const struct dsp_debug_info *info;
+	unsigned int i, j, k;
+
+	info = cras_client_get_dsp_debug_info(client);
+	if (!info)
+		return;
+
+	printf("DSP Debug Stats:\n");
+	for (i = 0; i < info->num_pipelines &&
+		    i < MAX_DEBUG_DSP_PIPELINES; i++) {
+		const struct dsp_pipeline_debug_info *p = &info->pipelines[i];
+
+		printf("pipeline: %s rate %u\n", p->purpose,
+		       (unsigned int)p->sample_rate);
+		printf("frames %llu blocks %llu time %lluns "
+		       "min %lluns max %lluns\n",
+		       (unsigned long long)p->total_frames,
+		       (unsigned long long)p->total_blocks,
+		       (unsigned long long)p->total_time_ns,
+		       (unsigned long long)p->min_time_ns,
+		       (unsigned long long)p->max_time_ns);
+		for (j = 0; j < p->num_modules &&
+			    j < MAX_DEBUG_DSP_MODULES; j++) {
+			const struct dsp_module_debug_info *m = &p->modules[j];
+
+			printf("  module: %s%s\n", m->title,
+			       m->skipped ? " (skipped)" : "");
+			if (!m->sampled_blocks)
+				continue;
+			printf("  sampled blocks %llu frames %llu "
+			       "avg %lluns max %lluns",
+			       (unsigned long long)m->sampled_blocks,
+			       (unsigned long long)m->sampled_frames,
+			       (unsigned long long)(m->total_time_ns /
+						    m->sampled_blocks),
+			       (unsigned long long)m->max_time_ns);
+			if (m->total_time_ns)
+				printf(" %.0f frames/s", m->sampled_frames *
+				       1e9 / m->total_time_ns);
+			printf("\n");
+			for (k = 0; k < DSP_TIME_HISTOGRAM_BUCKETS; k++)
+				if (m->histogram[k])
+					printf("    < %lluns: %u\n",
+					       2ULL << k,
+					       (unsigned int)m->histogram[k]);
+		}
+	}
+
+	/* Signal main thread we are done. */
+	pthread_mutex_lock(&done_mutex);
+	pthread_cond_signal(&done_cond);
+	pthread_mutex_unlock(&done_mutex);
+}
+
+static void print_latency_histogram(const char *name,
+				    const struct latency_histogram *h)
+{
+	unsigned int k;
+
+	if (!h->count) {
+		printf("  %s: none\n", name);
+		return;
+	}
+	printf("  %s: count %llu avg %lluus max %uus\n", name,
+	       (unsigned long long)h->count,
+	       (unsigned long long)(h->total_us / h->count),
+	       (unsigned int)h->max_us);
+	for (k = 0; k < LATENCY_HISTOGRAM_BUCKETS - 1; k++)
+		if (h->buckets[k])
+			printf("    < %uus: %u\n", 2U << k,
+			       (unsigned int)h->buckets[k]);
+	/* The last bucket counts everything longer. */
+	if (h->buckets[k])
+		printf("    >= %uus: %u\n", 1U << k,
+		       (unsigned int)h->buckets[k]);
+}
+
+static void stream_latency_info(struct cras_client *client)
+{
+	const struct stream_latency_info *info;
+	unsigned int i;
+
+	info = cras_client_get_stream_latency_info(client);
+	if (!info)
+		return;
+
+	printf("Stream Latency:\n");
+	for (i = 0; i < info->num_streams && i < MAX_DEBUG_STREAMS; i++) {
+		const struct stream_latency_debug_info *s = &info->streams[i];
+
+		printf("stream: %llx dir: %s rate: %u cb_threshold: %u "
+		       "underruns: %u\n",
+		       (unsigned long long)s->stream_id,
+		       s->direction == CRAS_STREAM_OUTPUT ? "Output" : "Input",
+		       (unsigned int)s->frame_rate,
+		       (unsigned int)s->cb_threshold,
+		       (unsigned int)s->num_underruns);
+		print_latency_histogram("latency", &s->latency);
+		if (s->direction != CRAS_STREAM_OUTPUT)
+			continue;
+		print_latency_histogram("cb_lateness", &s->cb_lateness);
+		print_latency_histogram("fetch_to_ready", &s->fetch_to_ready);
+	}
+
+	/* Signal main thread we are done. */
+	pthread_mutex_lock(&done_mutex);
+	pthread_cond_signal(&done_cond);
+	pthread_mutex_unlock(&done_mutex);
+}
+
 static int start_stream(struct cras_client *client,
 			cras_stream_id_t *stream_id,
 			struct cras_stream_params *params,
@@ -891,6 +1012,21 @@ static int run_hotword(struct cras_client *client,
 			   HOTWORD_STREAM);
 	return 0;
 }
+
+static void print_stream_latency_info(struct cras_client *client)
+{
+	struct timespec wait_time;
+
+	cras_client_update_stream_latency_info(client, stream_latency_info);
+
+	clock_gettime(CLOCK_REALTIME, &wait_time);
+	wait_time.tv_sec += 2;
+
+	pthread_mutex_lock(&done_mutex);
+	pthread_cond_timedwait(&done_cond, &done_mutex, &wait_time);
+	pthread_mutex_unlock(&done_mutex);
+}
+
 static void print_server_info(struct cras_client *client)
 {
 	cras_client_run_thread(client);
@@ -900,6 +1036,7 @@ static void print_server_info(struct cras_client *client)
 	print_selected_nodes(client);
 	print_attached_client_list(client);
 	print_active_stream_info(client);
+	print_stream_latency_info(client);
 }
 
 static void print_audio_debug_info(struct cras_client *client)
@@ -918,6 +1055,22 @@ static void print_audio_debug_info(struct cras_client *client)
 	pthread_mutex_unlock(&done_mutex);
 }
 
+static void print_dsp_debug_info(struct cras_client *client)
+{
+	struct timespec wait_time;
+
+	cras_client_run_thread(client);
+	cras_client_connected_wait(client); /* To synchronize data. */
+	cras_client_update_dsp_debug_info(client, dsp_debug_info);
+
+	clock_gettime(CLOCK_REALTIME, &wait_time);
+	wait_time.tv_sec += 2;
+
+	pthread_mutex_lock(&done_mutex);
+	pthread_cond_timedwait(&done_cond, &done_mutex, &wait_time);
+	pthread_mutex_unlock(&done_mutex);
+}
+
 static void check_output_plugged(struct cras_client *client, const char *name)
 {
 	cras_client_run_thread(client);
@@ -926,6 +1079,124 @@ static void check_output_plugged(struct cras_client *client, const char *name)
 	       cras_client_output_dev_plugged(client, name) ? "Yes" : "No");
 }
 
+/* Waits until the server has set up the pull streams, returns the first
+ * connect error if any. */
+static int wait_pull_streams_ready(struct cras_pull_stream **pulls,
+				   unsigned int num_streams)
+{
+	unsigned int i;
+
+	for (i = 0; i < num_streams; i++) {
+		while (!cras_client_pull_stream_ready(pulls[i])) {
+			if (pulls[i]->error)
+				return pulls[i]->error;
+			sched_yield();
+		}
+	}
+	return 0;
+}
+
+static double timespec_to_us(const struct timespec *ts)
+{
+	return ts->tv_sec * 1000000.0 + ts->tv_nsec / 1000.0;
+}
+
+/* Measures how long num_streams playback streams take to be ready, connected
+ * one at a time and then all at once with cras_client_add_streams. */
+static int run_connect_bench(struct cras_client *client,
+			     unsigned int num_streams,
+			     size_t block_size,
+			     size_t rate,
+			     size_t num_channels)
+{
+	struct cras_stream_params *configs[CRAS_CLIENT_MAX_BATCHED_STREAMS];
+	cras_stream_id_t stream_ids[CRAS_CLIENT_MAX_BATCHED_STREAMS];
+	struct cras_pull_stream *pulls[CRAS_CLIENT_MAX_BATCHED_STREAMS];
+	struct cras_stream_params *params;
+	struct cras_audio_format *aud_format;
+	struct timespec start, end, diff;
+	double single_us = 0, batched_us;
+	unsigned int i, added = 0;
+	int rc;
+
+	if (num_streams == 0 || num_streams > CRAS_CLIENT_MAX_BATCHED_STREAMS) {
+		fprintf(stderr, "connect_bench: 1 to %d streams\n",
+			CRAS_CLIENT_MAX_BATCHED_STREAMS);
+		return -EINVAL;
+	}
+
+	aud_format = cras_audio_format_create(SND_PCM_FORMAT_S16_LE, rate,
+					      num_channels);
+	if (aud_format == NULL)
+		return -ENOMEM;
+	params = cras_client_stream_params_create(CRAS_STREAM_OUTPUT,
+						  block_size * 2, block_size,
+						  0, CRAS_STREAM_TYPE_DEFAULT,
+						  0, NULL, NULL, NULL,
+						  aud_format);
+	if (params == NULL) {
+		rc = -ENOMEM;
+		goto destroy_format;
+	}
+	for (i = 0; i < num_streams; i++)
+		configs[i] = params;
+
+	cras_client_run_thread(client);
+	cras_client_connected_wait(client);
+
+	for (i = 0; i < num_streams; i++) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		rc = cras_client_add_pull_stream(client, &stream_ids[i],
+						 params, &pulls[i]);
+		if (rc == 0) {
+			added = i + 1;
+			rc = wait_pull_streams_ready(&pulls[i], 1);
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		if (rc < 0) {
+			fprintf(stderr, "connect_bench: add stream %d\n", rc);
+			goto remove_streams;
+		}
+		subtract_timespecs(&end, &start, &diff);
+		single_us += timespec_to_us(&diff);
+	}
+	for (i = 0; i < added; i++)
+		cras_client_rm_stream(client, stream_ids[i]);
+	added = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	rc = cras_client_add_streams(client, num_streams, configs, stream_ids,
+				     pulls);
+	if (rc < 0) {
+		fprintf(stderr, "connect_bench: add streams %d\n", rc);
+		goto destroy_params;
+	}
+	added = num_streams;
+	rc = wait_pull_streams_ready(pulls, num_streams);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	if (rc < 0) {
+		fprintf(stderr, "connect_bench: connect streams %d\n", rc);
+		goto remove_streams;
+	}
+	subtract_timespecs(&end, &start, &diff);
+	batched_us = timespec_to_us(&diff);
+
+	printf("%u streams\n", num_streams);
+	printf("one at a time: %10.1f us total %10.1f us/stream\n",
+	       single_us, single_us / num_streams);
+	printf("batched:       %10.1f us total %10.1f us/stream\n",
+	       batched_us, batched_us / num_streams);
+
+remove_streams:
+	for (i = 0; i < added; i++)
+		cras_client_rm_stream(client, stream_ids[i]);
+destroy_params:
+	cras_client_stream_params_destroy(params);
+destroy_format:
+	cras_audio_format_destroy(aud_format);
+	return rc;
+}
+
 static void init_sbc_codec()
 {
 	capture_codec = cras_sbc_codec_create(SBC_FREQ_16000,
@@ -980,6 +1251,8 @@ static struct option long_options[] = {
 	{"test_hotword_file",   required_argument,      0, '6'},
 	{"listen_for_hotword",  no_argument,            0, '7'},
 	{"pin_device",		required_argument,	0, '8'},
+	{"dump_dsp_stats",      no_argument,            0, '9'},
+	{"connect_bench",       required_argument,      0, 'z'},
 	{0, 0, 0, 0}
 };
 
@@ -1007,6 +1280,7 @@ static void show_usage()
 	printf("--reload_dsp - Reload dsp configuration from the ini file\n");
 	printf("--dump_server_info - Print status of the server.\n");
 	printf("--dump_dsp - Print status of dsp to syslog.\n");
+	printf("--dump_dsp_stats - Print processing time of each dsp module.\n");
 	printf("--plug <N>:<M>:<0|1> - Set the plug state (0 or 1) for the"
 	       " ionode with the given index M on the device with index N\n");
 	printf("--swap_left_right <N>:<M>:<0|1> - Swap or unswap (1 or 0) the"
@@ -1030,6 +1304,8 @@ static void show_usage()
 	printf("--listen_for_hotword - Listen for a hotword if supported\n");
 	printf("--pin_device <N> - Playback/Capture only on the given device."
 	       "\n");
+	printf("--connect_bench <N> - Time setting up N playback streams, one"
+	       " at a time and then in one batch.\n");
 	printf("--help - Print this message.\n");
 }
 
@@ -1044,6 +1320,7 @@ int main(int argc, char **argv)
 	const char *capture_file = NULL;
 	const char *playback_file = NULL;
 	const char *loopback_file = NULL;
+	unsigned int connect_bench_streams = 0;
 	int rc = 0;
 
 	option_index = 0;
@@ -1266,6 +1543,12 @@ int main(int argc, char **argv)
 		case '8':
 			pin_device_id = atoi(optarg);
 			break;
+		case '9':
+			print_dsp_debug_info(client);
+			break;
+		case 'z':
+			connect_bench_streams = atoi(optarg);
+			break;
 		default:
 			break;
 		}
@@ -1292,6 +1575,9 @@ int main(int argc, char **argv)
 	} else if (loopback_file != NULL) {
 		rc = run_capture(client, loopback_file,
 				 block_size, rate, num_channels);
+	} else if (connect_bench_streams) {
+		rc = run_connect_bench(client, connect_bench_streams,
+				       block_size, rate, num_channels);
 	}
 
 destroy_exit:
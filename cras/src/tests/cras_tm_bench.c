@@ -0,0 +1,139 @@
+/* Copyright (c) 2015 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/* Measures the cost of the timer manager operations with many timers armed,
+ * the way bluetooth, jack debouncing and UCM code arm short timers. */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "cras_tm.h"
+
+static unsigned int fired;
+
+static double tp_diff(struct timespec *tp2, struct timespec *tp1)
+{
+	return (tp2->tv_sec - tp1->tv_sec)
+		+ (tp2->tv_nsec - tp1->tv_nsec) * 1e-9;
+}
+
+static void count_cb(struct cras_timer *t, void *data)
+{
+	fired++;
+}
+
+static void print_result(const char *name, unsigned int ops,
+			 struct timespec *end, struct timespec *start)
+{
+	printf("%-20s %10u %12.1f\n", name, ops,
+	       tp_diff(end, start) * 1e9 / ops);
+}
+
+/* Runs the benchmark with num_timers armed at once. */
+static int run(unsigned int num_timers)
+{
+	struct cras_tm *tm;
+	struct cras_timer **timers;
+	struct timespec start, end, ts;
+	unsigned int i, j;
+	struct cras_timer *tmp;
+
+	tm = cras_tm_init();
+	timers = (struct cras_timer **)calloc(num_timers, sizeof(*timers));
+	if (!tm || !timers) {
+		fprintf(stderr, "cannot allocate timers\n");
+		return -1;
+	}
+	srand(1);
+
+	/* Timeouts far enough not to expire while measuring. */
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < num_timers; i++) {
+		timers[i] = cras_tm_create_timer(tm, 60000 + rand() % 60000,
+						 count_cb, NULL);
+		if (!timers[i]) {
+			fprintf(stderr, "cannot create timer %u\n", i);
+			return -1;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	print_result("create", num_timers, &end, &start);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < num_timers; i++)
+		cras_tm_get_next_timeout(tm, &ts);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	print_result("get_next_timeout", num_timers, &end, &start);
+
+	/* Cancel in random order, not the order they were armed. */
+	for (i = num_timers - 1; i > 0; i--) {
+		j = rand() % (i + 1);
+		tmp = timers[i];
+		timers[i] = timers[j];
+		timers[j] = tmp;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < num_timers; i++)
+		cras_tm_cancel_timer(tm, timers[i]);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	print_result("cancel", num_timers, &end, &start);
+
+	/* Every timer expired at once. */
+	for (i = 0; i < num_timers; i++)
+		cras_tm_create_timer(tm, 0, count_cb, NULL);
+	fired = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	cras_tm_call_callbacks(tm);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	if (fired != num_timers)
+		fprintf(stderr, "only %u of %u timers fired\n", fired,
+			num_timers);
+	print_result("call_callbacks", num_timers, &end, &start);
+
+	free(timers);
+	cras_tm_deinit(tm);
+	return 0;
+}
+
+static void show_usage()
+{
+	printf("Usage: cras_tm_bench [options]\n");
+	printf("--timers <N> - Number of timers armed at once"
+	       " (default 10000).\n");
+}
+
+static struct option long_options[] = {
+	{"help",		no_argument,		0, 'h'},
+	{"timers",		required_argument,	0, 't'},
+	{0, 0, 0, 0}
+};
+
+int main(int argc, char **argv)
+{
+	int num_timers = 10000;
+	int c;
+
+	while ((c = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+		switch (c) {
+		case 't':
+			num_timers = atoi(optarg);
+			break;
+		default:
+			show_usage();
+			return 1;
+		}
+	}
+
+	if (optind != argc || num_timers <= 0) {
+		show_usage();
+		return 1;
+	}
+
+	printf("%d timers\n", num_timers);
+	printf("operation                   ops      ns/op\n");
+	return run(num_timers) ? 1 : 0;
+}
@@ -38,6 +38,28 @@ void test_cb2(struct cras_timer *t, void *data) {
   test_cb2_called++;
 }
 
+static unsigned int fired_order[32];
+static unsigned int num_fired;
+
+void order_cb(struct cras_timer *t, void *data) {
+  fired_order[num_fired++] = (unsigned long)data;
+}
+
+static struct cras_tm *cb_tm;
+static struct cras_timer *cb_timer;
+
+/* Cancels cb_timer. */
+void cancel_cb(struct cras_timer *t, void *data) {
+  test_cb_called++;
+  cras_tm_cancel_timer(cb_tm, cb_timer);
+}
+
+/* Arms test_cb2 to fire right away. */
+void rearm_cb(struct cras_timer *t, void *data) {
+  test_cb_called++;
+  cb_timer = cras_tm_create_timer(cb_tm, 0, test_cb2, NULL);
+}
+
 TEST_F(TimerTestSuite, InitNoTimers) {
   struct timespec ts;
   int timers_active;
@@ -182,6 +204,102 @@ TEST_F(TimerTestSuite, AddTwoTimers) {
   cras_tm_cancel_timer(tm_, t1);
 }
 
+TEST_F(TimerTestSuite, FireInOrder) {
+  static const unsigned int ms[] = { 7, 3, 9, 1, 5, 8, 2, 6, 4, 10 };
+  struct cras_timer *t[10];
+  struct timespec ts;
+
+  time_now.tv_sec = 0;
+  time_now.tv_nsec = 0;
+  for (unsigned long i = 0; i < 10; i++) {
+    t[i] = cras_tm_create_timer(tm_, ms[i], order_cb,
+                                (void *)(unsigned long)ms[i]);
+    ASSERT_TRUE(t[i]);
+  }
+  cras_tm_cancel_timer(tm_, t[4]);
+  cras_tm_cancel_timer(tm_, t[3]);
+
+  ASSERT_TRUE(cras_tm_get_next_timeout(tm_, &ts));
+  EXPECT_EQ(2 * 1000000, ts.tv_nsec);
+
+  num_fired = 0;
+  time_now.tv_nsec = 8 * 1000000;
+  cras_tm_call_callbacks(tm_);
+  ASSERT_EQ(6, num_fired);
+  for (unsigned int i = 0; i < 6; i++)
+    EXPECT_EQ(i + 2 + (i >= 3), fired_order[i]);
+
+  ASSERT_TRUE(cras_tm_get_next_timeout(tm_, &ts));
+  EXPECT_EQ(1000000, ts.tv_nsec);
+  time_now.tv_nsec = 10 * 1000000;
+  cras_tm_call_callbacks(tm_);
+  EXPECT_EQ(8, num_fired);
+  EXPECT_FALSE(cras_tm_get_next_timeout(tm_, &ts));
+}
+
+TEST_F(TimerTestSuite, CancelFromCallback) {
+  struct cras_timer *t;
+
+  time_now.tv_sec = 0;
+  time_now.tv_nsec = 0;
+  cb_tm = tm_;
+  t = cras_tm_create_timer(tm_, 1, cancel_cb, NULL);
+  ASSERT_TRUE(t);
+  cb_timer = cras_tm_create_timer(tm_, 2, test_cb2, NULL);
+  ASSERT_TRUE(cb_timer);
+
+  // Both expired, the second one is canceled by the first.
+  test_cb_called = 0;
+  test_cb2_called = 0;
+  time_now.tv_nsec = 5 * 1000000;
+  cras_tm_call_callbacks(tm_);
+  EXPECT_EQ(1, test_cb_called);
+  EXPECT_EQ(0, test_cb2_called);
+}
+
+TEST_F(TimerTestSuite, TimerAddedByCallbackWaits) {
+  struct timespec ts;
+
+  time_now.tv_sec = 0;
+  time_now.tv_nsec = 0;
+  cb_tm = tm_;
+  ASSERT_TRUE(cras_tm_create_timer(tm_, 1, rearm_cb, NULL));
+
+  test_cb_called = 0;
+  test_cb2_called = 0;
+  time_now.tv_nsec = 1000000;
+  cras_tm_call_callbacks(tm_);
+  EXPECT_EQ(1, test_cb_called);
+  EXPECT_EQ(0, test_cb2_called);
+  ASSERT_TRUE(cras_tm_get_next_timeout(tm_, &ts));
+  EXPECT_EQ(0, ts.tv_nsec);
+
+  cras_tm_call_callbacks(tm_);
+  EXPECT_EQ(1, test_cb2_called);
+}
+
+TEST_F(TimerTestSuite, ReuseTimers) {
+  struct cras_timer *t[100];
+  struct cras_timer *reused;
+
+  time_now.tv_sec = 0;
+  time_now.tv_nsec = 0;
+  for (unsigned int i = 0; i < 100; i++) {
+    t[i] = cras_tm_create_timer(tm_, 10, test_cb, NULL);
+    ASSERT_TRUE(t[i]);
+  }
+
+  // A canceled timer is handed out again.
+  cras_tm_cancel_timer(tm_, t[50]);
+  reused = cras_tm_create_timer(tm_, 10, test_cb, NULL);
+  EXPECT_EQ(t[50], reused);
+
+  test_cb_called = 0;
+  time_now.tv_nsec = 10 * 1000000;
+  cras_tm_call_callbacks(tm_);
+  EXPECT_EQ(100, test_cb_called);
+}
+
 /* Stubs */
 extern "C" {
 
@@ -88,6 +88,11 @@ static float cras_fmt_conv_set_linear_resample_rates_to;
 
 static unsigned int rstream_playable_frames_ret;
 static struct mix_add_call mix_add_call;
+static struct mix_add_call mix_add_ramp_call;
+static float mix_add_ramp_step;
+static unsigned int mix_add_ramp_called;
+static float rstream_volume_ret;
+static unsigned int rstream_volume_ramp_frames_ret;
 static struct rstream_get_readable_call rstream_get_readable_call;
 static unsigned int rstream_get_readable_num;
 static uint8_t *rstream_get_readable_ptr;
@@ -114,6 +119,10 @@ class CreateSuite : public testing::Test{
 
       config_format_converter_called = 0;
       cras_fmt_conversion_needed_val = 0;
+      rstream_volume_ret = 1.0;
+      rstream_volume_ramp_frames_ret = 0;
+      mix_add_ramp_called = 0;
+      memset(&mix_add_call, 0, sizeof(mix_add_call));
       cras_fmt_conv_set_linear_resample_rates_called = 0;
 
       memset(&copy_area_call, 0xff, sizeof(copy_area_call));
@@ -468,6 +477,7 @@ TEST_F(CreateSuite, StreamMixNoFrames) {
   struct dev_stream dev_stream;
   struct cras_audio_format fmt;
 
+  memset(&dev_stream, 0, sizeof(dev_stream));
   dev_stream.conv = NULL;
   rstream_playable_frames_ret = 0;
   fmt.num_channels = 2;
@@ -480,6 +490,7 @@ TEST_F(CreateSuite, StreamMixNoConv) {
   const unsigned int nfr = 100;
   struct cras_audio_format fmt;
 
+  memset(&dev_stream, 0, sizeof(dev_stream));
   dev_stream.conv = NULL;
   dev_stream.stream = reinterpret_cast<cras_rstream*>(0x5446);
   rstream_playable_frames_ret = nfr;
@@ -506,6 +517,7 @@ TEST_F(CreateSuite, StreamMixNoConvTwoPass) {
   const unsigned int bytes_per_frame = bytes_per_sample * num_channels;
   struct cras_audio_format fmt;
 
+  memset(&dev_stream, 0, sizeof(dev_stream));
   dev_stream.conv = NULL;
   dev_stream.stream = reinterpret_cast<cras_rstream*>(0x5446);
   rstream_playable_frames_ret = nfr;
@@ -525,6 +537,51 @@ TEST_F(CreateSuite, StreamMixNoConvTwoPass) {
   EXPECT_EQ(2, rstream_get_readable_call.num_called);
 }
 
+TEST_F(CreateSuite, StreamMixVolumeRamp) {
+  struct dev_stream dev_stream;
+  const unsigned int nfr = 100;
+  struct cras_audio_format fmt;
+
+  memset(&dev_stream, 0, sizeof(dev_stream));
+  dev_stream.stream = &rstream_;
+  dev_stream.mix_gain = 1.0;
+  dev_stream.ramp_target = 1.0;
+  rstream_.format.frame_rate = 48000;
+  fmt.num_channels = 2;
+  fmt.format = SND_PCM_FORMAT_S16_LE;
+  fmt.frame_rate = 48000;
+  rstream_playable_frames_ret = nfr;
+  rstream_get_readable_num = nfr;
+  rstream_get_readable_ptr = reinterpret_cast<uint8_t*>(0x4000);
+
+  // Ramp to half volume over 150 frames, the first 100 this pass.
+  rstream_volume_ret = 0.5;
+  rstream_volume_ramp_frames_ret = 150;
+  EXPECT_EQ(nfr, dev_stream_mix(&dev_stream, &fmt, (uint8_t*)0x5000, nfr));
+  EXPECT_EQ(1, mix_add_ramp_called);
+  EXPECT_EQ(nfr, mix_add_ramp_call.count);
+  EXPECT_FLOAT_EQ(1.0, mix_add_ramp_call.mix_vol);
+  EXPECT_FLOAT_EQ(-0.5 / 150, mix_add_ramp_step);
+  EXPECT_EQ((int16_t*)0x5000, mix_add_ramp_call.dst);
+
+  // The ramp ends 50 frames in, the rest is mixed at the target.
+  EXPECT_EQ(nfr, dev_stream_mix(&dev_stream, &fmt, (uint8_t*)0x5000, nfr));
+  EXPECT_EQ(2, mix_add_ramp_called);
+  EXPECT_EQ(50, mix_add_ramp_call.count);
+  EXPECT_NEAR(1.0 - 0.5 * 100 / 150, mix_add_ramp_call.mix_vol, 1e-5);
+  EXPECT_EQ((int16_t*)(0x5000 + 50 * 4), mix_add_call.dst);
+  EXPECT_EQ((int16_t*)(0x4000 + 50 * 4), mix_add_call.src);
+  EXPECT_EQ(50 * 2, mix_add_call.count);
+  EXPECT_FLOAT_EQ(0.5, mix_add_call.mix_vol);
+
+  // Muting without a ramp takes effect at once.
+  rstream_volume_ret = 0.0;
+  rstream_volume_ramp_frames_ret = 0;
+  EXPECT_EQ(nfr, dev_stream_mix(&dev_stream, &fmt, (uint8_t*)0x5000, nfr));
+  EXPECT_EQ(2, mix_add_ramp_called);
+  EXPECT_FLOAT_EQ(0.0, mix_add_call.mix_vol);
+}
+
 //  Test set_playback_timestamp.
 TEST(DevStreamTimimg, SetPlaybackTimeStampSimple) {
   struct cras_timespec ts;
@@ -652,6 +709,14 @@ int cras_rstream_get_mute(const struct cras_rstream *rstream) {
   return 0;
 }
 
+int cras_rstream_get_volume_ramp(const struct cras_rstream *rstream,
+                                 float *volume_scaler,
+                                 unsigned int *ramp_frames) {
+  *volume_scaler = rstream_volume_ret;
+  *ramp_frames = rstream_volume_ramp_frames_ret;
+  return 0;
+}
+
 int config_format_converter(struct cras_fmt_conv **conv,
 			    enum CRAS_STREAM_DIRECTION dir,
 			    const struct cras_audio_format *from,
@@ -691,6 +756,17 @@ void cras_mix_add(snd_pcm_format_t fmt, uint8_t *dst, uint8_t *src,
   mix_add_call.mix_vol = mix_vol;
 }
 
+void cras_mix_add_ramp(snd_pcm_format_t fmt, uint8_t *dst, uint8_t *src,
+                       unsigned int frames, unsigned int num_channels,
+                       float mix_vol, float step) {
+  mix_add_ramp_called++;
+  mix_add_ramp_call.dst = (int16_t *)dst;
+  mix_add_ramp_call.src = (int16_t *)src;
+  mix_add_ramp_call.count = frames;
+  mix_add_ramp_call.mix_vol = mix_vol;
+  mix_add_ramp_step = step;
+}
+
 struct cras_audio_area *cras_audio_area_create(int num_channels) {
   cras_audio_area_create_num_channels_val = num_channels;
   return NULL;
@@ -204,6 +204,8 @@ TEST(Eq2Test, All) {
   }
   EXPECT_EQ(-1, eq2_append_biquad(eq2, 0, BQ_PEAKING, f_high, 5, 6));
   EXPECT_EQ(-1, eq2_append_biquad(eq2, 1, BQ_PEAKING, f_high, 5, 6));
+  EXPECT_EQ(MAX_BIQUADS_PER_EQ2, eq2_len(eq2, 0));
+  EXPECT_EQ(MAX_BIQUADS_PER_EQ2, eq2_len(eq2, 1));
   eq2_free(eq2);
 }
 
@@ -324,6 +326,53 @@ TEST(Crossover2Test, All) {
   free(data2R);
 }
 
+TEST(Crossover2Test, FiveBands) {
+  struct crossover2 xo2;
+  size_t len = 44100;
+  float NQ = len / 2;
+  /* Band edges, and a frequency in the middle of each band. */
+  float edges[4] = {150 / NQ, 600 / NQ, 2400 / NQ, 9600 / NQ};
+  float f[5] = {40 / NQ, 300 / NQ, 1200 / NQ, 4800 / NQ, 19200 / NQ};
+  float *dataL[5], *dataR[5];
+  float *sumL = (float *)calloc(len, sizeof(float));
+
+  for (int i = 0; i < 5; i++) {
+    dataL[i] = (float *)calloc(len, sizeof(float));
+    dataR[i] = (float *)calloc(len, sizeof(float));
+  }
+
+  dsp_enable_flush_denormal_to_zero();
+  crossover2_init_bands(&xo2, 5, edges);
+  for (int i = 0; i < 5; i++) {
+    add_sine(dataL[0], len, f[i], 0, 1);
+    add_sine(dataR[0], len, f[i], 0, 0.5);
+  }
+
+  crossover2_process_bands(&xo2, len, dataL, dataR);
+
+  /* The test frequencies are one octave from the nearest band edge, where
+   * the LR4 filters leak about -24dB into the neighbouring band. */
+  for (int i = 0; i < 5; i++) {
+    for (int j = 0; j < 5; j++) {
+      EXPECT_NEAR(i == j ? 1 : 0, magnitude_at(dataL[i], len, f[j]), 0.15);
+      EXPECT_NEAR(i == j ? 0.5 : 0, magnitude_at(dataR[i], len, f[j]),
+                  0.075);
+    }
+    for (size_t k = 0; k < len; k++)
+      sumL[k] += dataL[i][k];
+  }
+
+  /* The bands add up to an allpass signal. */
+  for (int j = 0; j < 5; j++)
+    EXPECT_NEAR(1, magnitude_at(sumL, len, f[j]), 0.01);
+
+  for (int i = 0; i < 5; i++) {
+    free(dataL[i]);
+    free(dataR[i]);
+  }
+  free(sumL);
+}
+
 TEST(DrcTest, All) {
   size_t len = 44100;
   float NQ = len / 2;
@@ -405,6 +454,96 @@ TEST(DrcTest, All) {
 
 }  //  namespace
 
+TEST(DrcTest, MultiChannel) {
+  size_t len = 44100;
+  float NQ = len / 2;
+  float f0 = 62.5 / NQ;
+  float f1 = 250 / NQ;
+  float f2 = 1000 / NQ;
+  float *data[3];
+  float *ptr[3];
+  struct drc *drc;
+
+  EXPECT_EQ(NULL, drc_new_layout(44100, 0, 2));
+  EXPECT_EQ(NULL, drc_new_layout(44100, DRC_MAX_CHANNELS + 1, 2));
+  EXPECT_EQ(NULL, drc_new_layout(44100, 2, DRC_MAX_KERNELS + 1));
+
+  /* Three channels in two bands. The third channel is paired with silence,
+   * and the second channel is silent, so the first and the third are
+   * compressed the same way. */
+  dsp_enable_flush_denormal_to_zero();
+  drc = drc_new_layout(44100, 3, 2);
+  ASSERT_NE((struct drc *)NULL, drc);
+  drc_set_param(drc, 0, PARAM_ENABLED, 1);
+  drc_set_param(drc, 0, PARAM_THRESHOLD, -30);
+  drc_set_param(drc, 0, PARAM_KNEE, 0);
+  drc_set_param(drc, 0, PARAM_RATIO, 3);
+  drc_set_param(drc, 1, PARAM_CROSSOVER_LOWER_FREQ, f1);
+  drc_set_param(drc, 1, PARAM_ENABLED, 0);
+  drc_init(drc);
+
+  for (int i = 0; i < 3; i++)
+    data[i] = (float *)calloc(len, sizeof(float));
+  add_sine(data[0], len, f0, 0, 1);
+  add_sine(data[0], len, f2, 0, 1);
+  memcpy(data[2], data[0], sizeof(float) * len);
+
+  for (size_t start = 0; start < len; start += DRC_PROCESS_MAX_FRAMES) {
+    int chunk = std::min(len - start, (size_t)DRC_PROCESS_MAX_FRAMES);
+    for (int i = 0; i < 3; i++)
+      ptr[i] = data[i] + start;
+    drc_process(drc, ptr, chunk);
+  }
+
+  for (size_t k = 0; k < len; k++) {
+    ASSERT_EQ(data[0][k], data[2][k]);
+    ASSERT_EQ(0, data[1][k]);
+  }
+  /* The low band is compressed and the high band is not. */
+  EXPECT_NEAR(0.4, magnitude_at(data[2], len, f0), 0.1);
+  EXPECT_NEAR(1, magnitude_at(data[2], len, f2), 0.1);
+
+  /* Folding a stereo eq2 needs a stereo drc. */
+  struct eq2 *eq2 = eq2_new();
+  EXPECT_EQ(-1, drc_prepend_eq2(drc, eq2));
+  eq2_free(eq2);
+
+  drc_free(drc);
+  for (int i = 0; i < 3; i++)
+    free(data[i]);
+}
+
+TEST(DrcTest, PrependEq2) {
+  struct drc *drc;
+  struct eq2 *eq2;
+  float f = 1000 / 22050.0;
+
+  eq2 = eq2_new();
+  EXPECT_EQ(0, eq2_append_biquad(eq2, 0, BQ_PEAKING, f, 5, 6));
+  EXPECT_EQ(0, eq2_append_biquad(eq2, 1, BQ_PEAKING, f, 5, 6));
+  EXPECT_EQ(0, eq2_append_biquad(eq2, 1, BQ_LOWSHELF, f, 0, -6));
+
+  /* The biquads of the eq2 go before the two emphasis stages. */
+  drc = drc_new(44100);
+  drc_init(drc);
+  EXPECT_EQ(2, eq2_len(drc->emphasis_eq[0], 0));
+  EXPECT_EQ(0, drc_prepend_eq2(drc, eq2));
+  EXPECT_EQ(3, eq2_len(drc->emphasis_eq[0], 0));
+  EXPECT_EQ(4, eq2_len(drc->emphasis_eq[0], 1));
+  EXPECT_EQ(eq2_get_bq(eq2, 1, 1)->b0,
+            eq2_get_bq(drc->emphasis_eq[0], 1, 1)->b0);
+  drc_free(drc);
+
+  /* Nothing to fold into if the emphasis is disabled. */
+  drc = drc_new(44100);
+  drc->emphasis_disabled = 1;
+  drc_init(drc);
+  EXPECT_EQ(-1, drc_prepend_eq2(drc, eq2));
+  drc_free(drc);
+
+  eq2_free(eq2);
+}
+
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
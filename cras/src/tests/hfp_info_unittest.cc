@@ -18,12 +18,26 @@ static cras_audio_format format;
 static thread_callback thread_cb;
 static void *cb_data;
 static timespec ts;
+static struct cras_audio_codec fake_codec;
+static int msbc_decode_called;
+static int msbc_encode_called;
+
+/* Builds an mSBC packet whose fake frame decodes to samples of value. */
+static void FillMsbcPacket(uint8_t *pkt, int seq, uint8_t value) {
+  memset(pkt, 0, MSBC_PKT_SIZE);
+  pkt[0] = 0x01;
+  pkt[1] = h2_header_frames_count[seq];
+  pkt[2] = MSBC_SYNC_WORD;
+  pkt[3] = value;
+}
 
 void ResetStubData() {
   format.format = SND_PCM_FORMAT_S16_LE;
   format.num_channels = 1;
   format.frame_rate = 8000;
   dev.format = &format;
+  msbc_decode_called = 0;
+  msbc_encode_called = 0;
 }
 
 namespace {
@@ -133,11 +147,12 @@ TEST(HfpInfo, AcquireCaptureBuffer) {
   put_write_buf_bytes(info->capture_buf, HFP_BUF_SIZE_BYTES - 100);
   put_write_buf_bytes(info->capture_buf, 100);
 
-  /* Assert consecutive acquire call will consume the whole buffer */
+  /* Assert consecutive acquire call will consume the whole buffer, the
+   * first one across the end of the mirrored buffer. */
   buffer_frames = 500;
   hfp_buf_acquire(info, &dev, &samples, &buffer_frames);
   hfp_buf_release(info, &dev, buffer_frames);
-  ASSERT_GT(500, buffer_frames);
+  ASSERT_EQ(500, buffer_frames);
 
   buffer_frames2 = 500;
   hfp_buf_acquire(info, &dev, &samples, &buffer_frames2);
@@ -186,14 +201,14 @@ TEST(HfpInfo, HfpReadWriteFD) {
   ASSERT_EQ(0, hfp_info_add_iodev(info, &dev));
 
   /* Initial buffer is empty */
-  rc = hfp_write(info);
+  rc = hfp_write(info, 48);
   ASSERT_EQ(0, rc);
 
   buffer_count = 1024;
   get_write_buf_bytes(info->playback_buf, &buf, &buffer_count);
   put_write_buf_bytes(info->playback_buf, buffer_count);
 
-  rc = hfp_write(info);
+  rc = hfp_write(info, 48);
   ASSERT_EQ(48, rc);
 
   rc = recv(sock[0], sample, 48, 0);
@@ -210,7 +225,7 @@ TEST(HfpInfo, StartHfpInfo) {
   info = hfp_info_create();
   ASSERT_NE(info, (void *)NULL);
 
-  hfp_info_start(sock[0], info);
+  hfp_info_start(sock[0], HFP_CODEC_ID_CVSD, info);
   ASSERT_EQ(1, hfp_info_running(info));
   ASSERT_EQ(cb_data, (void *)info);
 
@@ -234,7 +249,7 @@ TEST(HfpInfo, StartHfpInfoAndRead) {
   ASSERT_NE(info, (void *)NULL);
 
   /* Start and send two chunk of fake data */
-  hfp_info_start(sock[1], info);
+  hfp_info_start(sock[1], HFP_CODEC_ID_CVSD, info);
   send(sock[0], sample ,48, 0);
   send(sock[0], sample ,48, 0);
 
@@ -248,7 +263,12 @@ TEST(HfpInfo, StartHfpInfoAndRead) {
   rc = hfp_buf_queued(info, &dev);
   ASSERT_EQ(0, rc);
 
+  /* Both chunks were consumed by the previous callback. */
+  thread_cb((struct hfp_info *)cb_data);
+  ASSERT_EQ(0, hfp_buf_queued(info, &dev));
+
   /* Trigger thread callback after idev added. */
+  send(sock[0], sample ,48, 0);
   ts.tv_sec = 0;
   ts.tv_nsec = 5000000;
   thread_cb((struct hfp_info *)cb_data);
@@ -276,7 +296,7 @@ TEST(HfpInfo, StartHfpInfoAndWrite) {
   info = hfp_info_create();
   ASSERT_NE(info, (void *)NULL);
 
-  hfp_info_start(sock[1], info);
+  hfp_info_start(sock[1], HFP_CODEC_ID_CVSD, info);
   send(sock[0], sample ,48, 0);
   send(sock[0], sample ,48, 0);
 
@@ -291,6 +311,7 @@ TEST(HfpInfo, StartHfpInfoAndWrite) {
 
   /* Put some fake data and trigger thread callback again */
   put_write_buf_bytes(info->playback_buf, 1008);
+  send(sock[0], sample ,48, 0);
   thread_cb((struct hfp_info *)cb_data);
 
   /* Assert some samples written */
@@ -302,10 +323,344 @@ TEST(HfpInfo, StartHfpInfoAndWrite) {
   hfp_info_destroy(info);
 }
 
+TEST(HfpInfo, ReadWriteMultiplePackets) {
+  int sock[2];
+  uint8_t sample[480];
+  struct cras_iodev odev;
+
+  ResetStubData();
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sock));
+
+  info = hfp_info_create();
+  ASSERT_NE(info, (void *)NULL);
+  hfp_info_start(sock[1], HFP_CODEC_ID_CVSD, info);
+
+  dev.direction = CRAS_STREAM_INPUT;
+  ASSERT_EQ(0, hfp_info_add_iodev(info, &dev));
+  odev = dev;
+  odev.direction = CRAS_STREAM_OUTPUT;
+  ASSERT_EQ(0, hfp_info_add_iodev(info, &odev));
+  put_write_buf_bytes(info->playback_buf, 480);
+
+  /* Three packets queued are read, and three written, in one wakeup. */
+  for (int i = 0; i < 3; i++)
+    send(sock[0], sample, 48, 0);
+  thread_cb((struct hfp_info *)cb_data);
+
+  EXPECT_EQ(3 * 48 / 2, hfp_buf_queued(info, &dev));
+  EXPECT_EQ((480 - 3 * 48) / 2, hfp_buf_queued(info, &odev));
+  for (int i = 0; i < 3; i++)
+    EXPECT_EQ(48, recv(sock[0], sample, sizeof(sample), MSG_DONTWAIT));
+  EXPECT_GT(0, recv(sock[0], sample, sizeof(sample), MSG_DONTWAIT));
+
+  hfp_info_stop(info);
+  hfp_info_destroy(info);
+  close(sock[0]);
+}
+
+TEST(HfpInfo, MsbcReadFramesAcrossPackets) {
+  int sock[2];
+  uint8_t pkts[2 * MSBC_PKT_SIZE];
+  uint8_t *samples;
+  unsigned int frames;
+
+  ResetStubData();
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sock));
+
+  info = hfp_info_create();
+  ASSERT_NE(info, (void *)NULL);
+  ASSERT_EQ(0, hfp_info_start(sock[1], HFP_CODEC_ID_MSBC, info));
+  format.frame_rate = 16000;
+  dev.direction = CRAS_STREAM_INPUT;
+  ASSERT_EQ(0, hfp_info_add_iodev(info, &dev));
+  EXPECT_EQ(HFP_MSBC_BUF_SIZE_BYTES / 2, hfp_buf_size(info, &dev));
+
+  /* Two frames cut in 24 bytes packets, the controller's choice. */
+  FillMsbcPacket(pkts, 0, 10);
+  FillMsbcPacket(pkts + MSBC_PKT_SIZE, 1, 20);
+  for (int i = 0; i < 5; i++)
+    send(sock[0], pkts + i * 24, 24, 0);
+  thread_cb((struct hfp_info *)cb_data);
+
+  EXPECT_EQ(2, msbc_decode_called);
+  ASSERT_EQ(2 * MSBC_FRAME_SAMPLES, hfp_buf_queued(info, &dev));
+  frames = 2 * MSBC_FRAME_SAMPLES;
+  hfp_buf_acquire(info, &dev, &samples, &frames);
+  EXPECT_EQ(10, ((int16_t *)samples)[0]);
+  EXPECT_EQ(20, ((int16_t *)samples)[MSBC_FRAME_SAMPLES]);
+  EXPECT_EQ(24, info->packet_size);
+
+  hfp_info_stop(info);
+  hfp_info_destroy(info);
+  close(sock[0]);
+}
+
+TEST(HfpInfo, MsbcConcealLostFrames) {
+  int sock[2];
+  uint8_t pkt[MSBC_PKT_SIZE];
+  uint8_t garbage[MSBC_PKT_SIZE];
+
+  ResetStubData();
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sock));
+
+  info = hfp_info_create();
+  ASSERT_NE(info, (void *)NULL);
+  ASSERT_EQ(0, hfp_info_start(sock[1], HFP_CODEC_ID_MSBC, info));
+  dev.direction = CRAS_STREAM_INPUT;
+  ASSERT_EQ(0, hfp_info_add_iodev(info, &dev));
+
+  /* Frame 1 never arrives and frame 2 is garbled, then 3 is good. */
+  FillMsbcPacket(pkt, 0, 10);
+  send(sock[0], pkt, MSBC_PKT_SIZE, 0);
+  memset(garbage, 0x55, sizeof(garbage));
+  send(sock[0], garbage, MSBC_PKT_SIZE, 0);
+  FillMsbcPacket(pkt, 3, 10);
+  send(sock[0], pkt, MSBC_PKT_SIZE, 0);
+  thread_cb((struct hfp_info *)cb_data);
+
+  EXPECT_EQ(2, msbc_decode_called);
+  EXPECT_EQ(4 * MSBC_FRAME_SAMPLES, hfp_buf_queued(info, &dev));
+
+  /* A frame that fails to decode is concealed too. */
+  FillMsbcPacket(pkt, 0, 0xff);
+  send(sock[0], pkt, MSBC_PKT_SIZE, 0);
+  thread_cb((struct hfp_info *)cb_data);
+  EXPECT_EQ(5 * MSBC_FRAME_SAMPLES, hfp_buf_queued(info, &dev));
+
+  hfp_info_stop(info);
+  hfp_info_destroy(info);
+  close(sock[0]);
+}
+
+TEST(HfpInfo, MsbcWrite) {
+  int sock[2];
+  uint8_t pkt[MSBC_PKT_SIZE];
+  uint8_t out[2 * MSBC_PKT_SIZE];
+
+  ResetStubData();
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sock));
+
+  info = hfp_info_create();
+  ASSERT_NE(info, (void *)NULL);
+  ASSERT_EQ(0, hfp_info_start(sock[1], HFP_CODEC_ID_MSBC, info));
+  dev.direction = CRAS_STREAM_OUTPUT;
+  ASSERT_EQ(0, hfp_info_add_iodev(info, &dev));
+  put_write_buf_bytes(info->playback_buf, 3 * MSBC_CODE_SIZE);
+
+  /* Two packets read, two frames encoded and written. */
+  FillMsbcPacket(pkt, 0, 0);
+  send(sock[0], pkt, MSBC_PKT_SIZE, 0);
+  FillMsbcPacket(pkt, 1, 0);
+  send(sock[0], pkt, MSBC_PKT_SIZE, 0);
+  thread_cb((struct hfp_info *)cb_data);
+
+  EXPECT_EQ(2, msbc_encode_called);
+  EXPECT_EQ(MSBC_FRAME_SAMPLES, hfp_buf_queued(info, &dev));
+  for (int i = 0; i < 2; i++) {
+    ASSERT_EQ(MSBC_PKT_SIZE, recv(sock[0], out, sizeof(out), MSG_DONTWAIT));
+    EXPECT_EQ(0x01, out[0]);
+    EXPECT_EQ(h2_header_frames_count[i], out[1]);
+    EXPECT_EQ(MSBC_SYNC_WORD, out[2]);
+    EXPECT_EQ(0, out[MSBC_PKT_SIZE - 1]);
+  }
+
+  hfp_info_stop(info);
+  hfp_info_destroy(info);
+  close(sock[0]);
+}
+
+TEST(HfpInfo, CvsdPartialPackets) {
+  int sock[2];
+  uint8_t sample[480];
+  struct cras_iodev odev;
+
+  ResetStubData();
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sock));
+
+  info = hfp_info_create();
+  ASSERT_NE(info, (void *)NULL);
+  hfp_info_start(sock[1], HFP_CODEC_ID_CVSD, info);
+
+  dev.direction = CRAS_STREAM_INPUT;
+  ASSERT_EQ(0, hfp_info_add_iodev(info, &dev));
+  odev = dev;
+  odev.direction = CRAS_STREAM_OUTPUT;
+  ASSERT_EQ(0, hfp_info_add_iodev(info, &odev));
+  put_write_buf_bytes(info->playback_buf, 480);
+
+  /* 30 bytes packets are taken, and an odd byte cut from the last. */
+  send(sock[0], sample, 30, 0);
+  send(sock[0], sample, 31, 0);
+  thread_cb((struct hfp_info *)cb_data);
+
+  EXPECT_EQ(30, hfp_buf_queued(info, &dev));
+  EXPECT_EQ(31, info->packet_size);
+  EXPECT_EQ(1, hfp_info_running(info));
+
+  hfp_info_stop(info);
+  hfp_info_destroy(info);
+  close(sock[0]);
+}
+
+TEST(HfpInfo, JitterConcealLostPackets) {
+  struct timespec arrival = { 1, 0 };
+  unsigned int conceal;
+
+  info = hfp_info_create();
+  ASSERT_NE(info, (void *)NULL);
+  info->jitter = HFP_MTU_BYTES / 2;
+
+  /* A packet every 3ms is on time. */
+  for (int i = 0; i < 3; i++) {
+    arrival.tv_nsec = i * 3000000;
+    EXPECT_EQ(0, jitter_update(info, HFP_MTU_BYTES, &arrival, &conceal));
+    EXPECT_EQ(0, conceal);
+  }
+
+  /* Two packets never arrive. */
+  arrival.tv_nsec = 15000000;
+  EXPECT_EQ(0, jitter_update(info, HFP_MTU_BYTES, &arrival, &conceal));
+  EXPECT_EQ(2 * HFP_MTU_BYTES, conceal);
+
+  /* A packet a bit late is waited for. */
+  arrival.tv_nsec = 19500000;
+  EXPECT_EQ(0, jitter_update(info, HFP_MTU_BYTES, &arrival, &conceal));
+  EXPECT_EQ(0, conceal);
+  arrival.tv_nsec = 21000000;
+  EXPECT_EQ(0, jitter_update(info, HFP_MTU_BYTES, &arrival, &conceal));
+  EXPECT_EQ(0, conceal);
+
+  hfp_info_destroy(info);
+}
+
+TEST(HfpInfo, JitterDropLatePackets) {
+  struct timespec arrival = { 1, 0 };
+  unsigned int conceal, jitter;
+
+  info = hfp_info_create();
+  ASSERT_NE(info, (void *)NULL);
+  info->jitter = jitter = HFP_MTU_BYTES / 2;
+
+  EXPECT_EQ(0, jitter_update(info, HFP_MTU_BYTES, &arrival, &conceal));
+
+  /* The next packets are 6ms late, two are concealed. */
+  arrival.tv_nsec = 9000000;
+  EXPECT_EQ(0, jitter_update(info, HFP_MTU_BYTES, &arrival, &conceal));
+  EXPECT_EQ(2 * HFP_MTU_BYTES, conceal);
+
+  /* And then arrive, they are dropped to keep the latency, and the jitter
+   * allowed grows. */
+  for (int i = 0; i < 2; i++) {
+    EXPECT_EQ(1, jitter_update(info, HFP_MTU_BYTES, &arrival, &conceal));
+    EXPECT_EQ(0, conceal);
+  }
+  EXPECT_LT(jitter, info->jitter);
+
+  /* Nothing more is owed, a burst is kept. */
+  EXPECT_EQ(0, jitter_update(info, HFP_MTU_BYTES, &arrival, &conceal));
+
+  hfp_info_destroy(info);
+}
+
+TEST(HfpInfo, CvsdConcealRepeatsLastPacket) {
+  int16_t samples[HFP_MTU_BYTES];
+  uint8_t *buf;
+  unsigned int frames;
+
+  ResetStubData();
+  info = hfp_info_create();
+  ASSERT_NE(info, (void *)NULL);
+  dev.direction = CRAS_STREAM_INPUT;
+  ASSERT_EQ(0, hfp_info_add_iodev(info, &dev));
+
+  for (int i = 0; i < HFP_MTU_BYTES / 2; i++)
+    samples[i] = 1000;
+  cvsd_receive(info, (uint8_t *)samples, HFP_MTU_BYTES);
+  cvsd_conceal(info, 2 * HFP_MTU_BYTES);
+  ASSERT_EQ(3 * HFP_MTU_BYTES / 2, hfp_buf_queued(info, &dev));
+
+  frames = 3 * HFP_MTU_BYTES / 2;
+  hfp_buf_acquire(info, &dev, &buf, &frames);
+  EXPECT_EQ(1000, ((int16_t *)buf)[0]);
+  EXPECT_EQ(500, ((int16_t *)buf)[HFP_MTU_BYTES / 2]);
+  EXPECT_EQ(250, ((int16_t *)buf)[HFP_MTU_BYTES]);
+
+  hfp_info_destroy(info);
+}
+
+TEST(HfpInfo, MsbcConcealLongLoss) {
+  int sock[2];
+  uint8_t pkt[MSBC_PKT_SIZE];
+
+  ResetStubData();
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sock));
+
+  info = hfp_info_create();
+  ASSERT_NE(info, (void *)NULL);
+  ASSERT_EQ(0, hfp_info_start(sock[1], HFP_CODEC_ID_MSBC, info));
+  dev.direction = CRAS_STREAM_INPUT;
+  ASSERT_EQ(0, hfp_info_add_iodev(info, &dev));
+
+  FillMsbcPacket(pkt, 0, 10);
+  send(sock[0], pkt, MSBC_PKT_SIZE, 0);
+  thread_cb((struct hfp_info *)cb_data);
+  EXPECT_EQ(MSBC_FRAME_SAMPLES, hfp_buf_queued(info, &dev));
+
+  /* Five frames lost, the sequence numbers only show one. */
+  info->msbc_lost_bytes = 5 * MSBC_PKT_SIZE;
+  FillMsbcPacket(pkt, 2, 10);
+  send(sock[0], pkt, MSBC_PKT_SIZE, 0);
+  thread_cb((struct hfp_info *)cb_data);
+  EXPECT_EQ(7 * MSBC_FRAME_SAMPLES, hfp_buf_queued(info, &dev));
+
+  hfp_info_stop(info);
+  hfp_info_destroy(info);
+  close(sock[0]);
+}
+
 } // namespace
 
 extern "C" {
 
+static int fake_msbc_decode(struct cras_audio_codec *codec, const void *input,
+                            size_t input_len, void *output, size_t output_len,
+                            size_t *count)
+{
+  const uint8_t *frame = (const uint8_t *)input;
+  int16_t *samples = (int16_t *)output;
+
+  msbc_decode_called++;
+  *count = 0;
+  if (frame[0] != MSBC_SYNC_WORD || frame[1] == 0xff)
+    return -1;
+  for (int i = 0; i < MSBC_FRAME_SAMPLES; i++)
+    samples[i] = frame[1];
+  *count = MSBC_CODE_SIZE;
+  return MSBC_FRAME_LEN;
+}
+
+static int fake_msbc_encode(struct cras_audio_codec *codec, const void *input,
+                            size_t input_len, void *output, size_t output_len,
+                            size_t *count)
+{
+  msbc_encode_called++;
+  memset(output, 0, MSBC_FRAME_LEN);
+  ((uint8_t *)output)[0] = MSBC_SYNC_WORD;
+  *count = MSBC_FRAME_LEN;
+  return MSBC_CODE_SIZE;
+}
+
+struct cras_audio_codec *cras_msbc_codec_create()
+{
+  fake_codec.decode = fake_msbc_decode;
+  fake_codec.encode = fake_msbc_encode;
+  return &fake_codec;
+}
+
+void cras_sbc_codec_destroy(struct cras_audio_codec *codec)
+{
+}
+
 void audio_thread_add_callback(int fd, thread_callback cb,
                                void *data)
 {
@@ -10,6 +10,7 @@ extern "C" {
 #include "cras_hfp_iodev.h"
 #include "cras_iodev.h"
 #include "cras_hfp_info.h"
+#include "cras_hfp_slc.h"
 }
 
 static struct cras_iodev *iodev;
@@ -37,6 +38,9 @@ static unsigned hfp_buf_acquire_return_val;
 static size_t hfp_buf_release_called;
 static unsigned hfp_buf_release_nwritten_val;
 static cras_audio_area *dummy_audio_area;
+static int cras_bt_device_get_sco_codec_return_val;
+static int cras_bt_device_sco_connect_codec_val;
+static int hfp_info_start_codec_val;
 
 void ResetStubData() {
   cras_bt_device_append_iodev_called = 0;
@@ -59,6 +63,9 @@ void ResetStubData() {
   hfp_buf_acquire_return_val = 0;
   hfp_buf_release_called = 0;
   hfp_buf_release_nwritten_val = 0;
+  cras_bt_device_get_sco_codec_return_val = HFP_CODEC_ID_CVSD;
+  cras_bt_device_sco_connect_codec_val = 0;
+  hfp_info_start_codec_val = 0;
 
   fake_info = reinterpret_cast<struct hfp_info *>(0x123);
 
@@ -161,6 +168,35 @@ TEST(HfpIodev, PutGetBuffer) {
   ASSERT_EQ(40, hfp_buf_release_nwritten_val);
 }
 
+TEST(HfpIodev, OpenMsbcIodev) {
+  struct cras_audio_format format;
+
+  ResetStubData();
+  iodev = hfp_iodev_create(CRAS_STREAM_INPUT, fake_device,
+                           CRAS_BT_DEVICE_PROFILE_HFP_AUDIOGATEWAY,
+                           fake_info);
+
+  /* Wideband speech once mSBC is negotiated. */
+  cras_bt_device_get_sco_codec_return_val = HFP_CODEC_ID_MSBC;
+  iodev->format = &format;
+  iodev->update_supported_formats(iodev);
+  ASSERT_EQ(16000, iodev->supported_rates[0]);
+  ASSERT_EQ(0, iodev->supported_rates[1]);
+
+  hfp_info_running_return_val = 0;
+  iodev->open_dev(iodev);
+  ASSERT_EQ(HFP_CODEC_ID_MSBC, cras_bt_device_sco_connect_codec_val);
+  ASSERT_EQ(HFP_CODEC_ID_MSBC, hfp_info_start_codec_val);
+
+  /* Back to narrowband with CVSD. */
+  cras_bt_device_get_sco_codec_return_val = HFP_CODEC_ID_CVSD;
+  iodev->update_supported_formats(iodev);
+  ASSERT_EQ(8000, iodev->supported_rates[0]);
+
+  iodev->close_dev(iodev);
+  hfp_iodev_destroy(iodev);
+}
+
 } // namespace
 
 extern "C" {
@@ -205,9 +241,10 @@ size_t cras_system_get_volume()
 }
 
 // From bt device
-int cras_bt_device_sco_connect(struct cras_bt_device *device)
+int cras_bt_device_sco_connect(struct cras_bt_device *device, int codec)
 {
   cras_bt_device_sco_connect_called++;
+  cras_bt_device_sco_connect_codec_val = codec;
   return cras_bt_transport_sco_connect_return_val;
 }
 
@@ -259,9 +296,15 @@ int hfp_info_running(struct hfp_info *info)
   return hfp_info_running_return_val;
 }
 
-int hfp_info_start(int fd, struct hfp_info *info)
+int cras_bt_device_get_sco_codec(struct cras_bt_device *device)
+{
+  return cras_bt_device_get_sco_codec_return_val;
+}
+
+int hfp_info_start(int fd, int codec, struct hfp_info *info)
 {
   hfp_info_start_called++;
+  hfp_info_start_codec_val = codec;
   return 0;
 }
 
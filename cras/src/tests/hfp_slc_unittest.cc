@@ -92,6 +92,72 @@ TEST(HfpSlc, InitializeSlc) {
   hfp_slc_destroy(handle);
 }
 
+TEST(HfpSlc, CodecNegotiation) {
+  int err;
+  int sock[2];
+  char buf[256];
+  ResetStubData();
+
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sock));
+  handle = hfp_slc_create(sock[0], 0, slc_initialized_cb,
+                          slc_disconnected_cb);
+
+  err = write(sock[1], "AT+BAC=1,2\r", 11);
+  ASSERT_EQ(11, err);
+  slc_cb(slc_cb_data);
+  memset(buf, 0, sizeof(buf));
+  err = read(sock[1], buf, 256);
+  ASSERT_NE((void *)NULL, (void *)strstr(buf, "\r\nOK\r\n"));
+
+  /* mSBC is proposed once the SLC is established. */
+  err = write(sock[1], "AT+CMER=3,0,0,1\r", 16);
+  ASSERT_EQ(16, err);
+  slc_cb(slc_cb_data);
+  ASSERT_EQ(1, slc_initialized_cb_called);
+  memset(buf, 0, sizeof(buf));
+  err = read(sock[1], buf, 256);
+  ASSERT_NE((void *)NULL, (void *)strstr(buf, "\r\n+BCS:2\r\n"));
+  ASSERT_EQ(HFP_CODEC_ID_CVSD, hfp_slc_get_selected_codec(handle));
+
+  /* And used once confirmed. */
+  err = write(sock[1], "AT+BCS=2\r", 9);
+  ASSERT_EQ(9, err);
+  slc_cb(slc_cb_data);
+  memset(buf, 0, sizeof(buf));
+  err = read(sock[1], buf, 256);
+  ASSERT_NE((void *)NULL, (void *)strstr(buf, "\r\nOK\r\n"));
+  ASSERT_EQ(HFP_CODEC_ID_MSBC, hfp_slc_get_selected_codec(handle));
+
+  /* An unknown codec is refused. */
+  err = write(sock[1], "AT+BCS=3\r", 9);
+  ASSERT_EQ(9, err);
+  slc_cb(slc_cb_data);
+  memset(buf, 0, sizeof(buf));
+  err = read(sock[1], buf, 256);
+  ASSERT_NE((void *)NULL, (void *)strstr(buf, "\r\nERROR\r\n"));
+  ASSERT_EQ(HFP_CODEC_ID_MSBC, hfp_slc_get_selected_codec(handle));
+
+  /* So is a malformed codec id. */
+  err = write(sock[1], "AT+BCS=1x\r", 10);
+  ASSERT_EQ(10, err);
+  slc_cb(slc_cb_data);
+  memset(buf, 0, sizeof(buf));
+  err = read(sock[1], buf, 256);
+  ASSERT_NE((void *)NULL, (void *)strstr(buf, "\r\nERROR\r\n"));
+  ASSERT_EQ(HFP_CODEC_ID_MSBC, hfp_slc_get_selected_codec(handle));
+
+  err = write(sock[1], "AT+BCS\r", 7);
+  ASSERT_EQ(7, err);
+  slc_cb(slc_cb_data);
+  memset(buf, 0, sizeof(buf));
+  err = read(sock[1], buf, 256);
+  ASSERT_NE((void *)NULL, (void *)strstr(buf, "\r\nERROR\r\n"));
+  ASSERT_EQ(HFP_CODEC_ID_MSBC, hfp_slc_get_selected_codec(handle));
+
+  hfp_slc_destroy(handle);
+  close(sock[1]);
+}
+
 TEST(HfpSlc, DisconnectSlc) {
   int sock[2];
   ResetStubData();
@@ -594,7 +594,6 @@ void cras_alert_destroy(struct cras_alert *alert) {
 
 struct audio_thread *audio_thread_create(struct cras_iodev *out,
                                          struct cras_iodev *in,
-                                         struct cras_iodev *loop_out,
                                          struct cras_iodev *loop_in) {
   return &thread;
 }
@@ -603,6 +602,11 @@ int audio_thread_start(struct audio_thread *thread) {
   return 0;
 }
 
+void audio_thread_set_output_standby(struct audio_thread *thread,
+                                     unsigned int standby_ms,
+                                     int prewarm) {
+}
+
 void audio_thread_destroy(struct audio_thread *thread) {
 }
 
@@ -691,14 +695,12 @@ void test_iodev_command(struct cras_iodev *iodev,
                         const uint8_t *data) {
 }
 
-void loopback_iodev_create(struct cras_iodev **loop_in,
-                           struct cras_iodev **loop_out)
+struct cras_iodev *loopback_iodev_create()
 {
-  *loop_in = &loopback_input;
+  return &loopback_input;
 }
 
-void loopback_iodev_destroy(struct cras_iodev *loop_in,
-                            struct cras_iodev *loop_out)
+void loopback_iodev_destroy(struct cras_iodev *loop_in)
 {
 }
 
@@ -521,6 +521,79 @@ TEST(IoDevPutOutputBuffer, Scale32Bit) {
   EXPECT_EQ(SND_PCM_FORMAT_S32_LE, cras_scale_buffer_fmt);
 }
 
+static unsigned int pre_dsp_hook_frames;
+static const struct cras_audio_format *pre_dsp_hook_fmt;
+static unsigned int pre_dsp_hook_apply_count;
+static unsigned int post_dsp_hook_frames;
+static const struct cras_audio_format *post_dsp_hook_fmt;
+static unsigned int post_dsp_hook_apply_count;
+static void *hook_cb_data;
+
+static void pre_dsp_hook(const uint8_t *frames, unsigned int nframes,
+                         const struct cras_audio_format *fmt, void *cb_data)
+{
+  pre_dsp_hook_frames = nframes;
+  pre_dsp_hook_fmt = fmt;
+  pre_dsp_hook_apply_count = cras_dsp_pipeline_apply_sample_count;
+  hook_cb_data = cb_data;
+}
+
+static void post_dsp_hook(const uint8_t *frames, unsigned int nframes,
+                          const struct cras_audio_format *fmt, void *cb_data)
+{
+  post_dsp_hook_frames = nframes;
+  post_dsp_hook_fmt = fmt;
+  post_dsp_hook_apply_count = cras_dsp_pipeline_apply_sample_count;
+}
+
+TEST(IoDevPutOutputBuffer, Hooks) {
+  struct cras_audio_format fmt;
+  struct cras_audio_format ext_fmt;
+  struct cras_iodev iodev;
+  uint8_t *frames = reinterpret_cast<uint8_t*>(0x44);
+  int rc;
+
+  ResetStubData();
+  memset(&iodev, 0, sizeof(iodev));
+  iodev.dsp_context = reinterpret_cast<cras_dsp_context*>(0x15);
+  cras_dsp_get_pipeline_ret = 0x25;
+
+  fmt.format = SND_PCM_FORMAT_S16_LE;
+  fmt.frame_rate = 48000;
+  fmt.num_channels = 2;
+  ext_fmt = fmt;
+  iodev.format = &fmt;
+  iodev.ext_format = &ext_fmt;
+  iodev.put_buffer = put_buffer;
+
+  cras_iodev_register_pre_dsp_hook(&iodev, pre_dsp_hook, (void *)0x55);
+  cras_iodev_register_post_dsp_hook(&iodev, post_dsp_hook, NULL);
+
+  // The pre DSP tap sees the mixed samples, the post DSP one what is
+  // written to the device.
+  pre_dsp_hook_apply_count = 1;
+  rc = cras_iodev_put_output_buffer(&iodev, frames, 32);
+  EXPECT_EQ(0, rc);
+  EXPECT_EQ(32, pre_dsp_hook_frames);
+  EXPECT_EQ(&ext_fmt, pre_dsp_hook_fmt);
+  EXPECT_EQ(0, pre_dsp_hook_apply_count);
+  EXPECT_EQ((void *)0x55, hook_cb_data);
+  EXPECT_EQ(32, post_dsp_hook_frames);
+  EXPECT_EQ(&fmt, post_dsp_hook_fmt);
+  EXPECT_EQ(32, post_dsp_hook_apply_count);
+  EXPECT_EQ(32, put_buffer_nframes);
+
+  // Unregistered hooks aren't called.
+  cras_iodev_register_pre_dsp_hook(&iodev, NULL, NULL);
+  cras_iodev_register_post_dsp_hook(&iodev, NULL, NULL);
+  pre_dsp_hook_frames = 0;
+  post_dsp_hook_frames = 0;
+  rc = cras_iodev_put_output_buffer(&iodev, frames, 16);
+  EXPECT_EQ(0, rc);
+  EXPECT_EQ(0, pre_dsp_hook_frames);
+  EXPECT_EQ(0, post_dsp_hook_frames);
+}
+
 static void update_active_node(struct cras_iodev *iodev)
 {
 }
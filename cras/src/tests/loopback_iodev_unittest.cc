@@ -20,6 +20,9 @@ static const unsigned int kBufferFrames = 16384;
 static const unsigned int kFrameBytes = 4;
 static const unsigned int kBufferSize = kBufferFrames * kFrameBytes;
 static cras_audio_area *dummy_audio_area;
+static unsigned int cras_fmt_conv_create_called;
+static unsigned int cras_fmt_conv_convert_frames_called;
+static struct cras_audio_format cras_fmt_conv_in_fmt;
 
 class LoopBackTestSuite : public testing::Test{
   protected:
@@ -32,103 +35,197 @@ class LoopBackTestSuite : public testing::Test{
       fmt_.frame_rate = 44100;
       fmt_.num_channels = 2;
       fmt_.format = SND_PCM_FORMAT_S16_LE;
+      cras_fmt_conv_create_called = 0;
+      cras_fmt_conv_convert_frames_called = 0;
 
-      loopback_iodev_create(&loop_in_, &loop_out_);
+      memset(&odev_, 0, sizeof(odev_));
+      odev_.direction = CRAS_STREAM_OUTPUT;
+      odev_fmt_ = fmt_;
+
+      loop_in_ = loopback_iodev_create();
       loop_in_->format = &fmt_;
-      loop_out_->format = &fmt_;
     }
 
     virtual void TearDown() {
-      loopback_iodev_destroy(loop_in_, loop_out_);
+      loopback_iodev_destroy(loop_in_);
       free(dummy_audio_area);
     }
 
+    // Writes frames the way the output device does after mixing.
+    void TapWrite(const uint8_t *frames, unsigned int nframes) {
+      ASSERT_NE((void *)NULL, (void *)odev_.pre_dsp_hook);
+      odev_.pre_dsp_hook(frames, nframes, &odev_fmt_,
+                         odev_.pre_dsp_hook_cb_data);
+    }
+
     uint8_t buf_[kBufferSize];
     struct cras_audio_format fmt_;
-    struct cras_iodev *loop_in_, *loop_out_;
+    struct cras_audio_format odev_fmt_;
+    struct cras_iodev odev_;
+    struct cras_iodev *loop_in_;
 };
 
 TEST_F(LoopBackTestSuite, OpenAndCloseDevice) {
   int rc;
 
-  // Open loopback devices.
-  rc = loop_out_->open_dev(loop_out_);
-  EXPECT_EQ(rc, 0);
+  // Open loopback device.
   rc = loop_in_->open_dev(loop_in_);
   EXPECT_EQ(rc, 0);
 
   // Check device open status.
-  rc = loop_out_->is_open(loop_out_);
-  EXPECT_EQ(rc, 1);
   rc = loop_in_->is_open(loop_in_);
   EXPECT_EQ(rc, 1);
 
   // Check zero frames queued.
-  rc = loop_out_->frames_queued(loop_out_);
-  EXPECT_EQ(rc, 0);
   rc = loop_in_->frames_queued(loop_in_);
   EXPECT_EQ(rc, 0);
 
-  // Close loopback devices.
+  // Close loopback device.
   rc = loop_in_->close_dev(loop_in_);
   EXPECT_EQ(rc, 0);
-  rc = loop_out_->close_dev(loop_out_);
-  EXPECT_EQ(rc, 0);
 
   // Check device open status.
-  rc = loop_out_->is_open(loop_out_);
-  EXPECT_EQ(rc, 0);
   rc = loop_in_->is_open(loop_in_);
   EXPECT_EQ(rc, 0);
 }
 
+TEST_F(LoopBackTestSuite, SetTap) {
+  struct cras_iodev odev2;
+
+  memset(&odev2, 0, sizeof(odev2));
+
+  loopback_iodev_set_tap(loop_in_, &odev_);
+  EXPECT_NE((void *)NULL, (void *)odev_.pre_dsp_hook);
+
+  // Moving the tap removes it from the previous device.
+  loopback_iodev_set_tap(loop_in_, &odev2);
+  EXPECT_EQ((void *)NULL, (void *)odev_.pre_dsp_hook);
+  EXPECT_NE((void *)NULL, (void *)odev2.pre_dsp_hook);
+
+  loopback_iodev_set_tap(loop_in_, NULL);
+  EXPECT_EQ((void *)NULL, (void *)odev2.pre_dsp_hook);
+}
+
 TEST_F(LoopBackTestSuite, SimpleLoopback) {
   static cras_audio_area *area;
   unsigned int nread = 1024;
   int rc;
 
-  loop_out_->open_dev(loop_out_);
+  loopback_iodev_set_tap(loop_in_, &odev_);
+
+  // Nothing is kept while no reader is open.
+  TapWrite(buf_, 256);
+
   loop_in_->open_dev(loop_in_);
+  rc = loop_in_->frames_queued(loop_in_);
+  EXPECT_EQ(rc, 0);
 
-  // Copy frames to loopback playback.
-  loop_out_->get_buffer(loop_out_, &area, &nread);
-  EXPECT_EQ(nread, 1024);
-  memcpy(area->channels[0].buf, buf_, nread);
-  loop_out_->put_buffer(loop_out_, nread);
+  // Mixed frames from the output device are tapped once.
+  TapWrite(buf_, 1024);
 
   // Check frames queued.
-  rc = loop_out_->frames_queued(loop_out_);
+  rc = loop_in_->frames_queued(loop_in_);
   EXPECT_EQ(rc, 1024);
 
   // Verify frames from loopback record.
   loop_in_->get_buffer(loop_in_, &area, &nread);
   EXPECT_EQ(nread, 1024);
-  rc = memcmp(area->channels[0].buf, buf_, nread);
+  rc = memcmp(area->channels[0].buf, buf_, nread * kFrameBytes);
   EXPECT_EQ(rc, 0);
   loop_in_->put_buffer(loop_in_, nread);
 
   // Check zero frames queued.
-  rc = loop_out_->frames_queued(loop_in_);
+  rc = loop_in_->frames_queued(loop_in_);
   EXPECT_EQ(rc, 0);
+  EXPECT_EQ(0, cras_fmt_conv_create_called);
 
   loop_in_->close_dev(loop_in_);
-  loop_out_->close_dev(loop_out_);
+  loopback_iodev_set_tap(loop_in_, NULL);
 }
 
 TEST_F(LoopBackTestSuite, CheckSharedBufferLimit) {
   static cras_audio_area *area;
-  unsigned int nread = 1024 * 16;
+  unsigned int nread = kBufferFrames;
+  int rc;
 
-  loop_out_->open_dev(loop_out_);
+  loopback_iodev_set_tap(loop_in_, &odev_);
   loop_in_->open_dev(loop_in_);
 
-  // Check loopback shared buffer limit.
-  loop_out_->get_buffer(loop_out_, &area, &nread);
-  EXPECT_EQ(nread, 8192);
-  loop_out_->put_buffer(loop_out_, nread);
+  // The reader falls behind, only the newest 8192 frames are kept.
+  TapWrite(buf_, 8000);
+  TapWrite(buf_ + 8000 * kFrameBytes, 4000);
+  rc = loop_in_->frames_queued(loop_in_);
+  EXPECT_EQ(rc, 8192);
+
+  loop_in_->get_buffer(loop_in_, &area, &nread);
+  EXPECT_EQ(nread, 8192 - (12000 - 8192));
+  rc = memcmp(area->channels[0].buf, buf_ + (12000 - 8192) * kFrameBytes,
+              nread * kFrameBytes);
+  EXPECT_EQ(rc, 0);
+  loop_in_->put_buffer(loop_in_, nread);
+
+  // The rest wrapped to the start of the ring.
+  nread = kBufferFrames;
+  loop_in_->get_buffer(loop_in_, &area, &nread);
+  EXPECT_EQ(nread, 12000 - 8192);
+  rc = memcmp(area->channels[0].buf, buf_ + 8192 * kFrameBytes,
+              nread * kFrameBytes);
+  EXPECT_EQ(rc, 0);
+  loop_in_->put_buffer(loop_in_, nread);
+  rc = loop_in_->frames_queued(loop_in_);
+  EXPECT_EQ(rc, 0);
 
   loop_in_->close_dev(loop_in_);
-  loop_out_->close_dev(loop_out_);
+  loopback_iodev_set_tap(loop_in_, NULL);
+}
+
+TEST_F(LoopBackTestSuite, FollowTapFormat) {
+  struct cras_audio_format ext_fmt = fmt_;
+
+  // Without a device to follow, use the default format.
+  loop_in_->update_supported_formats(loop_in_);
+  EXPECT_EQ(44100, loop_in_->supported_rates[0]);
+  EXPECT_EQ(2, loop_in_->supported_channel_counts[0]);
+  EXPECT_EQ(SND_PCM_FORMAT_S16_LE, loop_in_->supported_formats[0]);
+
+  ext_fmt.frame_rate = 48000;
+  ext_fmt.num_channels = 6;
+  ext_fmt.format = SND_PCM_FORMAT_S32_LE;
+  odev_.ext_format = &ext_fmt;
+  loopback_iodev_set_tap(loop_in_, &odev_);
+  loop_in_->update_supported_formats(loop_in_);
+  EXPECT_EQ(48000, loop_in_->supported_rates[0]);
+  EXPECT_EQ(6, loop_in_->supported_channel_counts[0]);
+  EXPECT_EQ(SND_PCM_FORMAT_S32_LE, loop_in_->supported_formats[0]);
+
+  loopback_iodev_set_tap(loop_in_, NULL);
+}
+
+TEST_F(LoopBackTestSuite, ConvertWhenTapFormatDiffers) {
+  static cras_audio_area *area;
+  unsigned int nread = 1024;
+  int rc;
+
+  loopback_iodev_set_tap(loop_in_, &odev_);
+  loop_in_->open_dev(loop_in_);
+
+  // The output device was reopened at another rate after the reader.
+  odev_fmt_.frame_rate = 48000;
+  TapWrite(buf_, 480);
+  TapWrite(buf_, 480);
+  EXPECT_EQ(1, cras_fmt_conv_create_called);
+  EXPECT_EQ(2, cras_fmt_conv_convert_frames_called);
+  EXPECT_EQ(48000, cras_fmt_conv_in_fmt.frame_rate);
+
+  // The stub converter drops every other frame.
+  rc = loop_in_->frames_queued(loop_in_);
+  EXPECT_EQ(rc, 480);
+  loop_in_->get_buffer(loop_in_, &area, &nread);
+  EXPECT_EQ(nread, 480);
+  loop_in_->put_buffer(loop_in_, nread);
+
+  loop_in_->close_dev(loop_in_);
+  loopback_iodev_set_tap(loop_in_, NULL);
 }
 
 /* Stubs */
@@ -159,6 +256,51 @@ int cras_iodev_list_rm_input(struct cras_iodev *input)
   return 0;
 }
 
+void cras_iodev_register_pre_dsp_hook(struct cras_iodev *iodev,
+                                      loopback_hook_t loop_cb,
+                                      void *cb_data)
+{
+  iodev->pre_dsp_hook = loop_cb;
+  iodev->pre_dsp_hook_cb_data = cb_data;
+}
+
+struct cras_fmt_conv *cras_fmt_conv_create(const struct cras_audio_format *in,
+                                           const struct cras_audio_format *out,
+                                           size_t max_frames,
+                                           size_t pre_linear_resample)
+{
+  cras_fmt_conv_create_called++;
+  cras_fmt_conv_in_fmt = *in;
+  return reinterpret_cast<struct cras_fmt_conv*>(0x33);
+}
+
+void cras_fmt_conv_destroy(struct cras_fmt_conv *conv)
+{
+}
+
+const struct cras_audio_format *cras_fmt_conv_in_format(
+    const struct cras_fmt_conv *conv)
+{
+  return &cras_fmt_conv_in_fmt;
+}
+
+size_t cras_fmt_conv_in_frames_to_out(struct cras_fmt_conv *conv,
+                                      size_t in_frames)
+{
+  return in_frames / 2;
+}
+
+size_t cras_fmt_conv_convert_frames(struct cras_fmt_conv *conv,
+                                    const uint8_t *in_buf,
+                                    uint8_t *out_buf,
+                                    unsigned int *in_frames,
+                                    size_t out_frames)
+{
+  cras_fmt_conv_convert_frames_called++;
+  memset(out_buf, 0, *in_frames / 2 * kFrameBytes);
+  return *in_frames / 2;
+}
+
 }  // extern "C"
 
 }  //  namespace
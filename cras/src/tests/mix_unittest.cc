@@ -148,6 +148,21 @@ TEST_F(MixTestSuiteS16_LE, StrideCopy) {
   EXPECT_EQ(0, memcmp(compare_buffer_, mix_buffer_, kBufferFrames * 4));
 }
 
+TEST_F(MixTestSuiteS16_LE, MixAddRamp) {
+  for (size_t i = 0; i < kBufferFrames * 2; i++)
+    src_buffer_[i] = 1000;
+  memset(mix_buffer_, 0, kBufferFrames * 4);
+  cras_mix_add_ramp(fmt_, (uint8_t *)mix_buffer_, (uint8_t *)src_buffer_,
+                    100, kNumChannels, 1.0, -0.01);
+
+  // Both channels of a frame get the same gain.
+  for (size_t i = 0; i < 100; i++) {
+    EXPECT_NEAR(1000 - 10 * i, mix_buffer_[2 * i], 1);
+    EXPECT_EQ(mix_buffer_[2 * i], mix_buffer_[2 * i + 1]);
+  }
+  EXPECT_EQ(0, mix_buffer_[200]);
+}
+
 class MixTestSuiteS24_LE : public testing::Test{
   protected:
     virtual void SetUp() {
@@ -0,0 +1,100 @@
+// Copyright (c) 2015 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <math.h>
+#include <stdint.h>
+#include <gtest/gtest.h>
+
+extern "C" {
+#include "cras_msbc_plc.h"
+}
+
+/* 200Hz at 16kHz, a period of 80 samples. */
+#define PERIOD 80
+
+static void FillSine(int16_t *frame, unsigned int start) {
+  for (int i = 0; i < MSBC_FRAME_SAMPLES; i++)
+    frame[i] = 10000 * sin(2 * M_PI * (start + i) / PERIOD);
+}
+
+namespace {
+
+TEST(MsbcPlc, ConcealBeforeGoodFrame) {
+  struct cras_msbc_plc *plc = cras_msbc_plc_create();
+  int16_t frame[MSBC_FRAME_SAMPLES];
+
+  ASSERT_NE((void *)NULL, plc);
+  cras_msbc_plc_handle_bad_frame(plc, frame);
+  for (int i = 0; i < MSBC_FRAME_SAMPLES; i++)
+    EXPECT_EQ(0, frame[i]);
+
+  cras_msbc_plc_destroy(plc);
+}
+
+TEST(MsbcPlc, RepeatPitchAndFade) {
+  struct cras_msbc_plc *plc = cras_msbc_plc_create();
+  int16_t frame[MSBC_FRAME_SAMPLES];
+  int16_t expected[MSBC_FRAME_SAMPLES];
+  unsigned int pos = 0;
+
+  for (int i = 0; i < 4; i++) {
+    FillSine(frame, pos);
+    cras_msbc_plc_handle_good_frame(plc, frame);
+    pos += MSBC_FRAME_SAMPLES;
+  }
+
+  /* The first lost frame continues the waveform. */
+  cras_msbc_plc_handle_bad_frame(plc, frame);
+  FillSine(expected, pos);
+  for (int i = 0; i < MSBC_FRAME_SAMPLES; i++)
+    EXPECT_NEAR(expected[i], frame[i], 1);
+  pos += MSBC_FRAME_SAMPLES;
+
+  /* Then fades out, and stays silent. */
+  cras_msbc_plc_handle_bad_frame(plc, frame);
+  FillSine(expected, pos);
+  EXPECT_NEAR(expected[0], frame[0], 1);
+  EXPECT_GT(abs(expected[100]), abs(frame[100]));
+  for (int i = 0; i < 4; i++)
+    cras_msbc_plc_handle_bad_frame(plc, frame);
+  for (int i = 0; i < MSBC_FRAME_SAMPLES; i++)
+    EXPECT_EQ(0, frame[i]);
+
+  cras_msbc_plc_destroy(plc);
+}
+
+TEST(MsbcPlc, CrossFadeGoodFrame) {
+  struct cras_msbc_plc *plc = cras_msbc_plc_create();
+  int16_t frame[MSBC_FRAME_SAMPLES];
+  int16_t expected[MSBC_FRAME_SAMPLES];
+
+  for (int i = 0; i < 4; i++) {
+    FillSine(frame, i * MSBC_FRAME_SAMPLES);
+    cras_msbc_plc_handle_good_frame(plc, frame);
+  }
+  cras_msbc_plc_handle_bad_frame(plc, frame);
+
+  /* A silent frame after the loss starts from the concealed signal and
+   * reaches silence within the cross fade. */
+  memset(frame, 0, sizeof(frame));
+  cras_msbc_plc_handle_good_frame(plc, frame);
+  EXPECT_NE(0, frame[1]);
+  for (int i = 32; i < MSBC_FRAME_SAMPLES; i++)
+    EXPECT_EQ(0, frame[i]);
+
+  /* No loss, the frame is untouched. */
+  FillSine(frame, 0);
+  FillSine(expected, 0);
+  cras_msbc_plc_handle_good_frame(plc, frame);
+  EXPECT_EQ(0, memcmp(expected, frame, sizeof(frame)));
+
+  cras_msbc_plc_destroy(plc);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -120,6 +120,7 @@ class RClientMessagesSuite : public testing::Test {
       stream_id_ = 0x10002;
       connect_msg_.header.id = CRAS_SERVER_CONNECT_STREAM;
       connect_msg_.header.length = sizeof(connect_msg_);
+      connect_msg_.proto_version = CRAS_PROTO_VER;
       connect_msg_.stream_type = CRAS_STREAM_TYPE_DEFAULT;
       connect_msg_.direction = CRAS_STREAM_OUTPUT;
       connect_msg_.stream_id = stream_id_;
@@ -187,6 +188,24 @@ TEST_F(RClientMessagesSuite, RstreamCreateErrorReply) {
             audio_thread_disconnect_stream_called);
 }
 
+TEST_F(RClientMessagesSuite, ConnectMsgWithBadProtoVersion) {
+  struct cras_client_stream_connected out_msg;
+  int rc;
+
+  get_iodev_odev = (struct cras_iodev *)0xbaba;
+  connect_msg_.proto_version = CRAS_PROTO_VER - 1;
+
+  rc = cras_rclient_message_from_client(rclient_, &connect_msg_.header, -1);
+  EXPECT_EQ(0, rc);
+
+  rc = read(pipe_fds_[0], &out_msg, sizeof(out_msg));
+  EXPECT_EQ(sizeof(out_msg), rc);
+  EXPECT_EQ(stream_id_, out_msg.stream_id);
+  EXPECT_EQ(-EINVAL, out_msg.err);
+  EXPECT_EQ(0, cras_rstream_destroy_called);
+  EXPECT_EQ(0, audio_thread_add_stream_called);
+}
+
 TEST_F(RClientMessagesSuite, ConnectMsgWithBadFd) {
   struct cras_client_stream_connected out_msg;
   int rc;
@@ -393,6 +412,12 @@ int audio_thread_dump_thread_info(struct audio_thread *thread,
   return 0;
 }
 
+int audio_thread_dump_stream_latency(struct audio_thread *thread,
+				     struct stream_latency_info *info)
+{
+  return 0;
+}
+
 const char *cras_config_get_socket_file_dir()
 {
   return "/tmp";
@@ -528,6 +553,10 @@ void cras_dsp_dump_info()
 {
 }
 
+void cras_dsp_get_debug_info(struct dsp_debug_info *info)
+{
+}
+
 int cras_iodev_list_set_node_attr(int dev_index, int node_index,
                                   enum ionode_attr attr, int value)
 {
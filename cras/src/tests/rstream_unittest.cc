@@ -13,6 +13,9 @@ extern "C" {
 #include "cras_shm.h"
 }
 
+// Size of a shm pool region in cras_rstream.c.
+static const size_t kShmPoolRegionSize = 64 * 1024;
+
 namespace {
 
 class RstreamTestSuite : public testing::Test {
@@ -185,6 +188,56 @@ TEST_F(RstreamTestSuite, CreateInput) {
   cras_rstream_destroy(s);
 }
 
+TEST_F(RstreamTestSuite, ShmPoolReused) {
+  struct cras_rstream *s1, *s2, *big;
+  int key1, key2, rc;
+
+  ASSERT_EQ(1, cras_rstream_shm_pool_init(1));
+
+  rc = cras_rstream_create(555, CRAS_STREAM_TYPE_DEFAULT, CRAS_STREAM_OUTPUT,
+                           0, &fmt_, 4096, 2048, NULL, &s1);
+  ASSERT_EQ(0, rc);
+  key1 = cras_rstream_output_shm_key(s1);
+
+  // The only region is taken, the next stream gets its own segment.
+  rc = cras_rstream_create(556, CRAS_STREAM_TYPE_DEFAULT, CRAS_STREAM_OUTPUT,
+                           0, &fmt_, 4096, 2048, NULL, &s2);
+  ASSERT_EQ(0, rc);
+  key2 = cras_rstream_output_shm_key(s2);
+  EXPECT_NE(key1, key2);
+  cras_rstream_destroy(s2);
+
+  // Released regions are handed out again, cleared.
+  cras_shm_buffer_write_complete(cras_rstream_output_shm(s1));
+  cras_rstream_destroy(s1);
+  rc = cras_rstream_create(557, CRAS_STREAM_TYPE_DEFAULT, CRAS_STREAM_OUTPUT,
+                           0, &fmt_, 4096, 2048, NULL, &s1);
+  ASSERT_EQ(0, rc);
+  EXPECT_EQ(key1, cras_rstream_output_shm_key(s1));
+  EXPECT_EQ(0, cras_rstream_output_shm(s1)->area->write_buf_idx);
+
+  // A smaller stream doesn't see what was past its end in the region.
+  ((uint8_t *)cras_rstream_output_shm(s1)->area)[kShmPoolRegionSize - 1] = 1;
+  cras_rstream_destroy(s1);
+  rc = cras_rstream_create(557, CRAS_STREAM_TYPE_DEFAULT, CRAS_STREAM_OUTPUT,
+                           0, &fmt_, 1024, 512, NULL, &s1);
+  ASSERT_EQ(0, rc);
+  EXPECT_EQ(key1, cras_rstream_output_shm_key(s1));
+  EXPECT_EQ(0, ((uint8_t *)cras_rstream_output_shm(s1)->area)[
+      kShmPoolRegionSize - 1]);
+  cras_rstream_destroy(s1);
+
+  // Too large for a region.
+  rc = cras_rstream_create(558, CRAS_STREAM_TYPE_DEFAULT, CRAS_STREAM_OUTPUT,
+                           0, &fmt_, 16384, 2048, NULL, &big);
+  ASSERT_EQ(0, rc);
+  EXPECT_NE(key1, cras_rstream_output_shm_key(big));
+  cras_rstream_destroy(big);
+
+  cras_rstream_shm_pool_deinit();
+  EXPECT_LT(shmget(key1, 0, 0), 0);
+}
+
 }  //  namespace
 
 int main(int argc, char **argv) {
@@ -0,0 +1,193 @@
+/* Copyright (c) 2015 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/* Measures how fast the SBC encoder runs at the bitpools used by a2dp. The
+ * input is fed from a ring the same way the a2dp encoder thread does, in two
+ * parts when it wraps, so blocks split across the end are included. */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <sys/uio.h>
+#include <time.h>
+
+#include "cras_sbc_codec.h"
+
+/* Stereo S16_LE. */
+#define FORMAT_BYTES 4
+/* Not a multiple of the SBC codesize, so blocks keep moving across the end
+ * of the ring. */
+#define RING_SIZE (4096 * FORMAT_BYTES + FORMAT_BYTES)
+
+static const int bitpools[] = { 2, 18, 32, 45, 51, 53 };
+
+static double tp_diff(struct timespec *tp2, struct timespec *tp1)
+{
+	return (tp2->tv_sec - tp1->tv_sec)
+		+ (tp2->tv_nsec - tp1->tv_nsec) * 1e-9;
+}
+
+/* Fills buf with a deterministic noise signal at about -6dBFS. */
+static void fill_synthetic(int16_t *buf, size_t samples)
+{
+	uint32_t seed = 1;
+	size_t i;
+
+	for (i = 0; i < samples; i++) {
+		seed = seed * 1103515245 + 12345;
+		buf[i] = (int16_t)(seed >> 16) / 2;
+	}
+}
+
+static int freq_from_rate(int rate)
+{
+	switch (rate) {
+	case 16000:
+		return SBC_FREQ_16000;
+	case 32000:
+		return SBC_FREQ_32000;
+	case 44100:
+		return SBC_FREQ_44100;
+	case 48000:
+		return SBC_FREQ_48000;
+	default:
+		return -1;
+	}
+}
+
+static int run_bitpool(const uint8_t *ring, int freq, int rate, int bitpool,
+		       size_t mtu, size_t frames)
+{
+	struct cras_audio_codec *codec;
+	struct timespec wall1, wall2;
+	struct iovec iov[2];
+	uint8_t *out;
+	size_t total = frames * FORMAT_BYTES;
+	size_t done = 0, offset = 0;
+	size_t encoded, encoded_bytes = 0;
+	unsigned int sbc_frames = 0;
+	size_t frame_length;
+	double wall, audio;
+	int processed;
+
+	codec = cras_sbc_codec_create(freq, SBC_MODE_JOINT_STEREO, SBC_SB_8,
+				      SBC_AM_LOUDNESS, SBC_BLK_16, bitpool);
+	if (!codec) {
+		fprintf(stderr, "cannot create codec for bitpool %d\n",
+			bitpool);
+		return -1;
+	}
+	frame_length = cras_sbc_get_frame_length(codec);
+
+	out = (uint8_t *)malloc(mtu);
+	if (!out) {
+		cras_sbc_codec_destroy(codec);
+		return -1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &wall1);
+	while (done < total) {
+		/* As much as fits in one packet, from where the last call
+		 * stopped. */
+		iov[0].iov_base = (uint8_t *)ring + offset;
+		iov[0].iov_len = MIN(total - done, RING_SIZE - offset);
+		iov[1].iov_base = (uint8_t *)ring;
+		iov[1].iov_len = MIN(total - done - iov[0].iov_len, offset);
+
+		processed = cras_sbc_encode_iov(codec, iov,
+						iov[1].iov_len ? 2 : 1,
+						out, mtu, &encoded);
+		if (processed <= 0)
+			break;
+		done += processed;
+		offset = (offset + processed) % RING_SIZE;
+		encoded_bytes += encoded;
+		sbc_frames += encoded / frame_length;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &wall2);
+
+	wall = tp_diff(&wall2, &wall1);
+	audio = (double)done / FORMAT_BYTES / rate;
+	printf("%7d %12zu %14.0f %10.1fx %8.1f\n", bitpool, frame_length,
+	       wall > 0 ? sbc_frames / wall : 0,
+	       wall > 0 ? audio / wall : 0,
+	       audio > 0 ? encoded_bytes * 8 / audio / 1000 : 0);
+
+	free(out);
+	cras_sbc_codec_destroy(codec);
+	return 0;
+}
+
+static void show_usage()
+{
+	printf("Usage: sbc_bench [options]\n");
+	printf("--rate <N> - Sample rate in Hz (default 48000).\n");
+	printf("--mtu <N> - Output bytes per encode call, like the a2dp"
+	       " link mtu (default 895).\n");
+	printf("--duration_seconds <N> - Seconds of audio to encode per"
+	       " bitpool (default 10).\n");
+}
+
+static struct option long_options[] = {
+	{"duration_seconds",	required_argument,	0, 'd'},
+	{"help",		no_argument,		0, 'h'},
+	{"mtu",			required_argument,	0, 'm'},
+	{"rate",		required_argument,	0, 'r'},
+	{0, 0, 0, 0}
+};
+
+int main(int argc, char **argv)
+{
+	int16_t *ring;
+	int rate = 48000;
+	int mtu = 895;
+	float duration_seconds = 10;
+	unsigned int i;
+	int freq;
+	int c;
+
+	while ((c = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+		switch (c) {
+		case 'd':
+			duration_seconds = atof(optarg);
+			break;
+		case 'm':
+			mtu = atoi(optarg);
+			break;
+		case 'r':
+			rate = atoi(optarg);
+			break;
+		default:
+			show_usage();
+			return 1;
+		}
+	}
+
+	freq = freq_from_rate(rate);
+	if (optind != argc || freq < 0 || mtu <= 0 || duration_seconds <= 0) {
+		show_usage();
+		return 1;
+	}
+
+	ring = (int16_t *)malloc(RING_SIZE);
+	if (!ring) {
+		fprintf(stderr, "cannot allocate ring\n");
+		return 1;
+	}
+	fill_synthetic(ring, RING_SIZE / sizeof(int16_t));
+
+	printf("rate %d, mtu %d, joint stereo, 8 subbands, 16 blocks\n",
+	       rate, mtu);
+	printf("bitpool frame_length  sbc_frames/s   realtime     kbps\n");
+	for (i = 0; i < sizeof(bitpools) / sizeof(bitpools[0]); i++)
+		if (run_bitpool((uint8_t *)ring, freq, rate, bitpools[i], mtu,
+				duration_seconds * rate))
+			break;
+
+	free(ring);
+	return 0;
+}
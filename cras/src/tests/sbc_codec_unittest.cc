@@ -0,0 +1,128 @@
+// Copyright (c) 2015 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <gtest/gtest.h>
+
+extern "C" {
+#include "cras_sbc_codec.h"
+}
+
+#define CODESIZE 16
+#define FRAME_LENGTH 4
+#define MAX_BLOCKS 16
+
+static int sbc_encode_called;
+static uint8_t sbc_encode_input[MAX_BLOCKS][CODESIZE];
+
+void ResetStubData() {
+  sbc_encode_called = 0;
+  memset(sbc_encode_input, 0, sizeof(sbc_encode_input));
+}
+
+namespace {
+
+TEST(SbcCodec, EncodeIovSplitBlock) {
+  struct cras_audio_codec *codec;
+  uint8_t pcm[64];
+  uint8_t out[64];
+  struct iovec iov[3];
+  size_t count;
+  int processed;
+
+  ResetStubData();
+  for (unsigned int i = 0; i < sizeof(pcm); i++)
+    pcm[i] = i;
+
+  codec = cras_sbc_codec_create(SBC_FREQ_48000, SBC_MODE_JOINT_STEREO,
+                                SBC_SB_8, SBC_AM_LOUDNESS, SBC_BLK_16, 53);
+  ASSERT_NE((void *)NULL, codec);
+
+  // Blocks at 0, 16, 32 and 48, the second one spans all three buffers.
+  iov[0].iov_base = pcm;
+  iov[0].iov_len = 20;
+  iov[1].iov_base = pcm + 20;
+  iov[1].iov_len = 4;
+  iov[2].iov_base = pcm + 24;
+  iov[2].iov_len = 40 + 3;
+  processed = cras_sbc_encode_iov(codec, iov, 3, out, sizeof(out), &count);
+
+  EXPECT_EQ(4 * CODESIZE, processed);
+  EXPECT_EQ(4 * FRAME_LENGTH, count);
+  EXPECT_EQ(4, sbc_encode_called);
+  for (int i = 0; i < 4; i++)
+    for (int j = 0; j < CODESIZE; j++)
+      ASSERT_EQ(i * CODESIZE + j, sbc_encode_input[i][j]);
+
+  cras_sbc_codec_destroy(codec);
+}
+
+TEST(SbcCodec, EncodeFitsOutput) {
+  struct cras_audio_codec *codec;
+  uint8_t pcm[CODESIZE * 8];
+  uint8_t out[64];
+  size_t count;
+  int processed;
+
+  ResetStubData();
+  codec = cras_sbc_codec_create(SBC_FREQ_48000, SBC_MODE_JOINT_STEREO,
+                                SBC_SB_8, SBC_AM_LOUDNESS, SBC_BLK_16, 53);
+  ASSERT_NE((void *)NULL, codec);
+
+  // Room for two frames and a half, only full frames are encoded.
+  processed = codec->encode(codec, pcm, sizeof(pcm), out,
+                            FRAME_LENGTH * 5 / 2, &count);
+  EXPECT_EQ(2 * CODESIZE, processed);
+  EXPECT_EQ(2 * FRAME_LENGTH, count);
+  EXPECT_EQ(2, sbc_encode_called);
+
+  cras_sbc_codec_destroy(codec);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+
+extern "C" {
+
+int sbc_init(sbc_t *sbc, unsigned long flags) {
+  return 0;
+}
+
+int sbc_init_msbc(sbc_t *sbc, unsigned long flags) {
+  return 0;
+}
+
+void sbc_finish(sbc_t *sbc) {
+}
+
+size_t sbc_get_codesize(sbc_t *sbc) {
+  return CODESIZE;
+}
+
+size_t sbc_get_frame_length(sbc_t *sbc) {
+  return FRAME_LENGTH;
+}
+
+ssize_t sbc_encode(sbc_t *sbc, const void *input, size_t input_len,
+                   void *output, size_t output_len, ssize_t *written) {
+  if (output_len < FRAME_LENGTH)
+    return -ENOSPC;
+  if (sbc_encode_called < MAX_BLOCKS)
+    memcpy(sbc_encode_input[sbc_encode_called], input, CODESIZE);
+  sbc_encode_called++;
+  *written = FRAME_LENGTH;
+  return CODESIZE;
+}
+
+ssize_t sbc_decode(sbc_t *sbc, const void *input, size_t input_len,
+                   void *output, size_t output_len, size_t *written) {
+  return 0;
+}
+
+}  // extern "C"
@@ -198,6 +198,29 @@ TEST_F(ShmTestSuite, SetVolume) {
   EXPECT_EQ(shm_.area->volume_scaler, 0.5);
 }
 
+TEST_F(ShmTestSuite, VolumeRamp) {
+  float volume;
+  unsigned int ramp_frames;
+
+  cras_shm_set_volume_ramp(&shm_, 0.25, 480);
+  EXPECT_EQ(0, shm_.area->volume_seq & 1);
+  EXPECT_EQ(0, cras_shm_get_volume_ramp(&shm_, &volume, &ramp_frames));
+  EXPECT_EQ(0.25, volume);
+  EXPECT_EQ(480, ramp_frames);
+
+  cras_shm_set_mute_ramp(&shm_, 1, 96);
+  EXPECT_EQ(0, cras_shm_get_volume_ramp(&shm_, &volume, &ramp_frames));
+  EXPECT_EQ(0.0, volume);
+  EXPECT_EQ(96, ramp_frames);
+  EXPECT_EQ(0.25, cras_shm_get_volume_scaler(&shm_));
+
+  // Not read while the client is writing.
+  cras_shm_volume_write_begin(&shm_);
+  EXPECT_EQ(-EAGAIN, cras_shm_get_volume_ramp(&shm_, &volume, &ramp_frames));
+  cras_shm_volume_write_end(&shm_);
+  EXPECT_EQ(0, cras_shm_get_volume_ramp(&shm_, &volume, &ramp_frames));
+}
+
 // Test that invalid read/write offsets are detected.
 
 TEST_F(ShmTestSuite, InvalidWriteOffset) {
@@ -6,6 +6,7 @@
 #include <gtest/gtest.h>
 
 extern "C" {
+#include "cras_alsa_card_probe.h"
 #include "cras_system_state.h"
 #include "cras_types.h"
 }
@@ -14,6 +15,12 @@ namespace {
 static struct cras_alsa_card* kFakeAlsaCard;
 size_t cras_alsa_card_create_called;
 size_t cras_alsa_card_destroy_called;
+static int cras_alsa_card_probe_queue_return;
+static size_t cras_alsa_card_probe_queue_called;
+static cras_alsa_card_probe_cb cras_alsa_card_probe_queue_cb;
+static void *cras_alsa_card_probe_queue_arg;
+static size_t cras_alsa_card_create_from_probe_called;
+static size_t cras_alsa_card_probe_destroy_called;
 static size_t add_stub_called;
 static size_t rm_stub_called;
 static size_t callback_stub_called;
@@ -25,10 +32,17 @@ static size_t rm_callback_called;
 static cras_alert_cb rm_callback_cb;
 static void *rm_callback_arg;
 static size_t alert_pending_called;
+static size_t futex_wake_called;
 
 static void ResetStubData() {
   cras_alsa_card_create_called = 0;
   cras_alsa_card_destroy_called = 0;
+  cras_alsa_card_probe_queue_return = -ENODEV;
+  cras_alsa_card_probe_queue_called = 0;
+  cras_alsa_card_probe_queue_cb = NULL;
+  cras_alsa_card_probe_queue_arg = NULL;
+  cras_alsa_card_create_from_probe_called = 0;
+  cras_alsa_card_probe_destroy_called = 0;
   kFakeAlsaCard = reinterpret_cast<struct cras_alsa_card*>(0x33);
   add_stub_called = 0;
   rm_stub_called = 0;
@@ -36,6 +50,7 @@ static void ResetStubData() {
   add_callback_called = 0;
   rm_callback_called = 0;
   alert_pending_called = 0;
+  futex_wake_called = 0;
 }
 
 static void volume_changed(void *arg) {
@@ -381,6 +396,68 @@ TEST(SystemStateSuite, AddCard) {
   EXPECT_EQ(1, cras_alsa_card_destroy_called);
 }
 
+TEST(SystemStateSuite, AddCardProbed) {
+  struct cras_alsa_card_probe *probe =
+      reinterpret_cast<struct cras_alsa_card_probe *>(0x44);
+  cras_alsa_card_info info;
+
+  ResetStubData();
+  cras_alsa_card_probe_queue_return = 0;
+  info.card_type = ALSA_CARD_TYPE_USB;
+  info.card_index = 1;
+  EXPECT_EQ(0, cras_system_add_alsa_card(&info));
+  EXPECT_EQ(1, cras_alsa_card_probe_queue_called);
+  EXPECT_EQ(0, cras_alsa_card_create_called);
+  ASSERT_NE((void *)NULL, (void *)cras_alsa_card_probe_queue_cb);
+
+  // The card counts as added while it is probed.
+  EXPECT_EQ(1, cras_system_alsa_card_exists(1));
+  EXPECT_NE(0, cras_system_add_alsa_card(&info));
+  EXPECT_EQ(1, cras_alsa_card_probe_queue_called);
+
+  cras_alsa_card_probe_queue_cb(probe, cras_alsa_card_probe_queue_arg);
+  EXPECT_EQ(1, cras_alsa_card_create_from_probe_called);
+  EXPECT_EQ(1, cras_alsa_card_probe_destroy_called);
+  EXPECT_EQ(1, cras_system_alsa_card_exists(1));
+
+  EXPECT_EQ(0, cras_system_remove_alsa_card(1));
+  EXPECT_EQ(1, cras_alsa_card_destroy_called);
+  EXPECT_EQ(0, cras_system_alsa_card_exists(1));
+}
+
+TEST(SystemStateSuite, AddCardProbeFails) {
+  cras_alsa_card_info info;
+
+  ResetStubData();
+  cras_alsa_card_probe_queue_return = 0;
+  info.card_type = ALSA_CARD_TYPE_USB;
+  info.card_index = 1;
+  EXPECT_EQ(0, cras_system_add_alsa_card(&info));
+  cras_alsa_card_probe_queue_cb(NULL, cras_alsa_card_probe_queue_arg);
+  EXPECT_EQ(0, cras_alsa_card_create_from_probe_called);
+  EXPECT_EQ(0, cras_system_alsa_card_exists(1));
+}
+
+TEST(SystemStateSuite, RemoveCardWhileProbing) {
+  struct cras_alsa_card_probe *probe =
+      reinterpret_cast<struct cras_alsa_card_probe *>(0x44);
+  cras_alsa_card_info info;
+
+  ResetStubData();
+  cras_alsa_card_probe_queue_return = 0;
+  info.card_type = ALSA_CARD_TYPE_USB;
+  info.card_index = 1;
+  EXPECT_EQ(0, cras_system_add_alsa_card(&info));
+  EXPECT_EQ(0, cras_system_remove_alsa_card(1));
+  EXPECT_EQ(0, cras_system_alsa_card_exists(1));
+
+  // The result of the probe is dropped without creating devices.
+  cras_alsa_card_probe_queue_cb(probe, cras_alsa_card_probe_queue_arg);
+  EXPECT_EQ(0, cras_alsa_card_create_from_probe_called);
+  EXPECT_EQ(1, cras_alsa_card_probe_destroy_called);
+  EXPECT_EQ(0, cras_alsa_card_destroy_called);
+}
+
 TEST(SystemSettingsRegisterSelectDescriptor, AddSelectFd) {
   void *stub_data = reinterpret_cast<void *>(44);
   void *select_data = reinterpret_cast<void *>(33);
@@ -463,6 +540,80 @@ TEST(SystemSettingsStreamCount, StreamCountByDirection) {
   cras_system_state_deinit();
 }
 
+TEST(SystemStateSuite, BatchedUpdates) {
+  struct cras_server_state *state;
+  unsigned int count;
+
+  ResetStubData();
+  cras_system_state_init();
+  state = cras_system_state_get_no_lock();
+
+  count = state->update_count;
+  cras_system_state_stream_added(CRAS_STREAM_OUTPUT);
+  EXPECT_EQ(count + 2, state->update_count);
+  EXPECT_EQ(1, futex_wake_called);
+
+  // Updates in a batch look like one, odd until the batch ends.
+  count = state->update_count;
+  cras_system_state_batch_begin();
+  cras_system_state_batch_begin();
+  cras_system_state_stream_added(CRAS_STREAM_INPUT);
+  EXPECT_EQ(count + 1, state->update_count);
+  cras_system_state_stream_removed(CRAS_STREAM_OUTPUT);
+  cras_system_state_batch_end();
+  cras_system_state_stream_removed(CRAS_STREAM_INPUT);
+  EXPECT_EQ(count + 1, state->update_count);
+  EXPECT_EQ(1, futex_wake_called);
+  cras_system_state_batch_end();
+  EXPECT_EQ(count + 2, state->update_count);
+  EXPECT_EQ(2, futex_wake_called);
+  EXPECT_EQ(0, cras_system_state_get_active_streams());
+
+  // A batch without updates doesn't touch the count.
+  cras_system_state_batch_begin();
+  cras_system_state_batch_end();
+  EXPECT_EQ(count + 2, state->update_count);
+  EXPECT_EQ(2, futex_wake_called);
+
+  cras_system_state_deinit();
+}
+
+static void *AddStreamThread(void *arg) {
+  cras_system_state_stream_added(CRAS_STREAM_OUTPUT);
+  return NULL;
+}
+
+TEST(SystemStateSuite, BatchDoesntHoldOtherThreadsUpdates) {
+  struct cras_server_state *state;
+  unsigned int count;
+  pthread_t tid;
+
+  ResetStubData();
+  cras_system_state_init();
+  state = cras_system_state_get_no_lock();
+  count = state->update_count;
+
+  // An update from another thread publishes the batch so far.
+  cras_system_state_batch_begin();
+  cras_system_state_stream_added(CRAS_STREAM_INPUT);
+  EXPECT_EQ(count + 1, state->update_count);
+  ASSERT_EQ(0, pthread_create(&tid, NULL, AddStreamThread, NULL));
+  pthread_join(tid, NULL);
+  EXPECT_EQ(count + 2, state->update_count);
+  EXPECT_EQ(1, futex_wake_called);
+
+  // The batch goes on with the next update from its thread.
+  cras_system_state_stream_removed(CRAS_STREAM_INPUT);
+  EXPECT_EQ(count + 3, state->update_count);
+  cras_system_state_batch_end();
+  EXPECT_EQ(count + 4, state->update_count);
+  EXPECT_EQ(2, futex_wake_called);
+  EXPECT_EQ(1, cras_system_state_get_active_streams());
+
+  cras_system_state_stream_removed(CRAS_STREAM_OUTPUT);
+  cras_system_state_deinit();
+}
+
 extern "C" {
 
 struct cras_alsa_card *cras_alsa_card_create(struct cras_alsa_card_info *info) {
@@ -478,6 +629,27 @@ size_t cras_alsa_card_get_index(const struct cras_alsa_card *alsa_card) {
   return 0;
 }
 
+struct cras_alsa_card *cras_alsa_card_create_from_probe(
+    struct cras_alsa_card_probe *probe) {
+  cras_alsa_card_create_from_probe_called++;
+  return kFakeAlsaCard;
+}
+
+void cras_alsa_card_probe_destroy(struct cras_alsa_card_probe *probe) {
+  if (probe)
+    cras_alsa_card_probe_destroy_called++;
+}
+
+int cras_alsa_card_probe_queue(const struct cras_alsa_card_info *info,
+                               struct cras_device_blacklist *blacklist,
+                               cras_alsa_card_probe_cb cb,
+                               void *arg) {
+  cras_alsa_card_probe_queue_called++;
+  cras_alsa_card_probe_queue_cb = cb;
+  cras_alsa_card_probe_queue_arg = arg;
+  return cras_alsa_card_probe_queue_return;
+}
+
 struct cras_device_blacklist *cras_device_blacklist_create(
 		const char *config_path)
 {
@@ -528,6 +700,11 @@ void cras_tm_deinit(cras_tm *tm) {
   free(tm);
 }
 
+int cras_futex_wake(void *addr) {
+  futex_wake_called++;
+  return 0;
+}
+
 }  // extern "C"
 }  // namespace
 
@@ -3,6 +3,7 @@
 // found in the LICENSE file.
 
 #include <gtest/gtest.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <unistd.h>
@@ -97,6 +98,30 @@ TEST(Util, TimeToFrames) {
   EXPECT_EQ(0, frames);
 }
 
+static uint32_t futex_value;
+
+static void *ChangeAndWake(void *arg) {
+  usleep(10000);
+  __sync_fetch_and_add(&futex_value, 1);
+  cras_futex_wake(&futex_value);
+  return NULL;
+}
+
+TEST(Util, FutexWait) {
+  struct timespec timeout = {0, 1000000};
+  pthread_t tid;
+
+  // Returns at once if the value already changed.
+  futex_value = 2;
+  EXPECT_EQ(0, cras_futex_wait(&futex_value, 1, NULL));
+  EXPECT_EQ(-ETIMEDOUT, cras_futex_wait(&futex_value, 2, &timeout));
+
+  ASSERT_EQ(0, pthread_create(&tid, NULL, ChangeAndWake, NULL));
+  EXPECT_EQ(0, cras_futex_wait(&futex_value, 2, NULL));
+  EXPECT_EQ(3, futex_value);
+  pthread_join(tid, NULL);
+}
+
 }  //  namespace
 
 int main(int argc, char **argv) {